@@ -14,16 +14,19 @@
 #include <cassert>
 #include <cinttypes>
 #include <climits>
+#include <condition_variable>
 #include <cstddef>
 #include <cstdio>
 #include <cstring>
+#include <deque>
+#include <list>
 #include <map>
 #include <mutex>
 #include <optional>
 #include <span>
 #include <string>
+#include <string_view>
 #include <unordered_map>
-#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -71,6 +74,10 @@ gamescope::ConVar<bool> cv_drm_debug_disable_color_encoding( "drm_debug_disable_
 gamescope::ConVar<bool> cv_drm_debug_disable_color_range( "drm_debug_disable_color_range", false, "YUV Color Range chicken bit. (Forces COLOR_RANGE to DEFAULT, does not affect other logic)" );
 gamescope::ConVar<bool> cv_drm_debug_disable_explicit_sync( "drm_debug_disable_explicit_sync", true, "Force disable explicit sync on the DRM backend." );
 gamescope::ConVar<bool> cv_drm_debug_disable_in_fence_fd( "drm_debug_disable_in_fence_fd", false, "Force disable IN_FENCE_FD being set to avoid over-synchronization on the DRM backend." );
+gamescope::ConVar<bool> cv_drm_async_fb_import( "drm_async_fb_import", true, "Create FB_IDs for client buffers on a separate thread. They are composited until it's done." );
+gamescope::ConVar<bool> cv_drm_composite_in_fence( "drm_composite_in_fence", true, "Have KMS wait for composition to finish through IN_FENCE_FD instead of waiting for it before committing tearing flips. Allows tearing while compositing." );
+gamescope::ConVar<bool> cv_drm_damage_clips( "drm_damage_clips", true, "Tell KMS which part of each plane changed through FB_DAMAGE_CLIPS, for panel self refresh selective updates." );
+gamescope::ConVar<bool> cv_drm_idle_skip_commits( "drm_idle_skip_commits", true, "Don't commit anything if the frame is the same as the last one on screen." );
 
 namespace gamescope
 {
@@ -162,6 +169,7 @@ namespace gamescope
 		uint64_t GetPendingValue() const { return m_ulPendingValue; }
 		uint64_t GetCurrentValue() const { return m_ulCurrentValue; }
 		uint64_t GetInitialValue() const { return m_ulInitialValue; }
+		uint32_t GetPropertyId() const { return m_uPropertyId; }
 		int SetPendingValue( drmModeAtomicReq *pRequest, uint64_t ulValue, bool bForce );
 
 		void OnCommit();
@@ -207,6 +215,7 @@ namespace gamescope
 			std::optional<CDRMAtomicProperty> zpos;
 			std::optional<CDRMAtomicProperty> alpha;
 			std::optional<CDRMAtomicProperty> rotation;
+			std::optional<CDRMAtomicProperty> FB_DAMAGE_CLIPS;
 			std::optional<CDRMAtomicProperty> COLOR_ENCODING;
 			std::optional<CDRMAtomicProperty> COLOR_RANGE;
 			std::optional<CDRMAtomicProperty> AMD_PLANE_DEGAMMA_TF;
@@ -222,6 +231,9 @@ namespace gamescope
 		};
 		      PlaneProperties &GetProperties()       { return m_Props; }
 		const PlaneProperties &GetProperties() const { return m_Props; }
+
+		// For properties we only know by name, eg. the ones set on a liftoff layer.
+		std::optional<CDRMAtomicProperty> *GetPropertyByName( std::string_view svName );
 	private:
 		CAutoDeletePtr<drmModePlane> m_pPlane;
 		PlaneProperties m_Props;
@@ -410,16 +422,34 @@ namespace gamescope
 	class CDRMFb final : public CBaseBackendFb
 	{
 	public:
+		// Shared with the FB import thread, which can finish after we are gone.
+		struct FbIdState_t
+		{
+			std::mutex mutex;
+			std::atomic<uint32_t> uFbId = { 0 };
+			bool bOrphaned = false;
+		};
+
 		CDRMFb( uint32_t uFbId );
+		// FB_ID filled in by the import thread later.
+		CDRMFb( std::shared_ptr<FbIdState_t> pFbIdState );
 		~CDRMFb();
 
-		uint32_t GetFbId() const { return m_uFbId; }
+		// 0 while the import is still pending, or if it failed.
+		uint32_t GetFbId() const { return m_pFbIdState->uFbId.load( std::memory_order_acquire ); }
 	
 	private:
-		uint32_t m_uFbId = 0;
+		std::shared_ptr<FbIdState_t> m_pFbIdState;
 	};
 }
 
+struct DRMFbImportJob_t
+{
+	// Holds our own dups of the DMA-BUF fds.
+	struct wlr_dmabuf_attributes dmabuf;
+	std::shared_ptr<gamescope::CDRMFb::FbIdState_t> pFbIdState;
+};
+
 struct saved_mode {
 	int width;
 	int height;
@@ -453,6 +483,13 @@ struct drm_t {
 	struct liftoff_device *lo_device;
 	struct liftoff_output *lo_output;
 	struct liftoff_layer *lo_layers[ k_nMaxLayers ];
+	// What has been set on each lo_layer, so a cached plane assignment can be
+	// put in the request without going through libliftoff again.
+	std::vector< std::pair< const char *, uint64_t > > lo_layer_props[ k_nMaxLayers ];
+
+	// sync_file of the composite the next request shows, used as IN_FENCE_FD
+	// instead of the always signalled one. Owned by the composition path.
+	int nCompositeInFence = -1;
 
 	std::shared_ptr<gamescope::BackendBlob> sdr_static_metadata;
 
@@ -462,6 +499,12 @@ struct drm_t {
 		std::shared_ptr<gamescope::BackendBlob> lut3d_id[ EOTF_Count ];
 		std::shared_ptr<gamescope::BackendBlob> shaperlut_id[ EOTF_Count ];
 		amdgpu_transfer_function output_tf = AMDGPU_TRANSFER_FUNCTION_DEFAULT;
+
+		// What each layer last put on which plane, FB_DAMAGE_CLIPS is only
+		// relative to the FB the plane had before.
+		uint64_t layer_commit_id[ k_nMaxLayers ];
+		uint32_t layer_plane_id[ k_nMaxLayers ];
+		std::shared_ptr<gamescope::BackendBlob> damage_clips[ k_nMaxLayers ];
 	} current, pending;
 
 	// FBs in the atomic request, but not yet submitted to KMS
@@ -479,9 +522,30 @@ struct drm_t {
 
 	std::atomic < uint32_t > uPendingFlipCount = { 0 };
 
+	// Client buffers get their FB_ID on the gamescope-fbid thread so
+	// a burst of new swapchain images doesn't stall us.
+	std::mutex m_FbImportQueueMutex;
+	std::condition_variable m_FbImportQueueCV;
+	std::deque<DRMFbImportJob_t> m_FbImportQueue;
+	// GEM handles aren't ref'counted, so imports must not interleave.
+	std::mutex m_FbImportMutex;
+
 	std::atomic < bool > paused = { false };
 	std::atomic < int > out_of_date = { false };
 	std::atomic < bool > needs_modeset = { false };
+	// Only MODE_ID changes, eg. a dynamic refresh rate switch.
+	std::atomic < bool > needs_mode_change = { false };
+
+	// Mode and blob for each of the connector's dynamic refresh rates, made
+	// when the connector is set up, so switching doesn't run the modegen
+	// or create a blob. Only valid for that resolution.
+	struct dynamic_refresh_mode_t {
+		drmModeModeInfo mode;
+		std::shared_ptr<gamescope::BackendBlob> blob;
+	};
+	std::unordered_map< int, dynamic_refresh_mode_t > dynamic_refresh_modes;
+	int dynamic_refresh_modes_width = 0;
+	int dynamic_refresh_modes_height = 0;
 
 	std::unordered_map< std::string, int > connector_priorities;
 
@@ -542,6 +606,8 @@ static std::unordered_map< std::string, std::string > pnps = {};
 
 static void drm_unset_mode( struct drm_t *drm );
 static void drm_unset_connector( struct drm_t *drm );
+static void drm_fb_import_thread_run( struct drm_t *drm );
+static void drm_precompute_dynamic_refresh_modes( struct drm_t *drm, int width, int height );
 
 static constexpr uint32_t s_kSteamDeckLCDRates[] =
 {
@@ -1039,6 +1105,8 @@ static bool setup_best_connector(struct drm_t *drm, bool force, bool initial)
 	// Don't allow rollback of mode_id after connector change
 	drm->current.mode_id = drm->pending.mode_id;
 
+	drm_precompute_dynamic_refresh_modes( drm, mode->hdisplay, mode->vdisplay );
+
 	const struct wlserver_output_info wlserver_output_info = {
 		.description = description,
 		.phys_width = (int) best->GetModeConnector()->mmWidth,
@@ -1289,6 +1357,9 @@ bool init_drm(struct drm_t *drm, int width, int height, int refresh)
 	std::thread flip_handler_thread( flip_handler_thread_run );
 	flip_handler_thread.detach();
 
+	std::thread fb_import_thread( drm_fb_import_thread_run, drm );
+	fb_import_thread.detach();
+
 	// Set log priority to the max, liftoff_log_scope will filter for us.
 	liftoff_log_set_priority(LIFTOFF_DEBUG);
 	liftoff_log_set_handler(gamescope_liftoff_log_handler);
@@ -1442,16 +1513,11 @@ void finish_drm(struct drm_t *drm)
 	// page-flip handler thread.
 }
 
-gamescope::OwningRc<gamescope::IBackendFb> drm_fbid_from_dmabuf( struct drm_t *drm, struct wlr_buffer *buf, struct wlr_dmabuf_attributes *dma_buf )
+static uint32_t drm_add_fb_from_dmabuf( struct drm_t *drm, const struct wlr_dmabuf_attributes *dma_buf )
 {
-	gamescope::OwningRc<gamescope::IBackendFb> pBackendFb;
-	uint32_t fb_id = 0;
+	std::unique_lock lock( drm->m_FbImportMutex );
 
-	if ( !wlr_drm_format_set_has( &drm->formats, dma_buf->format, dma_buf->modifier ) )
-	{
-		drm_log.errorf( "Cannot import FB to DRM: format 0x%" PRIX32 " and modifier 0x%" PRIX64 " not supported for scan-out", dma_buf->format, dma_buf->modifier );
-		return nullptr;
-	}
+	uint32_t fb_id = 0;
 
 	uint32_t handles[4] = {0};
 	uint64_t modifiers[4] = {0};
@@ -1468,15 +1534,10 @@ gamescope::OwningRc<gamescope::IBackendFb> drm_fbid_from_dmabuf( struct drm_t *d
 
 	if ( dma_buf->modifier != DRM_FORMAT_MOD_INVALID )
 	{
-		if ( !drm->allow_modifiers )
-		{
-			drm_log.errorf("Cannot import DMA-BUF: has a modifier (0x%" PRIX64 "), but KMS doesn't support them", dma_buf->modifier);
-			goto out;
-		}
-
 		if ( drmModeAddFB2WithModifiers( drm->fd, dma_buf->width, dma_buf->height, dma_buf->format, handles, dma_buf->stride, dma_buf->offset, modifiers, &fb_id, DRM_MODE_FB_MODIFIERS ) != 0 )
 		{
 			drm_log.errorf_errno("drmModeAddFB2WithModifiers failed");
+			fb_id = 0;
 			goto out;
 		}
 	}
@@ -1485,14 +1546,13 @@ gamescope::OwningRc<gamescope::IBackendFb> drm_fbid_from_dmabuf( struct drm_t *d
 		if ( drmModeAddFB2( drm->fd, dma_buf->width, dma_buf->height, dma_buf->format, handles, dma_buf->stride, dma_buf->offset, &fb_id, 0 ) != 0 )
 		{
 			drm_log.errorf_errno("drmModeAddFB2 failed");
+			fb_id = 0;
 			goto out;
 		}
 	}
 
 	drm_log.debugf("make fbid %u", fb_id);
 
-	pBackendFb = new gamescope::CDRMFb( fb_id );
-
 out:
 	for ( int i = 0; i < dma_buf->n_planes; i++ ) {
 		if ( handles[i] == 0 )
@@ -1515,7 +1575,110 @@ out:
 		}
 	}
 
-	return pBackendFb;
+	return fb_id;
+}
+
+static void drm_fb_import_thread_run( struct drm_t *drm )
+{
+	pthread_setname_np( pthread_self(), "gamescope-fbid" );
+
+	for ( ;; )
+	{
+		DRMFbImportJob_t job;
+		{
+			std::unique_lock lock( drm->m_FbImportQueueMutex );
+			drm->m_FbImportQueueCV.wait( lock, [ drm ]{ return !drm->m_FbImportQueue.empty(); } );
+
+			job = std::move( drm->m_FbImportQueue.front() );
+			drm->m_FbImportQueue.pop_front();
+		}
+
+		bool bOrphaned;
+		{
+			std::unique_lock lock( job.pFbIdState->mutex );
+			bOrphaned = job.pFbIdState->bOrphaned;
+		}
+
+		uint32_t uFbId = bOrphaned ? 0 : drm_add_fb_from_dmabuf( drm, &job.dmabuf );
+
+		for ( int i = 0; i < job.dmabuf.n_planes; i++ )
+			close( job.dmabuf.fd[i] );
+
+		if ( uFbId == 0 )
+			continue;
+
+		std::unique_lock lock( job.pFbIdState->mutex );
+		if ( job.pFbIdState->bOrphaned )
+		{
+			// Buffer went away while we were busy.
+			if ( drmModeRmFB( drm->fd, uFbId ) != 0 )
+				drm_log.errorf_errno( "drmModeRmFB failed" );
+			continue;
+		}
+
+		job.pFbIdState->uFbId.store( uFbId, std::memory_order_release );
+		lock.unlock();
+
+		// The buffer is only composited until now, a static one wouldn't
+		// get another chance at a plane until its next commit.
+		force_repaint();
+	}
+}
+
+gamescope::OwningRc<gamescope::IBackendFb> drm_fbid_from_dmabuf( struct drm_t *drm, struct wlr_buffer *buf, struct wlr_dmabuf_attributes *dma_buf )
+{
+	if ( !wlr_drm_format_set_has( &drm->formats, dma_buf->format, dma_buf->modifier ) )
+	{
+		drm_log.errorf( "Cannot import FB to DRM: format 0x%" PRIX32 " and modifier 0x%" PRIX64 " not supported for scan-out", dma_buf->format, dma_buf->modifier );
+		return nullptr;
+	}
+
+	if ( dma_buf->modifier != DRM_FORMAT_MOD_INVALID && !drm->allow_modifiers )
+	{
+		drm_log.errorf("Cannot import DMA-BUF: has a modifier (0x%" PRIX64 "), but KMS doesn't support them", dma_buf->modifier);
+		return nullptr;
+	}
+
+	// Our own images (buf == nullptr) get scanned out right away, so need the FB_ID now.
+	// Client buffers can be composited until theirs is ready.
+	if ( buf && cv_drm_async_fb_import )
+	{
+		DRMFbImportJob_t job = { .dmabuf = *dma_buf };
+
+		bool bDupFailed = false;
+		for ( int i = 0; i < dma_buf->n_planes; i++ )
+		{
+			job.dmabuf.fd[i] = bDupFailed ? -1 : fcntl( dma_buf->fd[i], F_DUPFD_CLOEXEC, 0 );
+			bDupFailed |= job.dmabuf.fd[i] < 0;
+		}
+
+		if ( !bDupFailed )
+		{
+			job.pFbIdState = std::make_shared<gamescope::CDRMFb::FbIdState_t>();
+			gamescope::OwningRc<gamescope::IBackendFb> pBackendFb = new gamescope::CDRMFb( job.pFbIdState );
+
+			{
+				std::unique_lock lock( drm->m_FbImportQueueMutex );
+				drm->m_FbImportQueue.emplace_back( std::move( job ) );
+			}
+			drm->m_FbImportQueueCV.notify_one();
+
+			return pBackendFb;
+		}
+
+		drm_log.errorf_errno( "Failed to dup DMA-BUF fd, importing synchronously" );
+		for ( int i = 0; i < dma_buf->n_planes; i++ )
+		{
+			if ( job.dmabuf.fd[i] >= 0 )
+				close( job.dmabuf.fd[i] );
+		}
+	}
+
+	uint32_t uFbId = drm_add_fb_from_dmabuf( drm, dma_buf );
+	if ( uFbId == 0 )
+		return nullptr;
+
+	return new gamescope::CDRMFb( uFbId );
 }
 
 static void update_drm_effective_orientations( struct drm_t *drm, const drmModeModeInfo *pMode )
@@ -1599,6 +1762,7 @@ struct LiftoffStateCacheEntry
 	}
 
     int nLayerCount;
+	uint64_t ulRotation;
 
 	struct LiftoffLayerState_t
 	{
@@ -1607,6 +1771,8 @@ struct LiftoffStateCacheEntry
 		uint32_t srcW, srcH;
 		uint32_t crtcX, crtcY, crtcW, crtcH;
 		uint16_t opacity;
+		uint32_t drmFormat;
+		uint64_t modifier;
 		drm_color_encoding colorEncoding;
 		drm_color_range    colorRange;
 		GamescopeAppTextureColorspace colorspace;
@@ -1624,6 +1790,7 @@ struct LiftoffStateCacheEntryKasher
 	{
 		size_t hash = 0;
 		hash_combine(hash, k.nLayerCount);
+		hash_combine(hash, k.ulRotation);
 		for ( int i = 0; i < k.nLayerCount; i++ )
 		{
 			hash_combine(hash, k.layerState[i].ycbcr);
@@ -1635,6 +1802,8 @@ struct LiftoffStateCacheEntryKasher
 			hash_combine(hash, k.layerState[i].crtcW);
 			hash_combine(hash, k.layerState[i].crtcH);
 			hash_combine(hash, k.layerState[i].opacity);
+			hash_combine(hash, k.layerState[i].drmFormat);
+			hash_combine(hash, k.layerState[i].modifier);
 			hash_combine(hash, k.layerState[i].colorEncoding);
 			hash_combine(hash, k.layerState[i].colorRange);
 			hash_combine(hash, k.layerState[i].colorspace);
@@ -1644,8 +1813,75 @@ struct LiftoffStateCacheEntryKasher
   	}
 };
 
+struct LiftoffStateCacheResult_t
+{
+	bool bSuccess;
+	// Plane each layer ended up on, 0 for none. Only meaningful if bSuccess.
+	uint32_t uPlaneIds[ k_nMaxLayers ];
+};
+
+// Remembers what libliftoff came up with for a given layer configuration,
+// both layouts that can't be scanned out and the plane assignments of those
+// that can, so steady-state frames don't redo the allocation and its
+// TEST_ONLY commits. Least recently used entries go first.
+class CLiftoffStateCache
+{
+public:
+	const LiftoffStateCacheResult_t *Find( const LiftoffStateCacheEntry &entry )
+	{
+		auto iter = m_Lookup.find( entry );
+		if ( iter == m_Lookup.end() )
+			return nullptr;
+
+		m_Entries.splice( m_Entries.begin(), m_Entries, iter->second );
+		return &iter->second->second;
+	}
+
+	void Insert( const LiftoffStateCacheEntry &entry, const LiftoffStateCacheResult_t &result, size_t uMaxEntries )
+	{
+		auto iter = m_Lookup.find( entry );
+		if ( iter != m_Lookup.end() )
+		{
+			iter->second->second = result;
+			m_Entries.splice( m_Entries.begin(), m_Entries, iter->second );
+			return;
+		}
+
+		m_Entries.emplace_front( entry, result );
+		m_Lookup.emplace( entry, m_Entries.begin() );
+
+		while ( m_Entries.size() > std::max<size_t>( uMaxEntries, 1 ) )
+		{
+			m_Lookup.erase( m_Entries.back().first );
+			m_Entries.pop_back();
+		}
+	}
+
+	void Erase( const LiftoffStateCacheEntry &entry )
+	{
+		auto iter = m_Lookup.find( entry );
+		if ( iter == m_Lookup.end() )
+			return;
+
+		m_Entries.erase( iter->second );
+		m_Lookup.erase( iter );
+	}
+
+	void Clear()
+	{
+		m_Lookup.clear();
+		m_Entries.clear();
+	}
+private:
+	using EntryList = std::list< std::pair< LiftoffStateCacheEntry, LiftoffStateCacheResult_t > >;
+
+	EntryList m_Entries;
+	std::unordered_map< LiftoffStateCacheEntry, EntryList::iterator, LiftoffStateCacheEntryKasher > m_Lookup;
+};
+
+static gamescope::ConVar<int> cv_drm_liftoff_state_cache_size( "drm_liftoff_state_cache_size", 64, "How many layer configurations to remember libliftoff plane assignments (or failures) for." );
 
-std::unordered_set<LiftoffStateCacheEntry, LiftoffStateCacheEntryKasher> g_LiftoffStateCache;
+CLiftoffStateCache g_LiftoffStateCache;
 
 static inline amdgpu_transfer_function colorspace_to_plane_degamma_tf(GamescopeAppTextureColorspace colorspace)
 {
@@ -1737,11 +1973,28 @@ static inline uint32_t ColorSpaceToEOTFIndex( GamescopeAppTextureColorspace colo
 }
 
 
+static uint64_t drm_get_plane_rotation( struct drm_t *drm )
+{
+	switch ( drm->pConnector->GetCurrentOrientation() )
+	{
+	default:
+	case GAMESCOPE_PANEL_ORIENTATION_0:
+		return DRM_MODE_ROTATE_0;
+	case GAMESCOPE_PANEL_ORIENTATION_270:
+		return DRM_MODE_ROTATE_270;
+	case GAMESCOPE_PANEL_ORIENTATION_90:
+		return DRM_MODE_ROTATE_90;
+	case GAMESCOPE_PANEL_ORIENTATION_180:
+		return DRM_MODE_ROTATE_180;
+	}
+}
+
 LiftoffStateCacheEntry FrameInfoToLiftoffStateCacheEntry( struct drm_t *drm, const FrameInfo_t *frameInfo )
 {
 	LiftoffStateCacheEntry entry{};
 
 	entry.nLayerCount = frameInfo->layerCount;
+	entry.ulRotation = drm_get_plane_rotation( drm );
 	for ( int i = 0; i < entry.nLayerCount; i++ )
 	{
 		const uint16_t srcWidth  = frameInfo->layers[ i ].tex->width();
@@ -1772,6 +2025,9 @@ LiftoffStateCacheEntry FrameInfoToLiftoffStateCacheEntry( struct drm_t *drm, con
 		entry.layerState[i].crtcW = crtcW;
 		entry.layerState[i].crtcH = crtcH;
 		entry.layerState[i].opacity = frameInfo->layers[i].opacity * 0xffff;
+		// Which planes can take a buffer depends on its format and modifier.
+		entry.layerState[i].drmFormat = frameInfo->layers[ i ].tex->drmFormat();
+		entry.layerState[i].modifier = frameInfo->layers[ i ].tex->dmabuf().modifier;
 		entry.layerState[i].ycbcr = frameInfo->layers[i].isYcbcr();
 		if ( entry.layerState[i].ycbcr )
 		{
@@ -1919,6 +2175,7 @@ namespace gamescope
 			m_Props.zpos                     = CDRMAtomicProperty::Instantiate( "zpos",                     this, *rawProperties );
 			m_Props.alpha                    = CDRMAtomicProperty::Instantiate( "alpha",                    this, *rawProperties );
 			m_Props.rotation                 = CDRMAtomicProperty::Instantiate( "rotation",                 this, *rawProperties );
+			m_Props.FB_DAMAGE_CLIPS          = CDRMAtomicProperty::Instantiate( "FB_DAMAGE_CLIPS",          this, *rawProperties );
 			m_Props.COLOR_ENCODING           = CDRMAtomicProperty::Instantiate( "COLOR_ENCODING",           this, *rawProperties );
 			m_Props.COLOR_RANGE              = CDRMAtomicProperty::Instantiate( "COLOR_RANGE",              this, *rawProperties );
 			m_Props.AMD_PLANE_DEGAMMA_TF     = CDRMAtomicProperty::Instantiate( "AMD_PLANE_DEGAMMA_TF",     this, *rawProperties );
@@ -1933,6 +2190,47 @@ namespace gamescope
 		}
 	}
 
+	std::optional<CDRMAtomicProperty> *CDRMPlane::GetPropertyByName( std::string_view svName )
+	{
+		static constexpr std::pair<std::string_view, std::optional<CDRMAtomicProperty> PlaneProperties::*> k_Names[] =
+		{
+			{ "FB_ID",                 &PlaneProperties::FB_ID },
+			{ "IN_FENCE_FD",           &PlaneProperties::IN_FENCE_FD },
+			{ "CRTC_ID",               &PlaneProperties::CRTC_ID },
+			{ "SRC_X",                 &PlaneProperties::SRC_X },
+			{ "SRC_Y",                 &PlaneProperties::SRC_Y },
+			{ "SRC_W",                 &PlaneProperties::SRC_W },
+			{ "SRC_H",                 &PlaneProperties::SRC_H },
+			{ "CRTC_X",                &PlaneProperties::CRTC_X },
+			{ "CRTC_Y",                &PlaneProperties::CRTC_Y },
+			{ "CRTC_W",                &PlaneProperties::CRTC_W },
+			{ "CRTC_H",                &PlaneProperties::CRTC_H },
+			{ "zpos",                  &PlaneProperties::zpos },
+			{ "alpha",                 &PlaneProperties::alpha },
+			{ "rotation",              &PlaneProperties::rotation },
+			{ "FB_DAMAGE_CLIPS",       &PlaneProperties::FB_DAMAGE_CLIPS },
+			{ "COLOR_ENCODING",        &PlaneProperties::COLOR_ENCODING },
+			{ "COLOR_RANGE",           &PlaneProperties::COLOR_RANGE },
+			{ "AMD_PLANE_DEGAMMA_TF",  &PlaneProperties::AMD_PLANE_DEGAMMA_TF },
+			{ "AMD_PLANE_DEGAMMA_LUT", &PlaneProperties::AMD_PLANE_DEGAMMA_LUT },
+			{ "AMD_PLANE_CTM",         &PlaneProperties::AMD_PLANE_CTM },
+			{ "AMD_PLANE_HDR_MULT",    &PlaneProperties::AMD_PLANE_HDR_MULT },
+			{ "AMD_PLANE_SHAPER_LUT",  &PlaneProperties::AMD_PLANE_SHAPER_LUT },
+			{ "AMD_PLANE_SHAPER_TF",   &PlaneProperties::AMD_PLANE_SHAPER_TF },
+			{ "AMD_PLANE_LUT3D",       &PlaneProperties::AMD_PLANE_LUT3D },
+			{ "AMD_PLANE_BLEND_TF",    &PlaneProperties::AMD_PLANE_BLEND_TF },
+			{ "AMD_PLANE_BLEND_LUT",   &PlaneProperties::AMD_PLANE_BLEND_LUT },
+		};
+
+		for ( const auto &[ svPropName, pMember ] : k_Names )
+		{
+			if ( svPropName == svName )
+				return &( m_Props.*pMember );
+		}
+
+		return nullptr;
+	}
+
 	/////////////////////////
 	// CDRMCRTC
 	/////////////////////////
@@ -2363,16 +2661,178 @@ namespace gamescope
 	// CDRMFb
 	/////////////////////////
 	CDRMFb::CDRMFb( uint32_t uFbId )
-		: m_uFbId{ uFbId }
+		: m_pFbIdState{ std::make_shared<FbIdState_t>() }
+	{
+		m_pFbIdState->uFbId = uFbId;
+	}
+	CDRMFb::CDRMFb( std::shared_ptr<FbIdState_t> pFbIdState )
+		: m_pFbIdState{ std::move( pFbIdState ) }
 	{
-
 	}
 	CDRMFb::~CDRMFb()
 	{
+		uint32_t uFbId = 0;
+		{
+			// If the import is still pending, the import thread cleans up.
+			std::unique_lock lock( m_pFbIdState->mutex );
+			m_pFbIdState->bOrphaned = true;
+			uFbId = m_pFbIdState->uFbId.exchange( 0 );
+		}
+
 		// I own the fbid.
-		if ( drmModeRmFB( g_DRM.fd, m_uFbId ) != 0 )
+		if ( uFbId != 0 && drmModeRmFB( g_DRM.fd, uFbId ) != 0 )
 			drm_log.errorf_errno( "drmModeRmFB failed" );
-		m_uFbId = 0;
+	}
+}
+
+static void drm_liftoff_layer_set_property( struct drm_t *drm, int nLayer, const char *pszName, uint64_t ulValue )
+{
+	liftoff_layer_set_property( drm->lo_layers[ nLayer ], pszName, ulValue );
+
+	for ( auto &prop : drm->lo_layer_props[ nLayer ] )
+	{
+		if ( !strcmp( prop.first, pszName ) )
+		{
+			prop.second = ulValue;
+			return;
+		}
+	}
+	drm->lo_layer_props[ nLayer ].emplace_back( pszName, ulValue );
+}
+
+static void drm_liftoff_layer_unset_property( struct drm_t *drm, int nLayer, const char *pszName )
+{
+	liftoff_layer_unset_property( drm->lo_layers[ nLayer ], pszName );
+
+	std::erase_if( drm->lo_layer_props[ nLayer ], [ pszName ]( const auto &prop ) { return !strcmp( prop.first, pszName ); } );
+}
+
+// Puts a plane assignment libliftoff came up with for an identical layer
+// configuration straight into the request, the same way libliftoff would
+// apply it, without any TEST_ONLY commits.
+static int drm_apply_cached_liftoff_assignment( struct drm_t *drm, const LiftoffStateCacheResult_t &result, int nLayerCount )
+{
+	const int nCursor = drmModeAtomicGetCursor( drm->req );
+
+	for ( std::unique_ptr< gamescope::CDRMPlane > &pPlane : drm->planes )
+	{
+		const uint32_t uPlaneId = pPlane->GetObjectId();
+		auto &props = pPlane->GetProperties();
+
+		int nLayer = -1;
+		for ( int i = 0; i < nLayerCount; i++ )
+		{
+			if ( result.uPlaneIds[ i ] == uPlaneId )
+				nLayer = i;
+		}
+
+		int ret = 0;
+		if ( nLayer < 0 )
+		{
+			ret = drmModeAtomicAddProperty( drm->req, uPlaneId, props.FB_ID->GetPropertyId(), 0 );
+			if ( ret >= 0 )
+				ret = drmModeAtomicAddProperty( drm->req, uPlaneId, props.CRTC_ID->GetPropertyId(), 0 );
+		}
+		else
+		{
+			ret = drmModeAtomicAddProperty( drm->req, uPlaneId, props.CRTC_ID->GetPropertyId(), drm->pCRTC->GetObjectId() );
+
+			for ( const auto &[ pszName, ulValue ] : drm->lo_layer_props[ nLayer ] )
+			{
+				if ( ret < 0 )
+					break;
+
+				// libliftoff only uses zpos to pick planes, it never sets it.
+				if ( !strcmp( pszName, "zpos" ) )
+					continue;
+
+				std::optional<gamescope::CDRMAtomicProperty> *pProperty = pPlane->GetPropertyByName( pszName );
+				if ( !pProperty || !*pProperty )
+				{
+					if ( !strcmp( pszName, "alpha" ) && ulValue == 0xFFFF )
+						continue;
+					if ( !strcmp( pszName, "rotation" ) && ulValue == DRM_MODE_ROTATE_0 )
+						continue;
+					// Only a hint, like libliftoff we drop it if the plane doesn't take it.
+					if ( !strcmp( pszName, "FB_DAMAGE_CLIPS" ) )
+						continue;
+
+					ret = -EINVAL;
+					break;
+				}
+
+				ret = drmModeAtomicAddProperty( drm->req, uPlaneId, ( *pProperty )->GetPropertyId(), ulValue );
+			}
+		}
+
+		if ( ret < 0 )
+		{
+			drmModeAtomicSetCursor( drm->req, nCursor );
+			return ret;
+		}
+	}
+
+	// The cache key doesn't cover everything the kernel checks (blobs, FB
+	// layouts, bandwidth...), so still test the request, just once instead
+	// of libliftoff's search.
+	uint32_t uTestFlags = ( drm->flags & ~DRM_MODE_PAGE_FLIP_EVENT ) | DRM_MODE_ATOMIC_TEST_ONLY;
+	int ret = drmModeAtomicCommit( drm->fd, drm->req, uTestFlags, nullptr );
+	if ( ret != 0 )
+	{
+		drmModeAtomicSetCursor( drm->req, nCursor );
+		return ret;
+	}
+
+	return 0;
+}
+
+// FB_DAMAGE_CLIPS blob for a layer, 0 (no clips) if the whole plane has to
+// be considered changed.
+static uint64_t drm_get_layer_damage_clips( struct drm_t *drm, const struct FrameInfo_t *frameInfo, int i )
+{
+	drm->pending.damage_clips[ i ] = nullptr;
+
+	// The damage is only against the commit the layer showed last.
+	const FrameInfo_t::Layer_t *pLayer = &frameInfo->layers[ i ];
+	if ( !cv_drm_damage_clips || !pLayer->ulCommitID || !pLayer->ulPrevCommitID ||
+		 pLayer->ulPrevCommitID != drm->current.layer_commit_id[ i ] )
+		return 0;
+
+	drm_mode_rect rect =
+	{
+		.x1 = std::clamp<int32_t>( pLayer->damageBox[0], 0, pLayer->tex->width() ),
+		.y1 = std::clamp<int32_t>( pLayer->damageBox[1], 0, pLayer->tex->height() ),
+		.x2 = std::clamp<int32_t>( pLayer->damageBox[2], 0, pLayer->tex->width() ),
+		.y2 = std::clamp<int32_t>( pLayer->damageBox[3], 0, pLayer->tex->height() ),
+	};
+	if ( rect.x1 >= rect.x2 || rect.y1 >= rect.y2 )
+		return 0;
+
+	drm->pending.damage_clips[ i ] = GetBackend()->CreateBackendBlob( rect );
+	return drm->pending.damage_clips[ i ] ? drm->pending.damage_clips[ i ]->GetBlobValue() : 0;
+}
+
+// Called once the planes are picked. A layer that moved to another plane
+// can't keep its damage, that plane had some other FB before.
+static void drm_finish_layer_damage( struct drm_t *drm, const struct FrameInfo_t *frameInfo, const uint32_t *puPlaneIds )
+{
+	for ( int i = 0; i < k_nMaxLayers; i++ )
+	{
+		const bool bActive = i < frameInfo->layerCount;
+		const uint32_t uPlaneId = bActive ? puPlaneIds[ i ] : 0;
+
+		if ( drm->pending.damage_clips[ i ] && uPlaneId != drm->current.layer_plane_id[ i ] )
+		{
+			for ( std::unique_ptr< gamescope::CDRMPlane > &pPlane : drm->planes )
+			{
+				if ( pPlane->GetObjectId() == uPlaneId && pPlane->GetProperties().FB_DAMAGE_CLIPS )
+					drmModeAtomicAddProperty( drm->req, uPlaneId, pPlane->GetProperties().FB_DAMAGE_CLIPS->GetPropertyId(), 0 );
+			}
+			drm->pending.damage_clips[ i ] = nullptr;
+		}
+
+		drm->pending.layer_commit_id[ i ] = bActive ? frameInfo->layers[ i ].ulCommitID : 0;
+		drm->pending.layer_plane_id[ i ] = uPlaneId;
 	}
 }
 
@@ -2385,11 +2845,17 @@ drm_prepare_liftoff( struct drm_t *drm, const struct FrameInfo_t *frameInfo, boo
 	// move to another CRTC or whatever which might have differing caps.
 	// (same with different modes)
 	if (needs_modeset)
-		g_LiftoffStateCache.clear();
+		g_LiftoffStateCache.Clear();
+
+	// Async flips can't change as much as a regular commit can, so only
+	// trust assignments for those.
+	const bool bCanUseCachedAssignment = !needs_modeset && !( drm->flags & DRM_MODE_PAGE_FLIP_ASYNC );
 
+	const LiftoffStateCacheResult_t *pCachedResult = nullptr;
 	if (is_liftoff_caching_enabled())
 	{
-		if (g_LiftoffStateCache.count(entry) != 0)
+		pCachedResult = g_LiftoffStateCache.Find( entry );
+		if (pCachedResult && !pCachedResult->bSuccess)
 			return -EINVAL;
 	}
 
@@ -2408,45 +2874,40 @@ drm_prepare_liftoff( struct drm_t *drm, const struct FrameInfo_t *frameInfo, boo
 				return -EINVAL;
 			}
 
-			const int nFence = cv_drm_debug_disable_in_fence_fd ? -1 : g_nAlwaysSignalledSyncFile;
+			if ( pDrmFb->GetFbId() == 0 )
+			{
+				drm_log.debugf("drm_prepare_liftoff: layer %d FB is still being imported", i );
+				return -EINVAL;
+			}
 
+			int nFence = -1;
+			if ( !cv_drm_debug_disable_in_fence_fd )
+				nFence = drm->nCompositeInFence >= 0 ? drm->nCompositeInFence : g_nAlwaysSignalledSyncFile;
 
-			liftoff_layer_set_property( drm->lo_layers[ i ], "FB_ID", pDrmFb->GetFbId());
-			liftoff_layer_set_property( drm->lo_layers[ i ], "IN_FENCE_FD", nFence );
+
+			drm_liftoff_layer_set_property( drm, i, "FB_ID", pDrmFb->GetFbId());
+			drm_liftoff_layer_set_property( drm, i, "IN_FENCE_FD", nFence );
 			drm->m_FbIdsInRequest.emplace_back( pDrmFb );
 
-			liftoff_layer_set_property( drm->lo_layers[ i ], "zpos", entry.layerState[i].zpos );
-			liftoff_layer_set_property( drm->lo_layers[ i ], "alpha", frameInfo->layers[ i ].opacity * 0xffff);
+			drm_liftoff_layer_set_property( drm, i, "zpos", entry.layerState[i].zpos );
+			drm_liftoff_layer_set_property( drm, i, "alpha", frameInfo->layers[ i ].opacity * 0xffff);
 
-			liftoff_layer_set_property( drm->lo_layers[ i ], "SRC_X", 0);
-			liftoff_layer_set_property( drm->lo_layers[ i ], "SRC_Y", 0);
-			liftoff_layer_set_property( drm->lo_layers[ i ], "SRC_W", entry.layerState[i].srcW );
-			liftoff_layer_set_property( drm->lo_layers[ i ], "SRC_H", entry.layerState[i].srcH );
+			drm_liftoff_layer_set_property( drm, i, "SRC_X", 0);
+			drm_liftoff_layer_set_property( drm, i, "SRC_Y", 0);
+			drm_liftoff_layer_set_property( drm, i, "SRC_W", entry.layerState[i].srcW );
+			drm_liftoff_layer_set_property( drm, i, "SRC_H", entry.layerState[i].srcH );
 
-			uint64_t ulOrientation = DRM_MODE_ROTATE_0;
-			switch ( drm->pConnector->GetCurrentOrientation() )
-			{
-			default:
-			case GAMESCOPE_PANEL_ORIENTATION_0:
-				ulOrientation = DRM_MODE_ROTATE_0;
-				break;
-			case GAMESCOPE_PANEL_ORIENTATION_270:
-				ulOrientation = DRM_MODE_ROTATE_270;
-				break;
-			case GAMESCOPE_PANEL_ORIENTATION_90:
-				ulOrientation = DRM_MODE_ROTATE_90;
-				break;
-			case GAMESCOPE_PANEL_ORIENTATION_180:
-				ulOrientation = DRM_MODE_ROTATE_180;
-				break;
-			}
-			liftoff_layer_set_property( drm->lo_layers[ i ], "rotation", ulOrientation );
+			drm_liftoff_layer_set_property( drm, i, "rotation", entry.ulRotation );
+
+			drm_liftoff_layer_set_property( drm, i, "CRTC_X", entry.layerState[i].crtcX);
+			drm_liftoff_layer_set_property( drm, i, "CRTC_Y", entry.layerState[i].crtcY);
 
-			liftoff_layer_set_property( drm->lo_layers[ i ], "CRTC_X", entry.layerState[i].crtcX);
-			liftoff_layer_set_property( drm->lo_layers[ i ], "CRTC_Y", entry.layerState[i].crtcY);
+			drm_liftoff_layer_set_property( drm, i, "CRTC_W", entry.layerState[i].crtcW);
+			drm_liftoff_layer_set_property( drm, i, "CRTC_H", entry.layerState[i].crtcH);
 
-			liftoff_layer_set_property( drm->lo_layers[ i ], "CRTC_W", entry.layerState[i].crtcW);
-			liftoff_layer_set_property( drm->lo_layers[ i ], "CRTC_H", entry.layerState[i].crtcH);
+			// libliftoff drops it for planes without the property and doesn't
+			// reallocate planes when it changes.
+			drm_liftoff_layer_set_property( drm, i, "FB_DAMAGE_CLIPS", drm_get_layer_damage_clips( drm, frameInfo, i ) );
 
 			if ( frameInfo->layers[i].applyColorMgmt )
 			{
@@ -2454,20 +2915,20 @@ drm_prepare_liftoff( struct drm_t *drm, const struct FrameInfo_t *frameInfo, boo
 
 				if ( !cv_drm_debug_disable_color_encoding && bYCbCr )
 				{
-					liftoff_layer_set_property( drm->lo_layers[ i ], "COLOR_ENCODING", entry.layerState[i].colorEncoding );
+					drm_liftoff_layer_set_property( drm, i, "COLOR_ENCODING", entry.layerState[i].colorEncoding );
 				}
 				else
 				{
-					liftoff_layer_unset_property( drm->lo_layers[ i ], "COLOR_ENCODING" );
+					drm_liftoff_layer_unset_property( drm, i, "COLOR_ENCODING" );
 				}
 
 				if ( !cv_drm_debug_disable_color_range && bYCbCr )
 				{
-					liftoff_layer_set_property( drm->lo_layers[ i ], "COLOR_RANGE",    entry.layerState[i].colorRange );
+					drm_liftoff_layer_set_property( drm, i, "COLOR_RANGE",    entry.layerState[i].colorRange );
 				}
 				else
 				{
-					liftoff_layer_unset_property( drm->lo_layers[ i ], "COLOR_RANGE" );
+					drm_liftoff_layer_unset_property( drm, i, "COLOR_RANGE" );
 				}
 
 				if ( drm_supports_color_mgmt( drm ) )
@@ -2491,23 +2952,23 @@ drm_prepare_liftoff( struct drm_t *drm, const struct FrameInfo_t *frameInfo, boo
 
 					bool bUseDegamma = !cv_drm_debug_disable_degamma_tf;
 					if ( bUseDegamma )
-						liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_DEGAMMA_TF", degamma_tf );
+						drm_liftoff_layer_set_property( drm, i, "AMD_PLANE_DEGAMMA_TF", degamma_tf );
 					else
-						liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_DEGAMMA_TF", 0 );
+						drm_liftoff_layer_set_property( drm, i, "AMD_PLANE_DEGAMMA_TF", 0 );
 
 					bool bUseShaperAnd3DLUT = !cv_drm_debug_disable_shaper_and_3dlut;
 					if ( bUseShaperAnd3DLUT )
 					{
-						liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_SHAPER_LUT", drm->pending.shaperlut_id[ ColorSpaceToEOTFIndex( entry.layerState[i].colorspace ) ]->GetBlobValue() );
-						liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_SHAPER_TF", shaper_tf );
-						liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_LUT3D", drm->pending.lut3d_id[ ColorSpaceToEOTFIndex( entry.layerState[i].colorspace ) ]->GetBlobValue() );
+						drm_liftoff_layer_set_property( drm, i, "AMD_PLANE_SHAPER_LUT", drm->pending.shaperlut_id[ ColorSpaceToEOTFIndex( entry.layerState[i].colorspace ) ]->GetBlobValue() );
+						drm_liftoff_layer_set_property( drm, i, "AMD_PLANE_SHAPER_TF", shaper_tf );
+						drm_liftoff_layer_set_property( drm, i, "AMD_PLANE_LUT3D", drm->pending.lut3d_id[ ColorSpaceToEOTFIndex( entry.layerState[i].colorspace ) ]->GetBlobValue() );
 						// Josh: See shaders/colorimetry.h colorspace_blend_tf if you have questions as to why we start doing sRGB for BLEND_TF despite potentially working in Gamma 2.2 space prior.
 					}
 					else
 					{
-						liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_SHAPER_LUT", 0 );
-						liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_SHAPER_TF", 0 );
-						liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_LUT3D", 0 );
+						drm_liftoff_layer_set_property( drm, i, "AMD_PLANE_SHAPER_LUT", 0 );
+						drm_liftoff_layer_set_property( drm, i, "AMD_PLANE_SHAPER_TF", 0 );
+						drm_liftoff_layer_set_property( drm, i, "AMD_PLANE_LUT3D", 0 );
 					}
 				}
 			}
@@ -2515,47 +2976,62 @@ drm_prepare_liftoff( struct drm_t *drm, const struct FrameInfo_t *frameInfo, boo
 			{
 				if ( drm_supports_color_mgmt( drm ) )
 				{
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_DEGAMMA_TF", AMDGPU_TRANSFER_FUNCTION_DEFAULT );
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_SHAPER_LUT", 0 );
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_SHAPER_TF", 0 );
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_LUT3D", 0 );
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_CTM", 0 );
+					drm_liftoff_layer_set_property( drm, i, "AMD_PLANE_DEGAMMA_TF", AMDGPU_TRANSFER_FUNCTION_DEFAULT );
+					drm_liftoff_layer_set_property( drm, i, "AMD_PLANE_SHAPER_LUT", 0 );
+					drm_liftoff_layer_set_property( drm, i, "AMD_PLANE_SHAPER_TF", 0 );
+					drm_liftoff_layer_set_property( drm, i, "AMD_PLANE_LUT3D", 0 );
+					drm_liftoff_layer_set_property( drm, i, "AMD_PLANE_CTM", 0 );
 				}
 			}
 
 			if ( drm_supports_color_mgmt( drm ) )
 			{
 				if (!cv_drm_debug_disable_blend_tf && !bSinglePlane)
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_BLEND_TF", drm->pending.output_tf );
+					drm_liftoff_layer_set_property( drm, i, "AMD_PLANE_BLEND_TF", drm->pending.output_tf );
 				else
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_BLEND_TF", AMDGPU_TRANSFER_FUNCTION_DEFAULT );
+					drm_liftoff_layer_set_property( drm, i, "AMD_PLANE_BLEND_TF", AMDGPU_TRANSFER_FUNCTION_DEFAULT );
 
 				if (!cv_drm_debug_disable_ctm && frameInfo->layers[i].ctm != nullptr)
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_CTM", frameInfo->layers[i].ctm->GetBlobValue() );
+					drm_liftoff_layer_set_property( drm, i, "AMD_PLANE_CTM", frameInfo->layers[i].ctm->GetBlobValue() );
 				else
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_CTM", 0 );
+					drm_liftoff_layer_set_property( drm, i, "AMD_PLANE_CTM", 0 );
 			}
 		}
 		else
 		{
-			liftoff_layer_set_property( drm->lo_layers[ i ], "FB_ID", 0 );
-			liftoff_layer_set_property( drm->lo_layers[ i ], "IN_FENCE_FD", -1 );
+			drm_liftoff_layer_set_property( drm, i, "FB_ID", 0 );
+			drm_liftoff_layer_set_property( drm, i, "IN_FENCE_FD", -1 );
+			drm_liftoff_layer_set_property( drm, i, "FB_DAMAGE_CLIPS", 0 );
+			drm->pending.damage_clips[ i ] = nullptr;
 
-			liftoff_layer_unset_property( drm->lo_layers[ i ], "COLOR_ENCODING" );
-			liftoff_layer_unset_property( drm->lo_layers[ i ], "COLOR_RANGE" );
+			drm_liftoff_layer_unset_property( drm, i, "COLOR_ENCODING" );
+			drm_liftoff_layer_unset_property( drm, i, "COLOR_RANGE" );
 
 			if ( drm_supports_color_mgmt( drm ) )
 			{
-				liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_DEGAMMA_TF", AMDGPU_TRANSFER_FUNCTION_DEFAULT );
-				liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_SHAPER_LUT", 0 );
-				liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_SHAPER_TF", 0 );
-				liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_LUT3D", 0 );
-				liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_BLEND_TF", AMDGPU_TRANSFER_FUNCTION_DEFAULT );
-				liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_CTM", 0 );
+				drm_liftoff_layer_set_property( drm, i, "AMD_PLANE_DEGAMMA_TF", AMDGPU_TRANSFER_FUNCTION_DEFAULT );
+				drm_liftoff_layer_set_property( drm, i, "AMD_PLANE_SHAPER_LUT", 0 );
+				drm_liftoff_layer_set_property( drm, i, "AMD_PLANE_SHAPER_TF", 0 );
+				drm_liftoff_layer_set_property( drm, i, "AMD_PLANE_LUT3D", 0 );
+				drm_liftoff_layer_set_property( drm, i, "AMD_PLANE_BLEND_TF", AMDGPU_TRANSFER_FUNCTION_DEFAULT );
+				drm_liftoff_layer_set_property( drm, i, "AMD_PLANE_CTM", 0 );
 			}
 		}
 	}
 
+	if ( pCachedResult && bCanUseCachedAssignment )
+	{
+		if ( drm_apply_cached_liftoff_assignment( drm, *pCachedResult, frameInfo->layerCount ) == 0 )
+		{
+			drm_finish_layer_damage( drm, frameInfo, pCachedResult->uPlaneIds );
+			drm_log.debugf( "can drm present %i layers (cached)", frameInfo->layerCount );
+			return 0;
+		}
+
+		drm_log.debugf( "cached plane assignment for %i layers failed to apply, falling back to libliftoff", frameInfo->layerCount );
+		g_LiftoffStateCache.Erase( entry );
+	}
+
 	struct liftoff_output_apply_options lo_options = {
 		.timeout_ns = std::numeric_limits<int64_t>::max()
 	};
@@ -2575,7 +3051,14 @@ drm_prepare_liftoff( struct drm_t *drm, const struct FrameInfo_t *frameInfo, boo
 		attempted_in_fence_fallback = true;
 		for ( int i = 0; i < frameInfo->layerCount; i++ )
 		{
-			liftoff_layer_set_property( drm->lo_layers[ i ], "IN_FENCE_FD", -1 );
+			drm_liftoff_layer_set_property( drm, i, "IN_FENCE_FD", -1 );
+		}
+
+		// KMS won't be waiting for the composite then, do it ourselves.
+		if ( drm->nCompositeInFence >= 0 )
+		{
+			pollfd fence = { .fd = drm->nCompositeInFence, .events = POLLIN };
+			poll( &fence, 1, -1 );
 		}
 
 		ret = liftoff_output_apply( drm->lo_output, drm->req, drm->flags, &lo_options );
@@ -2600,7 +3083,22 @@ drm_prepare_liftoff( struct drm_t *drm, const struct FrameInfo_t *frameInfo, boo
 	if (!needs_modeset)
 	{
 		if (ret == -EINVAL)
-			g_LiftoffStateCache.insert(entry);
+			g_LiftoffStateCache.Insert( entry, LiftoffStateCacheResult_t{ .bSuccess = false }, cv_drm_liftoff_state_cache_size );
+	}
+
+	if ( ret == 0 )
+	{
+		LiftoffStateCacheResult_t result = { .bSuccess = true };
+		for ( int i = 0; i < frameInfo->layerCount; i++ )
+		{
+			struct liftoff_plane *pPlane = liftoff_layer_get_plane( drm->lo_layers[ i ] );
+			result.uPlaneIds[ i ] = pPlane ? liftoff_plane_get_id( pPlane ) : 0;
+		}
+
+		drm_finish_layer_damage( drm, frameInfo, result.uPlaneIds );
+
+		if ( bCanUseCachedAssignment )
+			g_LiftoffStateCache.Insert( entry, result, cv_drm_liftoff_state_cache_size );
 	}
 
 	if ( ret == 0 )
@@ -2611,6 +3109,49 @@ drm_prepare_liftoff( struct drm_t *drm, const struct FrameInfo_t *frameInfo, boo
 	return ret;
 }
 
+// Whether two frames would put the same thing on screen.
+static bool drm_frames_match( const FrameInfo_t &a, const FrameInfo_t &b )
+{
+	if ( a.useFSRLayer0 != b.useFSRLayer0 ||
+		 a.useNISLayer0 != b.useNISLayer0 ||
+		 a.blurLayer0 != b.blurLayer0 ||
+		 a.blurRadius != b.blurRadius ||
+		 a.allowVRR != b.allowVRR ||
+		 a.applyOutputColorMgmt != b.applyOutputColorMgmt ||
+		 a.outputEncodingEOTF != b.outputEncodingEOTF ||
+		 a.layerCount != b.layerCount )
+		return false;
+
+	for ( uint32_t i = 0; i < EOTF_Count; i++ )
+	{
+		if ( a.shaperLut[i].get() != b.shaperLut[i].get() || a.lut3D[i].get() != b.lut3D[i].get() )
+			return false;
+	}
+
+	for ( int i = 0; i < a.layerCount; i++ )
+	{
+		const FrameInfo_t::Layer_t &layerA = a.layers[i];
+		const FrameInfo_t::Layer_t &layerB = b.layers[i];
+
+		if ( layerA.tex.get() != layerB.tex.get() ||
+			 layerA.ulCommitID != layerB.ulCommitID ||
+			 layerA.zpos != layerB.zpos ||
+			 layerA.offset.x != layerB.offset.x ||
+			 layerA.offset.y != layerB.offset.y ||
+			 layerA.scale.x != layerB.scale.x ||
+			 layerA.scale.y != layerB.scale.y ||
+			 layerA.opacity != layerB.opacity ||
+			 layerA.filter != layerB.filter ||
+			 layerA.blackBorder != layerB.blackBorder ||
+			 layerA.applyColorMgmt != layerB.applyColorMgmt ||
+			 layerA.ctm != layerB.ctm ||
+			 layerA.colorspace != layerB.colorspace )
+			return false;
+	}
+
+	return true;
+}
+
 bool g_bForceAsyncFlips = false;
 
 void drm_rollback( struct drm_t *drm )
@@ -2690,6 +3231,8 @@ int drm_prepare( struct drm_t *drm, bool async, const struct FrameInfo_t *frameI
 	drm->m_FbIdsInRequest.clear();
 
 	bool needs_modeset = drm->needs_modeset.exchange(false);
+	// A full modeset sets MODE_ID anyway.
+	bool needs_mode_change = drm->needs_mode_change.exchange(false) && !needs_modeset;
 
 	assert( drm->req == nullptr );
 	drm->req = drmModeAtomicAlloc();
@@ -2797,6 +3340,13 @@ int drm_prepare( struct drm_t *drm, bool async, const struct FrameInfo_t *frameI
 				drm->pCRTC->GetProperties().VRR_ENABLED->SetPendingValue( drm->req, bVRREnabled, true );
 		}
 	}
+	else if ( needs_mode_change && drm->pCRTC )
+	{
+		// Same connector and CRTC, no need to tear everything down and back up.
+		flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+
+		drm->pCRTC->GetProperties().MODE_ID->SetPendingValue( drm->req, drm->pending.mode_id ? drm->pending.mode_id->GetBlobValue() : 0lu, true );
+	}
 
 	if ( drm->pConnector )
 	{
@@ -2824,7 +3374,7 @@ int drm_prepare( struct drm_t *drm, bool async, const struct FrameInfo_t *frameI
 	if ( drm->pCRTC == nullptr ) {
 		ret = 0;
 	} else if ( drm->bUseLiftoff ) {
-		ret = drm_prepare_liftoff( drm, frameInfo, needs_modeset );
+		ret = drm_prepare_liftoff( drm, frameInfo, needs_modeset || needs_mode_change );
 	} else {
 		ret = 0;
 	}
@@ -2839,6 +3389,8 @@ int drm_prepare( struct drm_t *drm, bool async, const struct FrameInfo_t *frameI
 
 		if ( needs_modeset )
 			drm->needs_modeset = true;
+		if ( needs_mode_change )
+			drm->needs_mode_change = true;
 	}
 
 	return ret;
@@ -2876,6 +3428,7 @@ static bool drm_set_crtc( struct drm_t *drm, gamescope::CDRMCRTC *pCRTC )
 	{
 		liftoff_layer_destroy( drm->lo_layers[ i ] );
 		drm->lo_layers[ i ] = liftoff_layer_create( lo_output );
+		drm->lo_layer_props[ i ].clear();
 		if ( drm->lo_layers[ i ] == nullptr )
 			return false;
 	}
@@ -2921,6 +3474,7 @@ static void drm_unset_connector( struct drm_t *drm )
 	{
 		liftoff_layer_destroy( drm->lo_layers[ i ] );
 		drm->lo_layers[ i ] = nullptr;
+		drm->lo_layer_props[ i ].clear();
 	}
 
 	liftoff_output_destroy(drm->lo_output);
@@ -2928,6 +3482,8 @@ static void drm_unset_connector( struct drm_t *drm )
 
 	drm->pConnector = nullptr;
 	drm->needs_modeset = true;
+
+	drm->dynamic_refresh_modes.clear();
 }
 
 bool drm_get_vrr_in_use(struct drm_t *drm)
@@ -2996,15 +3552,15 @@ static void drm_unset_mode( struct drm_t *drm )
 	g_bRotated = false;
 }
 
-bool drm_set_mode( struct drm_t *drm, const drmModeModeInfo *mode )
+static void drm_set_mode_blob( struct drm_t *drm, const drmModeModeInfo *mode, std::shared_ptr<gamescope::BackendBlob> pBlob, bool bFullModeset )
 {
-	if (!drm->pConnector || !drm->pConnector->GetModeConnector())
-		return false;
-
 	drm_log.infof("selecting mode %dx%d@%uHz", mode->hdisplay, mode->vdisplay, mode->vrefresh);
 
-	drm->pending.mode_id = GetBackend()->CreateBackendBlob( *mode );
-	drm->needs_modeset = true;
+	drm->pending.mode_id = std::move( pBlob );
+	if ( bFullModeset )
+		drm->needs_modeset = true;
+	else
+		drm->needs_mode_change = true;
 
 	g_nOutputRefresh = gamescope::GetModeRefresh( mode );
 	g_nDynamicRefreshHz = 0;
@@ -3027,23 +3583,19 @@ bool drm_set_mode( struct drm_t *drm, const drmModeModeInfo *mode )
 		g_nOutputHeight = mode->hdisplay;
 		break;
 	}
-
-	return true;
 }
 
-bool drm_set_refresh( struct drm_t *drm, int refresh )
+bool drm_set_mode( struct drm_t *drm, const drmModeModeInfo *mode )
 {
-	int width = g_nOutputWidth;
-	int height = g_nOutputHeight;
-
-	if ( g_bRotated ) {
-		int tmp = width;
-		width = height;
-		height = tmp;
-	}
 	if (!drm->pConnector || !drm->pConnector->GetModeConnector())
 		return false;
 
+	drm_set_mode_blob( drm, mode, GetBackend()->CreateBackendBlob( *mode ), true );
+	return true;
+}
+
+static drmModeModeInfo drm_generate_refresh_mode( struct drm_t *drm, int width, int height, int refresh )
+{
 	drmModeConnector *connector = drm->pConnector->GetModeConnector();
 	const drmModeModeInfo *existing_mode = find_mode(connector, width, height, refresh);
 	drmModeModeInfo mode = {0};
@@ -3053,10 +3605,10 @@ bool drm_set_refresh( struct drm_t *drm, int refresh )
 	}
 	else
 	{
-		if ( g_DRM.pConnector && g_DRM.pConnector->GetModeGenerator() )
+		if ( drm->pConnector->GetModeGenerator() )
 		{
 			const drmModeModeInfo *preferred_mode = find_mode(connector, 0, 0, 0);
-			mode = g_DRM.pConnector->GetModeGenerator()( preferred_mode, refresh );
+			mode = drm->pConnector->GetModeGenerator()( preferred_mode, refresh );
 		}
 		else
 		{
@@ -3078,6 +3630,61 @@ bool drm_set_refresh( struct drm_t *drm, int refresh )
 
 	mode.type = DRM_MODE_TYPE_USERDEF;
 
+	return mode;
+}
+
+static void drm_precompute_dynamic_refresh_modes( struct drm_t *drm, int width, int height )
+{
+	drm->dynamic_refresh_modes.clear();
+	drm->dynamic_refresh_modes_width = width;
+	drm->dynamic_refresh_modes_height = height;
+
+	if ( !drm->pConnector || !drm->pConnector->GetModeConnector() )
+		return;
+
+	for ( uint32_t uRefresh : drm->pConnector->GetValidDynamicRefreshRates() )
+	{
+		const int nRefresh = int( uRefresh );
+		drmModeModeInfo mode = drm_generate_refresh_mode( drm, width, height, nRefresh );
+
+		std::shared_ptr<gamescope::BackendBlob> pBlob = GetBackend()->CreateBackendBlob( mode );
+		if ( !pBlob )
+			continue;
+
+		drm->dynamic_refresh_modes[ nRefresh ] = drm_t::dynamic_refresh_mode_t{ mode, std::move( pBlob ) };
+	}
+
+	if ( !drm->dynamic_refresh_modes.empty() )
+		drm_log.infof( "precomputed %zu dynamic refresh modes for %dx%d", drm->dynamic_refresh_modes.size(), width, height );
+}
+
+bool drm_set_refresh( struct drm_t *drm, int refresh )
+{
+	int width = g_nOutputWidth;
+	int height = g_nOutputHeight;
+
+	if ( g_bRotated ) {
+		int tmp = width;
+		width = height;
+		height = tmp;
+	}
+	if (!drm->pConnector || !drm->pConnector->GetModeConnector())
+		return false;
+
+	if ( width == drm->dynamic_refresh_modes_width && height == drm->dynamic_refresh_modes_height )
+	{
+		auto iter = drm->dynamic_refresh_modes.find( refresh );
+		if ( iter != drm->dynamic_refresh_modes.end() )
+		{
+			// Same connector and CRTC, only MODE_ID needs to change.
+			drm_set_mode_blob( drm, &iter->second.mode, iter->second.blob, false );
+			g_nDynamicRefreshHz = refresh;
+			return true;
+		}
+	}
+
+	drmModeModeInfo mode = drm_generate_refresh_mode( drm, width, height, refresh );
+
 	bool bSuccess = drm_set_mode(drm, &mode);
 	if ( !bSuccess )
 		return false;
@@ -3278,6 +3885,14 @@ namespace gamescope
 
 			bNeedsFullComposite |= !!(g_uCompositeDebug & CompositeDebugFlag::Heatmap);
 
+			// Don't wake the display (or the GPU) for the frame that is already
+			// on screen, so the panel can stay in self refresh.
+			if ( IsFrameOnScreen( pFrameInfo ) )
+			{
+				drm_log.debugf( "frame unchanged, skipping commit" );
+				return 0;
+			}
+
 			bool bDoComposite = true;
 			if ( !bNeedsFullComposite && !bWantsPartialComposite )
 			{
@@ -3299,7 +3914,7 @@ namespace gamescope
 				if ( pFrameInfo->layerCount == 2 )
 					m_nLastSingleOverlayZPos = pFrameInfo->layers[1].zpos;
 
-				return Commit( pFrameInfo );
+				return CommitFrame( pFrameInfo, pFrameInfo );
 			}
 
 			// Composition Path
@@ -3380,7 +3995,16 @@ namespace gamescope
 				return -EINVAL;
 			}
 
-			vulkan_wait( *oCompositeResult, true );
+			// Rather than stalling until the composite is done, let KMS wait for it.
+			// Only for tearing flips: the vblank timer learns how long we take from
+			// UpdateLastDrawTime, which would then miss the GPU time and wake us too
+			// late for regular flips.
+			if ( UseCompositeInFence() && ( bAsync || g_bForceAsyncFlips ) )
+				g_DRM.nCompositeInFence = vulkan_export_sync_file( *oCompositeResult );
+			defer( if ( g_DRM.nCompositeInFence >= 0 ) { close( g_DRM.nCompositeInFence ); g_DRM.nCompositeInFence = -1; } );
+
+			if ( g_DRM.nCompositeInFence < 0 )
+				vulkan_wait( *oCompositeResult, true );
 
 			FrameInfo_t presentCompFrameInfo = {};
 			presentCompFrameInfo.allowVRR = pFrameInfo->allowVRR;
@@ -3404,6 +4028,13 @@ namespace gamescope
 				baseLayer->ctm = nullptr;
 				baseLayer->colorspace = pFrameInfo->outputEncodingEOTF == EOTF_PQ ? GAMESCOPE_APP_TEXTURE_COLORSPACE_HDR10_PQ : GAMESCOPE_APP_TEXTURE_COLORSPACE_SRGB;
 
+				// Composites get commit ids of their own, the composite damage
+				// is against the last full composite.
+				baseLayer->ulCommitID = k_ulCompositeCommitIDBit | ++m_ulCompositeCount;
+				if ( compositeFrameInfo.damage.GetBounds( baseLayer->damageBox ) )
+					baseLayer->ulPrevCommitID = m_ulLastCompositeCommitID;
+				m_ulLastCompositeCommitID = baseLayer->ulCommitID;
+
 				m_bWasPartialCompsiting = false;
 			}
 			else
@@ -3503,11 +4134,14 @@ namespace gamescope
 				}
 			}
 
-			return Commit( &compositeFrameInfo );
+			// A deferred partial composite shows the previous overlay composite,
+			// not this frame's, so it can't count as this frame being on screen.
+			return CommitFrame( &compositeFrameInfo, bDefer ? nullptr : pFrameInfo );
 		}
 
 		virtual void DirtyState( bool bForce, bool bForceModeset ) override
 		{
+			m_oFrameOnScreen = std::nullopt;
 			if ( bForceModeset )
 				g_DRM.needs_modeset = true;
 			g_DRM.out_of_date = std::max<int>( g_DRM.out_of_date, bForce ? 2 : 1 );
@@ -3602,6 +4236,11 @@ namespace gamescope
 			return g_bSupportsAsyncFlips;
 		}
 
+		virtual bool SupportsTearingWhileCompositing() const override
+		{
+			return SupportsTearing() && UseCompositeInFence();
+		}
+
 		virtual bool UsesVulkanSwapchain() const override
 		{
 			return false;
@@ -3678,6 +4317,52 @@ namespace gamescope
 			return drm_supports_color_mgmt( &g_DRM );
 		}
 
+		bool UseCompositeInFence() const
+		{
+			return cv_drm_composite_in_fence && !cv_drm_debug_disable_in_fence_fd && vulkan_supports_sync_file_export();
+		}
+
+		// Set above any client commit id.
+		static constexpr uint64_t k_ulCompositeCommitIDBit = 1ull << 63;
+		uint64_t m_ulCompositeCount = 0;
+		uint64_t m_ulLastCompositeCommitID = 0;
+
+		// The input of the last frame that made it to the screen. Holds on to
+		// its textures, so they can be compared by pointer.
+		std::optional<FrameInfo_t> m_oFrameOnScreen;
+		uint32_t m_uFrameOnScreenColorMgmtSerial = 0;
+
+		bool IsFrameOnScreen( const FrameInfo_t *pFrameInfo ) const
+		{
+			if ( !cv_drm_idle_skip_commits || !m_oFrameOnScreen )
+				return false;
+
+			// Things that change the output without changing the frame.
+			if ( g_DRM.needs_modeset || g_DRM.needs_mode_change || g_DRM.out_of_date || g_DRM.paused )
+				return false;
+			if ( pFrameInfo->bFadingOut || g_bColorSliderInUse || !g_reshade_effect.empty() || g_uCompositeDebug != 0 )
+				return false;
+			if ( g_ColorMgmt.serial != m_uFrameOnScreenColorMgmtSerial )
+				return false;
+
+			return drm_frames_match( *m_oFrameOnScreen, *pFrameInfo );
+		}
+
+		// pFrameInfo is the input the committed frame fully shows, if any.
+		int CommitFrame( const FrameInfo_t *pCommitFrameInfo, const FrameInfo_t *pFrameInfo )
+		{
+			int ret = Commit( pCommitFrameInfo );
+
+			m_oFrameOnScreen = std::nullopt;
+			if ( ret == 0 && pFrameInfo )
+			{
+				m_oFrameOnScreen = *pFrameInfo;
+				m_uFrameOnScreenColorMgmtSerial = g_ColorMgmt.serial;
+			}
+
+			return ret;
+		}
+
 		int Commit( const FrameInfo_t *pFrameInfo )
 		{
 			drm_t *drm = &g_DRM;
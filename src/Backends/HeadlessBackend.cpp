@@ -1,13 +1,333 @@
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include "backend.h"
 #include "rendervulkan.hpp"
 #include "wlserver.hpp"
 #include "refresh_rate.h"
+#include "steamcompmgr.hpp"
+#include "vblankmanager.hpp"
+#include "convar.h"
+#include "log.hpp"
+#include "headless_sink_gamescope.hpp"
 
 extern int g_nPreferredOutputWidth;
 extern int g_nPreferredOutputHeight;
 
+static LogScope headless_log( "headless" );
+
 namespace gamescope
 {
+    static ConVar<bool> cv_headless_composite{ "headless_composite", false, "Composite every frame into the headless backend's own output images, even with no sink to send them to. Useful for benchmarking." };
+    static ConVar<std::string> cv_headless_sink_file{ "headless_sink_file", "", "Write the composited frames of the headless backend to this file, or to an inherited fd with fd:N. See headless_sink_gamescope.hpp for the format." };
+    static ConVar<std::string> cv_headless_sink_shm{ "headless_sink_shm", "", "Publish the composited frames of the headless backend in a shared-memory ring with this shm_open name. See headless_sink_gamescope.hpp for the layout." };
+    static ConVar<int> cv_headless_refresh{ "headless_refresh", 0, "Rate of the virtual vblank of the headless backend in Hz. 0 keeps the one from -r." };
+
+    static constexpr uint32_t k_uHeadlessShmSlots = 3;
+
+    // Writes composited frames out on its own thread, so a slow consumer
+    // can't hold up the compositor. Frames are dropped while it is busy.
+    // Holds a reference to the texture it is writing and the one queued.
+    class CHeadlessFrameSink
+    {
+    public:
+        CHeadlessFrameSink()
+        {
+            m_Thread = std::thread{ [this]() { this->SinkThreadFunc(); } };
+        }
+
+        ~CHeadlessFrameSink()
+        {
+            {
+                std::unique_lock lock( m_Mutex );
+                m_bRunning = false;
+            }
+            m_Condition.notify_all();
+            m_Thread.join();
+
+            CloseFile();
+            CloseShm();
+        }
+
+        static bool IsEnabled()
+        {
+            return !std::string_view{ cv_headless_sink_file }.empty() || !std::string_view{ cv_headless_sink_shm }.empty();
+        }
+
+        // pTexture must be idle on the GPU. Replaces a frame the sink
+        // hasn't picked up yet.
+        void Queue( Rc<CVulkanTexture> pTexture, uint64_t ulFrameId, uint64_t ulVBlank )
+        {
+            // The convars are only safe to read from here.
+            PendingFrame_t frame =
+            {
+                .pTexture  = std::move( pTexture ),
+                .ulFrameId = ulFrameId,
+                .ulVBlank  = ulVBlank,
+                .sFilePath = std::string{ std::string_view{ cv_headless_sink_file } },
+                .sShmName  = std::string{ std::string_view{ cv_headless_sink_shm } },
+            };
+
+            {
+                std::unique_lock lock( m_Mutex );
+                m_oPending = std::move( frame );
+            }
+            m_Condition.notify_one();
+        }
+
+    private:
+        struct PendingFrame_t
+        {
+            Rc<CVulkanTexture> pTexture;
+            uint64_t ulFrameId;
+            uint64_t ulVBlank;
+            std::string sFilePath;
+            std::string sShmName;
+        };
+
+        void SinkThreadFunc()
+        {
+            pthread_setname_np( pthread_self(), "gamescope-sink" );
+            // A consumer going away is not our problem. Only block SIGPIPE on
+            // this thread, writes then fail with EPIPE instead.
+            sigset_t pipeSet;
+            sigemptyset( &pipeSet );
+            sigaddset( &pipeSet, SIGPIPE );
+            pthread_sigmask( SIG_BLOCK, &pipeSet, nullptr );
+
+            for ( ;; )
+            {
+                std::optional<PendingFrame_t> oFrame;
+                {
+                    std::unique_lock lock( m_Mutex );
+                    m_Condition.wait( lock, [this]() { return !m_bRunning || m_oPending; } );
+                    if ( !m_bRunning )
+                        return;
+
+                    oFrame = std::exchange( m_oPending, std::nullopt );
+                }
+
+                Write( *oFrame );
+            }
+        }
+
+        void Write( const PendingFrame_t &frame )
+        {
+            CVulkanTexture *pTexture = frame.pTexture.get();
+
+            gamescope_headless_frame header =
+            {
+                .magic       = GAMESCOPE_HEADLESS_FRAME_MAGIC,
+                .header_size = sizeof( gamescope_headless_frame ),
+                .width       = pTexture->width(),
+                .height      = pTexture->height(),
+                .stride      = pTexture->width() * 4,
+                .drm_format  = pTexture->drmFormat(),
+                .frame_id    = frame.ulFrameId,
+                .vblank_ns   = frame.ulVBlank,
+            };
+
+            WriteToFile( frame.sFilePath, header, pTexture );
+            WriteToShm( frame.sShmName, header, pTexture );
+        }
+
+        void WriteToFile( const std::string &sPath, const gamescope_headless_frame &header, CVulkanTexture *pTexture )
+        {
+            if ( sPath != m_sFilePath )
+            {
+                CloseFile();
+                m_sFilePath = sPath;
+
+                if ( sPath.starts_with( "fd:" ) )
+                {
+                    m_nFileFD = atoi( sPath.c_str() + 3 );
+                    m_bOwnsFileFD = false;
+                }
+                else if ( !sPath.empty() )
+                {
+                    m_nFileFD = open( sPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+                    m_bOwnsFileFD = true;
+                    if ( m_nFileFD < 0 )
+                        headless_log.errorf_errno( "Failed to open sink file %s", sPath.c_str() );
+                }
+            }
+
+            if ( m_nFileFD < 0 )
+                return;
+
+            bool bOk = WriteAll( m_nFileFD, &header, sizeof( header ) );
+            for ( uint32_t y = 0; bOk && y < header.height; y++ )
+                bOk = WriteAll( m_nFileFD, pTexture->mappedData() + y * pTexture->rowPitch(), header.stride );
+
+            if ( !bOk )
+            {
+                headless_log.errorf_errno( "Failed to write to sink file %s, closing it", m_sFilePath.c_str() );
+                CloseFile();
+            }
+        }
+
+        void WriteToShm( const std::string &sName, const gamescope_headless_frame &header, CVulkanTexture *pTexture )
+        {
+            const uint32_t uSlotSize = sizeof( gamescope_headless_frame ) + header.stride * header.height;
+            if ( sName != m_sShmName || uSlotSize != m_uShmSlotSize )
+            {
+                if ( sName != m_sShmName )
+                {
+                    CloseShm();
+                    m_sShmName = sName;
+                    if ( !sName.empty() )
+                    {
+                        m_nShmFD = shm_open( sName.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600 );
+                        if ( m_nShmFD < 0 )
+                            headless_log.errorf_errno( "Failed to open sink shm %s", sName.c_str() );
+                    }
+                }
+
+                if ( m_nShmFD < 0 || !ResizeShm( uSlotSize ) )
+                    return;
+            }
+
+            if ( !m_pShmRing )
+                return;
+
+            uint8_t *pSlot = reinterpret_cast<uint8_t *>( m_pShmRing ) + m_pShmRing->slots_offset + ( header.frame_id % k_uHeadlessShmSlots ) * uSlotSize;
+            gamescope_headless_frame *pSlotHeader = reinterpret_cast<gamescope_headless_frame *>( pSlot );
+
+            std::atomic_ref<uint64_t>( pSlotHeader->frame_id ).store( 0, std::memory_order_release );
+            std::atomic_thread_fence( std::memory_order_release );
+
+            gamescope_headless_frame slotHeader = header;
+            slotHeader.frame_id = 0;
+            memcpy( pSlot, &slotHeader, sizeof( slotHeader ) );
+            for ( uint32_t y = 0; y < header.height; y++ )
+                memcpy( pSlot + sizeof( gamescope_headless_frame ) + y * header.stride, pTexture->mappedData() + y * pTexture->rowPitch(), header.stride );
+
+            std::atomic_ref<uint64_t>( pSlotHeader->frame_id ).store( header.frame_id, std::memory_order_release );
+            std::atomic_ref<uint64_t>( m_pShmRing->latest_frame ).store( header.frame_id, std::memory_order_release );
+        }
+
+        bool ResizeShm( uint32_t uSlotSize )
+        {
+            if ( m_pShmRing )
+            {
+                munmap( m_pShmRing, m_ulShmSize );
+                m_pShmRing = nullptr;
+            }
+
+            const uint32_t uSlotsOffset = 64;
+            const size_t ulSize = uSlotsOffset + size_t( uSlotSize ) * k_uHeadlessShmSlots;
+            if ( ftruncate( m_nShmFD, ulSize ) != 0 )
+            {
+                headless_log.errorf_errno( "Failed to resize sink shm %s", m_sShmName.c_str() );
+                return false;
+            }
+
+            void *pData = mmap( nullptr, ulSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_nShmFD, 0 );
+            if ( pData == MAP_FAILED )
+            {
+                headless_log.errorf_errno( "Failed to map sink shm %s", m_sShmName.c_str() );
+                return false;
+            }
+
+            memset( pData, 0, ulSize );
+
+            m_pShmRing = reinterpret_cast<gamescope_headless_shm_ring *>( pData );
+            m_pShmRing->magic = GAMESCOPE_HEADLESS_SHM_RING_MAGIC;
+            m_pShmRing->version = GAMESCOPE_HEADLESS_SHM_RING_VERSION;
+            m_pShmRing->slot_count = k_uHeadlessShmSlots;
+            m_pShmRing->slot_size = uSlotSize;
+            m_pShmRing->slots_offset = uSlotsOffset;
+            m_ulShmSize = ulSize;
+            m_uShmSlotSize = uSlotSize;
+            return true;
+        }
+
+        static bool WriteAll( int nFD, const void *pData, size_t ulSize )
+        {
+            const uint8_t *pBytes = reinterpret_cast<const uint8_t *>( pData );
+            while ( ulSize )
+            {
+                ssize_t nWritten = write( nFD, pBytes, ulSize );
+                if ( nWritten < 0 )
+                {
+                    if ( errno == EINTR )
+                        continue;
+
+                    // Don't leave the SIGPIPE pending on this thread.
+                    if ( errno == EPIPE )
+                    {
+                        sigset_t pipeSet;
+                        sigemptyset( &pipeSet );
+                        sigaddset( &pipeSet, SIGPIPE );
+                        const timespec zero = {};
+                        sigtimedwait( &pipeSet, nullptr, &zero );
+                        errno = EPIPE;
+                    }
+                    return false;
+                }
+
+                pBytes += nWritten;
+                ulSize -= nWritten;
+            }
+            return true;
+        }
+
+        void CloseFile()
+        {
+            if ( m_nFileFD >= 0 && m_bOwnsFileFD )
+                close( m_nFileFD );
+            m_nFileFD = -1;
+        }
+
+        void CloseShm()
+        {
+            if ( m_pShmRing )
+                munmap( m_pShmRing, m_ulShmSize );
+            m_pShmRing = nullptr;
+            m_uShmSlotSize = 0;
+
+            if ( m_nShmFD >= 0 )
+            {
+                close( m_nShmFD );
+                shm_unlink( m_sShmName.c_str() );
+            }
+            m_nShmFD = -1;
+        }
+
+        std::thread m_Thread;
+        std::mutex m_Mutex;
+        std::condition_variable m_Condition;
+        bool m_bRunning = true;
+        std::optional<PendingFrame_t> m_oPending;
+
+        // Only touched by the sink thread.
+        std::string m_sFilePath;
+        int m_nFileFD = -1;
+        bool m_bOwnsFileFD = false;
+
+        std::string m_sShmName;
+        int m_nShmFD = -1;
+        gamescope_headless_shm_ring *m_pShmRing = nullptr;
+        size_t m_ulShmSize = 0;
+        uint32_t m_uShmSlotSize = 0;
+    };
+
     class CHeadlessConnector final : public IBackendConnector
     {
     public:
@@ -159,7 +479,39 @@ namespace gamescope
 
 		virtual int Present( const FrameInfo_t *pFrameInfo, bool bAsync ) override
 		{
-            return 0;
+			const bool bSink = CHeadlessFrameSink::IsEnabled();
+			if ( !bSink && !cv_headless_composite )
+				return 0;
+
+			Rc<CVulkanTexture> pOutputImage = AcquireOutputImage();
+			if ( !pOutputImage )
+				return -ENOMEM;
+
+			// The composite may swap in layer textures, eg. for ReShade.
+			FrameInfo_t compositeFrameInfo = *pFrameInfo;
+			std::optional oCompositeResult = vulkan_composite( &compositeFrameInfo, nullptr, false, pOutputImage, false );
+			if ( !oCompositeResult )
+				return -EINVAL;
+
+			m_PresentFeedback.m_uQueuedPresents++;
+
+			vulkan_wait( *oCompositeResult, true );
+
+			GetVBlankTimer().UpdateWasCompositing( true );
+			GetVBlankTimer().UpdateLastDrawTime( get_time_in_nanos() - g_SteamCompMgrVBlankTime.ulWakeupTime );
+
+			// Nothing scans out, so the frame is out as soon as it's done.
+			// Stamp it with the virtual vblank it was made for.
+			if ( bSink )
+			{
+				if ( !m_pSink )
+					m_pSink = std::make_unique<CHeadlessFrameSink>();
+				m_pSink->Queue( pOutputImage, ++m_ulFrameId, g_SteamCompMgrVBlankTime.schedule.ulTargetVBlank );
+			}
+
+			m_PresentFeedback.m_uCompletedPresents++;
+
+			return 0;
 		}
 
 		virtual void DirtyState( bool bForce, bool bForceModeset ) override
@@ -168,7 +520,18 @@ namespace gamescope
 
 		virtual bool PollState() override
 		{
-			return false;
+			// The vblank timer ticks at the output refresh, that's our virtual vblank.
+			if ( cv_headless_refresh <= 0 )
+				return false;
+
+			const int32_t nRefresh = ConvertHztomHz( int32_t( cv_headless_refresh ) );
+			if ( nRefresh == g_nOutputRefresh )
+				return false;
+
+			headless_log.infof( "Virtual vblank at %dHz", int( cv_headless_refresh ) );
+			g_nOutputRefresh = nRefresh;
+			g_nNestedRefresh = nRefresh;
+			return true;
 		}
 
 		virtual std::shared_ptr<BackendBlob> CreateBackendBlob( const std::type_info &type, std::span<const uint8_t> data ) override
@@ -259,7 +622,43 @@ namespace gamescope
 
 	private:
 
+		// An image is free once neither the composite nor the sink holds a reference.
+		Rc<CVulkanTexture> AcquireOutputImage()
+		{
+			for ( OwningRc<CVulkanTexture> &pImage : m_pOutputImages )
+			{
+				if ( pImage && pImage->GetRefCount() != 0 )
+					continue;
+
+				if ( !pImage || pImage->width() != uint32_t( g_nOutputWidth ) || pImage->height() != uint32_t( g_nOutputHeight ) )
+				{
+					CVulkanTexture::createFlags outputImageFlags;
+					outputImageFlags.bMappable = true;
+					outputImageFlags.bStorage = true;
+					outputImageFlags.bTransferDst = true;
+
+					pImage = new CVulkanTexture();
+					if ( !pImage->BInit( g_nOutputWidth, g_nOutputHeight, 1u, DRM_FORMAT_XRGB8888, outputImageFlags ) )
+					{
+						headless_log.errorf( "Failed to allocate output image" );
+						pImage = nullptr;
+						return nullptr;
+					}
+				}
+
+				return pImage.get();
+			}
+
+			headless_log.errorf( "Out of output images" );
+			return nullptr;
+		}
+
         CHeadlessConnector m_Connector;
+
+		// Composite, the frame queued for the sink and the one it's writing.
+		std::array<OwningRc<CVulkanTexture>, 3> m_pOutputImages;
+		std::unique_ptr<CHeadlessFrameSink> m_pSink;
+		uint64_t m_ulFrameId = 0;
 	};
 
 	/////////////////////////
@@ -0,0 +1,131 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstdio>
+#include <climits>
+
+#include <filesystem>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "Cache.h"
+#include "Defer.h"
+#include "../log.hpp"
+
+std::string_view GetHomeDir();
+
+namespace gamescope
+{
+    static LogScope s_CacheLog{ "cache" };
+
+    std::string_view GetCacheDir()
+    {
+        static std::string s_sCacheDir = []() -> std::string
+        {
+            const char *pszCacheHome = getenv( "XDG_CACHE_HOME" );
+            if ( pszCacheHome && *pszCacheHome )
+                return std::string{ pszCacheHome } + "/gamescope";
+
+            return std::string{ GetHomeDir() } + "/.cache/gamescope";
+        }();
+
+        return s_sCacheDir;
+    }
+
+    static std::string GetCachePath( std::string_view svRelativePath )
+    {
+        std::string sPath{ GetCacheDir() };
+        sPath += "/";
+        sPath += svRelativePath;
+        return sPath;
+    }
+
+    bool ReadCacheFile( std::string_view svRelativePath, std::vector<uint8_t> &outData )
+    {
+        std::string sPath = GetCachePath( svRelativePath );
+
+        int nFd = open( sPath.c_str(), O_RDONLY | O_CLOEXEC );
+        if ( nFd < 0 )
+            return false;
+        defer( close( nFd ) );
+
+        struct stat fileStat;
+        if ( fstat( nFd, &fileStat ) != 0 )
+            return false;
+
+        outData.resize( fileStat.st_size );
+
+        size_t uOffset = 0;
+        while ( uOffset < outData.size() )
+        {
+            ssize_t nRead = read( nFd, outData.data() + uOffset, outData.size() - uOffset );
+            if ( nRead < 0 && errno == EINTR )
+                continue;
+            if ( nRead <= 0 )
+            {
+                s_CacheLog.errorf_errno( "Failed to read %s", sPath.c_str() );
+                outData.clear();
+                return false;
+            }
+            uOffset += nRead;
+        }
+
+        return true;
+    }
+
+    bool WriteCacheFile( std::string_view svRelativePath, std::span<const uint8_t> data )
+    {
+        std::filesystem::path path = GetCachePath( svRelativePath );
+
+        std::error_code ec;
+        std::filesystem::create_directories( path.parent_path(), ec );
+        if ( ec )
+        {
+            s_CacheLog.errorf( "Failed to create cache directory %s: %s", path.parent_path().c_str(), ec.message().c_str() );
+            return false;
+        }
+
+        char szTempPath[ PATH_MAX ];
+        snprintf( szTempPath, sizeof( szTempPath ), "%s.XXXXXX", path.c_str() );
+
+        int nFd = mkostemp( szTempPath, O_CLOEXEC );
+        if ( nFd < 0 )
+        {
+            s_CacheLog.errorf_errno( "Failed to create %s", szTempPath );
+            return false;
+        }
+
+        size_t uOffset = 0;
+        while ( uOffset < data.size() )
+        {
+            ssize_t nWritten = write( nFd, data.data() + uOffset, data.size() - uOffset );
+            if ( nWritten < 0 && errno == EINTR )
+                continue;
+            if ( nWritten <= 0 )
+            {
+                s_CacheLog.errorf_errno( "Failed to write %s", szTempPath );
+                close( nFd );
+                unlink( szTempPath );
+                return false;
+            }
+            uOffset += nWritten;
+        }
+        close( nFd );
+
+        if ( rename( szTempPath, path.c_str() ) != 0 )
+        {
+            s_CacheLog.errorf_errno( "Failed to rename %s to %s", szTempPath, path.c_str() );
+            unlink( szTempPath );
+            return false;
+        }
+
+        return true;
+    }
+
+    bool RemoveCacheFile( std::string_view svRelativePath )
+    {
+        std::string sPath = GetCachePath( svRelativePath );
+        return unlink( sPath.c_str() ) == 0;
+    }
+}
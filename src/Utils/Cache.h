@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace gamescope
+{
+    // $XDG_CACHE_HOME/gamescope, or ~/.cache/gamescope.
+    std::string_view GetCacheDir();
+
+    // Reads/writes a file relative to the cache dir, eg. "pipelines/xxxx.bin".
+    // Writes go through a temporary file + rename so a crash or a
+    // second instance never observes a partially written file.
+    bool ReadCacheFile( std::string_view svRelativePath, std::vector<uint8_t> &outData );
+    bool WriteCacheFile( std::string_view svRelativePath, std::span<const uint8_t> data );
+    bool RemoveCacheFile( std::string_view svRelativePath );
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+namespace gamescope
+{
+    // Stable (across runs, builds and machines) 64-bit FNV-1a.
+    // Use this for anything that ends up on disk, std::hash is not guaranteed to be stable.
+    static constexpr uint64_t k_ulFnv1aOffsetBasis = 0xcbf29ce484222325ull;
+    static constexpr uint64_t k_ulFnv1aPrime = 0x100000001b3ull;
+
+    inline uint64_t HashFnv1a( const void *pData, size_t uSize, uint64_t ulHash = k_ulFnv1aOffsetBasis )
+    {
+        const uint8_t *pBytes = reinterpret_cast<const uint8_t *>( pData );
+        for ( size_t i = 0; i < uSize; i++ )
+        {
+            ulHash ^= pBytes[i];
+            ulHash *= k_ulFnv1aPrime;
+        }
+        return ulHash;
+    }
+
+    inline uint64_t HashFnv1a( std::string_view svData, uint64_t ulHash = k_ulFnv1aOffsetBasis )
+    {
+        return HashFnv1a( svData.data(), svData.size(), ulHash );
+    }
+
+    template <typename T>
+    inline uint64_t HashFnv1a( std::span<const T> data, uint64_t ulHash = k_ulFnv1aOffsetBasis )
+    {
+        return HashFnv1a( data.data(), data.size_bytes(), ulHash );
+    }
+
+    template <typename T>
+    inline uint64_t HashFnv1aValue( const T &value, uint64_t ulHash = k_ulFnv1aOffsetBasis )
+    {
+        return HashFnv1a( &value, sizeof( value ), ulHash );
+    }
+}
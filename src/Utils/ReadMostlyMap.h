@@ -0,0 +1,163 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace gamescope
+{
+    // Insert-only, open-addressed hash map for small caches that are read
+    // on every frame and written rarely (pipelines, samplers, ...).
+    //
+    // Lookups never lock: a slot's key/value are written once before its
+    // ready flag is published with release semantics, and are never touched
+    // again. Writers are serialized by a mutex. When the table needs to grow,
+    // a new table is built and its pointer published; the old ones are kept
+    // alive until the map is destroyed, as readers may still be walking them.
+    // Entries can not be removed, so no reader can ever see a torn entry.
+    template <typename TKey, typename TValue, typename THash = std::hash<TKey>>
+    class CReadMostlyMap
+    {
+    public:
+        CReadMostlyMap( uint32_t uInitialCapacity = 64 )
+        {
+            uint32_t uCapacity = 8;
+            while ( uCapacity < uInitialCapacity )
+                uCapacity <<= 1;
+
+            m_Tables.emplace_back( std::make_unique<Table_t>( uCapacity ) );
+            m_pTable.store( m_Tables.back().get(), std::memory_order_release );
+        }
+
+        CReadMostlyMap( const CReadMostlyMap & ) = delete;
+        CReadMostlyMap &operator=( const CReadMostlyMap & ) = delete;
+
+        std::optional<TValue> Find( const TKey &key ) const
+        {
+            const Table_t *pTable = m_pTable.load( std::memory_order_acquire );
+
+            for ( uint32_t i = 0, uIdx = Hash( key ) & pTable->uMask; i <= pTable->uMask; i++, uIdx = ( uIdx + 1 ) & pTable->uMask )
+            {
+                const Slot_t &slot = pTable->pSlots[ uIdx ];
+                if ( !slot.bReady.load( std::memory_order_acquire ) )
+                    return std::nullopt;
+
+                if ( slot.key == key )
+                    return slot.value;
+            }
+
+            return std::nullopt;
+        }
+
+        bool Contains( const TKey &key ) const
+        {
+            return Find( key ).has_value();
+        }
+
+        // Returns the value in the map for key and whether it was inserted.
+        // If the key was already present, value is left untouched, so the
+        // caller can clean it up.
+        std::pair<TValue, bool> Insert( const TKey &key, const TValue &value )
+        {
+            std::unique_lock lock( m_WriteMutex );
+
+            Table_t *pTable = m_pTable.load( std::memory_order_relaxed );
+            if ( std::optional<TValue> oExisting = Find( key ) )
+                return std::make_pair( *oExisting, false );
+
+            // Keep the load factor under 3/4 so probe chains stay short.
+            if ( ( m_uCount + 1 ) * 4 > ( pTable->uMask + 1 ) * 3 )
+                pTable = Grow( pTable );
+
+            InsertInto( pTable, key, value );
+            m_uCount++;
+
+            return std::make_pair( value, true );
+        }
+
+        // Visits every published entry. Entries inserted concurrently may or may not be seen.
+        template <typename TFunc>
+        void ForEach( TFunc func ) const
+        {
+            const Table_t *pTable = m_pTable.load( std::memory_order_acquire );
+            for ( uint32_t i = 0; i <= pTable->uMask; i++ )
+            {
+                const Slot_t &slot = pTable->pSlots[ i ];
+                if ( slot.bReady.load( std::memory_order_acquire ) )
+                    func( slot.key, slot.value );
+            }
+        }
+
+        uint32_t Size() const
+        {
+            std::unique_lock lock( m_WriteMutex );
+            return m_uCount;
+        }
+
+    private:
+        struct Slot_t
+        {
+            std::atomic<bool> bReady = false;
+            TKey key{};
+            TValue value{};
+        };
+
+        struct Table_t
+        {
+            Table_t( uint32_t uCapacity )
+                : uMask{ uCapacity - 1 }
+                , pSlots{ std::make_unique<Slot_t[]>( uCapacity ) }
+            {
+            }
+
+            uint32_t uMask;
+            std::unique_ptr<Slot_t[]> pSlots;
+        };
+
+        static uint32_t Hash( const TKey &key )
+        {
+            // Some of our hashes are tiny (eg. SamplerState is 0..3), spread them out.
+            uint64_t ulHash = static_cast<uint64_t>( THash{}( key ) ) * 0x9e3779b97f4a7c15ull;
+            return static_cast<uint32_t>( ulHash >> 32 );
+        }
+
+        static void InsertInto( Table_t *pTable, const TKey &key, const TValue &value )
+        {
+            uint32_t uIdx = Hash( key ) & pTable->uMask;
+            while ( pTable->pSlots[ uIdx ].bReady.load( std::memory_order_relaxed ) )
+                uIdx = ( uIdx + 1 ) & pTable->uMask;
+
+            Slot_t &slot = pTable->pSlots[ uIdx ];
+            slot.key = key;
+            slot.value = value;
+            slot.bReady.store( true, std::memory_order_release );
+        }
+
+        Table_t *Grow( Table_t *pOldTable )
+        {
+            auto pNewTable = std::make_unique<Table_t>( ( pOldTable->uMask + 1 ) * 2 );
+            for ( uint32_t i = 0; i <= pOldTable->uMask; i++ )
+            {
+                const Slot_t &slot = pOldTable->pSlots[ i ];
+                if ( slot.bReady.load( std::memory_order_relaxed ) )
+                    InsertInto( pNewTable.get(), slot.key, slot.value );
+            }
+
+            Table_t *pTable = pNewTable.get();
+            m_Tables.emplace_back( std::move( pNewTable ) );
+            m_pTable.store( pTable, std::memory_order_release );
+            return pTable;
+        }
+
+        std::atomic<Table_t *> m_pTable = nullptr;
+        // All tables ever published, for readers still walking an old one.
+        std::vector<std::unique_ptr<Table_t>> m_Tables;
+        uint32_t m_uCount = 0;
+        mutable std::mutex m_WriteMutex;
+    };
+}
@@ -164,6 +164,7 @@ namespace gamescope
         console_log.infof( "VRR Active: %s", this->IsVRRActive() ? "true" : "false" );
         console_log.infof( "Supports Plane Hardware Cursor: %s (not relevant for nested backends)", this->SupportsPlaneHardwareCursor() ? "true" : "false" );
         console_log.infof( "Supports Tearing: %s", this->SupportsTearing() ? "true" : "false" );
+        console_log.infof( "Supports Tearing While Compositing: %s", this->SupportsTearingWhileCompositing() ? "true" : "false" );
         console_log.infof( "Uses Vulkan Swapchain: %s", this->UsesVulkanSwapchain() ? "true" : "false" );
         console_log.infof( "Is Session Based: %s", this->IsSessionBased() ? "true" : "false" );
         console_log.infof( "Supports Explicit Sync: %s", this->SupportsExplicitSync() ? "true" : "false" );
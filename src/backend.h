@@ -219,6 +219,9 @@ namespace gamescope
 
         virtual bool SupportsPlaneHardwareCursor() const = 0;
         virtual bool SupportsTearing() const = 0;
+        // Whether a flip can be queued before composition is done, with the
+        // display waiting on it instead of us, so tearing is fine while compositing.
+        virtual bool SupportsTearingWhileCompositing() const = 0;
 
         virtual bool UsesVulkanSwapchain() const = 0;
         virtual bool IsSessionBased() const = 0;
@@ -274,6 +277,8 @@ namespace gamescope
         virtual bool HackTemporarySetDynamicRefresh( int nRefresh ) override { return false; }
         virtual void HackUpdatePatchedEdid() override {}
 
+        virtual bool SupportsTearingWhileCompositing() const override { return false; }
+
         virtual bool NeedsFrameSync() const override;
         virtual VBlankScheduleTime FrameSync() override;
 
@@ -71,6 +71,23 @@ static void BenchmarkCalcColorTransforms_PQ(benchmark::State &state)
 }
 BENCHMARK(BenchmarkCalcColorTransforms_PQ);
 
+// Same work as above, with a fixed LUT generation thread count (1 is the old serial path).
+static void BenchmarkCalcColorTransforms_G22_Threads(benchmark::State &state)
+{
+    g_uColorTransformThreads = state.range(0);
+    BenchmarkCalcColorTransform(EOTF_Gamma22, state);
+    g_uColorTransformThreads = 0;
+}
+BENCHMARK(BenchmarkCalcColorTransforms_G22_Threads)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime();
+
+static void BenchmarkCalcColorTransforms_PQ_Threads(benchmark::State &state)
+{
+    g_uColorTransformThreads = state.range(0);
+    BenchmarkCalcColorTransform(EOTF_PQ, state);
+    g_uColorTransformThreads = 0;
+}
+BENCHMARK(BenchmarkCalcColorTransforms_PQ_Threads)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime();
+
 static void BenchmarkCalcColorTransforms(benchmark::State &state)
 {
     for ( uint32_t nInputEOTF = 0; nInputEOTF < EOTF_Count; nInputEOTF++ )
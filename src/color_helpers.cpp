@@ -2,10 +2,13 @@
 #include "color_helpers_impl.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <cmath>
 #include <fstream>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
@@ -670,6 +673,43 @@ inline T applyShaper( const T & input, EOTF source, EOTF dest, const tonemapping
 
 bool g_bHuePreservationWhenClipping = false;
 
+uint32_t g_uColorTransformThreads = 0;
+
+// Runs func( nSlice ) for every slice, spread over a few short-lived workers
+// that pull slices off a shared counter. Every slice is computed exactly as it
+// would be serially, so the results are bit-identical whatever the thread count.
+template <typename Func>
+static void ParallelForSlices( int32_t nSlices, const Func & func )
+{
+    uint32_t uThreads = g_uColorTransformThreads ? g_uColorTransformThreads : std::thread::hardware_concurrency();
+    uThreads = std::clamp<uint32_t>( uThreads, 1u, std::min<uint32_t>( nSlices, 8u ) );
+
+    if ( uThreads == 1 )
+    {
+        for ( int32_t nSlice = 0; nSlice < nSlices; ++nSlice )
+            func( nSlice );
+        return;
+    }
+
+    std::atomic<int32_t> nNextSlice = { 0 };
+    auto worker = [&]()
+    {
+        for ( int32_t nSlice; ( nSlice = nNextSlice.fetch_add( 1, std::memory_order_relaxed ) ) < nSlices; )
+            func( nSlice );
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve( uThreads - 1 );
+    for ( uint32_t i = 0; i < uThreads - 1; ++i )
+        threads.emplace_back( worker );
+
+    // The calling thread takes slices too.
+    worker();
+
+    for ( auto & thread : threads )
+        thread.join();
+}
+
 template <uint32_t lutEdgeSize3d>
 void calcColorTransform( lut1d_t * pShaper, int nLutSize1d,
 	lut3d_t * pLut3d,
@@ -753,8 +793,12 @@ void calcColorTransform( lut1d_t * pShaper, int nLutSize1d,
         }
 
         pLut3d->resize( nLutEdgeSize3d );
-    
-        for ( int nBlue=0; nBlue<nLutEdgeSize3d; ++nBlue )
+
+        const bool bApplyLook = pLook && !pLook->data.empty();
+        const bool bHuePreservationWhenClipping = g_bHuePreservationWhenClipping;
+
+        // Each blue slice is independent, and writes a disjoint part of the LUT.
+        ParallelForSlices( nLutEdgeSize3d, [&]( int nBlue )
         {
             for ( int nGreen=0; nGreen<nLutEdgeSize3d; ++nGreen )
             {
@@ -762,7 +806,7 @@ void calcColorTransform( lut1d_t * pShaper, int nLutSize1d,
                 {
                     glm::vec3 sourceColorEOTFEncoded = glm::vec3( vSourceColorEOTFEncodedEdge[nRed].r, vSourceColorEOTFEncodedEdge[nGreen].g, vSourceColorEOTFEncodedEdge[nBlue].b );
 
-                    if ( pLook && !pLook->data.empty() )
+                    if ( bApplyLook )
                     {
                         sourceColorEOTFEncoded = ApplyLut3D_Tetrahedral( *pLook, sourceColorEOTFEncoded );
                     }
@@ -790,7 +834,7 @@ void calcColorTransform( lut1d_t * pShaper, int nLutSize1d,
                     destColorLinear = tonemapping.apply( destColorLinear );
 
                     // Hue preservation
-                    if ( g_bHuePreservationWhenClipping )
+                    if ( bHuePreservationWhenClipping )
                     {
                         float flMax = std::max( std::max( destColorLinear.r, destColorLinear.g ), destColorLinear.b );
                         // TODO: Don't use g22_luminance here or in tonemapping, use whatever maxContentLightLevel is for the connector.
@@ -808,7 +852,7 @@ void calcColorTransform( lut1d_t * pShaper, int nLutSize1d,
                     pLut3d->data[GetLut3DIndexRedFastRGB( nRed, nGreen, nBlue, nLutEdgeSize3d )] = destColorEOTFEncoded;
                 }
             }
-        }
+        } );
     }
 }
 
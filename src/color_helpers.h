@@ -362,6 +362,10 @@ bool LoadCubeLut( lut3d_t * lut3d, const char * filename );
 //
 // If the white points differ, this performs an absolute colorimetric match
 // Look luts are optional, but if specified applied in the sourceEOTF space
+//
+// The 3d lut is filled by up to g_uColorTransformThreads threads (0: one per core, max 8),
+// one blue slice at a time. The result does not depend on the thread count.
+extern uint32_t g_uColorTransformThreads;
 
 template <uint32_t lutEdgeSize3d>
 void calcColorTransform( lut1d_t * pShaper, int nLutSize1d,
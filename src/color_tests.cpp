@@ -1,5 +1,7 @@
 #include "color_helpers.h"
+#include "color_helpers_impl.h"
 #include <cstdio>
+#include <cstring>
 
 //#include <glm/ext.hpp>
 #include <glm/gtx/string_cast.hpp>
@@ -230,10 +232,72 @@ void test_eetf2390_mono()
     }
 }
 
+// The threaded 3D LUT generation must match the serial path bit for bit.
+bool test_calc_color_transform_threads()
+{
+    printf("%s\n", __func__ );
+
+    using ns_color_tests::nLutEdgeSize3d;
+    const int nLutSize1d = 4096;
+
+    const primaries_t primaries = { { 0.602f, 0.355f }, { 0.340f, 0.574f }, { 0.164f, 0.121f } };
+    const glm::vec2 white = { 0.3070f, 0.3220f };
+    const glm::vec2 destVirtualWhite = { 0.f, 0.f };
+
+    displaycolorimetry_t inputColorimetry{};
+    inputColorimetry.primaries = primaries;
+    inputColorimetry.white = white;
+
+    displaycolorimetry_t outputEncodingColorimetry{};
+    outputEncodingColorimetry.primaries = primaries;
+    outputEncodingColorimetry.white = white;
+
+    colormapping_t colorMapping{};
+
+    tonemapping_t tonemapping{};
+    tonemapping.bUseShaper = true;
+
+    nightmode_t nightmode{};
+    nightmode.amount = 0.5f;
+    nightmode.hue = 0.08f;
+    nightmode.saturation = 1.0f;
+    float flGain = 1.0f;
+
+    bool bSuccess = true;
+    for ( uint32_t nInputEOTF = 0; nInputEOTF < EOTF_Count; nInputEOTF++ )
+    {
+        lut1d_t serialShaper, threadedShaper;
+        lut3d_t serialLut, threadedLut;
+
+        g_uColorTransformThreads = 1;
+        calcColorTransform<nLutEdgeSize3d>( &serialShaper, nLutSize1d, &serialLut, inputColorimetry, (EOTF)nInputEOTF,
+            outputEncodingColorimetry, EOTF_Gamma22,
+            destVirtualWhite, k_EChromaticAdapatationMethod_XYZ,
+            colorMapping, nightmode, tonemapping, nullptr, flGain );
+
+        g_uColorTransformThreads = 8;
+        calcColorTransform<nLutEdgeSize3d>( &threadedShaper, nLutSize1d, &threadedLut, inputColorimetry, (EOTF)nInputEOTF,
+            outputEncodingColorimetry, EOTF_Gamma22,
+            destVirtualWhite, k_EChromaticAdapatationMethod_XYZ,
+            colorMapping, nightmode, tonemapping, nullptr, flGain );
+
+        g_uColorTransformThreads = 0;
+
+        bool bMatch = serialLut.data.size() == threadedLut.data.size() &&
+            memcmp( serialLut.data.data(), threadedLut.data.data(), serialLut.data.size() * sizeof( glm::vec3 ) ) == 0;
+        printf("input EOTF %u: %s\n", nInputEOTF, bMatch ? "match" : "MISMATCH" );
+        bSuccess &= bMatch;
+    }
+
+    return bSuccess;
+}
+
 int main(int argc, char* argv[])
 {
     printf("color_tests\n");
     // test_eetf2390_mono();
     color_tests();
+    if ( !test_calc_color_transform_threads() )
+        return 1;
     return 0;
 }
\ No newline at end of file
@@ -126,6 +126,18 @@ void commit_t::SetFence( int nFence, bool bMangoNudge, CommitDoneList_t *pDoneCo
     m_pDoneCommits = pDoneCommits;
 }
 
+void commit_t::AddUpscaledTexture( UpscaledTexture_t upscaled )
+{
+    // Drop what the new one replaces, and anything for an old output size or sharpness.
+    std::erase_if( upscaledTextures, [&]( const UpscaledTexture_t &existing )
+    {
+        return ( existing.eFilter == upscaled.eFilter && existing.eScaler == upscaled.eScaler ) ||
+            !existing.Matches( existing.eFilter, existing.eScaler );
+    });
+
+    upscaledTextures.emplace_back( std::move( upscaled ) );
+}
+
 void calc_scale_factor(float &out_scale_x, float &out_scale_y, float sourceWidth, float sourceHeight);
 
 bool commit_t::ShouldPreemptivelyUpscale()
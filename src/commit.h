@@ -2,6 +2,7 @@
 #include "Utils/NonCopyable.h"
 
 #include <optional>
+#include <vector>
 #include "main.hpp"
 
 class CVulkanTexture;
@@ -12,7 +13,19 @@ struct UpscaledTexture_t
 	GamescopeUpscaleScaler eScaler{};
 	uint32_t uOutputWidth = 0;
 	uint32_t uOutputHeight = 0;
+	int nSharpness = 0;
 	gamescope::Rc<CVulkanTexture> pTexture;
+	// What pTexture is encoded as, which is not necessarily the commit's colorspace.
+	GamescopeAppTextureColorspace eColorspace = GAMESCOPE_APP_TEXTURE_COLORSPACE_LINEAR;
+
+	bool Matches( GamescopeUpscaleFilter eOtherFilter, GamescopeUpscaleScaler eOtherScaler ) const
+	{
+		return eFilter == eOtherFilter &&
+			eScaler == eOtherScaler &&
+			uOutputWidth == g_nOutputWidth &&
+			uOutputHeight == g_nOutputHeight &&
+			nSharpness == g_upscaleFilterSharpness;
+	}
 };
 
 struct commit_t final : public gamescope::RcObject, public gamescope::IWaitable, public gamescope::NonCopyable
@@ -38,21 +51,43 @@ struct commit_t final : public gamescope::RcObject, public gamescope::IWaitable,
 
 	struct wlr_buffer *buf = nullptr;
 	gamescope::Rc<CVulkanTexture> vulkanTex;
-	std::optional<UpscaledTexture_t> upscaledTexture;
+	// Shader upscaled copies of vulkanTex, at most one per filter and scaler.
+	std::vector<UpscaledTexture_t> upscaledTextures;
 
 	gamescope::Rc<CVulkanTexture> GetTexture( GamescopeUpscaleFilter eFilter, GamescopeUpscaleScaler eScaler )
 	{
-		if ( upscaledTexture &&
-			 upscaledTexture->eFilter == eFilter &&
-			 upscaledTexture->eScaler == eScaler &&
-			 upscaledTexture->uOutputWidth == g_nOutputWidth &&
-			 upscaledTexture->uOutputHeight == g_nOutputHeight )
-			return upscaledTexture->pTexture;
+		for ( const UpscaledTexture_t &upscaled : upscaledTextures )
+		{
+			if ( upscaled.Matches( eFilter, eScaler ) )
+				return upscaled.pTexture;
+		}
 
 		return vulkanTex;
 	}
 
+	GamescopeAppTextureColorspace GetTextureColorspace( GamescopeUpscaleFilter eFilter, GamescopeUpscaleScaler eScaler ) const
+	{
+		for ( const UpscaledTexture_t &upscaled : upscaledTextures )
+		{
+			if ( upscaled.Matches( eFilter, eScaler ) )
+				return upscaled.eColorspace;
+		}
+
+		return colorspace();
+	}
+
+	bool HasUpscaledTexture( GamescopeUpscaleFilter eFilter, GamescopeUpscaleScaler eScaler )
+	{
+		return GetTexture( eFilter, eScaler ) != vulkanTex;
+	}
+
+	void AddUpscaledTexture( UpscaledTexture_t upscaled );
+
 	uint64_t commitID = 0;
+	// The commit this one directly followed on the same surface, 0 if
+	// unknown, and the extents of the buffer damage since then.
+	uint64_t ulPrevCommitID = 0;
+	Rect damage = {};
 	bool done = false;
 	bool async = false;
 	bool fifo = false;
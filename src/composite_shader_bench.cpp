@@ -0,0 +1,657 @@
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include <vulkan/vulkan.h>
+
+#include "shaders/descriptor_set_constants.h"
+
+#include "cs_composite_blit.h"
+#include "cs_composite_blit_fp16.h"
+#include "cs_composite_blur.h"
+#include "cs_composite_blur_fp16.h"
+#include "cs_composite_rcas.h"
+#include "cs_composite_rcas_fp16.h"
+
+// Times the fp32 composite shaders against their fp16 variants on a bare
+// Vulkan device, so it runs headless on any ICD, eg.
+//   VK_ICD_FILENAMES=/usr/share/vulkan/icd.d/lvp_icd.x86_64.json ./gamescope_composite_shader_microbench
+//
+// The descriptor set layout mirrors CVulkanDevice::createLayouts, every
+// sampler slot points at the same source image.
+
+static constexpr uint32_t k_unWidth = 1920;
+static constexpr uint32_t k_unHeight = 1080;
+static constexpr uint32_t k_unMaxLayers = VKR_MAX_LAYERS;
+
+#pragma pack(push, 1)
+// Same layout as blit_push_data.h.
+struct BenchBlitData_t
+{
+    float scale[k_unMaxLayers][2];
+    float offset[k_unMaxLayers][2];
+    float opacity[k_unMaxLayers];
+    float ctm[k_unMaxLayers][12];
+    uint32_t borderMask;
+    uint32_t frameId;
+    uint32_t blurRadius;
+    uint32_t shaderFilter;
+    float linearToNits;
+    float nitsToLinear;
+    float itmSdrNits;
+    float itmTargetNits;
+    uint32_t tileOffset[2];
+};
+
+// Same layout as rcas_push_data.h, without the fused upscaler constants.
+struct BenchRcasData_t
+{
+    uint32_t layer0Offset[2];
+    float scale[k_unMaxLayers - 1][2];
+    float offset[k_unMaxLayers - 1][2];
+    float opacity[k_unMaxLayers];
+    float ctm[k_unMaxLayers][12];
+    uint32_t borderMask;
+    uint32_t frameId;
+    uint32_t c1;
+    uint32_t shaderFilter;
+    float linearToNits;
+    float nitsToLinear;
+    float itmSdrNits;
+    float itmTargetNits;
+};
+#pragma pack(pop)
+
+#define BENCH_CHECK(expr) \
+    do { if ((expr) != VK_SUCCESS) { fprintf(stderr, "%s failed\n", #expr); return false; } } while (0)
+
+class CBenchDevice
+{
+public:
+    ~CBenchDevice()
+    {
+        if (!m_device)
+            return;
+
+        vkDeviceWaitIdle(m_device);
+        vkDestroyQueryPool(m_device, m_queryPool, nullptr);
+        vkDestroyCommandPool(m_device, m_commandPool, nullptr);
+        vkDestroyDescriptorPool(m_device, m_descriptorPool, nullptr);
+        vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
+        vkDestroyDescriptorSetLayout(m_device, m_descriptorSetLayout, nullptr);
+        vkDestroySampler(m_device, m_sampler, nullptr);
+        for (VkImageView view : m_views)
+            vkDestroyImageView(m_device, view, nullptr);
+        for (VkImage image : m_images)
+            vkDestroyImage(m_device, image, nullptr);
+        vkDestroyBuffer(m_device, m_uniformBuffer, nullptr);
+        for (VkDeviceMemory memory : m_memory)
+            vkFreeMemory(m_device, memory, nullptr);
+        vkDestroyDevice(m_device, nullptr);
+        vkDestroyInstance(m_instance, nullptr);
+    }
+
+    bool Init()
+    {
+        VkApplicationInfo appInfo = {
+            .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+            .pApplicationName = "gamescope_composite_shader_bench",
+            .apiVersion = VK_API_VERSION_1_2,
+        };
+        VkInstanceCreateInfo instanceInfo = {
+            .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+            .pApplicationInfo = &appInfo,
+        };
+        BENCH_CHECK(vkCreateInstance(&instanceInfo, nullptr, &m_instance));
+
+        uint32_t uPhysDevCount = 1;
+        if (vkEnumeratePhysicalDevices(m_instance, &uPhysDevCount, &m_physDev) < 0 || uPhysDevCount == 0)
+            return false;
+
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(m_physDev, &props);
+        m_flTimestampPeriod = props.limits.timestampPeriod;
+
+        uint32_t uQueueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(m_physDev, &uQueueFamilyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> queueFamilies(uQueueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(m_physDev, &uQueueFamilyCount, queueFamilies.data());
+        m_uQueueFamily = ~0u;
+        for (uint32_t i = 0; i < uQueueFamilyCount; i++)
+        {
+            if ((queueFamilies[i].queueFlags & VK_QUEUE_COMPUTE_BIT) && queueFamilies[i].timestampValidBits)
+            {
+                m_uQueueFamily = i;
+                break;
+            }
+        }
+        if (m_uQueueFamily == ~0u)
+            return false;
+
+        VkPhysicalDeviceVulkan12Features features12 = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        };
+        VkPhysicalDeviceVulkan11Features features11 = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES,
+            .pNext = &features12,
+        };
+        VkPhysicalDeviceFeatures2 features2 = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = &features11,
+        };
+        vkGetPhysicalDeviceFeatures2(m_physDev, &features2);
+
+        // Same requirement as m_bSupportsFp16 in rendervulkan.
+        m_bSupportsFp16 = features12.shaderFloat16 && features2.features.shaderInt16;
+
+        VkPhysicalDeviceVulkan12Features enabled12 = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+            .shaderFloat16 = m_bSupportsFp16,
+            .scalarBlockLayout = VK_TRUE,
+        };
+        VkPhysicalDeviceVulkan11Features enabled11 = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES,
+            .pNext = &enabled12,
+        };
+        VkPhysicalDeviceFeatures2 enabled2 = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = &enabled11,
+            .features = {
+                .shaderStorageImageWriteWithoutFormat = features2.features.shaderStorageImageWriteWithoutFormat,
+                .shaderInt16 = m_bSupportsFp16,
+            },
+        };
+
+        float flPriority = 1.0f;
+        VkDeviceQueueCreateInfo queueInfo = {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+            .queueFamilyIndex = m_uQueueFamily,
+            .queueCount = 1,
+            .pQueuePriorities = &flPriority,
+        };
+        VkDeviceCreateInfo deviceInfo = {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+            .pNext = &enabled2,
+            .queueCreateInfoCount = 1,
+            .pQueueCreateInfos = &queueInfo,
+        };
+        BENCH_CHECK(vkCreateDevice(m_physDev, &deviceInfo, nullptr, &m_device));
+        vkGetDeviceQueue(m_device, m_uQueueFamily, 0, &m_queue);
+
+        return CreateResources() && CreateLayouts();
+    }
+
+    bool SupportsFp16() const { return m_bSupportsFp16; }
+
+    VkPipeline CreatePipeline(const uint32_t *pCode, size_t uCodeSize, uint32_t uLayerCount, uint32_t uBlurLayerCount)
+    {
+        VkShaderModuleCreateInfo moduleInfo = {
+            .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+            .codeSize = uCodeSize,
+            .pCode = pCode,
+        };
+        VkShaderModule module = VK_NULL_HANDLE;
+        if (vkCreateShaderModule(m_device, &moduleInfo, nullptr, &module) != VK_SUCCESS)
+            return VK_NULL_HANDLE;
+
+        // Same ids as CVulkanDevice::compilePipeline, everything but the layer counts left at 0.
+        std::array<VkSpecializationMapEntry, 7> entries;
+        for (uint32_t i = 0; i < entries.size(); i++)
+            entries[i] = { .constantID = i, .offset = uint32_t(sizeof(uint32_t) * i), .size = sizeof(uint32_t) };
+        std::array<uint32_t, 7> data = { uLayerCount, 0, 0, uBlurLayerCount, 0, 0, 0 };
+
+        VkSpecializationInfo specializationInfo = {
+            .mapEntryCount = uint32_t(entries.size()),
+            .pMapEntries = entries.data(),
+            .dataSize = sizeof(data),
+            .pData = data.data(),
+        };
+        VkComputePipelineCreateInfo pipelineInfo = {
+            .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+            .stage = {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+                .module = module,
+                .pName = "main",
+                .pSpecializationInfo = &specializationInfo,
+            },
+            .layout = m_pipelineLayout,
+        };
+
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        vkCreateComputePipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline);
+        vkDestroyShaderModule(m_device, module, nullptr);
+        return pipeline;
+    }
+
+    void DestroyPipeline(VkPipeline pipeline)
+    {
+        vkDestroyPipeline(m_device, pipeline, nullptr);
+    }
+
+    void UploadUniforms(const void *pData, size_t uSize)
+    {
+        memcpy(m_pUniformData, pData, uSize);
+    }
+
+    // Returns the GPU time of the dispatch in seconds, or a negative value on failure.
+    double Dispatch(VkPipeline pipeline, uint32_t uGroupsX, uint32_t uGroupsY)
+    {
+        VkCommandBufferBeginInfo beginInfo = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        };
+        vkResetCommandPool(m_device, m_commandPool, 0);
+        vkBeginCommandBuffer(m_commandBuffer, &beginInfo);
+        vkCmdResetQueryPool(m_commandBuffer, m_queryPool, 0, 2);
+        vkCmdBindPipeline(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+        vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, 1, &m_descriptorSet, 0, nullptr);
+        vkCmdWriteTimestamp(m_commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_queryPool, 0);
+        vkCmdDispatch(m_commandBuffer, uGroupsX, uGroupsY, 1);
+        vkCmdWriteTimestamp(m_commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_queryPool, 1);
+        vkEndCommandBuffer(m_commandBuffer);
+
+        VkSubmitInfo submitInfo = {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &m_commandBuffer,
+        };
+        if (vkQueueSubmit(m_queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+            return -1.0;
+        vkQueueWaitIdle(m_queue);
+
+        uint64_t ulTimestamps[2] = {};
+        if (vkGetQueryPoolResults(m_device, m_queryPool, 0, 2, sizeof(ulTimestamps), ulTimestamps, sizeof(uint64_t),
+                                  VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT) != VK_SUCCESS)
+            return -1.0;
+
+        return double(ulTimestamps[1] - ulTimestamps[0]) * m_flTimestampPeriod * 1e-9;
+    }
+
+private:
+    bool AllocateMemory(const VkMemoryRequirements &reqs, VkMemoryPropertyFlags flags, VkDeviceMemory *pMemory)
+    {
+        VkPhysicalDeviceMemoryProperties memProps;
+        vkGetPhysicalDeviceMemoryProperties(m_physDev, &memProps);
+        for (uint32_t i = 0; i < memProps.memoryTypeCount; i++)
+        {
+            if ((reqs.memoryTypeBits & (1u << i)) && (memProps.memoryTypes[i].propertyFlags & flags) == flags)
+            {
+                VkMemoryAllocateInfo allocInfo = {
+                    .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+                    .allocationSize = reqs.size,
+                    .memoryTypeIndex = i,
+                };
+                if (vkAllocateMemory(m_device, &allocInfo, nullptr, pMemory) != VK_SUCCESS)
+                    return false;
+                m_memory.push_back(*pMemory);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    VkImageView CreateImage(VkImageType type, VkImageViewType viewType, VkExtent3D extent, VkImageUsageFlags usage)
+    {
+        VkImageCreateInfo imageInfo = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .imageType = type,
+            .format = VK_FORMAT_R8G8B8A8_UNORM,
+            .extent = extent,
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = usage,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        };
+        VkImage image = VK_NULL_HANDLE;
+        if (vkCreateImage(m_device, &imageInfo, nullptr, &image) != VK_SUCCESS)
+            return VK_NULL_HANDLE;
+        m_images.push_back(image);
+
+        VkMemoryRequirements reqs;
+        vkGetImageMemoryRequirements(m_device, image, &reqs);
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        if (!AllocateMemory(reqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &memory) ||
+            vkBindImageMemory(m_device, image, memory, 0) != VK_SUCCESS)
+            return VK_NULL_HANDLE;
+
+        VkImageViewCreateInfo viewInfo = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .image = image,
+            .viewType = viewType,
+            .format = VK_FORMAT_R8G8B8A8_UNORM,
+            .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+        };
+        VkImageView view = VK_NULL_HANDLE;
+        if (vkCreateImageView(m_device, &viewInfo, nullptr, &view) != VK_SUCCESS)
+            return VK_NULL_HANDLE;
+        m_views.push_back(view);
+        return view;
+    }
+
+    bool CreateResources()
+    {
+        m_srcView = CreateImage(VK_IMAGE_TYPE_2D, VK_IMAGE_VIEW_TYPE_2D, { k_unWidth, k_unHeight, 1 }, VK_IMAGE_USAGE_SAMPLED_BIT);
+        m_dstView = CreateImage(VK_IMAGE_TYPE_2D, VK_IMAGE_VIEW_TYPE_2D, { k_unWidth, k_unHeight, 1 }, VK_IMAGE_USAGE_STORAGE_BIT);
+        m_shaperView = CreateImage(VK_IMAGE_TYPE_1D, VK_IMAGE_VIEW_TYPE_1D, { 16, 1, 1 }, VK_IMAGE_USAGE_SAMPLED_BIT);
+        m_lut3DView = CreateImage(VK_IMAGE_TYPE_3D, VK_IMAGE_VIEW_TYPE_3D, { 4, 4, 4 }, VK_IMAGE_USAGE_SAMPLED_BIT);
+        if (!m_srcView || !m_dstView || !m_shaperView || !m_lut3DView)
+            return false;
+
+        VkBufferCreateInfo bufferInfo = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = 4096,
+            .usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        };
+        BENCH_CHECK(vkCreateBuffer(m_device, &bufferInfo, nullptr, &m_uniformBuffer));
+        VkMemoryRequirements reqs;
+        vkGetBufferMemoryRequirements(m_device, m_uniformBuffer, &reqs);
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        if (!AllocateMemory(reqs, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &memory))
+            return false;
+        BENCH_CHECK(vkBindBufferMemory(m_device, m_uniformBuffer, memory, 0));
+        BENCH_CHECK(vkMapMemory(m_device, memory, 0, VK_WHOLE_SIZE, 0, &m_pUniformData));
+
+        VkSamplerCreateInfo samplerInfo = {
+            .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+            .magFilter = VK_FILTER_LINEAR,
+            .minFilter = VK_FILTER_LINEAR,
+            .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+            .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+            .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        };
+        BENCH_CHECK(vkCreateSampler(m_device, &samplerInfo, nullptr, &m_sampler));
+
+        VkCommandPoolCreateInfo poolInfo = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .queueFamilyIndex = m_uQueueFamily,
+        };
+        BENCH_CHECK(vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_commandPool));
+        VkCommandBufferAllocateInfo cmdInfo = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = m_commandPool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+        };
+        BENCH_CHECK(vkAllocateCommandBuffers(m_device, &cmdInfo, &m_commandBuffer));
+
+        VkQueryPoolCreateInfo queryInfo = {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = 2,
+        };
+        BENCH_CHECK(vkCreateQueryPool(m_device, &queryInfo, nullptr, &m_queryPool));
+
+        // Move everything into the layouts the shaders expect once, up front.
+        VkCommandBufferBeginInfo beginInfo = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        };
+        vkBeginCommandBuffer(m_commandBuffer, &beginInfo);
+        std::vector<VkImageMemoryBarrier> barriers;
+        for (size_t i = 0; i < m_images.size(); i++)
+        {
+            barriers.push_back(VkImageMemoryBarrier{
+                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+                .newLayout = m_views[i] == m_dstView ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .image = m_images[i],
+                .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+            });
+        }
+        vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                             0, nullptr, 0, nullptr, uint32_t(barriers.size()), barriers.data());
+        vkEndCommandBuffer(m_commandBuffer);
+
+        VkSubmitInfo submitInfo = {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &m_commandBuffer,
+        };
+        BENCH_CHECK(vkQueueSubmit(m_queue, 1, &submitInfo, VK_NULL_HANDLE));
+        vkQueueWaitIdle(m_queue);
+        return true;
+    }
+
+    bool CreateLayouts()
+    {
+        const std::array<VkDescriptorSetLayoutBinding, 7> bindings = {{
+            { 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+            { 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+            { 2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+            { 3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VKR_SAMPLER_SLOTS, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+            // The real layout has immutable YCbCr samplers here, none of the benched inputs are YCbCr.
+            { 4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VKR_YCBCR_SAMPLER_SLOTS, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+            { 5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VKR_LUT3D_COUNT, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+            { 6, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VKR_LUT3D_COUNT, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+        }};
+        VkDescriptorSetLayoutCreateInfo setLayoutInfo = {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+            .bindingCount = uint32_t(bindings.size()),
+            .pBindings = bindings.data(),
+        };
+        BENCH_CHECK(vkCreateDescriptorSetLayout(m_device, &setLayoutInfo, nullptr, &m_descriptorSetLayout));
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+            .setLayoutCount = 1,
+            .pSetLayouts = &m_descriptorSetLayout,
+        };
+        BENCH_CHECK(vkCreatePipelineLayout(m_device, &pipelineLayoutInfo, nullptr, &m_pipelineLayout));
+
+        const std::array<VkDescriptorPoolSize, 3> poolSizes = {{
+            { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 },
+            { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 2 },
+            { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VKR_SAMPLER_SLOTS + VKR_YCBCR_SAMPLER_SLOTS + 2 * VKR_LUT3D_COUNT },
+        }};
+        VkDescriptorPoolCreateInfo poolInfo = {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+            .maxSets = 1,
+            .poolSizeCount = uint32_t(poolSizes.size()),
+            .pPoolSizes = poolSizes.data(),
+        };
+        BENCH_CHECK(vkCreateDescriptorPool(m_device, &poolInfo, nullptr, &m_descriptorPool));
+
+        VkDescriptorSetAllocateInfo allocInfo = {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            .descriptorPool = m_descriptorPool,
+            .descriptorSetCount = 1,
+            .pSetLayouts = &m_descriptorSetLayout,
+        };
+        BENCH_CHECK(vkAllocateDescriptorSets(m_device, &allocInfo, &m_descriptorSet));
+
+        VkDescriptorBufferInfo bufferInfo = { m_uniformBuffer, 0, VK_WHOLE_SIZE };
+        VkDescriptorImageInfo dstInfo = { VK_NULL_HANDLE, m_dstView, VK_IMAGE_LAYOUT_GENERAL };
+        std::array<VkDescriptorImageInfo, VKR_SAMPLER_SLOTS> srcInfos;
+        srcInfos.fill({ m_sampler, m_srcView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL });
+        std::array<VkDescriptorImageInfo, VKR_LUT3D_COUNT> shaperInfos;
+        shaperInfos.fill({ m_sampler, m_shaperView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL });
+        std::array<VkDescriptorImageInfo, VKR_LUT3D_COUNT> lut3DInfos;
+        lut3DInfos.fill({ m_sampler, m_lut3DView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL });
+
+        auto write = [&](uint32_t uBinding, VkDescriptorType type, uint32_t uCount, const VkDescriptorImageInfo *pImageInfo)
+        {
+            return VkWriteDescriptorSet{
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = m_descriptorSet,
+                .dstBinding = uBinding,
+                .descriptorCount = uCount,
+                .descriptorType = type,
+                .pImageInfo = pImageInfo,
+                .pBufferInfo = uBinding == 0 ? &bufferInfo : nullptr,
+            };
+        };
+        const std::array<VkWriteDescriptorSet, 7> writes = {{
+            write(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, nullptr),
+            write(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, &dstInfo),
+            write(2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, &dstInfo),
+            write(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VKR_SAMPLER_SLOTS, srcInfos.data()),
+            write(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VKR_YCBCR_SAMPLER_SLOTS, srcInfos.data()),
+            write(5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VKR_LUT3D_COUNT, shaperInfos.data()),
+            write(6, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VKR_LUT3D_COUNT, lut3DInfos.data()),
+        }};
+        vkUpdateDescriptorSets(m_device, uint32_t(writes.size()), writes.data(), 0, nullptr);
+        return true;
+    }
+
+    VkInstance m_instance = VK_NULL_HANDLE;
+    VkPhysicalDevice m_physDev = VK_NULL_HANDLE;
+    VkDevice m_device = VK_NULL_HANDLE;
+    VkQueue m_queue = VK_NULL_HANDLE;
+    uint32_t m_uQueueFamily = 0;
+    float m_flTimestampPeriod = 1.0f;
+    bool m_bSupportsFp16 = false;
+
+    std::vector<VkDeviceMemory> m_memory;
+    std::vector<VkImage> m_images;
+    std::vector<VkImageView> m_views;
+    VkImageView m_srcView = VK_NULL_HANDLE;
+    VkImageView m_dstView = VK_NULL_HANDLE;
+    VkImageView m_shaperView = VK_NULL_HANDLE;
+    VkImageView m_lut3DView = VK_NULL_HANDLE;
+    VkSampler m_sampler = VK_NULL_HANDLE;
+    VkBuffer m_uniformBuffer = VK_NULL_HANDLE;
+    void *m_pUniformData = nullptr;
+
+    VkDescriptorSetLayout m_descriptorSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
+    VkDescriptorPool m_descriptorPool = VK_NULL_HANDLE;
+    VkDescriptorSet m_descriptorSet = VK_NULL_HANDLE;
+
+    VkCommandPool m_commandPool = VK_NULL_HANDLE;
+    VkCommandBuffer m_commandBuffer = VK_NULL_HANDLE;
+    VkQueryPool m_queryPool = VK_NULL_HANDLE;
+};
+
+static CBenchDevice *GetBenchDevice()
+{
+    static CBenchDevice *s_pDevice = []() -> CBenchDevice *
+    {
+        CBenchDevice *pDevice = new CBenchDevice;
+        if (!pDevice->Init())
+        {
+            delete pDevice;
+            return nullptr;
+        }
+        return pDevice;
+    }();
+    return s_pDevice;
+}
+
+static void SetIdentityLayers(float (*ctm)[12], float *opacity, uint32_t uCount)
+{
+    for (uint32_t i = 0; i < uCount; i++)
+    {
+        memset(ctm[i], 0, sizeof(ctm[i]));
+        ctm[i][0] = ctm[i][5] = ctm[i][10] = 1.0f;
+        opacity[i] = 1.0f;
+    }
+}
+
+static void RunCompositeBenchmark(benchmark::State &state, const uint32_t *pCode, size_t uCodeSize, bool bHalf,
+                                  const void *pUniforms, size_t uUniformSize, uint32_t uBlurLayerCount, uint32_t uPixelsPerGroup)
+{
+    CBenchDevice *pDevice = GetBenchDevice();
+    if (!pDevice)
+    {
+        state.SkipWithError("No usable Vulkan device");
+        return;
+    }
+    if (bHalf && !pDevice->SupportsFp16())
+    {
+        state.SkipWithError("Device lacks shaderFloat16/shaderInt16");
+        return;
+    }
+
+    const uint32_t uLayerCount = uint32_t(state.range(0));
+    VkPipeline pipeline = pDevice->CreatePipeline(pCode, uCodeSize, uLayerCount, uBlurLayerCount);
+    if (!pipeline)
+    {
+        state.SkipWithError("Failed to create pipeline");
+        return;
+    }
+    pDevice->UploadUniforms(pUniforms, uUniformSize);
+
+    const uint32_t uGroupsX = (k_unWidth + uPixelsPerGroup - 1) / uPixelsPerGroup;
+    const uint32_t uGroupsY = (k_unHeight + uPixelsPerGroup - 1) / uPixelsPerGroup;
+    for (auto _ : state)
+    {
+        double flSeconds = pDevice->Dispatch(pipeline, uGroupsX, uGroupsY);
+        if (flSeconds < 0.0)
+        {
+            state.SkipWithError("Dispatch failed");
+            break;
+        }
+        state.SetIterationTime(flSeconds);
+    }
+    state.SetItemsProcessed(state.iterations() * k_unWidth * k_unHeight);
+
+    pDevice->DestroyPipeline(pipeline);
+}
+
+static BenchBlitData_t GetBlitData(uint32_t uBlurRadius)
+{
+    BenchBlitData_t data = {};
+    for (uint32_t i = 0; i < k_unMaxLayers; i++)
+    {
+        data.scale[i][0] = data.scale[i][1] = 1.0f;
+    }
+    SetIdentityLayers(data.ctm, data.opacity, k_unMaxLayers);
+    data.blurRadius = uBlurRadius;
+    data.linearToNits = 400.0f;
+    data.nitsToLinear = 1.0f / 400.0f;
+    return data;
+}
+
+static void Benchmark_CompositeBlit(benchmark::State &state, bool bHalf)
+{
+    BenchBlitData_t data = GetBlitData(0);
+    if (bHalf)
+        RunCompositeBenchmark(state, cs_composite_blit_fp16, sizeof(cs_composite_blit_fp16), true, &data, sizeof(data), 0, 8);
+    else
+        RunCompositeBenchmark(state, cs_composite_blit, sizeof(cs_composite_blit), false, &data, sizeof(data), 0, 8);
+}
+
+static void Benchmark_CompositeBlur(benchmark::State &state, bool bHalf)
+{
+    BenchBlitData_t data = GetBlitData(20);
+    if (bHalf)
+        RunCompositeBenchmark(state, cs_composite_blur_fp16, sizeof(cs_composite_blur_fp16), true, &data, sizeof(data), 1, 8);
+    else
+        RunCompositeBenchmark(state, cs_composite_blur, sizeof(cs_composite_blur), false, &data, sizeof(data), 1, 8);
+}
+
+static void Benchmark_CompositeRcas(benchmark::State &state, bool bHalf)
+{
+    BenchRcasData_t data = {};
+    for (uint32_t i = 0; i < k_unMaxLayers - 1; i++)
+    {
+        data.scale[i][0] = data.scale[i][1] = 1.0f;
+    }
+    SetIdentityLayers(data.ctm, data.opacity, k_unMaxLayers);
+    // FsrRcasCon(sharpness = 0.2), ie. exp2(-0.2) as float bits.
+    float flSharpness = 0.870550563f;
+    memcpy(&data.c1, &flSharpness, sizeof(data.c1));
+    data.linearToNits = 400.0f;
+    data.nitsToLinear = 1.0f / 400.0f;
+
+    if (bHalf)
+        RunCompositeBenchmark(state, cs_composite_rcas_fp16, sizeof(cs_composite_rcas_fp16), true, &data, sizeof(data), 0, 16);
+    else
+        RunCompositeBenchmark(state, cs_composite_rcas, sizeof(cs_composite_rcas), false, &data, sizeof(data), 0, 16);
+}
+
+BENCHMARK_CAPTURE(Benchmark_CompositeBlit, fp32, false)->Arg(1)->Arg(3)->Arg(k_unMaxLayers)->UseManualTime();
+BENCHMARK_CAPTURE(Benchmark_CompositeBlit, fp16, true)->Arg(1)->Arg(3)->Arg(k_unMaxLayers)->UseManualTime();
+BENCHMARK_CAPTURE(Benchmark_CompositeBlur, fp32, false)->Arg(1)->Arg(3)->UseManualTime();
+BENCHMARK_CAPTURE(Benchmark_CompositeBlur, fp16, true)->Arg(1)->Arg(3)->UseManualTime();
+BENCHMARK_CAPTURE(Benchmark_CompositeRcas, fp32, false)->Arg(1)->Arg(3)->UseManualTime();
+BENCHMARK_CAPTURE(Benchmark_CompositeRcas, fp16, true)->Arg(1)->Arg(3)->UseManualTime();
+
+BENCHMARK_MAIN();
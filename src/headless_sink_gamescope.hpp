@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+
+// Layout of the frames the headless backend hands to its sinks, for
+// consumers outside of gamescope.
+//
+// headless_sink_file: every frame is a gamescope_headless_frame followed
+// by height rows of stride bytes.
+//
+// headless_sink_shm: the shm_open object starts with a
+// gamescope_headless_shm_ring, followed by slot_count slots of slot_size
+// bytes, each a gamescope_headless_frame and its pixels.
+// Frame N lives in slot N % slot_count. The writer zeroes the slot's
+// frame_id while it writes the slot, sets it once done, then bumps
+// latest_frame. Readers should check frame_id is unchanged after copying.
+// If the output size changes, the object is resized and slot_size changes.
+
+#define GAMESCOPE_HEADLESS_FRAME_MAGIC    0x46534d47u // 'GMSF'
+#define GAMESCOPE_HEADLESS_SHM_RING_MAGIC 0x52534d47u // 'GMSR'
+#define GAMESCOPE_HEADLESS_SHM_RING_VERSION 1u
+
+struct gamescope_headless_frame
+{
+    uint32_t magic;
+    uint32_t header_size;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t drm_format;
+    // Starts at 1, 0 means the shm slot is being written.
+    uint64_t frame_id;
+    // CLOCK_MONOTONIC time of the virtual vblank the frame was made for.
+    uint64_t vblank_ns;
+};
+
+struct gamescope_headless_shm_ring
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_size;
+    uint32_t slots_offset;
+    uint32_t reserved;
+    // Frame id of the last complete slot, 0 if none yet.
+    uint64_t latest_frame;
+};
@@ -0,0 +1,134 @@
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <benchmark/benchmark.h>
+
+#include "Utils/ReadMostlyMap.h"
+
+// Same shape as PipelineInfo_t, without dragging in Vulkan.
+struct BenchPipelineKey_t
+{
+    uint32_t shaderType;
+    uint32_t layerCount;
+    uint32_t ycbcrMask;
+    uint32_t blurLayerCount;
+    uint32_t compositeDebug;
+    uint32_t colorspaceMask;
+    uint32_t outputEOTF;
+    bool itmEnable;
+    bool halfPrecision;
+
+    bool operator==( const BenchPipelineKey_t &o ) const = default;
+};
+
+template <>
+struct std::hash<BenchPipelineKey_t>
+{
+    size_t operator()( const BenchPipelineKey_t &k ) const
+    {
+        size_t hash = k.shaderType;
+        for ( uint32_t uValue : { k.layerCount, k.ycbcrMask, k.blurLayerCount, k.compositeDebug, k.colorspaceMask, k.outputEOTF, uint32_t( k.itmEnable ), uint32_t( k.halfPrecision ) } )
+            hash ^= uValue + 0x9e3779b9 + ( hash << 6 ) + ( hash >> 2 );
+        return hash;
+    }
+};
+
+// Roughly what compileAllPipelines produces at startup.
+static std::vector<BenchPipelineKey_t> GetStartupKeys()
+{
+    std::vector<BenchPipelineKey_t> keys;
+    for ( uint32_t uType = 0; uType < 8; uType++ )
+    {
+        for ( uint32_t uLayers = 1; uLayers <= 6; uLayers++ )
+        {
+            for ( uint32_t uYcbcr = 0; uYcbcr < 3; uYcbcr++ )
+                keys.push_back( BenchPipelineKey_t{ uType, uLayers, uYcbcr, 0, 0, 0x249249u & ( ( 1u << ( uLayers * 3 ) ) - 1 ), 0, false, false } );
+        }
+    }
+    return keys;
+}
+
+// The keys a steady-state frame looks up.
+static const BenchPipelineKey_t s_FrameKeys[] =
+{
+    { 0, 3, 0, 0, 0, 0x49, 0, false, false },
+    { 0, 2, 1, 0, 0, 0x9, 0, false, false },
+    { 4, 3, 0, 0, 0, 0x49, 0, false, false },
+};
+
+// Simulates the gamescope-shdr threads inserting new variants while we look up.
+template <typename TInsert>
+class CCompileContention
+{
+public:
+    CCompileContention( TInsert insert )
+        : m_Thread{ [this, insert]()
+        {
+            uint32_t uDebug = 0;
+            while ( !m_bStop.load( std::memory_order_relaxed ) )
+            {
+                // Wraps around, so later inserts hit existing keys like racing compiles do.
+                insert( BenchPipelineKey_t{ 0, 6, 0, 0, 1 + ( uDebug++ % 4096 ), 0, 1, true, false } );
+                std::this_thread::yield();
+            }
+        } }
+    {
+    }
+
+    ~CCompileContention()
+    {
+        m_bStop = true;
+        m_Thread.join();
+    }
+private:
+    std::atomic<bool> m_bStop = false;
+    std::thread m_Thread;
+};
+
+static void Benchmark_PipelineLookup_Std(benchmark::State &state)
+{
+    std::unordered_map<BenchPipelineKey_t, uint64_t> map;
+    std::mutex mutex;
+    for ( const auto &key : GetStartupKeys() )
+        map.emplace( key, map.size() + 1 );
+
+    CCompileContention contention{ [&]( const BenchPipelineKey_t &key )
+    {
+        std::lock_guard lock( mutex );
+        map.emplace( key, 1 );
+    } };
+
+    for (auto _ : state) {
+        for ( const auto &key : s_FrameKeys )
+        {
+            std::lock_guard lock( mutex );
+            auto iter = map.find( key );
+            benchmark::DoNotOptimize( iter != map.end() ? iter->second : 0 );
+        }
+    }
+    state.SetItemsProcessed( state.iterations() * std::size( s_FrameKeys ) );
+}
+BENCHMARK(Benchmark_PipelineLookup_Std);
+
+static void Benchmark_PipelineLookup_ReadMostly(benchmark::State &state)
+{
+    gamescope::CReadMostlyMap<BenchPipelineKey_t, uint64_t> map{ 1024 };
+    for ( const auto &key : GetStartupKeys() )
+        map.Insert( key, map.Size() + 1 );
+
+    CCompileContention contention{ [&]( const BenchPipelineKey_t &key )
+    {
+        map.Insert( key, 1 );
+    } };
+
+    for (auto _ : state) {
+        for ( const auto &key : s_FrameKeys )
+            benchmark::DoNotOptimize( map.Find( key ) );
+    }
+    state.SetItemsProcessed( state.iterations() * std::size( s_FrameKeys ) );
+}
+BENCHMARK(Benchmark_PipelineLookup_ReadMostly);
+
+BENCHMARK_MAIN();
@@ -1,6 +1,7 @@
 
 #include <assert.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <poll.h>
 #include <stdio.h>
 #include <sys/mman.h>
@@ -89,12 +90,47 @@ static void calculate_capture_size()
 	}
 }
 
+uint32_t spa_format_to_drm(uint32_t spa_format)
+{
+	switch (spa_format)
+	{
+		case SPA_VIDEO_FORMAT_NV12: return DRM_FORMAT_NV12;
+		default:
+		case SPA_VIDEO_FORMAT_BGR: return DRM_FORMAT_XRGB8888;
+	}
+}
+
+static CVulkanTexture::createFlags get_texture_flags(bool dmabuf, uint64_t modifier)
+{
+	CVulkanTexture::createFlags flags;
+	flags.bTransferDst = true;
+	flags.bStorage = true;
+	if (dmabuf) {
+		// The consumer gets the image itself, no need to map it.
+		flags.bExportable = true;
+		flags.bLinear = modifier == DRM_FORMAT_MOD_LINEAR;
+		flags.ulExportModifier = modifier;
+	} else {
+		flags.bMappable = true;
+	}
+	return flags;
+}
+
+static std::vector<uint64_t> get_export_modifiers(spa_video_format format)
+{
+	std::vector<uint64_t> modifiers = vulkan_get_export_modifiers(spa_format_to_drm(format), get_texture_flags(true, DRM_FORMAT_MOD_INVALID));
+	// Without modifier support we can still hand out implicit linear images.
+	if (modifiers.empty())
+		modifiers.push_back(DRM_FORMAT_MOD_LINEAR);
+	return modifiers;
+}
+
 static void build_format_params(struct spa_pod_builder *builder, spa_video_format format, std::vector<const struct spa_pod *> &params) {
 	struct spa_rectangle size = SPA_RECTANGLE(s_nCaptureWidth, s_nCaptureHeight);
 	struct spa_rectangle min_requested_size = { 0, 0 };
 	struct spa_rectangle max_requested_size = { UINT32_MAX, UINT32_MAX };
 	struct spa_fraction framerate = SPA_FRACTION(0, 1);
-	uint64_t modifier = DRM_FORMAT_MOD_LINEAR;
+	std::vector<uint64_t> modifiers = get_export_modifiers(format);
 
 	struct spa_pod_frame obj_frame, choice_frame;
 	spa_pod_builder_push_object(builder, &obj_frame, SPA_TYPE_OBJECT_Format, SPA_PARAM_EnumFormat);
@@ -121,8 +157,9 @@ static void build_format_params(struct spa_pod_builder *builder, spa_video_forma
 	}
 	spa_pod_builder_prop(builder, SPA_FORMAT_VIDEO_modifier, SPA_POD_PROP_FLAG_MANDATORY);
 	spa_pod_builder_push_choice(builder, &choice_frame, SPA_CHOICE_Enum, 0);
-	spa_pod_builder_long(builder, modifier); // default
-	spa_pod_builder_long(builder, modifier);
+	spa_pod_builder_long(builder, modifiers[0]); // default
+	for (uint64_t modifier : modifiers)
+		spa_pod_builder_long(builder, modifier);
 	spa_pod_builder_pop(builder, &choice_frame);
 	params.push_back((const struct spa_pod *) spa_pod_builder_pop(builder, &obj_frame));
 
@@ -208,7 +245,6 @@ static void copy_buffer(struct pipewire_state *state, struct pipewire_buffer *bu
 	struct spa_chunk *chunk = spa_buffer->datas[0].chunk;
 	chunk->flags = needs_reneg ? SPA_CHUNK_FLAG_CORRUPTED : 0;
 
-	struct wlr_dmabuf_attributes dmabuf;
 	switch (buffer->type) {
 	case SPA_DATA_MemFd:
 		chunk->offset = 0;
@@ -250,12 +286,28 @@ static void copy_buffer(struct pipewire_state *state, struct pipewire_buffer *bu
 		}
 		break;
 	case SPA_DATA_DmaBuf:
-		dmabuf = tex->dmabuf();
-		assert(dmabuf.n_planes == 1);
-		chunk->offset = dmabuf.offset[0];
-		chunk->stride = dmabuf.stride[0];
-		chunk->size = 0; // TODO
+	{
+		const struct wlr_dmabuf_attributes &dmabuf = tex->dmabuf();
+		assert(dmabuf.n_planes <= int(spa_buffer->n_datas));
+		const bool nv12 = state->video_info.format == SPA_VIDEO_FORMAT_NV12;
+		const int color_planes = nv12 ? 2 : 1;
+		for (int i = 0; i < dmabuf.n_planes; i++) {
+			struct spa_chunk *plane_chunk = spa_buffer->datas[i].chunk;
+			plane_chunk->flags = chunk->flags;
+			plane_chunk->offset = dmabuf.offset[i];
+			plane_chunk->stride = dmabuf.stride[i];
+			if (i < color_planes) {
+				// Chroma is subsampled vertically for NV12.
+				uint32_t rows = i > 0 ? (tex->height() + 1) / 2 : tex->height();
+				plane_chunk->size = rows * dmabuf.stride[i];
+			} else {
+				// Extra planes of the modifier (eg. compression metadata) have a
+				// driver-defined layout, consumers size those from the modifier.
+				plane_chunk->size = 0;
+			}
+		}
 		break;
+	}
 	default:
 		assert(false); // unreachable
 	}
@@ -365,6 +417,15 @@ static void stream_handle_param_changed(void *data, uint32_t id, const struct sp
 	const struct spa_pod_prop *modifier_prop = spa_pod_find_prop(param, nullptr, SPA_FORMAT_VIDEO_modifier);
 	state->dmabuf = modifier_prop != nullptr;
 
+	// Multi-planar formats and some tiled modifiers (eg. with CCS) need a block per plane.
+	int blocks = 1;
+	if (state->dmabuf) {
+		uint32_t drmFormat = spa_format_to_drm(state->video_info.format);
+		blocks = vulkan_get_modifier_plane_count(drmFormat, state->video_info.modifier);
+		if (blocks == 0)
+			blocks = drmFormat == DRM_FORMAT_NV12 ? 2 : 1;
+	}
+
 	uint8_t buf[1024];
 	struct spa_pod_builder builder = SPA_POD_BUILDER_INIT(buf, sizeof(buf));
 
@@ -379,7 +440,7 @@ static void stream_handle_param_changed(void *data, uint32_t id, const struct sp
 		(const struct spa_pod *) spa_pod_builder_add_object(&builder,
 		SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers,
 		SPA_PARAM_BUFFERS_buffers, SPA_POD_CHOICE_RANGE_Int(buffers, 1, 8),
-		SPA_PARAM_BUFFERS_blocks, SPA_POD_Int(1),
+		SPA_PARAM_BUFFERS_blocks, SPA_POD_Int(blocks),
 		SPA_PARAM_BUFFERS_size, SPA_POD_Int(shm_size),
 		SPA_PARAM_BUFFERS_stride, SPA_POD_Int(state->shm_stride),
 		SPA_PARAM_BUFFERS_dataType, SPA_POD_CHOICE_FLAGS_Int(data_type));
@@ -400,10 +461,11 @@ static void stream_handle_param_changed(void *data, uint32_t id, const struct sp
 		pwr_log.errorf("pw_stream_update_params failed");
 	}
 
-	pwr_log.debugf("format changed (size: %dx%d, requested %dx%d, format %d, stride %d, size: %d, dmabuf: %d)",
+	pwr_log.debugf("format changed (size: %dx%d, requested %dx%d, format %d, stride %d, size: %d, dmabuf: %d, modifier: 0x%" PRIx64 ", planes: %d)",
 		state->video_info.size.width, state->video_info.size.height,
 		s_nRequestedWidth, s_nRequestedHeight,
-		state->video_info.format, state->shm_stride, shm_size, state->dmabuf);
+		state->video_info.format, state->shm_stride, shm_size, state->dmabuf,
+		state->dmabuf ? state->video_info.modifier : DRM_FORMAT_MOD_INVALID, blocks);
 }
 
 static void randname(char *buf)
@@ -437,16 +499,6 @@ static int anonymous_shm_open(void)
 	return -1;
 }
 
-uint32_t spa_format_to_drm(uint32_t spa_format)
-{
-	switch (spa_format)
-	{
-		case SPA_VIDEO_FORMAT_NV12: return DRM_FORMAT_NV12;
-		default:
-		case SPA_VIDEO_FORMAT_BGR: return DRM_FORMAT_XRGB8888;
-	}
-}
-
 static void stream_handle_add_buffer(void *user_data, struct pw_buffer *pw_buffer)
 {
 	struct pipewire_state *state = (struct pipewire_state *) user_data;
@@ -495,14 +547,11 @@ static void stream_handle_add_buffer(void *user_data, struct pw_buffer *pw_buffe
 	uint32_t drmFormat = spa_format_to_drm(state->video_info.format);
 
 	buffer->texture = new CVulkanTexture();
-	CVulkanTexture::createFlags screenshotImageFlags;
-	screenshotImageFlags.bMappable = true;
-	screenshotImageFlags.bTransferDst = true;
-	screenshotImageFlags.bStorage = true;
-	if (is_dmabuf || drmFormat == DRM_FORMAT_NV12)
+	CVulkanTexture::createFlags screenshotImageFlags = get_texture_flags(is_dmabuf, state->video_info.modifier);
+	if (!is_dmabuf && drmFormat == DRM_FORMAT_NV12)
 	{
 		screenshotImageFlags.bExportable = true;
-		screenshotImageFlags.bLinear = true; // TODO: support multi-planar DMA-BUF export via PipeWire
+		screenshotImageFlags.bLinear = true;
 	}
 	bool bImageInitSuccess = buffer->texture->BInit( s_nCaptureWidth, s_nCaptureHeight, 1u, drmFormat, screenshotImageFlags );
 	if ( !bImageInitSuccess )
@@ -514,9 +563,9 @@ static void stream_handle_add_buffer(void *user_data, struct pw_buffer *pw_buffe
 
 	if (is_dmabuf) {
 		const struct wlr_dmabuf_attributes dmabuf = buffer->texture->dmabuf();
-		if (dmabuf.n_planes != 1)
+		if (dmabuf.n_planes > int(spa_buffer->n_datas))
 		{
-			pwr_log.errorf("dmabuf.n_planes != 1");
+			pwr_log.errorf("dmabuf has %d planes, but the buffer only has %u datas", dmabuf.n_planes, spa_buffer->n_datas);
 			goto error;
 		}
 
@@ -528,12 +577,15 @@ static void stream_handle_add_buffer(void *user_data, struct pw_buffer *pw_buffe
 
 		buffer->type = SPA_DATA_DmaBuf;
 
-		spa_data->type = SPA_DATA_DmaBuf;
-		spa_data->flags = SPA_DATA_FLAG_READABLE;
-		spa_data->fd = dmabuf.fd[0];
-		spa_data->mapoffset = dmabuf.offset[0];
-		spa_data->maxsize = size;
-		spa_data->data = nullptr;
+		// Plane offsets and strides go in the chunks, see copy_buffer.
+		for (int i = 0; i < dmabuf.n_planes; i++) {
+			spa_buffer->datas[i].type = SPA_DATA_DmaBuf;
+			spa_buffer->datas[i].flags = SPA_DATA_FLAG_READABLE;
+			spa_buffer->datas[i].fd = dmabuf.fd[i];
+			spa_buffer->datas[i].mapoffset = 0;
+			spa_buffer->datas[i].maxsize = size;
+			spa_buffer->datas[i].data = nullptr;
+		}
 	} else if (is_memfd) {
 		int fd = anonymous_shm_open();
 		if (fd < 0) {
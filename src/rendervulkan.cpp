@@ -37,14 +37,27 @@
 #include "steamcompmgr.hpp"
 #include "log.hpp"
 #include "Utils/Process.h"
+#include "Utils/Defer.h"
+#include "Utils/Cache.h"
+#include "Utils/Hash.h"
+#include "gpuvis_trace_utils.h"
 
 #include "cs_composite_blit.h"
+#include "cs_composite_blit_fp16.h"
 #include "cs_composite_blur.h"
+#include "cs_composite_blur_fp16.h"
 #include "cs_composite_blur_cond.h"
+#include "cs_composite_blur_cond_fp16.h"
+#include "cs_composite_fsr_fused.h"
+#include "cs_composite_nis_fused.h"
 #include "cs_composite_rcas.h"
+#include "cs_composite_rcas_fp16.h"
 #include "cs_easu.h"
 #include "cs_easu_fp16.h"
 #include "cs_gaussian_blur_horizontal.h"
+#include "cs_gaussian_blur_horizontal_fp16.h"
+#include "cs_kawase_blur_down.h"
+#include "cs_kawase_blur_up.h"
 #include "cs_nis.h"
 #include "cs_nis_fp16.h"
 #include "cs_rgb_to_nv12.h"
@@ -287,13 +300,15 @@ bool CVulkanDevice::BInit(VkInstance instance, VkSurfaceKHR surface)
 		return false;
 	if (!createShaders())
 		return false;
+	if (!createPipelineCache())
+		return false;
 	if (!createScratchResources())
 		return false;
 
 	m_bInitialized = true;
 
-	std::thread piplelineThread([this](){compileAllPipelines();});
-	piplelineThread.detach();
+	startPipelineCompileThreads();
+	compileAllPipelines();
 
 	g_reshadeManager.init(this);
 
@@ -302,6 +317,9 @@ bool CVulkanDevice::BInit(VkInstance instance, VkSurfaceKHR surface)
 
 extern bool env_to_bool(const char *env);
 
+// Everything in the composite descriptor set, see createLayouts.
+static constexpr uint32_t k_uCompositeDescriptorCount = 1 + VKR_TARGET_SLOTS + VKR_SAMPLER_SLOTS + VKR_YCBCR_SAMPLER_SLOTS + 2 * VKR_LUT3D_COUNT;
+
 bool CVulkanDevice::selectPhysDev(VkSurfaceKHR surface)
 {
 	uint32_t deviceCount = 0;
@@ -389,6 +407,9 @@ bool CVulkanDevice::selectPhysDev(VkSurfaceKHR surface)
 	vk.GetPhysicalDeviceProperties( m_physDev, &props );
 	vk_log.infof( "selecting physical device '%s': queue family %x (general queue family %x)", props.deviceName, m_queueFamily, m_generalQueueFamily );
 
+	m_bSupportsTimestamps = props.limits.timestampComputeAndGraphics;
+	m_flTimestampPeriod = props.limits.timestampPeriod;
+
 	return true;
 }
 
@@ -405,6 +426,8 @@ bool CVulkanDevice::createDevice()
 	bool hasDrmProps = false;
 	bool supportsForeignQueue = false;
 	bool supportsHDRMetadata = false;
+	bool supportsExternalMemoryHost = false;
+	bool supportsPushDescriptor = false;
 	for ( uint32_t i = 0; i < supportedExtensionCount; ++i )
 	{
 		if ( strcmp(supportedExts[i].extensionName,
@@ -422,6 +445,14 @@ bool CVulkanDevice::createDevice()
 		if ( strcmp(supportedExts[i].extensionName,
 			 VK_EXT_HDR_METADATA_EXTENSION_NAME) == 0 )
 			 supportsHDRMetadata = true;
+
+		if ( strcmp(supportedExts[i].extensionName,
+		     VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME) == 0 )
+			supportsExternalMemoryHost = true;
+
+		if ( strcmp(supportedExts[i].extensionName,
+		     VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME) == 0 )
+			supportsPushDescriptor = true;
 	}
 
 	vk_log.infof( "physical device %s DRM format modifiers", m_bSupportsModifiers ? "supports" : "does not support" );
@@ -499,6 +530,37 @@ bool CVulkanDevice::createDevice()
 		m_bSupportsFp16 = vulkan12Features.shaderFloat16 && features2.features.shaderInt16;
 	}
 
+	if ( supportsExternalMemoryHost )
+	{
+		VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostProps = {
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT,
+		};
+		VkPhysicalDeviceProperties2 props2 = {
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+			.pNext = &hostProps,
+		};
+		vk.GetPhysicalDeviceProperties2( physDev(), &props2 );
+
+		m_bSupportsHostPointerImport = true;
+		m_ulHostPointerAlignment = hostProps.minImportedHostPointerAlignment;
+		vk_log.infof( "physical device supports host pointer import (alignment %llu)", (unsigned long long)m_ulHostPointerAlignment );
+	}
+
+	if ( supportsPushDescriptor && !env_to_bool( getenv( "GAMESCOPE_DISABLE_PUSH_DESCRIPTORS" ) ) )
+	{
+		VkPhysicalDevicePushDescriptorPropertiesKHR pushDescriptorProps = {
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PUSH_DESCRIPTOR_PROPERTIES_KHR,
+		};
+		VkPhysicalDeviceProperties2 props2 = {
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+			.pNext = &pushDescriptorProps,
+		};
+		vk.GetPhysicalDeviceProperties2( physDev(), &props2 );
+
+		m_bSupportsPushDescriptors = pushDescriptorProps.maxPushDescriptors >= k_uCompositeDescriptorCount;
+	}
+	vk_log.infof( "%s push descriptors", m_bSupportsPushDescriptors ? "using" : "not using" );
+
 	float queuePriorities = 1.0f;
 
 	VkDeviceQueueGlobalPriorityCreateInfoEXT queueCreateInfoEXT = {
@@ -555,6 +617,12 @@ bool CVulkanDevice::createDevice()
 	if ( supportsHDRMetadata )
 		enabledExtensions.push_back( VK_EXT_HDR_METADATA_EXTENSION_NAME );
 
+	if ( m_bSupportsHostPointerImport )
+		enabledExtensions.push_back( VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME );
+
+	if ( m_bSupportsPushDescriptors )
+		enabledExtensions.push_back( VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME );
+
 	for ( auto& extension : GetBackend()->GetDeviceExtensions( physDev() ) )
 		enabledExtensions.push_back( extension );
 
@@ -732,7 +800,7 @@ bool CVulkanDevice::createLayouts()
 	vk.CreateSampler( device(), &ycbcrSamplerInfo, nullptr, &m_ycbcrSampler );
 
 	// Create an array of our ycbcrSampler to fill up
-	std::array<VkSampler, VKR_SAMPLER_SLOTS> ycbcrSamplers;
+	std::array<VkSampler, VKR_YCBCR_SAMPLER_SLOTS> ycbcrSamplers;
 	for (auto& sampler : ycbcrSamplers)
 		sampler = m_ycbcrSampler;
 
@@ -764,7 +832,7 @@ bool CVulkanDevice::createLayouts()
 		VkDescriptorSetLayoutBinding {
 			.binding = 4,
 			.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-			.descriptorCount = VKR_SAMPLER_SLOTS,
+			.descriptorCount = VKR_YCBCR_SAMPLER_SLOTS,
 			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
 			.pImmutableSamplers = ycbcrSamplers.data(),
 		},
@@ -782,9 +850,12 @@ bool CVulkanDevice::createLayouts()
 		},
 	};
 
+	// With push descriptors, dispatch() records the bindings straight into
+	// the command buffer instead of allocating and updating a set.
 	VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo =
 	{
 		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.flags = m_bSupportsPushDescriptors ? VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR : 0u,
 		.bindingCount = (uint32_t)layoutBindings.size(),
 		.pBindings = layoutBindings.data()
 	};
@@ -840,36 +911,42 @@ bool CVulkanDevice::createPools()
 		return false;
 	}
 
+	return true;
+}
+
+VkDescriptorPool CVulkanDevice::createDescriptorPool()
+{
 	VkDescriptorPoolSize poolSizes[3] {
 		{
 			VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-			uint32_t(m_descriptorSets.size()),
+			descriptor_sets_per_pool,
 		},
 		{
 			VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
-			uint32_t(m_descriptorSets.size()) * 2,
+			descriptor_sets_per_pool * 2,
 		},
 		{
 			VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-			uint32_t(m_descriptorSets.size()) * ((2 * VKR_SAMPLER_SLOTS) + (2 * VKR_LUT3D_COUNT)),
+			descriptor_sets_per_pool * (VKR_SAMPLER_SLOTS + VKR_YCBCR_SAMPLER_SLOTS + (2 * VKR_LUT3D_COUNT)),
 		},
 	};
 	
 	VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {
 		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-		.maxSets = uint32_t(m_descriptorSets.size()),
+		.maxSets = descriptor_sets_per_pool,
 		.poolSizeCount = sizeof(poolSizes) / sizeof(poolSizes[0]),
 		.pPoolSizes = poolSizes,
 	};
 	
-	res = vk.CreateDescriptorPool(device(), &descriptorPoolCreateInfo, nullptr, &m_descriptorPool);
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+	VkResult res = vk.CreateDescriptorPool(device(), &descriptorPoolCreateInfo, nullptr, &descriptorPool);
 	if ( res != VK_SUCCESS )
 	{
 		vk_errorf( res, "vkCreateDescriptorPool failed" );
-		return false;
+		return VK_NULL_HANDLE;
 	}
 
-	return true;
+	return descriptorPool;
 }
 
 bool CVulkanDevice::createShaders()
@@ -881,71 +958,313 @@ bool CVulkanDevice::createShaders()
 	};
 
 	std::array<ShaderInfo_t, SHADER_TYPE_COUNT> shaderInfos;
+	std::array<ShaderInfo_t, SHADER_TYPE_COUNT> fp16ShaderInfos = {};
 #define SHADER(type, array) shaderInfos[SHADER_TYPE_##type] = {array , sizeof(array)}
+#define SHADER_FP16(type, array) fp16ShaderInfos[SHADER_TYPE_##type] = {array , sizeof(array)}
 	SHADER(BLIT, cs_composite_blit);
 	SHADER(BLUR, cs_composite_blur);
 	SHADER(BLUR_COND, cs_composite_blur_cond);
 	SHADER(BLUR_FIRST_PASS, cs_gaussian_blur_horizontal);
 	SHADER(RCAS, cs_composite_rcas);
+	SHADER(EASU, cs_easu);
+	SHADER(NIS, cs_nis);
+	SHADER(RGB_TO_NV12, cs_rgb_to_nv12);
+	SHADER(FSR_FUSED, cs_composite_fsr_fused);
+	SHADER(NIS_FUSED, cs_composite_nis_fused);
+	SHADER(BLUR_KAWASE_DOWN, cs_kawase_blur_down);
+	SHADER(BLUR_KAWASE_UP, cs_kawase_blur_up);
 	if (m_bSupportsFp16)
 	{
-		SHADER(EASU, cs_easu_fp16);
-		SHADER(NIS, cs_nis_fp16);
+		SHADER_FP16(BLIT, cs_composite_blit_fp16);
+		SHADER_FP16(BLUR, cs_composite_blur_fp16);
+		SHADER_FP16(BLUR_COND, cs_composite_blur_cond_fp16);
+		SHADER_FP16(BLUR_FIRST_PASS, cs_gaussian_blur_horizontal_fp16);
+		SHADER_FP16(RCAS, cs_composite_rcas_fp16);
+		SHADER_FP16(EASU, cs_easu_fp16);
+		SHADER_FP16(NIS, cs_nis_fp16);
 	}
-	else
-	{
-		SHADER(EASU, cs_easu);
-		SHADER(NIS, cs_nis);
-	}
-	SHADER(RGB_TO_NV12, cs_rgb_to_nv12);
+#undef SHADER_FP16
 #undef SHADER
 
-	for (uint32_t i = 0; i < shaderInfos.size(); i++)
+	auto createShaderModule = [this]( const ShaderInfo_t &info, VkShaderModule *pModule )
 	{
 		VkShaderModuleCreateInfo shaderCreateInfo = {
 			.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-			.codeSize = shaderInfos[i].size,
-			.pCode = shaderInfos[i].spirv,
+			.codeSize = info.size,
+			.pCode = info.spirv,
 		};
 
-		VkResult res = vk.CreateShaderModule(device(), &shaderCreateInfo, nullptr, &m_shaderModules[i]);
+		VkResult res = vk.CreateShaderModule(device(), &shaderCreateInfo, nullptr, pModule);
 		if ( res != VK_SUCCESS )
 		{
 			vk_errorf( res, "vkCreateShaderModule failed" );
 			return false;
 		}
+
+		return true;
+	};
+
+	m_ulShaderHash = gamescope::k_ulFnv1aOffsetBasis;
+	for (uint32_t i = 0; i < shaderInfos.size(); i++)
+	{
+		m_ulShaderHash = gamescope::HashFnv1a(shaderInfos[i].spirv, shaderInfos[i].size, m_ulShaderHash);
+		if (!createShaderModule(shaderInfos[i], &m_shaderModules[i]))
+			return false;
+
+		if (!fp16ShaderInfos[i].spirv)
+			continue;
+
+		m_ulShaderHash = gamescope::HashFnv1a(fp16ShaderInfos[i].spirv, fp16ShaderInfos[i].size, m_ulShaderHash);
+		if (!createShaderModule(fp16ShaderInfos[i], &m_shaderModulesFp16[i]))
+			return false;
+	}
+
+	return true;
+}
+
+static gamescope::ConVar<bool> cv_vulkan_pipeline_cache{ "vulkan_pipeline_cache", true, "Whether or not to load/store compiled composite pipelines in $XDG_CACHE_HOME/gamescope/pipelines." };
+
+static constexpr uint32_t k_uPipelineCacheMagic = 0x43505347; // 'GSPC'
+// Bump this whenever the specialization constants or pipeline layout change
+// in a way that the shader hash doesn't catch.
+static constexpr uint32_t k_uPipelineCacheVersion = 1;
+
+struct PipelineCacheFileHeader_t
+{
+	uint32_t uMagic;
+	uint32_t uVersion;
+	uint32_t uVendorID;
+	uint32_t uDeviceID;
+	uint32_t uDriverVersion;
+	uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+	// Explicit so the whole header we write out is initialized.
+	uint32_t uPadding;
+	uint64_t ulShaderHash;
+	uint64_t ulDataSize;
+	uint64_t ulDataHash;
+};
+
+static PipelineCacheFileHeader_t GetExpectedPipelineCacheHeader( const VkPhysicalDeviceProperties &props, uint64_t ulShaderHash )
+{
+	PipelineCacheFileHeader_t header = {
+		.uMagic = k_uPipelineCacheMagic,
+		.uVersion = k_uPipelineCacheVersion,
+		.uVendorID = props.vendorID,
+		.uDeviceID = props.deviceID,
+		.uDriverVersion = props.driverVersion,
+		.ulShaderHash = ulShaderHash,
+	};
+	memcpy( header.pipelineCacheUUID, props.pipelineCacheUUID, VK_UUID_SIZE );
+	return header;
+}
+
+static std::string GetPipelineCachePath( const VkPhysicalDeviceProperties &props )
+{
+	// One file per driver cache UUID, so multiple GPUs/drivers don't fight over it.
+	std::string sPath = "pipelines/";
+	for ( uint32_t i = 0; i < VK_UUID_SIZE; i++ )
+	{
+		char szByte[3];
+		snprintf( szByte, sizeof( szByte ), "%02x", props.pipelineCacheUUID[i] );
+		sPath += szByte;
+	}
+	sPath += ".bin";
+	return sPath;
+}
+
+bool CVulkanDevice::createPipelineCache()
+{
+	VkPhysicalDeviceProperties props;
+	vk.GetPhysicalDeviceProperties( physDev(), &props );
+
+	const PipelineCacheFileHeader_t expectedHeader = GetExpectedPipelineCacheHeader( props, m_ulShaderHash );
+
+	std::vector<uint8_t> fileData;
+	const uint8_t *pInitialData = nullptr;
+	size_t uInitialDataSize = 0;
+
+	if ( cv_vulkan_pipeline_cache && gamescope::ReadCacheFile( GetPipelineCachePath( props ), fileData ) )
+	{
+		PipelineCacheFileHeader_t header;
+		if ( fileData.size() < sizeof( header ) )
+		{
+			vk_log.infof( "pipeline cache: ignoring truncated cache file" );
+		}
+		else
+		{
+			memcpy( &header, fileData.data(), sizeof( header ) );
+
+			const uint8_t *pData = fileData.data() + sizeof( header );
+			const size_t uDataSize = fileData.size() - sizeof( header );
+
+			if ( header.uMagic != expectedHeader.uMagic ||
+			     header.uVersion != expectedHeader.uVersion ||
+			     header.uVendorID != expectedHeader.uVendorID ||
+			     header.uDeviceID != expectedHeader.uDeviceID ||
+			     header.uDriverVersion != expectedHeader.uDriverVersion ||
+			     memcmp( header.pipelineCacheUUID, expectedHeader.pipelineCacheUUID, VK_UUID_SIZE ) != 0 )
+			{
+				vk_log.infof( "pipeline cache: driver or cache version changed, discarding" );
+			}
+			else if ( header.ulShaderHash != expectedHeader.ulShaderHash )
+			{
+				vk_log.infof( "pipeline cache: shaders changed, discarding" );
+			}
+			else if ( header.ulDataSize != uDataSize || header.ulDataHash != gamescope::HashFnv1a( pData, uDataSize ) )
+			{
+				vk_log.infof( "pipeline cache: cache file is corrupt, discarding" );
+			}
+			else
+			{
+				pInitialData = pData;
+				uInitialDataSize = uDataSize;
+			}
+		}
+	}
+
+	VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+		.initialDataSize = uInitialDataSize,
+		.pInitialData = pInitialData,
+	};
+
+	VkResult res = vk.CreatePipelineCache( device(), &pipelineCacheCreateInfo, nullptr, &m_pipelineCache );
+	if ( res != VK_SUCCESS && uInitialDataSize != 0 )
+	{
+		// Drivers are meant to ignore incompatible data, but be defensive.
+		vk_errorf( res, "vkCreatePipelineCache failed with initial data, retrying without" );
+		pipelineCacheCreateInfo.initialDataSize = 0;
+		pipelineCacheCreateInfo.pInitialData = nullptr;
+		uInitialDataSize = 0;
+		res = vk.CreatePipelineCache( device(), &pipelineCacheCreateInfo, nullptr, &m_pipelineCache );
+	}
+
+	if ( res != VK_SUCCESS )
+	{
+		vk_errorf( res, "vkCreatePipelineCache failed" );
+		return false;
 	}
 
+	vk_log.infof( "pipeline cache: %s (%zu bytes)", uInitialDataSize ? "loaded" : "empty", uInitialDataSize );
+
 	return true;
 }
 
+void CVulkanDevice::savePipelineCache()
+{
+	if ( !cv_vulkan_pipeline_cache || m_pipelineCache == VK_NULL_HANDLE )
+		return;
+
+	// Can be called from the shader compile thread and at shutdown.
+	std::unique_lock lock( m_pipelineCacheSaveMutex );
+
+	if ( !m_bPipelineCacheDirty.exchange( false ) )
+		return;
+
+	size_t uDataSize = 0;
+	VkResult res = vk.GetPipelineCacheData( device(), m_pipelineCache, &uDataSize, nullptr );
+	if ( res != VK_SUCCESS )
+	{
+		vk_errorf( res, "vkGetPipelineCacheData failed" );
+		return;
+	}
+
+	VkPhysicalDeviceProperties props;
+	vk.GetPhysicalDeviceProperties( physDev(), &props );
+
+	PipelineCacheFileHeader_t header = GetExpectedPipelineCacheHeader( props, m_ulShaderHash );
+
+	std::vector<uint8_t> fileData( sizeof( header ) + uDataSize );
+	uint8_t *pData = fileData.data() + sizeof( header );
+
+	res = vk.GetPipelineCacheData( device(), m_pipelineCache, &uDataSize, pData );
+	if ( res != VK_SUCCESS )
+	{
+		// VK_INCOMPLETE if it grew between the two calls, we'll catch it next time.
+		vk_errorf( res, "vkGetPipelineCacheData failed" );
+		m_bPipelineCacheDirty = true;
+		return;
+	}
+	fileData.resize( sizeof( header ) + uDataSize );
+
+	header.ulDataSize = uDataSize;
+	header.ulDataHash = gamescope::HashFnv1a( pData, uDataSize );
+	memcpy( fileData.data(), &header, sizeof( header ) );
+
+	if ( gamescope::WriteCacheFile( GetPipelineCachePath( props ), fileData ) )
+		vk_log.debugf( "pipeline cache: saved %zu bytes", uDataSize );
+}
+
 bool CVulkanDevice::createScratchResources()
 {
-	std::vector<VkDescriptorSetLayout> descriptorSetLayouts(m_descriptorSets.size(), m_descriptorSetLayout);
-	
-	VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {
-		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-		.descriptorPool = m_descriptorPool,
-		.descriptorSetCount = (uint32_t)descriptorSetLayouts.size(),
-		.pSetLayouts = descriptorSetLayouts.data(),
+	// Constants are bound straight out of the upload buffer as uniform buffers.
+	VkPhysicalDeviceProperties props;
+	vk.GetPhysicalDeviceProperties( physDev(), &props );
+	m_uploadBufferAlignment = std::max<uint32_t>( m_uploadBufferAlignment, props.limits.minUniformBufferOffsetAlignment );
+	m_uploadBufferMaxRange = props.limits.maxUniformBufferRange;
+
+	if ( !createUploadBuffer( upload_buffer_size ) )
+		return false;
+
+	VkSemaphoreTypeCreateInfo timelineCreateInfo = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+		.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
 	};
-	
-	VkResult res = vk.AllocateDescriptorSets(device(), &descriptorSetAllocateInfo, m_descriptorSets.data());
+
+	VkSemaphoreCreateInfo semCreateInfo = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+		.pNext = &timelineCreateInfo,
+	};
+
+	VkResult res = vk.CreateSemaphore( device(), &semCreateInfo, NULL, &m_scratchTimelineSemaphore );
 	if ( res != VK_SUCCESS )
 	{
-		vk_log.errorf( "vkAllocateDescriptorSets failed" );
+		vk_errorf( res, "vkCreateSemaphore failed" );
 		return false;
 	}
 
-	// Make and map upload buffer
-	
+	const VkPhysicalDeviceExternalSemaphoreInfo syncFileSemaphoreInfo = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_SEMAPHORE_INFO,
+		.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT,
+	};
+	VkExternalSemaphoreProperties syncFileSemaphoreProps = {
+		.sType = VK_STRUCTURE_TYPE_EXTERNAL_SEMAPHORE_PROPERTIES,
+	};
+	vk.GetPhysicalDeviceExternalSemaphoreProperties( physDev(), &syncFileSemaphoreInfo, &syncFileSemaphoreProps );
+
+	if ( syncFileSemaphoreProps.externalSemaphoreFeatures & VK_EXTERNAL_SEMAPHORE_FEATURE_EXPORTABLE_BIT )
+	{
+		VkExportSemaphoreCreateInfo exportInfo = {
+			.sType = VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO,
+			.handleTypes = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT,
+		};
+
+		VkSemaphoreCreateInfo syncFileCreateInfo = {
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+			.pNext = &exportInfo,
+		};
+
+		res = vk.CreateSemaphore( device(), &syncFileCreateInfo, NULL, &m_syncFileSemaphore );
+		if ( res == VK_SUCCESS )
+			m_bSupportsSyncFileExport = true;
+		else
+			vk_errorf( res, "vkCreateSemaphore failed for the sync_file semaphore" );
+	}
+	vk_log.infof( "%s sync_file export", m_bSupportsSyncFileExport ? "using" : "not using" );
+
+	return true;
+}
+
+bool CVulkanDevice::createUploadBuffer(uint32_t size)
+{
 	VkBufferCreateInfo bufferCreateInfo = {
 		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-		.size = upload_buffer_size,
+		.size = size,
 		.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
 	};
 
-	res = vk.CreateBuffer( device(), &bufferCreateInfo, nullptr, &m_uploadBuffer );
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkResult res = vk.CreateBuffer( device(), &bufferCreateInfo, nullptr, &buffer );
 	if ( res != VK_SUCCESS )
 	{
 		vk_errorf( res, "vkCreateBuffer failed" );
@@ -953,56 +1272,136 @@ bool CVulkanDevice::createScratchResources()
 	}
 	
 	VkMemoryRequirements memRequirements;
-	vk.GetBufferMemoryRequirements(device(), m_uploadBuffer, &memRequirements);
-	
-	uint32_t memTypeIndex =  findMemoryType(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT|VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, memRequirements.memoryTypeBits );
-	if ( memTypeIndex == ~0u )
+	vk.GetBufferMemoryRequirements(device(), buffer, &memRequirements);
+
+	// Prefer memory the GPU can read quickly, the host visible part of VRAM
+	// can be small though, so fall back to system memory for bigger rings.
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	res = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+	for ( VkMemoryPropertyFlags memProps : { VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT|VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+	                                         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT|VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT } )
+	{
+		uint32_t memTypeIndex = findMemoryType( memProps, memRequirements.memoryTypeBits );
+		if ( memTypeIndex == ~0u )
+			continue;
+
+		VkMemoryAllocateInfo allocInfo = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+			.allocationSize = memRequirements.size,
+			.memoryTypeIndex = memTypeIndex,
+		};
+
+		res = vk.AllocateMemory( device(), &allocInfo, nullptr, &memory );
+		if ( res == VK_SUCCESS )
+			break;
+	}
+
+	if ( res != VK_SUCCESS )
 	{
-		vk_log.errorf( "findMemoryType failed" );
+		vk_errorf( res, "vkAllocateMemory failed" );
+		vk.DestroyBuffer( device(), buffer, nullptr );
 		return false;
 	}
-	
-	VkMemoryAllocateInfo allocInfo = {
-		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-		.allocationSize = memRequirements.size,
-		.memoryTypeIndex = memTypeIndex,
-	};
-	
-	vk.AllocateMemory( device(), &allocInfo, nullptr, &m_uploadBufferMemory);
-	
-	vk.BindBufferMemory( device(), m_uploadBuffer, m_uploadBufferMemory, 0 );
 
-	res = vk.MapMemory( device(), m_uploadBufferMemory, 0, VK_WHOLE_SIZE, 0, (void**)&m_uploadBufferData );
+	vk.BindBufferMemory( device(), buffer, memory, 0 );
+
+	void *data = nullptr;
+	res = vk.MapMemory( device(), memory, 0, VK_WHOLE_SIZE, 0, &data );
 	if ( res != VK_SUCCESS )
 	{
 		vk_errorf( res, "vkMapMemory failed" );
+		vk.DestroyBuffer( device(), buffer, nullptr );
+		vk.FreeMemory( device(), memory, nullptr );
 		return false;
 	}
 
-	VkSemaphoreTypeCreateInfo timelineCreateInfo = {
-		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
-		.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
-	};
+	m_uploadBuffer = buffer;
+	m_uploadBufferMemory = memory;
+	m_uploadBufferData = data;
+	m_uploadBufferSize = size;
+	return true;
+}
 
-	VkSemaphoreCreateInfo semCreateInfo = {
-		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
-		.pNext = &timelineCreateInfo,
-	};
+static gamescope::ConVar<uint32_t> cv_upload_buffer_max_size{ "upload_buffer_max_size", 256, "Size in MiB the upload ring may grow to before uploads wait for the GPU instead." };
 
-	res = vk.CreateSemaphore( device(), &semCreateInfo, NULL, &m_scratchTimelineSemaphore );
-	if ( res != VK_SUCCESS )
-	{
-		vk_errorf( res, "vkCreateSemaphore failed" );
+bool CVulkanDevice::growUploadBuffer(uint32_t minSize, bool bIgnoreMaxSize)
+{
+	const uint64_t ulMaxSize = bIgnoreMaxSize ? UINT32_MAX : std::max<uint64_t>( uint64_t( cv_upload_buffer_max_size ) << 20, minSize );
+
+	uint64_t ulNewSize = uint64_t( m_uploadBufferSize ) * 2;
+	while ( ulNewSize < minSize )
+		ulNewSize *= 2;
+	ulNewSize = std::min<uint64_t>( ulNewSize, std::min<uint64_t>( ulMaxSize, UINT32_MAX ) );
+	if ( ulNewSize <= m_uploadBufferSize || ulNewSize < minSize )
+		return false;
+
+	VkBuffer oldBuffer = m_uploadBuffer;
+	VkDeviceMemory oldMemory = m_uploadBufferMemory;
+	if ( !createUploadBuffer( uint32_t( ulNewSize ) ) )
 		return false;
+
+	vk_log.infof( "upload buffer grown to %u KiB", uint32_t( ulNewSize >> 10 ) );
+
+	// Whoever still has data in the old ring keeps it alive until they're done.
+	RetiredUploadBuffer_t retired = { 0, {}, oldBuffer, oldMemory };
+	for ( const UploadBufferRegion_t &region : m_uploadBufferRegions )
+	{
+		if ( region.pCmdBuffer )
+		{
+			if ( std::find( retired.pendingCmdBuffers.begin(), retired.pendingCmdBuffers.end(), region.pCmdBuffer ) == retired.pendingCmdBuffers.end() )
+				retired.pendingCmdBuffers.push_back( region.pCmdBuffer );
+		}
+		else
+		{
+			retired.ulSeqNo = std::max( retired.ulSeqNo, region.ulSeqNo );
+		}
 	}
+	m_retiredUploadBuffers.push_back( std::move( retired ) );
 
+	m_uploadBufferHead = m_uploadBufferTail = 0;
+	m_uploadBufferUsed = 0;
+	m_uploadBufferRegions.clear();
 	return true;
 }
 
+void CVulkanDevice::submitUploadBuffer(CVulkanCmdBuffer *pCmdBuffer, uint64_t sequence)
+{
+	for ( UploadBufferRegion_t &region : m_uploadBufferRegions )
+	{
+		if ( region.pCmdBuffer == pCmdBuffer )
+		{
+			region.pCmdBuffer = nullptr;
+			region.ulSeqNo = sequence;
+		}
+	}
+
+	for ( RetiredUploadBuffer_t &retired : m_retiredUploadBuffers )
+	{
+		if ( std::erase( retired.pendingCmdBuffers, pCmdBuffer ) )
+			retired.ulSeqNo = std::max( retired.ulSeqNo, sequence );
+	}
+}
+
+void CVulkanDevice::releaseUploadBuffer(CVulkanCmdBuffer *pCmdBuffer)
+{
+	// Never submitted, so the GPU never saw any of it.
+	for ( UploadBufferRegion_t &region : m_uploadBufferRegions )
+	{
+		if ( region.pCmdBuffer == pCmdBuffer )
+		{
+			region.pCmdBuffer = nullptr;
+			region.ulSeqNo = 0;
+		}
+	}
+
+	for ( RetiredUploadBuffer_t &retired : m_retiredUploadBuffers )
+		std::erase( retired.pendingCmdBuffers, pCmdBuffer );
+}
+
 VkSampler CVulkanDevice::sampler( SamplerState key )
 {
-	if ( m_samplerCache.count(key) != 0 )
-		return m_samplerCache[key];
+	if ( std::optional<VkSampler> oSampler = m_samplerCache.Find( key ) )
+		return *oSampler;
 
 	VkSampler ret = VK_NULL_HANDLE;
 
@@ -1019,12 +1418,21 @@ VkSampler CVulkanDevice::sampler( SamplerState key )
 
 	vk.CreateSampler( device(), &samplerCreateInfo, nullptr, &ret );
 
-	m_samplerCache[key] = ret;
+	auto [ cachedSampler, bInserted ] = m_samplerCache.Insert( key, ret );
+	if ( !bInserted )
+		vk.DestroySampler( device(), ret, nullptr );
+
+	return cachedSampler;
+}
+
+static gamescope::ConVar<bool> cv_composite_fp16{ "composite_fp16", true, "Use the half precision variants of the composite, blur and upscaling shaders if the GPU supports them." };
 
-	return ret;
+bool CVulkanDevice::usesHalfPrecision(ShaderType type)
+{
+	return cv_composite_fp16 && m_shaderModulesFp16[type] != VK_NULL_HANDLE;
 }
 
-VkPipeline CVulkanDevice::compilePipeline(uint32_t layerCount, uint32_t ycbcrMask, ShaderType type, uint32_t blur_layer_count, uint32_t composite_debug, uint32_t colorspace_mask, uint32_t output_eotf, bool itm_enable)
+VkPipeline CVulkanDevice::compilePipeline(uint32_t layerCount, uint32_t ycbcrMask, ShaderType type, uint32_t blur_layer_count, uint32_t composite_debug, uint32_t colorspace_mask, uint32_t output_eotf, bool itm_enable, bool half_precision)
 {
 	const std::array<VkSpecializationMapEntry, 7> specializationEntries = {{
 		{
@@ -1096,7 +1504,7 @@ VkPipeline CVulkanDevice::compilePipeline(uint32_t layerCount, uint32_t ycbcrMas
 		.stage = {
 			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
 			.stage = VK_SHADER_STAGE_COMPUTE_BIT,
-			.module = m_shaderModules[type],
+			.module = half_precision ? m_shaderModulesFp16[type] : m_shaderModules[type],
 			.pName = "main",
 			.pSpecializationInfo = &specializationInfo
 		},
@@ -1105,19 +1513,39 @@ VkPipeline CVulkanDevice::compilePipeline(uint32_t layerCount, uint32_t ycbcrMas
 
 	VkPipeline result;
 
-	VkResult res = vk.CreateComputePipelines(device(), VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &result);
+	VkResult res = vk.CreateComputePipelines(device(), m_pipelineCache, 1, &computePipelineCreateInfo, nullptr, &result);
 	if (res != VK_SUCCESS) {
 		vk_errorf( res, "vkCreateComputePipelines failed" );
 		return VK_NULL_HANDLE;
 	}
 
+	m_bPipelineCacheDirty = true;
+
 	return result;
 }
 
-void CVulkanDevice::compileAllPipelines()
+static gamescope::ConVar<bool> cv_pipeline_fallback{ "pipeline_fallback", true, "Composite with the closest already compiled pipeline variant while the exact one is compiled in the background, instead of stalling the frame." };
+
+static bool ShaderTypeHasCompositeLayers(ShaderType type)
 {
-	pthread_setname_np( pthread_self(), "gamescope-shdr" );
+	switch (type)
+	{
+		case SHADER_TYPE_BLIT:
+		case SHADER_TYPE_BLUR:
+		case SHADER_TYPE_BLUR_COND:
+		case SHADER_TYPE_BLUR_FIRST_PASS:
+		case SHADER_TYPE_RCAS:
+		case SHADER_TYPE_FSR_FUSED:
+		case SHADER_TYPE_NIS_FUSED:
+		case SHADER_TYPE_BLUR_KAWASE_DOWN:
+			return true;
+		default:
+			return false;
+	}
+}
 
+void CVulkanDevice::compileAllPipelines()
+{
 	std::array<PipelineInfo_t, SHADER_TYPE_COUNT> pipelineInfos;
 #define SHADER(type, layer_count, max_ycbcr, blur_layers) pipelineInfos[SHADER_TYPE_##type] = {SHADER_TYPE_##type, layer_count, max_ycbcr, blur_layers}
 	SHADER(BLIT, k_nMaxLayers, k_nMaxYcbcrMask_ToPreCompile, 1);
@@ -1128,8 +1556,29 @@ void CVulkanDevice::compileAllPipelines()
 	SHADER(EASU, 1, 1, 1);
 	SHADER(NIS, 1, 1, 1);
 	SHADER(RGB_TO_NV12, 1, 1, 1);
+	SHADER(FSR_FUSED, k_nMaxLayers, k_nMaxYcbcrMask_ToPreCompile, 1);
+	SHADER(NIS_FUSED, k_nMaxLayers, k_nMaxYcbcrMask_ToPreCompile, 1);
+	// The first downsample reads the base plane and the override plane if there is one.
+	SHADER(BLUR_KAWASE_DOWN, k_nMaxBlurLayers, 2, 1);
+	// Only used between levels, queued below.
+	SHADER(BLUR_KAWASE_UP, 0, 0, 0);
 #undef SHADER
 
+	{
+		std::unique_lock lock( m_pipelineCompileMutex );
+		m_ulPipelinePrecompileStartTime = get_time_in_nanos();
+		m_uPipelinesPrecompiled = 0;
+	}
+
+	// The exact variants used for screenshots and PipeWire streams, these have
+	// no acceptable fallback so get them in before the rest.
+	queuePipelineCompile({SHADER_TYPE_BLIT, 1, 0, 0, 0, GAMESCOPE_APP_TEXTURE_COLORSPACE_SRGB, EOTF_Count, false, usesHalfPrecision(SHADER_TYPE_BLIT)}, k_EPipelineCompilePriority_Likely);
+	queuePipelineCompile({SHADER_TYPE_RGB_TO_NV12, 1, 0, 0, 0, GAMESCOPE_APP_TEXTURE_COLORSPACE_SRGB, EOTF_Count, false, usesHalfPrecision(SHADER_TYPE_RGB_TO_NV12)}, k_EPipelineCompilePriority_Likely);
+
+	// The dual-Kawase passes between levels have no layers, only layer 0's colorspace.
+	for (ShaderType type : {SHADER_TYPE_BLUR_KAWASE_DOWN, SHADER_TYPE_BLUR_KAWASE_UP})
+		queuePipelineCompile({type, 0, 0, 0, 0, GAMESCOPE_APP_TEXTURE_COLORSPACE_SRGB, 0, false, usesHalfPrecision(type)}, k_EPipelineCompilePriority_Background);
+
 	for (auto& info : pipelineInfos) {
 		for (uint32_t layerCount = 1; layerCount <= info.layerCount; layerCount++) {
 			for (uint32_t ycbcrMask = 0; ycbcrMask < info.ycbcrMask; ycbcrMask++) {
@@ -1139,44 +1588,211 @@ void CVulkanDevice::compileAllPipelines()
 					if (blur_layers > layerCount)
 						continue;
 
-					VkPipeline newPipeline = compilePipeline(layerCount, ycbcrMask, info.shaderType, blur_layers, info.compositeDebug, info.colorspaceMask, info.outputEOTF, info.itmEnable);
+					// Only the blur passes read blurLayerCount, everything else is requested with 0.
+					const bool bBlur = info.shaderType == SHADER_TYPE_BLUR || info.shaderType == SHADER_TYPE_BLUR_COND;
+					PipelineInfo_t key = {info.shaderType, layerCount, ycbcrMask, bBlur ? blur_layers : 0u, info.compositeDebug};
+					key.halfPrecision = usesHalfPrecision(info.shaderType);
+
+					// Plain sRGB layers are by far the most common, so warm those too.
+					if (ShaderTypeHasCompositeLayers(info.shaderType))
 					{
-						std::lock_guard<std::mutex> lock(m_pipelineMutex);
-						PipelineInfo_t key = {info.shaderType, layerCount, ycbcrMask, blur_layers, info.compositeDebug};
-						auto result = m_pipelineMap.emplace(std::make_pair(key, newPipeline));
-						if (!result.second)
-							vk.DestroyPipeline(device(), newPipeline, nullptr);
+						PipelineInfo_t srgbKey = key;
+						for (uint32_t i = 0; i < layerCount; i++)
+							srgbKey.colorspaceMask |= GAMESCOPE_APP_TEXTURE_COLORSPACE_SRGB << (i * GamescopeAppTextureColorspace_Bits);
+						queuePipelineCompile(srgbKey, k_EPipelineCompilePriority_Background);
 					}
+					queuePipelineCompile(key, k_EPipelineCompilePriority_Background);
 				}
 			}
 		}
 	}
 }
 
-extern bool g_bSteamIsActiveWindow;
-
-VkPipeline CVulkanDevice::pipeline(ShaderType type, uint32_t layerCount, uint32_t ycbcrMask, uint32_t blur_layers, uint32_t colorspace_mask, uint32_t output_eotf, bool itm_enable)
+void CVulkanDevice::startPipelineCompileThreads()
 {
-	uint32_t effective_debug = g_uCompositeDebug;
-	if ( g_bSteamIsActiveWindow )
-		effective_debug &= ~(CompositeDebugFlag::Heatmap | CompositeDebugFlag::Heatmap_MSWCG | CompositeDebugFlag::Heatmap_Hard);
-
-	std::lock_guard<std::mutex> lock(m_pipelineMutex);
-	PipelineInfo_t key = {type, layerCount, ycbcrMask, blur_layers, effective_debug, colorspace_mask, output_eotf, itm_enable};
-	auto search = m_pipelineMap.find(key);
-	if (search == m_pipelineMap.end())
+	const uint32_t uThreadCount = std::clamp<uint32_t>( std::thread::hardware_concurrency() / 2, 1, 3 );
+	for ( uint32_t i = 0; i < uThreadCount; i++ )
 	{
-		VkPipeline result = compilePipeline(layerCount, ycbcrMask, type, blur_layers, effective_debug, colorspace_mask, output_eotf, itm_enable);
-		m_pipelineMap[key] = result;
-		return result;
-	}
-	else
-	{
-		return search->second;
+		std::thread pipelineThread([this](){ pipelineCompileThreadFunc(); });
+		pipelineThread.detach();
 	}
 }
 
-
+void CVulkanDevice::pipelineCompileThreadFunc()
+{
+	pthread_setname_np( pthread_self(), "gamescope-shdr" );
+
+	for ( ;; )
+	{
+		PipelineInfo_t info;
+		{
+			std::unique_lock lock( m_pipelineCompileMutex );
+			m_pipelineCompileCV.wait( lock, [this]{ return !m_pipelineCompileQueue.empty(); } );
+
+			info = m_pipelineCompileQueue.top().info;
+			m_pipelineCompileQueue.pop();
+
+			// Stale entry left behind by a priority bump.
+			auto iter = m_pipelinesQueued.find( info );
+			if ( iter == m_pipelinesQueued.end() || iter->second.bCompiling )
+				continue;
+
+			iter->second.bCompiling = true;
+		}
+
+		VkPipeline newPipeline = compilePipeline(info.layerCount, info.ycbcrMask, info.shaderType, info.blurLayerCount, info.compositeDebug, info.colorspaceMask, info.outputEOTF, info.itmEnable, info.halfPrecision);
+		if (!m_pipelineMap.Insert(info, newPipeline).second)
+			vk.DestroyPipeline(device(), newPipeline, nullptr);
+
+		bool bDrained = false;
+		{
+			std::unique_lock lock( m_pipelineCompileMutex );
+			m_pipelinesQueued.erase( info );
+			bDrained = m_pipelinesQueued.empty();
+
+			if ( m_ulPipelinePrecompileStartTime )
+			{
+				m_uPipelinesPrecompiled++;
+
+				// Startup-time measurement, compare runs with/without a warm cache
+				// (vulkan_pipeline_cache 0, or remove $XDG_CACHE_HOME/gamescope/pipelines).
+				if ( bDrained )
+				{
+					const uint64_t ulElapsedTime = get_time_in_nanos() - m_ulPipelinePrecompileStartTime;
+					vk_log.infof( "precompiled %u pipelines in %.2fms", m_uPipelinesPrecompiled, ulElapsedTime / 1'000'000.0 );
+					m_ulPipelinePrecompileStartTime = 0;
+				}
+			}
+		}
+
+		if ( bDrained )
+			savePipelineCache();
+	}
+}
+
+void CVulkanDevice::queuePipelineCompile(const PipelineInfo_t &info, EPipelineCompilePriority ePriority)
+{
+	if (m_pipelineMap.Contains(info))
+		return;
+
+	std::unique_lock lock( m_pipelineCompileMutex );
+
+	auto iter = m_pipelinesQueued.find( info );
+	if ( iter != m_pipelinesQueued.end() )
+	{
+		if ( iter->second.bCompiling || iter->second.ePriority >= ePriority )
+			return;
+
+		// Push it again with the new priority, the old entry gets skipped when popped.
+		iter->second.ePriority = ePriority;
+	}
+	else
+	{
+		m_pipelinesQueued.emplace( info, PipelineCompileState_t{ ePriority, false } );
+	}
+
+	m_pipelineCompileQueue.push( PipelineCompileJob_t{ ePriority, m_ulPipelineCompileSequence++, info } );
+	m_pipelineCompileCV.notify_one();
+}
+
+void CVulkanDevice::queueLikelyPipelines(const PipelineInfo_t &info)
+{
+	if (!ShaderTypeHasCompositeLayers(info.shaderType))
+		return;
+
+	// Overlays, the cursor, etc coming and going only change the layer count,
+	// the output EOTF and the colorspaces of the layers below stay the same.
+	for (uint32_t layerCount = 1; layerCount <= k_nMaxLayers; layerCount++)
+	{
+		if (layerCount == info.layerCount || info.blurLayerCount > layerCount)
+			continue;
+
+		PipelineInfo_t likely = info;
+		likely.layerCount = layerCount;
+		likely.ycbcrMask &= (1u << layerCount) - 1;
+		likely.colorspaceMask &= (1u << (layerCount * GamescopeAppTextureColorspace_Bits)) - 1;
+		// Assume new layers are regular sRGB overlays.
+		for (uint32_t i = info.layerCount; i < layerCount; i++)
+			likely.colorspaceMask |= GAMESCOPE_APP_TEXTURE_COLORSPACE_SRGB << (i * GamescopeAppTextureColorspace_Bits);
+
+		queuePipelineCompile(likely, k_EPipelineCompilePriority_Likely);
+	}
+}
+
+VkPipeline CVulkanDevice::findFallbackPipeline(const PipelineInfo_t &info)
+{
+	// Only the specialization constants that affect the color math may differ,
+	// the layer count, ycbcr and blur masks decide which descriptors get read.
+	if (!ShaderTypeHasCompositeLayers(info.shaderType))
+		return VK_NULL_HANDLE;
+
+	VkPipeline bestPipeline = VK_NULL_HANDLE;
+	int nBestScore = -1;
+	m_pipelineMap.ForEach([&](const PipelineInfo_t &candidate, VkPipeline candidatePipeline)
+	{
+		if (candidatePipeline == VK_NULL_HANDLE ||
+		    candidate.shaderType != info.shaderType ||
+		    candidate.layerCount != info.layerCount ||
+		    candidate.ycbcrMask != info.ycbcrMask ||
+		    candidate.blurLayerCount != info.blurLayerCount)
+			return;
+
+		int nScore = 0;
+		if (candidate.outputEOTF == info.outputEOTF)
+			nScore += 8;
+		if (candidate.colorspaceMask == info.colorspaceMask)
+			nScore += 4;
+		if (candidate.itmEnable == info.itmEnable)
+			nScore += 2;
+		if (candidate.compositeDebug == info.compositeDebug)
+			nScore += 1;
+
+		if (nScore > nBestScore)
+		{
+			bestPipeline = candidatePipeline;
+			nBestScore = nScore;
+		}
+	});
+
+	return bestPipeline;
+}
+
+extern bool g_bSteamIsActiveWindow;
+
+VkPipeline CVulkanDevice::pipeline(ShaderType type, uint32_t layerCount, uint32_t ycbcrMask, uint32_t blur_layers, uint32_t colorspace_mask, uint32_t output_eotf, bool itm_enable)
+{
+	uint32_t effective_debug = g_uCompositeDebug;
+	if ( g_bSteamIsActiveWindow )
+		effective_debug &= ~(CompositeDebugFlag::Heatmap | CompositeDebugFlag::Heatmap_MSWCG | CompositeDebugFlag::Heatmap_Hard);
+
+	PipelineInfo_t key = {type, layerCount, ycbcrMask, blur_layers, effective_debug, colorspace_mask, output_eotf, itm_enable, usesHalfPrecision(type)};
+	if (std::optional<VkPipeline> oPipeline = m_pipelineMap.Find(key))
+		return *oPipeline;
+
+	if ( cv_pipeline_fallback )
+	{
+		// Get the exact variant compiled ASAP, and composite with the
+		// closest one we have in the meantime instead of stalling.
+		queuePipelineCompile(key, k_EPipelineCompilePriority_Demand);
+		queueLikelyPipelines(key);
+
+		VkPipeline fallback = findFallbackPipeline(key);
+		if (fallback != VK_NULL_HANDLE)
+			return fallback;
+	}
+
+	// Nothing we can substitute, compile it here.
+	VkPipeline result = compilePipeline(layerCount, ycbcrMask, type, blur_layers, effective_debug, colorspace_mask, output_eotf, itm_enable, key.halfPrecision);
+	auto [ cachedPipeline, bInserted ] = m_pipelineMap.Insert(key, result);
+	if (!bInserted)
+	{
+		// A compile thread beat us to it.
+		vk.DestroyPipeline(device(), result, nullptr);
+	}
+	return cachedPipeline;
+}
+
+
 int32_t CVulkanDevice::findMemoryType( VkMemoryPropertyFlags properties, uint32_t requiredTypeBits )
 {
 	for ( uint32_t i = 0; i < m_memoryProperties.memoryTypeCount; i++ )
@@ -1196,6 +1812,10 @@ int32_t CVulkanDevice::findMemoryType( VkMemoryPropertyFlags properties, uint32_
 std::unique_ptr<CVulkanCmdBuffer> CVulkanDevice::commandBuffer()
 {
 	std::unique_ptr<CVulkanCmdBuffer> cmdBuffer;
+	// Pick up whatever the GPU finished since the last frame before growing the pool.
+	if (m_unusedCmdBufs.empty())
+		garbageCollect();
+
 	if (m_unusedCmdBufs.empty())
 	{
 		VkCommandBuffer rawCmdBuffer;
@@ -1213,7 +1833,7 @@ std::unique_ptr<CVulkanCmdBuffer> CVulkanDevice::commandBuffer()
 			return nullptr;
 		}
 
-		cmdBuffer = std::make_unique<CVulkanCmdBuffer>(this, rawCmdBuffer, queue(), queueFamily());
+		cmdBuffer = std::make_unique<CVulkanCmdBuffer>(this, rawCmdBuffer, m_commandPool, queue(), queueFamily());
 	}
 	else
 	{
@@ -1235,6 +1855,8 @@ uint64_t CVulkanDevice::submitInternal( CVulkanCmdBuffer* cmdBuffer )
 	// This is the seq no of the command buffer we are going to submit.
 	const uint64_t nextSeqNo = lastSubmissionSeqNo + 1;
 
+	submitUploadBuffer(cmdBuffer, nextSeqNo);
+
 	std::vector<VkSemaphore> pSignalSemaphores;
 	std::vector<uint64_t> ulSignalPoints;
 
@@ -1299,6 +1921,107 @@ void CVulkanDevice::garbageCollect( void )
 	vk_check( vk.GetSemaphoreCounterValue(device(), m_scratchTimelineSemaphore, &currentSeqNo) );
 
 	resetCmdBuffers(currentSeqNo);
+	retireUploadBuffer(currentSeqNo);
+}
+
+void *CVulkanDevice::uploadBufferData(uint32_t size, CVulkanCmdBuffer *pCmdBuffer)
+{
+	for (;;)
+	{
+		if (m_uploadBufferUsed == 0)
+			m_uploadBufferHead = m_uploadBufferTail = 0;
+
+		uint32_t offset = align(m_uploadBufferHead, m_uploadBufferAlignment);
+		std::optional<uint32_t> oOffset;
+		if (m_uploadBufferUsed == 0 || m_uploadBufferHead > m_uploadBufferTail)
+		{
+			// Free space is [head, end) and [0, tail).
+			if (uint64_t(offset) + size <= m_uploadBufferSize)
+			{
+				oOffset = offset;
+			}
+			else if (size <= m_uploadBufferTail)
+			{
+				oOffset = 0;
+			}
+		}
+		else if (m_uploadBufferHead < m_uploadBufferTail)
+		{
+			// Free space is [head, tail).
+			if (uint64_t(offset) + size <= m_uploadBufferTail)
+				oOffset = offset;
+		}
+
+		if (oOffset)
+		{
+			// Includes the padding skipped for alignment or at the end when wrapping.
+			const uint32_t uConsumed = (*oOffset >= m_uploadBufferHead ? *oOffset - m_uploadBufferHead : m_uploadBufferSize - m_uploadBufferHead) + size;
+			m_uploadBufferUsed += uConsumed;
+			m_uploadBufferHead = *oOffset + size;
+
+			if (!m_uploadBufferRegions.empty() && m_uploadBufferRegions.back().pCmdBuffer == pCmdBuffer)
+			{
+				m_uploadBufferRegions.back().uEnd = m_uploadBufferHead;
+				m_uploadBufferRegions.back().uSize += uConsumed;
+			}
+			else
+			{
+				m_uploadBufferRegions.push_back(UploadBufferRegion_t{ pCmdBuffer, 0, m_uploadBufferHead, uConsumed });
+			}
+
+			return ((uint8_t*)m_uploadBufferData) + *oOffset;
+		}
+
+		// Anything the GPU finished with in the meantime?
+		uint64_t currentSeqNo;
+		vk_check( vk.GetSemaphoreCounterValue(device(), m_scratchTimelineSemaphore, &currentSeqNo) );
+		const UploadBufferRegion_t *pOldest = m_uploadBufferRegions.empty() ? nullptr : &m_uploadBufferRegions.front();
+		if (pOldest && !pOldest->pCmdBuffer && pOldest->ulSeqNo <= currentSeqNo)
+		{
+			retireUploadBuffer(currentSeqNo);
+			continue;
+		}
+
+		// Rather grow than stall, eg. for big shm buffers from software rendered clients.
+		if (growUploadBuffer(size, false))
+			continue;
+
+		// Only wait for as much of the ring as we need, not for the whole device.
+		if (pOldest && !pOldest->pCmdBuffer)
+		{
+			wait(pOldest->ulSeqNo, false);
+			continue;
+		}
+
+		// The oldest data belongs to a command buffer that is still being
+		// recorded, waiting won't free it. Grow past the limit instead.
+		if (growUploadBuffer(size, true))
+			continue;
+
+		vk_log.errorf("Exceeded upload buffer (%u bytes in use, %u requested)", m_uploadBufferUsed, size);
+		return nullptr;
+	}
+}
+
+void CVulkanDevice::retireUploadBuffer(uint64_t sequence)
+{
+	while (!m_uploadBufferRegions.empty() && !m_uploadBufferRegions.front().pCmdBuffer && m_uploadBufferRegions.front().ulSeqNo <= sequence)
+	{
+		const UploadBufferRegion_t &region = m_uploadBufferRegions.front();
+		m_uploadBufferTail = region.uEnd;
+		m_uploadBufferUsed -= region.uSize;
+		m_uploadBufferRegions.pop_front();
+	}
+
+	std::erase_if(m_retiredUploadBuffers, [&](const RetiredUploadBuffer_t &retired)
+	{
+		if (!retired.pendingCmdBuffers.empty() || retired.ulSeqNo > sequence)
+			return false;
+
+		vk.DestroyBuffer(device(), retired.buffer, nullptr);
+		vk.FreeMemory(device(), retired.memory, nullptr);
+		return true;
+	});
 }
 
 VulkanTimelineSemaphore_t::~VulkanTimelineSemaphore_t()
@@ -1427,9 +2150,6 @@ void CVulkanCmdBuffer::AddSignal( std::shared_ptr<VulkanTimelineSemaphore_t> pTi
 
 void CVulkanDevice::wait(uint64_t sequence, bool reset)
 {
-	if (m_submissionSeqNo == sequence)
-		m_uploadBufferOffset = 0;
-
 	VkSemaphoreWaitInfo waitInfo = {
 		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
 		.semaphoreCount = 1,
@@ -1439,6 +2159,8 @@ void CVulkanDevice::wait(uint64_t sequence, bool reset)
 
 	vk_check( vk.WaitSemaphores( device(), &waitInfo, ~0ull ) );
 
+	retireUploadBuffer(sequence);
+
 	if (reset)
 		resetCmdBuffers(sequence);
 }
@@ -1448,31 +2170,83 @@ void CVulkanDevice::waitIdle(bool reset)
 	wait(m_submissionSeqNo, reset);
 }
 
-void CVulkanDevice::resetCmdBuffers(uint64_t sequence)
+int CVulkanDevice::exportSyncFile(uint64_t sequence)
 {
-	auto last = m_pendingCmdBufs.find(sequence);
-	if (last == m_pendingCmdBufs.end())
-		return;
+	if ( !m_bSupportsSyncFileExport )
+		return -1;
+
+	// Chain the binary semaphore onto the timeline point with an empty submission.
+	VkTimelineSemaphoreSubmitInfo timelineInfo = {
+		.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+		.waitSemaphoreValueCount = 1,
+		.pWaitSemaphoreValues = &sequence,
+	};
+
+	const VkPipelineStageFlags uWaitStageFlags = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+	VkSubmitInfo submitInfo = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.pNext = &timelineInfo,
+		.waitSemaphoreCount = 1,
+		.pWaitSemaphores = &m_scratchTimelineSemaphore,
+		.pWaitDstStageMask = &uWaitStageFlags,
+		.signalSemaphoreCount = 1,
+		.pSignalSemaphores = &m_syncFileSemaphore,
+	};
+
+	VkResult res = vk.QueueSubmit( queue(), 1, &submitInfo, VK_NULL_HANDLE );
+	if ( res != VK_SUCCESS )
+	{
+		vk_errorf( res, "vkQueueSubmit failed for sync_file export" );
+		return -1;
+	}
 
-	for (auto it = m_pendingCmdBufs.begin(); ; it++)
+	// Exporting a sync_file resets the semaphore, so it's ready for the next one.
+	const VkSemaphoreGetFdInfoKHR semaphoreGetInfo = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_FD_INFO_KHR,
+		.semaphore = m_syncFileSemaphore,
+		.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT,
+	};
+
+	int32_t nFd = -1;
+	if ( ( res = vk.GetSemaphoreFdKHR( device(), &semaphoreGetInfo, &nFd ) ) != VK_SUCCESS )
+	{
+		vk_errorf( res, "vkGetSemaphoreFdKHR failed for sync_file export" );
+		// The semaphore is left signalled, it can't be signalled again.
+		m_bSupportsSyncFileExport = false;
+		return -1;
+	}
+
+	return nFd;
+}
+
+void CVulkanDevice::resetCmdBuffers(uint64_t sequence)
+{
+	// Everything submitted up to sequence is done, not just the one with that exact seq no.
+	auto end = m_pendingCmdBufs.upper_bound(sequence);
+	for (auto it = m_pendingCmdBufs.begin(); it != end; it++)
 	{
+		it->second->resolveGPUPasses();
 		it->second->reset();
 		m_unusedCmdBufs.push_back(std::move(it->second));
-		if (it == last)
-			break;
 	}
 
-	m_pendingCmdBufs.erase(m_pendingCmdBufs.begin(), ++last);
+	m_pendingCmdBufs.erase(m_pendingCmdBufs.begin(), end);
 }
 
-CVulkanCmdBuffer::CVulkanCmdBuffer(CVulkanDevice *parent, VkCommandBuffer cmdBuffer, VkQueue queue, uint32_t queueFamily)
-	: m_cmdBuffer(cmdBuffer), m_device(parent), m_queue(queue), m_queueFamily(queueFamily)
+CVulkanCmdBuffer::CVulkanCmdBuffer(CVulkanDevice *parent, VkCommandBuffer cmdBuffer, VkCommandPool commandPool, VkQueue queue, uint32_t queueFamily)
+	: m_cmdBuffer(cmdBuffer), m_commandPool(commandPool), m_device(parent), m_queue(queue), m_queueFamily(queueFamily)
 {
 }
 
 CVulkanCmdBuffer::~CVulkanCmdBuffer()
 {
-	m_device->vk.FreeCommandBuffers(m_device->device(), m_device->commandPool(), 1, &m_cmdBuffer);
+	for (VkDescriptorPool descriptorPool : m_descriptorPools)
+		m_device->vk.DestroyDescriptorPool(m_device->device(), descriptorPool, nullptr);
+	if (m_gpuPassQueryPool != VK_NULL_HANDLE)
+		m_device->vk.DestroyQueryPool(m_device->device(), m_gpuPassQueryPool, nullptr);
+	m_device->releaseUploadBuffer(this);
+	m_device->vk.FreeCommandBuffers(m_device->device(), m_commandPool, 1, &m_cmdBuffer);
 }
 
 void CVulkanCmdBuffer::reset()
@@ -1481,8 +2255,131 @@ void CVulkanCmdBuffer::reset()
 	m_textureRefs.clear();
 	m_textureState.clear();
 
+	for (uint32_t i = 0; i < m_descriptorPools.size() && i <= m_currentDescriptorPool; i++)
+		vk_check( m_device->vk.ResetDescriptorPool(m_device->device(), m_descriptorPools[i], 0) );
+	m_currentDescriptorPool = 0;
+
 	m_ExternalDependencies.clear();
 	m_ExternalSignals.clear();
+
+	m_gpuPasses.clear();
+	m_bGPUPassOpen = false;
+}
+
+static gamescope::ConVar<bool> cv_gpu_pass_timestamps{ "gpu_pass_timestamps", true, "Time each pass of the composite on the GPU, see gpu_pass_stats." };
+
+void CVulkanCmdBuffer::beginGPUPass(EGPUPass ePass)
+{
+	assert(!m_bGPUPassOpen);
+
+	if (!cv_gpu_pass_timestamps || !m_device->supportsTimestamps() || m_gpuPasses.size() == k_uMaxGPUPasses)
+		return;
+
+	if (m_gpuPassQueryPool == VK_NULL_HANDLE)
+	{
+		VkQueryPoolCreateInfo queryPoolCreateInfo =
+		{
+			.sType      = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+			.queryType  = VK_QUERY_TYPE_TIMESTAMP,
+			.queryCount = 2 * k_uMaxGPUPasses,
+		};
+
+		if (m_device->vk.CreateQueryPool(m_device->device(), &queryPoolCreateInfo, nullptr, &m_gpuPassQueryPool) != VK_SUCCESS)
+		{
+			// Not fatal, stop trying until someone turns it back on.
+			vk_log.errorf("vkCreateQueryPool failed, disabling GPU pass timestamps");
+			m_gpuPassQueryPool = VK_NULL_HANDLE;
+			cv_gpu_pass_timestamps = false;
+			return;
+		}
+	}
+
+	if (m_gpuPasses.empty())
+		m_device->vk.CmdResetQueryPool(m_cmdBuffer, m_gpuPassQueryPool, 0, 2 * k_uMaxGPUPasses);
+
+	m_device->vk.CmdWriteTimestamp(m_cmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_gpuPassQueryPool, 2 * uint32_t(m_gpuPasses.size()));
+	m_gpuPasses.push_back(GPUPass_t{ ePass });
+	m_bGPUPassOpen = true;
+}
+
+void CVulkanCmdBuffer::setGPUPassTiles(uint32_t uTilesComposited, uint32_t uTilesTotal)
+{
+	if (!m_bGPUPassOpen)
+		return;
+
+	m_gpuPasses.back().uTilesComposited = uTilesComposited;
+	m_gpuPasses.back().uTilesTotal = uTilesTotal;
+}
+
+void CVulkanCmdBuffer::endGPUPass()
+{
+	if (!m_bGPUPassOpen)
+		return;
+
+	m_device->vk.CmdWriteTimestamp(m_cmdBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_gpuPassQueryPool, 2 * uint32_t(m_gpuPasses.size()) - 1);
+	m_bGPUPassOpen = false;
+}
+
+static void composite_record_tile_time( double flGPUTimeMs, uint32_t uTilesComposited, uint32_t uTilesTotal );
+
+void CVulkanCmdBuffer::resolveGPUPasses()
+{
+	// An unterminated pass has no end timestamp, drop it.
+	if (m_bGPUPassOpen)
+		m_gpuPasses.pop_back();
+
+	if (m_gpuPasses.empty())
+		return;
+
+	// The timeline semaphore says we're done, so this never waits.
+	std::array<uint64_t, 2 * k_uMaxGPUPasses> ulTimestamps = {};
+	if (m_device->vk.GetQueryPoolResults(m_device->device(), m_gpuPassQueryPool, 0, 2 * uint32_t(m_gpuPasses.size()),
+		sizeof(ulTimestamps), ulTimestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+		return;
+
+	for (uint32_t i = 0; i < m_gpuPasses.size(); i++)
+	{
+		double flGPUTimeMs = double(ulTimestamps[2 * i + 1] - ulTimestamps[2 * i]) * m_device->timestampPeriod() / 1'000'000.0;
+		vulkan_record_gpu_pass_time(m_gpuPasses[i].ePass, flGPUTimeMs);
+		if (m_gpuPasses[i].uTilesTotal)
+			composite_record_tile_time(flGPUTimeMs, m_gpuPasses[i].uTilesComposited, m_gpuPasses[i].uTilesTotal);
+	}
+}
+
+VkDescriptorSet CVulkanCmdBuffer::allocateDescriptorSet()
+{
+	VkDescriptorSetLayout descriptorSetLayout = m_device->m_descriptorSetLayout;
+
+	for (;;)
+	{
+		if (m_currentDescriptorPool == m_descriptorPools.size())
+		{
+			VkDescriptorPool descriptorPool = m_device->createDescriptorPool();
+			if (descriptorPool == VK_NULL_HANDLE)
+				return VK_NULL_HANDLE;
+			m_descriptorPools.push_back(descriptorPool);
+		}
+
+		VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {
+			.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+			.descriptorPool = m_descriptorPools[m_currentDescriptorPool],
+			.descriptorSetCount = 1,
+			.pSetLayouts = &descriptorSetLayout,
+		};
+
+		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+		VkResult res = m_device->vk.AllocateDescriptorSets(m_device->device(), &descriptorSetAllocateInfo, &descriptorSet);
+		if (res == VK_SUCCESS)
+			return descriptorSet;
+
+		if (res != VK_ERROR_OUT_OF_POOL_MEMORY && res != VK_ERROR_FRAGMENTED_POOL)
+		{
+			vk_errorf( res, "vkAllocateDescriptorSets failed" );
+			return VK_NULL_HANDLE;
+		}
+
+		m_currentDescriptorPool++;
+	}
 }
 
 void CVulkanCmdBuffer::begin()
@@ -1560,8 +2457,14 @@ void CVulkanCmdBuffer::uploadConstants(Args&&... args)
 {
 	PushData data(std::forward<Args>(args)...);
 
-	void *ptr = m_device->uploadBufferData(sizeof(data));
-	m_renderBufferOffset = m_device->m_uploadBufferOffset - sizeof(data);
+	void *ptr = m_device->uploadBufferData(sizeof(data), this);
+	// Already logged, leave the last constants bound rather than alias live data.
+	if (!ptr)
+		return;
+
+	m_renderBuffer = m_device->uploadBuffer();
+	m_renderBufferOffset = m_device->uploadBufferOffset(ptr);
+	m_renderBufferRange = std::min<VkDeviceSize>(m_device->uploadBufferSize() - m_renderBufferOffset, m_device->m_uploadBufferMaxRange);
 	memcpy(ptr, &data, sizeof(data));
 }
 
@@ -1581,11 +2484,18 @@ void CVulkanCmdBuffer::dispatch(uint32_t x, uint32_t y, uint32_t z)
 	prepareDestImage(m_target);
 	insertBarrier();
 
-	VkDescriptorSet descriptorSet = m_device->descriptorSet();
+	// Push descriptors need no set, dstSet is ignored.
+	VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+	if (!m_device->supportsPushDescriptors())
+	{
+		descriptorSet = allocateDescriptorSet();
+		if (descriptorSet == VK_NULL_HANDLE)
+			return;
+	}
 
 	std::array<VkWriteDescriptorSet, 7> writeDescriptorSets;
 	std::array<VkDescriptorImageInfo, VKR_SAMPLER_SLOTS> imageDescriptors = {};
-	std::array<VkDescriptorImageInfo, VKR_SAMPLER_SLOTS> ycbcrImageDescriptors = {};
+	std::array<VkDescriptorImageInfo, VKR_YCBCR_SAMPLER_SLOTS> ycbcrImageDescriptors = {};
 	std::array<VkDescriptorImageInfo, VKR_TARGET_SLOTS> targetDescriptors = {};
 	std::array<VkDescriptorImageInfo, VKR_LUT3D_COUNT> shaperLutDescriptor = {};
 	std::array<VkDescriptorImageInfo, VKR_LUT3D_COUNT> lut3DDescriptor = {};
@@ -1661,22 +2571,27 @@ void CVulkanCmdBuffer::dispatch(uint32_t x, uint32_t y, uint32_t z)
 		.pImageInfo = lut3DDescriptor.data(),
 	};
 
-	scratchDescriptor.buffer = m_device->m_uploadBuffer;
+	scratchDescriptor.buffer = m_renderBuffer;
 	scratchDescriptor.offset = m_renderBufferOffset;
-	scratchDescriptor.range = VK_WHOLE_SIZE;
+	scratchDescriptor.range = m_renderBufferRange;
+
+	for (uint32_t i = 0; i < VKR_YCBCR_SAMPLER_SLOTS; i++)
+		ycbcrImageDescriptors[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
 
 	for (uint32_t i = 0; i < VKR_SAMPLER_SLOTS; i++)
 	{
 		imageDescriptors[i].sampler = m_device->sampler(m_samplerState[i]);
 		imageDescriptors[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-		ycbcrImageDescriptors[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
 		if (m_boundTextures[i] == nullptr)
 			continue;
 
 		VkImageView view = m_useSrgb[i] ? m_boundTextures[i]->srgbView() : m_boundTextures[i]->linearView();
 
 		if (m_boundTextures[i]->format() == VK_FORMAT_G8_B8R8_2PLANE_420_UNORM)
+		{
+			assert(i < VKR_YCBCR_SAMPLER_SLOTS);
 			ycbcrImageDescriptors[i].imageView = view;
+		}
 		else
 			imageDescriptors[i].imageView = view;
 	}
@@ -1715,9 +2630,16 @@ void CVulkanCmdBuffer::dispatch(uint32_t x, uint32_t y, uint32_t z)
 		targetDescriptors[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
 	}
 
-	m_device->vk.UpdateDescriptorSets(m_device->device(), writeDescriptorSets.size(), writeDescriptorSets.data(), 0, nullptr);
+	if (m_device->supportsPushDescriptors())
+	{
+		m_device->vk.CmdPushDescriptorSetKHR(m_cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_device->pipelineLayout(), 0, writeDescriptorSets.size(), writeDescriptorSets.data());
+	}
+	else
+	{
+		m_device->vk.UpdateDescriptorSets(m_device->device(), writeDescriptorSets.size(), writeDescriptorSets.data(), 0, nullptr);
 
-	m_device->vk.CmdBindDescriptorSets(m_cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_device->pipelineLayout(), 0, 1, &descriptorSet, 0, nullptr);
+		m_device->vk.CmdBindDescriptorSets(m_cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_device->pipelineLayout(), 0, 1, &descriptorSet, 0, nullptr);
+	}
 
 	m_device->vk.CmdDispatch(m_cmdBuffer, x, y, z);
 
@@ -1811,6 +2733,16 @@ void CVulkanCmdBuffer::discardImage(CVulkanTexture *image)
 	result.first->second.discarded = true;
 }
 
+void CVulkanCmdBuffer::preserveImage(CVulkanTexture *image)
+{
+	auto result = m_textureState.emplace(image, TextureState());
+	if (!result.second)
+		return;
+	result.first->second.needsImport = image->externalImage();
+	result.first->second.needsExport = image->externalImage();
+	result.first->second.needsPresentLayout = image->outputImage();
+}
+
 void CVulkanCmdBuffer::markDirty(CVulkanTexture *image)
 {
 	auto result = m_textureState.find(image);
@@ -2154,24 +3086,57 @@ bool CVulkanTexture::BInit( uint32_t width, uint32_t height, uint32_t depth, uin
 		imageInfo.tiling = tiling = VK_IMAGE_TILING_DRM_FORMAT_MODIFIER_EXT;
 	}
 
-	if ( flags.bFlippable == true && tiling != VK_IMAGE_TILING_DRM_FORMAT_MODIFIER_EXT )
-	{
-		// We want to scan-out the image
-		wsiImageCreateInfo = {
-			.sType = VK_STRUCTURE_TYPE_WSI_IMAGE_CREATE_INFO_MESA,
-			.pNext = std::exchange(imageInfo.pNext, &wsiImageCreateInfo),
-			.scanout = VK_TRUE,
-		};
-	}
-	
-	if ( pDMA != nullptr )
+	if ( flags.ulExportModifier != DRM_FORMAT_MOD_INVALID && g_device.supportsModifiers() && !pDMA )
 	{
-		externalImageCreateInfo = {
-			.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO,
-			.pNext = std::exchange(imageInfo.pNext, &externalImageCreateInfo),
-			.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT,
+		assert( flags.bExportable && !flags.bMappable && !flags.bFlippable );
+
+		VkExternalImageFormatProperties externalFormatProps = {
+			.sType = VK_STRUCTURE_TYPE_EXTERNAL_IMAGE_FORMAT_PROPERTIES,
 		};
-	}
+		res = getModifierProps( &imageInfo, flags.ulExportModifier, &externalFormatProps );
+		if ( res != VK_SUCCESS ||
+		     !( externalFormatProps.externalMemoryProperties.externalMemoryFeatures & VK_EXTERNAL_MEMORY_FEATURE_EXPORTABLE_BIT ) )
+		{
+			vk_log.errorf( "Can't export DRM format 0x%" PRIX32 " with modifier 0x%" PRIX64, drmFormat, flags.ulExportModifier );
+			return false;
+		}
+
+		modifiers.push_back( flags.ulExportModifier );
+
+		modifierListInfo = {
+			.sType = VK_STRUCTURE_TYPE_IMAGE_DRM_FORMAT_MODIFIER_LIST_CREATE_INFO_EXT,
+			.pNext = std::exchange(imageInfo.pNext, &modifierListInfo),
+			.drmFormatModifierCount = uint32_t(modifiers.size()),
+			.pDrmFormatModifiers = modifiers.data(),
+		};
+
+		externalImageCreateInfo = {
+			.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO,
+			.pNext = std::exchange(imageInfo.pNext, &externalImageCreateInfo),
+			.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT,
+		};
+
+		imageInfo.tiling = tiling = VK_IMAGE_TILING_DRM_FORMAT_MODIFIER_EXT;
+	}
+
+	if ( flags.bFlippable == true && tiling != VK_IMAGE_TILING_DRM_FORMAT_MODIFIER_EXT )
+	{
+		// We want to scan-out the image
+		wsiImageCreateInfo = {
+			.sType = VK_STRUCTURE_TYPE_WSI_IMAGE_CREATE_INFO_MESA,
+			.pNext = std::exchange(imageInfo.pNext, &wsiImageCreateInfo),
+			.scanout = VK_TRUE,
+		};
+	}
+	
+	if ( pDMA != nullptr )
+	{
+		externalImageCreateInfo = {
+			.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO,
+			.pNext = std::exchange(imageInfo.pNext, &externalImageCreateInfo),
+			.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT,
+		};
+	}
 
 	m_width = width;
 	m_height = height;
@@ -2391,6 +3356,34 @@ bool CVulkanTexture::BInit( uint32_t width, uint32_t height, uint32_t depth, uin
 				}
 			}
 		}
+		else if ( isYcbcr() )
+		{
+			// Linear multi-planar images keep all their planes in the one allocation.
+			const VkImageAspectFlagBits planeAspects[] = {
+				VK_IMAGE_ASPECT_PLANE_0_BIT,
+				VK_IMAGE_ASPECT_PLANE_1_BIT,
+			};
+
+			dmabuf.n_planes = 2;
+			dmabuf.modifier = DRM_FORMAT_MOD_INVALID;
+
+			for ( int i = 0; i < dmabuf.n_planes; i++ )
+			{
+				const VkImageSubresource subresource = {
+					.aspectMask = planeAspects[i],
+				};
+				VkSubresourceLayout subresourceLayout = {};
+				g_device.vk.GetImageSubresourceLayout( g_device.device(), m_vkImage, &subresource, &subresourceLayout );
+				dmabuf.offset[i] = subresourceLayout.offset;
+				dmabuf.stride[i] = subresourceLayout.rowPitch;
+			}
+
+			dmabuf.fd[1] = dup( dmabuf.fd[0] );
+			if ( dmabuf.fd[1] < 0 ) {
+				vk_log.errorf_errno( "dup failed" );
+				return false;
+			}
+		}
 		else
 		{
 			const VkImageSubresource subresource = {
@@ -2989,23 +3982,29 @@ gamescope::Rc<CVulkanTexture> vulkan_create_3d_lut(uint32_t width, uint32_t heig
 	return texture;
 }
 
-void vulkan_update_luts(const gamescope::Rc<CVulkanTexture>& lut1d, const gamescope::Rc<CVulkanTexture>& lut3d, void* lut1d_data, void* lut3d_data)
+// Doesn't wait for the copy: anything compositing with these LUTs is
+// submitted after it on the same queue. Callers must not overwrite LUTs
+// a frame in flight is still sampling, see commit_color_mgmt_luts.
+uint64_t vulkan_update_luts(const gamescope::Rc<CVulkanTexture>& lut1d, const gamescope::Rc<CVulkanTexture>& lut3d, const void* lut1d_data, const void* lut3d_data)
 {
 	size_t lut1d_size = lut1d->width() * sizeof(uint16_t) * 4;
 	size_t lut3d_size = lut3d->width() * lut3d->height() * lut3d->depth() * sizeof(uint16_t) * 4;
 
-	void* base_dst = g_device.uploadBufferData(lut1d_size + lut3d_size);
+	auto cmdBuffer = g_device.commandBuffer();
+
+	void* base_dst = g_device.uploadBufferData(lut1d_size + lut3d_size, cmdBuffer.get());
+	if (!base_dst)
+		return g_device.submit(std::move(cmdBuffer));
+	VkDeviceSize base_offset = g_device.uploadBufferOffset(base_dst);
 
 	void* lut1d_dst = base_dst;
 	void *lut3d_dst = ((uint8_t*)base_dst) + lut1d_size;
 	memcpy(lut1d_dst, lut1d_data, lut1d_size);
 	memcpy(lut3d_dst, lut3d_data, lut3d_size);
 
-	auto cmdBuffer = g_device.commandBuffer();
-	cmdBuffer->copyBufferToImage(g_device.uploadBuffer(), 0, 0, lut1d);
-	cmdBuffer->copyBufferToImage(g_device.uploadBuffer(), lut1d_size, 0, lut3d);
-	g_device.submit(std::move(cmdBuffer));
-	g_device.waitIdle(); // TODO: Sync this better
+	cmdBuffer->copyBufferToImage(g_device.uploadBuffer(), base_offset, 0, lut1d);
+	cmdBuffer->copyBufferToImage(g_device.uploadBuffer(), base_offset + lut1d_size, 0, lut3d);
+	return g_device.submit(std::move(cmdBuffer));
 }
 
 gamescope::Rc<CVulkanTexture> vulkan_get_hacky_blank_texture()
@@ -3024,7 +4023,11 @@ gamescope::OwningRc<CVulkanTexture> vulkan_create_flat_texture( uint32_t width,
 	bool bRes = texture->BInit( width, height, 1u, VulkanFormatToDRM( VK_FORMAT_B8G8R8A8_UNORM ), flags );
 	assert( bRes );
 
-	uint8_t* dst = (uint8_t *)g_device.uploadBufferData( width * height * 4 );
+	auto cmdBuffer = g_device.commandBuffer();
+	uint8_t* dst = (uint8_t *)g_device.uploadBufferData( width * height * 4, cmdBuffer.get() );
+	if ( !dst )
+		return nullptr;
+
 	for ( uint32_t i = 0; i < width * height * 4; i += 4 )
 	{
 		dst[i + 0] = b;
@@ -3033,8 +4036,7 @@ gamescope::OwningRc<CVulkanTexture> vulkan_create_flat_texture( uint32_t width,
 		dst[i + 3] = a;
 	}
 
-	auto cmdBuffer = g_device.commandBuffer();
-	cmdBuffer->copyBufferToImage(g_device.uploadBuffer(), 0, 0, texture.get());
+	cmdBuffer->copyBufferToImage(g_device.uploadBuffer(), g_device.uploadBufferOffset(dst), 0, texture.get());
 	g_device.submit(std::move(cmdBuffer));
 	g_device.waitIdle();
 
@@ -3500,11 +4502,14 @@ gamescope::OwningRc<CVulkanTexture> vulkan_create_texture_from_bits( uint32_t wi
 		return nullptr;
 
 	size_t size = width * height * DRMFormatGetBPP(drmFormat);
-	memcpy( g_device.uploadBufferData(size), bits, size );
-
 	auto cmdBuffer = g_device.commandBuffer();
 
-	cmdBuffer->copyBufferToImage(g_device.uploadBuffer(), 0, 0, pTex.get());
+	void *dst = g_device.uploadBufferData(size, cmdBuffer.get());
+	if ( !dst )
+		return nullptr;
+	memcpy( dst, bits, size );
+
+	cmdBuffer->copyBufferToImage(g_device.uploadBuffer(), g_device.uploadBufferOffset(dst), 0, pTex.get());
 	// TODO: Sync this copyBufferToImage.
 
 	g_device.submit(std::move(cmdBuffer));
@@ -3520,6 +4525,11 @@ void vulkan_garbage_collect( void )
 	g_device.garbageCollect();
 }
 
+void vulkan_save_pipeline_cache()
+{
+	g_device.savePipelineCache();
+}
+
 gamescope::Rc<CVulkanTexture> vulkan_acquire_screenshot_texture(uint32_t width, uint32_t height, bool exportable, uint32_t drmFormat, EStreamColorspace colorspace)
 {
 	for (auto& pScreenshotImage : g_output.pScreenshotImages)
@@ -3534,7 +4544,7 @@ gamescope::Rc<CVulkanTexture> vulkan_acquire_screenshot_texture(uint32_t width,
 			screenshotImageFlags.bStorage = true;
 			if (exportable || drmFormat == DRM_FORMAT_NV12) {
 				screenshotImageFlags.bExportable = true;
-				screenshotImageFlags.bLinear = true; // TODO: support multi-planar DMA-BUF export via PipeWire
+				screenshotImageFlags.bLinear = true; // Mapped for readback
 			}
 
 			bool bSuccess = pScreenshotImage->BInit( width, height, 1u, drmFormat, screenshotImageFlags );
@@ -3556,6 +4566,95 @@ gamescope::Rc<CVulkanTexture> vulkan_acquire_screenshot_texture(uint32_t width,
 	return nullptr;
 }
 
+std::vector<uint64_t> vulkan_get_export_modifiers(uint32_t drmFormat, CVulkanTexture::createFlags flags)
+{
+	std::vector<uint64_t> modifiers;
+	if ( !g_device.supportsModifiers() )
+		return modifiers;
+
+	const VkFormat format = DRMFormatToVulkan( drmFormat, false );
+	auto iter = DRMModifierProps.find( format );
+	if ( iter == DRMModifierProps.end() )
+		return modifiers;
+
+	// Must match what BInit creates for these flags.
+	VkImageUsageFlags usage = 0;
+	if ( flags.bSampled )
+		usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+	if ( flags.bStorage )
+		usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+	if ( flags.bColorAttachment )
+		usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	if ( flags.bTransferSrc )
+		usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	if ( flags.bTransferDst )
+		usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+
+	VkImageCreateInfo imageInfo = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+		.imageType = flags.imageType,
+		.format = format,
+		.tiling = VK_IMAGE_TILING_DRM_FORMAT_MODIFIER_EXT,
+		.usage = usage,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+	};
+
+	std::array<VkFormat, 2> formats = {
+		DRMFormatToVulkan(drmFormat, false),
+		DRMFormatToVulkan(drmFormat, true),
+	};
+
+	VkImageFormatListCreateInfo formatList = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_FORMAT_LIST_CREATE_INFO,
+		.viewFormatCount = (uint32_t)formats.size(),
+		.pViewFormats = formats.data(),
+	};
+
+	if ( formats[0] != formats[1] )
+	{
+		formatList.pNext = std::exchange(imageInfo.pNext, &formatList);
+		imageInfo.flags |= VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT;
+	}
+
+	bool bHasLinear = false;
+	for ( const auto &[ modifier, props ] : iter->second )
+	{
+		VkExternalImageFormatProperties externalFormatProps = {
+			.sType = VK_STRUCTURE_TYPE_EXTERNAL_IMAGE_FORMAT_PROPERTIES,
+		};
+		if ( getModifierProps( &imageInfo, modifier, &externalFormatProps ) != VK_SUCCESS )
+			continue;
+
+		if ( !( externalFormatProps.externalMemoryProperties.externalMemoryFeatures & VK_EXTERNAL_MEMORY_FEATURE_EXPORTABLE_BIT ) )
+			continue;
+
+		if ( modifier == DRM_FORMAT_MOD_LINEAR )
+			bHasLinear = true;
+		else
+			modifiers.push_back( modifier );
+	}
+
+	// Tiled first, linear is the fallback everyone can import.
+	if ( bHasLinear )
+		modifiers.push_back( DRM_FORMAT_MOD_LINEAR );
+
+	return modifiers;
+}
+
+uint32_t vulkan_get_modifier_plane_count(uint32_t drmFormat, uint64_t modifier)
+{
+	const VkFormat format = DRMFormatToVulkan( drmFormat, false );
+	auto iter = DRMModifierProps.find( format );
+	if ( iter == DRMModifierProps.end() )
+		return 0;
+
+	auto modifierIter = iter->second.find( modifier );
+	if ( modifierIter == iter->second.end() )
+		return 0;
+
+	return modifierIter->second.drmFormatModifierPlaneCount;
+}
+
 // Internal display's native brightness.
 float g_flInternalDisplayBrightnessNits = 500.0f;
 
@@ -3580,6 +4679,8 @@ struct BlitPushData_t
     float u_itmSdrNits; // unset
     float u_itmTargetNits; // unset
 
+	uint32_t tileOffset[2];
+
 	explicit BlitPushData_t(const struct FrameInfo_t *frameInfo)
 	{
 		u_shaderFilter = 0;
@@ -3617,6 +4718,9 @@ struct BlitPushData_t
 		u_nitsToLinear = 1.0f / g_flInternalDisplayBrightnessNits;
 		u_itmSdrNits = g_flHDRItmSdrNits;
 		u_itmTargetNits = g_flHDRItmTargetNits;
+
+		tileOffset[0] = 0;
+		tileOffset[1] = 0;
 	}
 
 	explicit BlitPushData_t(float blit_scale) {
@@ -3637,6 +4741,23 @@ struct BlitPushData_t
 		u_nitsToLinear = 1.0f / g_flInternalDisplayBrightnessNits;
 		u_itmSdrNits = g_flHDRItmSdrNits;
 		u_itmTargetNits = g_flHDRItmTargetNits;
+
+		tileOffset[0] = 0;
+		tileOffset[1] = 0;
+	}
+};
+
+struct KawasePushData_t
+{
+	BlitPushData_t blit;
+	float kawaseOffset;
+
+	KawasePushData_t(const struct FrameInfo_t *frameInfo, float flOffset)
+		: blit(frameInfo)
+		, kawaseOffset(flOffset)
+	{
+		// The blur composite reads the finished background with a single tap.
+		blit.blurRadius = 0;
 	}
 };
 
@@ -3775,6 +4896,40 @@ struct NisPushData_t
 			tempX, tempY);
 	}
 };
+
+struct FsrFusedPushData_t
+{
+	RcasPushData_t composite;
+	uvec4_t easuCon[4];
+	uvec2_t layer0Extent;
+
+	FsrFusedPushData_t(const struct FrameInfo_t *frameInfo, float sharpness, uint32_t inputX, uint32_t inputY, uint32_t tempX, uint32_t tempY)
+		: composite(frameInfo, sharpness)
+	{
+		FsrEasuCon(&easuCon[0].x, &easuCon[1].x, &easuCon[2].x, &easuCon[3].x, inputX, inputY, inputX, inputY, tempX, tempY);
+		layer0Extent.x = tempX;
+		layer0Extent.y = tempY;
+	}
+};
+
+struct NisFusedPushData_t
+{
+	RcasPushData_t composite;
+	NISConfig nisConfig;
+
+	NisFusedPushData_t(const struct FrameInfo_t *frameInfo, uint32_t inputX, uint32_t inputY, uint32_t tempX, uint32_t tempY, float sharpness)
+		: composite(frameInfo, 0.0f)
+	{
+		NVScalerUpdateConfig(
+			nisConfig, sharpness,
+			0, 0,
+			inputX, inputY,
+			inputX, inputY,
+			0, 0,
+			tempX, tempY,
+			tempX, tempY);
+	}
+};
 #pragma pack(pop)
 
 void bind_all_layers(CVulkanCmdBuffer* cmdBuffer, const struct FrameInfo_t *frameInfo)
@@ -3809,6 +4964,7 @@ std::optional<uint64_t> vulkan_screenshot( const struct FrameInfo_t *frameInfo,
 	for (uint32_t i = 0; i < EOTF_Count; i++)
 		cmdBuffer->bindColorMgmtLuts(i, frameInfo->shaperLut[i], frameInfo->lut3D[i]);
 
+	cmdBuffer->beginGPUPass(k_EGPUPass_Screenshot);
 	cmdBuffer->bindPipeline( g_device.pipeline(SHADER_TYPE_BLIT, frameInfo->layerCount, frameInfo->ycbcrMask(), 0u, frameInfo->colorspaceMask(), outputTF ));
 	bind_all_layers(cmdBuffer.get(), frameInfo);
 	cmdBuffer->bindTarget(pScreenshotTexture);
@@ -3817,9 +4973,12 @@ std::optional<uint64_t> vulkan_screenshot( const struct FrameInfo_t *frameInfo,
 	const int pixelsPerGroup = 8;
 
 	cmdBuffer->dispatch(div_roundup(currentOutputWidth, pixelsPerGroup), div_roundup(currentOutputHeight, pixelsPerGroup));
+	cmdBuffer->endGPUPass();
 
 	if ( pYUVOutTexture != nullptr )
 	{
+		cmdBuffer->beginGPUPass(k_EGPUPass_Capture);
+
 		float scale = (float)pScreenshotTexture->width() / pYUVOutTexture->width();
 
 		CaptureConvertBlitData_t constants( scale, colorspace_to_conversion_from_srgb_matrix( pYUVOutTexture->streamColorspace() ) );
@@ -3847,21 +5006,539 @@ std::optional<uint64_t> vulkan_screenshot( const struct FrameInfo_t *frameInfo,
 		const int dispatchSize = pixelsPerGroup * 2;
 
 		cmdBuffer->dispatch(div_roundup(pYUVOutTexture->width(), dispatchSize), div_roundup(pYUVOutTexture->height(), dispatchSize));
+		cmdBuffer->endGPUPass();
 	}
 
 	uint64_t sequence = g_device.submit(std::move(cmdBuffer));
 	return sequence;
 }
 
+static gamescope::ConVar<bool> cv_composite_fused_upscale{ "composite_fused_upscale", true, "Do the FSR/NIS upscale of layer 0 in the same dispatch as the composite, instead of upscaling into an intermediate image first." };
+
+// The fused NIS pass writes its output pixels straight to the same
+// coordinates of the composite, layer 0 has to line up with the output.
+static bool nis_fused_covers_output( const struct FrameInfo_t *frameInfo )
+{
+	const FrameInfo_t::Layer_t &layer = frameInfo->layers[0];
+	return !layer.isYcbcr() &&
+		layer.offset.x == 0.0f && layer.offset.y == 0.0f &&
+		layer.integerWidth() == currentOutputWidth &&
+		layer.integerHeight() == currentOutputHeight;
+}
+
+static gamescope::ConVar<bool> cv_composite_tile_damage{ "composite_tile_damage", true, "Only recomposite the tiles of an output image that changed since it was last composited to." };
+
+// Enough frames of damage to bring every output image up to date when
+// they are used round-robin.
+static constexpr uint32_t k_uDamageHistoryLength = 4;
+// Past this many damaged tiles, or rects to dispatch, a full dispatch is cheaper.
+static constexpr uint32_t k_uDamageMaxTilesPercent = 75;
+static constexpr uint32_t k_uDamageMaxRects = 32;
+
+struct CompositeLayerState_t
+{
+	gamescope::Rc<CVulkanTexture> tex;
+	uint64_t ulCommitID = 0;
+	vec2_t offset{};
+	vec2_t scale{};
+	float opacity = 0.0f;
+	GamescopeUpscaleFilter filter = GamescopeUpscaleFilter::LINEAR;
+	GamescopeAppTextureColorspace colorspace = GAMESCOPE_APP_TEXTURE_COLORSPACE_LINEAR;
+	std::shared_ptr<gamescope::BackendBlob> ctm;
+	bool blackBorder = false;
+
+	explicit CompositeLayerState_t( const FrameInfo_t::Layer_t &layer )
+		: tex{ layer.tex }
+		, ulCommitID{ layer.ulCommitID }
+		, offset{ layer.offset }
+		, scale{ layer.scale }
+		, opacity{ layer.opacity }
+		, filter{ layer.filter }
+		, colorspace{ layer.colorspace }
+		, ctm{ layer.ctm }
+		, blackBorder{ layer.blackBorder }
+	{
+	}
+
+	// Everything but the contents of tex.
+	bool SamePlacement( const CompositeLayerState_t &other ) const
+	{
+		return tex && other.tex &&
+			tex->width() == other.tex->width() &&
+			tex->height() == other.tex->height() &&
+			offset.x == other.offset.x && offset.y == other.offset.y &&
+			scale.x == other.scale.x && scale.y == other.scale.y &&
+			opacity == other.opacity &&
+			filter == other.filter &&
+			colorspace == other.colorspace &&
+			ctm == other.ctm &&
+			blackBorder == other.blackBorder;
+	}
+
+	bool SameContents( const CompositeLayerState_t &other ) const
+	{
+		// Client buffers can be committed again with new contents, so go by
+		// commit for those.
+		if ( ulCommitID || other.ulCommitID )
+			return ulCommitID == other.ulCommitID;
+
+		return tex == other.tex;
+	}
+
+	void AddTexels( DamageTiles_t *pDamage, int32_t nX1, int32_t nY1, int32_t nX2, int32_t nY2 ) const
+	{
+		// Output pixel p samples texel ( p + offset ) * scale. Pad by a couple of
+		// texels for the filter taps and a pixel for rounding.
+		const int32_t nPadTexels = 2;
+		pDamage->AddRect(
+			int32_t( floorf( ( nX1 - nPadTexels ) / scale.x - offset.x ) ) - 1,
+			int32_t( floorf( ( nY1 - nPadTexels ) / scale.y - offset.y ) ) - 1,
+			int32_t( ceilf( ( nX2 + nPadTexels ) / scale.x - offset.x ) ) + 1,
+			int32_t( ceilf( ( nY2 + nPadTexels ) / scale.y - offset.y ) ) + 1 );
+	}
+
+	void AddFootprint( DamageTiles_t *pDamage ) const
+	{
+		// Black borders cover everything outside of the texture.
+		if ( !tex || blackBorder || scale.x <= 0.0f || scale.y <= 0.0f )
+		{
+			pDamage->AddAll();
+			return;
+		}
+
+		AddTexels( pDamage, 0, 0, tex->width(), tex->height() );
+	}
+};
+
+struct CompositeState_t
+{
+	uint32_t uWidth = 0;
+	uint32_t uHeight = 0;
+	EOTF outputTF = EOTF_Count;
+	CVulkanTexture *shaperLut[EOTF_Count] = {};
+	CVulkanTexture *lut3D[EOTF_Count] = {};
+	float flLinearToNits = 0.0f;
+	float flItmSdrNits = 0.0f;
+	float flItmTargetNits = 0.0f;
+	std::vector<CompositeLayerState_t> layers;
+
+	bool SameGlobals( const CompositeState_t &other ) const
+	{
+		return uWidth == other.uWidth && uHeight == other.uHeight &&
+			outputTF == other.outputTF &&
+			std::equal( std::begin( shaperLut ), std::end( shaperLut ), std::begin( other.shaperLut ) ) &&
+			std::equal( std::begin( lut3D ), std::end( lut3D ), std::begin( other.lut3D ) ) &&
+			flLinearToNits == other.flLinearToNits &&
+			flItmSdrNits == other.flItmSdrNits &&
+			flItmTargetNits == other.flItmTargetNits &&
+			layers.size() == other.layers.size();
+	}
+};
+
+// Tracks what changed between composites to the output images, so the
+// blit only has to redraw the damaged tiles of the image it reuses.
+class CCompositeDamageTracker
+{
+public:
+	// Damage of a regular composite against the previous one.
+	void Update( FrameInfo_t *frameInfo, EOTF outputTF, bool bForceFull )
+	{
+		CompositeState_t state;
+		state.uWidth = currentOutputWidth;
+		state.uHeight = currentOutputHeight;
+		state.outputTF = outputTF;
+		for ( uint32_t i = 0; i < EOTF_Count; i++ )
+		{
+			state.shaperLut[i] = frameInfo->shaperLut[i].get();
+			state.lut3D[i] = frameInfo->lut3D[i].get();
+		}
+		state.flLinearToNits = g_flInternalDisplayBrightnessNits;
+		state.flItmSdrNits = g_flHDRItmSdrNits;
+		state.flItmTargetNits = g_flHDRItmTargetNits;
+		for ( int i = 0; i < frameInfo->layerCount; i++ )
+			state.layers.emplace_back( frameInfo->layers[i] );
+
+		DamageTiles_t &damage = m_History[ ++m_ulFrame % k_uDamageHistoryLength ];
+		damage.Reset( state.uWidth, state.uHeight );
+
+		if ( bForceFull || !m_bValid || !state.SameGlobals( m_LastState ) )
+		{
+			damage.AddAll();
+		}
+		else
+		{
+			for ( int i = 0; i < frameInfo->layerCount; i++ )
+			{
+				const CompositeLayerState_t &layer = state.layers[i];
+				const CompositeLayerState_t &lastLayer = m_LastState.layers[i];
+
+				if ( layer.SamePlacement( lastLayer ) )
+				{
+					if ( layer.SameContents( lastLayer ) )
+						continue;
+
+					const FrameInfo_t::Layer_t &frameLayer = frameInfo->layers[i];
+					if ( frameLayer.ulCommitID && frameLayer.ulPrevCommitID == lastLayer.ulCommitID )
+					{
+						layer.AddTexels( &damage, frameLayer.damageBox[0], frameLayer.damageBox[1], frameLayer.damageBox[2], frameLayer.damageBox[3] );
+						continue;
+					}
+				}
+
+				lastLayer.AddFootprint( &damage );
+				layer.AddFootprint( &damage );
+			}
+		}
+
+		frameInfo->damage = damage;
+		m_LastState = std::move( state );
+		m_bValid = true;
+	}
+
+	// Tiles output image uImage is missing to show the last updated frame.
+	// Returns false if it has to be redrawn entirely.
+	bool GetImageDamage( uint32_t uImage, CVulkanTexture *pImage, DamageTiles_t *pDamage ) const
+	{
+		const OutputImage_t &image = m_Images[ uImage ];
+		if ( image.pImage != pImage || !image.ulFrame || m_ulFrame - image.ulFrame >= k_uDamageHistoryLength )
+			return false;
+
+		*pDamage = m_History[ m_ulFrame % k_uDamageHistoryLength ];
+		for ( uint64_t ulFrame = image.ulFrame + 1; ulFrame < m_ulFrame; ulFrame++ )
+			*pDamage |= m_History[ ulFrame % k_uDamageHistoryLength ];
+		return true;
+	}
+
+	void OnImageComposited( uint32_t uImage, gamescope::Rc<CVulkanTexture> pImage ) { m_Images[ uImage ] = OutputImage_t{ m_ulFrame, std::move( pImage ) }; }
+	void InvalidateImage( uint32_t uImage ) { m_Images[ uImage ] = OutputImage_t{}; }
+
+private:
+	bool m_bValid = false;
+	CompositeState_t m_LastState;
+
+	uint64_t m_ulFrame = 0;
+	std::array<DamageTiles_t, k_uDamageHistoryLength> m_History;
+	struct OutputImage_t
+	{
+		// Frame the image last received, 0 if its contents are unknown.
+		uint64_t ulFrame = 0;
+		// Held so a remade image can't show up at the same address.
+		gamescope::Rc<CVulkanTexture> pImage;
+	};
+	std::array<OutputImage_t, 3> m_Images;
+};
+
+static CCompositeDamageTracker s_compositeDamage;
+
+// Filled from the composite and from wherever command buffers are retired.
+static std::mutex s_compositeDamageStatsMutex;
+static CompositeDamageStats_t s_compositeDamageStats;
+
+// Estimates what the tiles we skipped would have cost from the time the
+// ones we drew took.
+static void composite_record_tile_time( double flGPUTimeMs, uint32_t uTilesComposited, uint32_t uTilesTotal )
+{
+	double flTileMs = flGPUTimeMs / std::max( uTilesComposited, 1u );
+
+	std::unique_lock lock( s_compositeDamageStatsMutex );
+	s_compositeDamageStats.flSavedGPUTimeMs = s_compositeDamageStats.flSavedGPUTimeMs.value_or( 0.0 ) +
+		flTileMs * ( uTilesTotal - uTilesComposited );
+}
+
+CompositeDamageStats_t vulkan_take_composite_damage_stats()
+{
+	std::unique_lock lock( s_compositeDamageStatsMutex );
+	return std::exchange( s_compositeDamageStats, {} );
+}
+
+const char *GetGPUPassName( EGPUPass ePass )
+{
+	switch ( ePass )
+	{
+		case k_EGPUPass_Reshade:	return "reshade";
+		case k_EGPUPass_Upscale:	return "upscale";
+		case k_EGPUPass_Blur:		return "blur";
+		case k_EGPUPass_Composite:	return "composite";
+		case k_EGPUPass_Capture:	return "capture";
+		case k_EGPUPass_Screenshot:	return "screenshot";
+		default:					return "unknown";
+	}
+}
+
+// Rolling window of GPU pass times. Filled from wherever command buffers
+// are retired, so it has its own lock.
+struct GPUPassTimes_t
+{
+	static constexpr uint32_t k_uWindow = 256;
+
+	std::array<double, k_uWindow> flTimesMs = {};
+	uint32_t uCount = 0;
+	uint32_t uNext = 0;
+};
+
+static std::mutex s_gpuPassTimesMutex;
+static std::array<GPUPassTimes_t, k_EGPUPass_Count> s_gpuPassTimes;
+
+void vulkan_record_gpu_pass_time( EGPUPass ePass, double flGPUTimeMs )
+{
+	if ( ePass >= k_EGPUPass_Count )
+		return;
+
+	gpuvis_trace_printf( "gpu pass %s %.3fms", GetGPUPassName( ePass ), flGPUTimeMs );
+
+	std::unique_lock lock( s_gpuPassTimesMutex );
+	GPUPassTimes_t &times = s_gpuPassTimes[ ePass ];
+	times.flTimesMs[ times.uNext ] = flGPUTimeMs;
+	times.uNext = ( times.uNext + 1 ) % GPUPassTimes_t::k_uWindow;
+	times.uCount = std::min( times.uCount + 1, GPUPassTimes_t::k_uWindow );
+}
+
+std::array<GPUPassStats_t, k_EGPUPass_Count> vulkan_get_gpu_pass_stats()
+{
+	std::array<GPUPassStats_t, k_EGPUPass_Count> stats;
+
+	std::unique_lock lock( s_gpuPassTimesMutex );
+	for ( uint32_t i = 0; i < k_EGPUPass_Count; i++ )
+	{
+		const GPUPassTimes_t &times = s_gpuPassTimes[ i ];
+		if ( !times.uCount )
+			continue;
+
+		std::array<double, GPUPassTimes_t::k_uWindow> flSorted;
+		std::copy_n( times.flTimesMs.begin(), times.uCount, flSorted.begin() );
+		std::sort( flSorted.begin(), flSorted.begin() + times.uCount );
+
+		auto Percentile = [&]( uint32_t uPercent ) { return flSorted[ ( times.uCount - 1 ) * uPercent / 100 ]; };
+		stats[ i ] = GPUPassStats_t
+		{
+			.uSamples = times.uCount,
+			.flP50Ms  = Percentile( 50 ),
+			.flP90Ms  = Percentile( 90 ),
+			.flP99Ms  = Percentile( 99 ),
+		};
+	}
+
+	return stats;
+}
+
+static gamescope::ConCommand cc_gpu_pass_stats( "gpu_pass_stats", "Print the GPU time percentiles of each composite pass.",
+[]( std::span<std::string_view> args )
+{
+	std::array<GPUPassStats_t, k_EGPUPass_Count> stats = vulkan_get_gpu_pass_stats();
+	for ( uint32_t i = 0; i < k_EGPUPass_Count; i++ )
+	{
+		if ( !stats[ i ].uSamples )
+			continue;
+
+		vk_log.infof( "%s: p50 %.3fms p90 %.3fms p99 %.3fms (%u samples)", GetGPUPassName( EGPUPass( i ) ),
+			stats[ i ].flP50Ms, stats[ i ].flP90Ms, stats[ i ].flP99Ms, stats[ i ].uSamples );
+	}
+});
+
+struct DamageTileRect_t
+{
+	uint32_t uX, uY;
+	uint32_t uWidth, uHeight;
+};
+
+// Runs of damaged tiles along each row, merged with the run above when
+// they span the same columns.
+static std::vector<DamageTileRect_t> damage_tile_rects( const DamageTiles_t &damage )
+{
+	std::vector<DamageTileRect_t> rects;
+	size_t uPrevRowStart = 0;
+
+	for ( uint32_t y = 0; y < damage.uTilesY; y++ )
+	{
+		size_t uRowStart = rects.size();
+		for ( uint32_t x = 0; x < damage.uTilesX; x++ )
+		{
+			if ( !damage.Test( x, y ) )
+				continue;
+
+			uint32_t uStart = x;
+			while ( x + 1 < damage.uTilesX && damage.Test( x + 1, y ) )
+				x++;
+			uint32_t uWidth = x - uStart + 1;
+
+			auto iter = std::find_if( rects.begin() + uPrevRowStart, rects.begin() + uRowStart, [&]( const DamageTileRect_t &rect )
+			{
+				return rect.uX == uStart && rect.uWidth == uWidth && rect.uY + rect.uHeight == y;
+			});
+
+			if ( iter != rects.begin() + uRowStart )
+			{
+				// Move it into this row so the next row can extend it further.
+				DamageTileRect_t rect = *iter;
+				rect.uHeight++;
+				rects.erase( iter );
+				uRowStart--;
+				rects.push_back( rect );
+			}
+			else
+			{
+				rects.push_back( DamageTileRect_t{ uStart, y, uWidth, 1 } );
+			}
+		}
+		uPrevRowStart = uRowStart;
+	}
+
+	return rects;
+}
+
 extern std::string g_reshade_effect;
 extern uint32_t g_reshade_technique_idx;
 
+static gamescope::ConVar<bool> cv_blur_kawase{ "blur_kawase", true, "Blur the background with a dual-Kawase down/upsample, whose cost doesn't grow with the blur radius, instead of the separable gaussian." };
+static gamescope::ConVar<bool> cv_blur_cache{ "blur_cache", true, "Only blur the background again when the windows behind the blur commit new buffers." };
+
+static constexpr uint32_t k_uKawaseMaxLevels = 5;
+
+// Each level doubles the footprint of the blur, the tap offset covers the
+// radii in between. Roughly matches the gaussian of the same radius.
+static void kawase_blur_params( int nBlurRadius, uint32_t *puLevels, float *pflOffset )
+{
+	// Same kernel width as BlitPushData_t::blurRadius.
+	const float flRadius = nBlurRadius ? float( nBlurRadius * 2 - 1 ) : 1.0f;
+
+	uint32_t uLevels = 1;
+	while ( uLevels < k_uKawaseMaxLevels && flRadius >= float( 4u << uLevels ) )
+		uLevels++;
+
+	*puLevels = uLevels;
+	*pflOffset = std::clamp( flRadius / float( 4u << ( uLevels - 1 ) ), 1.0f, 2.0f );
+}
+
+// What the blurred background in g_output.blurOutput was built from.
+struct BlurCacheState_t
+{
+	std::vector<CompositeLayerState_t> layers;
+	bool bKawase = false;
+	int nRadius = 0;
+
+	// Only client commits are known not to change under us.
+	bool IsCacheable() const
+	{
+		return std::all_of( layers.begin(), layers.end(), []( const CompositeLayerState_t &layer ) { return layer.ulCommitID != 0; } );
+	}
+
+	bool Matches( const BlurCacheState_t &other ) const
+	{
+		if ( layers.size() != other.layers.size() || bKawase != other.bKawase || nRadius != other.nRadius )
+			return false;
+
+		for ( size_t i = 0; i < layers.size(); i++ )
+		{
+			if ( !layers[i].SamePlacement( other.layers[i] ) || !layers[i].SameContents( other.layers[i] ) )
+				return false;
+		}
+
+		return true;
+	}
+};
+
+static std::optional<BlurCacheState_t> s_blurCache;
+
+static void update_blur_images( uint32_t width, uint32_t height, uint32_t uLevels )
+{
+	CVulkanTexture::createFlags createFlags;
+	createFlags.bSampled = true;
+	createFlags.bStorage = true;
+
+	if ( g_output.blurOutput == nullptr
+			|| width != g_output.blurOutput->width()
+			|| height != g_output.blurOutput->height() )
+	{
+		s_blurCache.reset();
+		g_output.blurLevels.clear();
+
+		g_output.blurOutput = new CVulkanTexture();
+		if ( !g_output.blurOutput->BInit( width, height, 1u, DRM_FORMAT_ARGB8888, createFlags, nullptr ) )
+		{
+			vk_log.errorf( "failed to create blur output" );
+			return;
+		}
+	}
+
+	for ( uint32_t i = g_output.blurLevels.size(); i < uLevels; i++ )
+	{
+		gamescope::OwningRc<CVulkanTexture> pLevel = new CVulkanTexture();
+		if ( !pLevel->BInit( std::max( width >> ( i + 1 ), 1u ), std::max( height >> ( i + 1 ), 1u ), 1u, DRM_FORMAT_ARGB8888, createFlags, nullptr ) )
+		{
+			vk_log.errorf( "failed to create blur level %u", i );
+			return;
+		}
+		g_output.blurLevels.push_back( std::move( pLevel ) );
+	}
+}
+
+static void bind_blur_level( CVulkanCmdBuffer *cmdBuffer, gamescope::Rc<CVulkanTexture> pLevel, bool useSrgbView )
+{
+	cmdBuffer->bindTexture( VKR_BLUR_EXTRA_SLOT, pLevel );
+	cmdBuffer->setTextureSrgb( VKR_BLUR_EXTRA_SLOT, !useSrgbView );
+	cmdBuffer->setSamplerUnnormalized( VKR_BLUR_EXTRA_SLOT, false );
+	cmdBuffer->setSamplerNearest( VKR_BLUR_EXTRA_SLOT, false );
+}
+
+// Down from the blurred layers to the smallest level, then back up into
+// g_output.blurOutput. Every pass reads at most 8 bilinear taps, so the
+// cost only depends on the output size. Returns false if nothing was written.
+static bool blur_background_kawase( CVulkanCmdBuffer *cmdBuffer, const struct FrameInfo_t *frameInfo, uint32_t blur_layer_count, uint32_t uLevels, float flOffset, bool useSrgbView, EOTF outputTF )
+{
+	// Not all levels could be allocated.
+	if ( g_output.blurLevels.size() < uLevels )
+		return false;
+
+	// The levels are stored in layer 0's colorspace, the passes between them
+	// don't need to know about the others.
+	const uint32_t uLevelColorspaceMask = frameInfo->colorspaceMask() & ( ( 1u << GamescopeAppTextureColorspace_Bits ) - 1 );
+	const int pixelsPerGroup = 8;
+
+	for ( uint32_t i = 0; i < uLevels; i++ )
+	{
+		if ( i == 0 )
+		{
+			cmdBuffer->bindPipeline( g_device.pipeline( SHADER_TYPE_BLUR_KAWASE_DOWN, blur_layer_count, frameInfo->ycbcrMask() & 0x3u, 0, frameInfo->colorspaceMask(), outputTF ) );
+			for ( uint32_t j = 0; j < blur_layer_count; j++ )
+			{
+				cmdBuffer->bindTexture( j, frameInfo->layers[j].tex );
+				cmdBuffer->setTextureSrgb( j, false );
+				cmdBuffer->setSamplerUnnormalized( j, true );
+				cmdBuffer->setSamplerNearest( j, false );
+			}
+		}
+		else
+		{
+			cmdBuffer->bindPipeline( g_device.pipeline( SHADER_TYPE_BLUR_KAWASE_DOWN, 0, 0, 0, uLevelColorspaceMask, outputTF ) );
+			bind_blur_level( cmdBuffer, g_output.blurLevels[i - 1], useSrgbView );
+		}
+
+		CVulkanTexture *pTarget = g_output.blurLevels[i].get();
+		cmdBuffer->bindTarget( pTarget );
+		cmdBuffer->uploadConstants<KawasePushData_t>( frameInfo, flOffset );
+		cmdBuffer->dispatch( div_roundup( pTarget->width(), pixelsPerGroup ), div_roundup( pTarget->height(), pixelsPerGroup ) );
+	}
+
+	cmdBuffer->bindPipeline( g_device.pipeline( SHADER_TYPE_BLUR_KAWASE_UP, 0, 0, 0, uLevelColorspaceMask, outputTF ) );
+	for ( uint32_t i = uLevels; i-- > 0; )
+	{
+		CVulkanTexture *pTarget = i > 0 ? g_output.blurLevels[i - 1].get() : g_output.blurOutput.get();
+		bind_blur_level( cmdBuffer, g_output.blurLevels[i], useSrgbView );
+		cmdBuffer->bindTarget( pTarget );
+		cmdBuffer->uploadConstants<KawasePushData_t>( frameInfo, flOffset );
+		cmdBuffer->dispatch( div_roundup( pTarget->width(), pixelsPerGroup ), div_roundup( pTarget->height(), pixelsPerGroup ) );
+	}
+
+	return true;
+}
+
 std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamescope::Rc<CVulkanTexture> pPipewireTexture, bool partial, gamescope::Rc<CVulkanTexture> pOutputOverride, bool increment, std::unique_ptr<CVulkanCmdBuffer> pInCommandBuffer )
 {
 	EOTF outputTF = frameInfo->outputEncodingEOTF;
 	if (!frameInfo->applyOutputColorMgmt)
 		outputTF = EOTF_Count; //Disable blending stuff.
 
+	std::optional<ReshadeExecution_t> reshadeExecution;
 	if (!g_reshade_effect.empty())
 	{
 		if (frameInfo->layers[0].tex)
@@ -3879,8 +5556,8 @@ std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamesco
 			ReshadeEffectPipeline* pipeline = g_reshadeManager.pipeline(key);
 			if (pipeline != nullptr)
 			{
-				uint64_t seq = pipeline->execute(frameInfo->layers[0].tex, &frameInfo->layers[0].tex);
-				g_device.wait(seq);
+				// No CPU wait here, the composite waits on the GPU below.
+				reshadeExecution = pipeline->execute(frameInfo->layers[0].tex, &frameInfo->layers[0].tex);
 			}
 		}
 	}
@@ -3895,12 +5572,64 @@ std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamesco
 	else
 		compositeImage = partial ? g_output.outputImagesPartialOverlay[ g_output.nOutImage ] : g_output.outputImages[ g_output.nOutImage ];
 
+	// Only the images we rotate through keep their contents for us to reuse.
+	const bool bTrackDamage = !pOutputOverride && !GetBackend()->UsesVulkanSwapchain();
+	if ( bTrackDamage && partial )
+	{
+		// The partial overlay images alias the regular ones.
+		s_compositeDamage.InvalidateImage( g_output.nOutImage );
+	}
+
+	if ( bTrackDamage && !partial )
+	{
+		// ReShade effects and debug overlays can change with nothing else changing.
+		const bool bForceFull = !g_reshade_effect.empty() || g_uCompositeDebug != 0;
+		s_compositeDamage.Update( frameInfo, outputTF, bForceFull );
+	}
+	else
+	{
+		frameInfo->damage.Reset( currentOutputWidth, currentOutputHeight );
+		frameInfo->damage.AddAll();
+	}
+
 	auto cmdBuffer = pInCommandBuffer ? std::move( pInCommandBuffer ) : g_device.commandBuffer();
 
+	std::optional<BlurCacheState_t> oNewBlurCache;
+
+	if ( reshadeExecution )
+	{
+		cmdBuffer->AddDependency( reshadeExecution->donePoint.pTimelineSemaphore, reshadeExecution->donePoint.ulPoint );
+		// Nothing past here bails out, so the effect's next execution can rely on this.
+		cmdBuffer->AddSignal( reshadeExecution->releasePoint.pTimelineSemaphore, reshadeExecution->releasePoint.ulPoint );
+	}
+
 	for (uint32_t i = 0; i < EOTF_Count; i++)
 		cmdBuffer->bindColorMgmtLuts(i, frameInfo->shaperLut[i], frameInfo->lut3D[i]);
 
-	if ( frameInfo->useFSRLayer0 )
+	if ( frameInfo->useFSRLayer0 && cv_composite_fused_upscale && !frameInfo->layers[0].isYcbcr() )
+	{
+		uint32_t inputX = frameInfo->layers[0].tex->width();
+		uint32_t inputY = frameInfo->layers[0].tex->height();
+
+		uint32_t tempX = frameInfo->layers[0].integerWidth();
+		uint32_t tempY = frameInfo->layers[0].integerHeight();
+
+		// EASU into shared memory, then RCAS + composite straight from there.
+		cmdBuffer->beginGPUPass(k_EGPUPass_Composite);
+		cmdBuffer->bindPipeline(g_device.pipeline(SHADER_TYPE_FSR_FUSED, frameInfo->layerCount, frameInfo->ycbcrMask() & ~1, 0u, frameInfo->colorspaceMask(), outputTF ));
+		bind_all_layers(cmdBuffer.get(), frameInfo);
+		cmdBuffer->setTextureSrgb(0, true);
+		cmdBuffer->setSamplerUnnormalized(0, false);
+		cmdBuffer->setSamplerNearest(0, false);
+		cmdBuffer->bindTarget(compositeImage);
+		cmdBuffer->uploadConstants<FsrFusedPushData_t>(frameInfo, g_upscaleFilterSharpness / 10.0f, inputX, inputY, tempX, tempY);
+
+		int pixelsPerGroup = 16;
+
+		cmdBuffer->dispatch(div_roundup(currentOutputWidth, pixelsPerGroup), div_roundup(currentOutputHeight, pixelsPerGroup));
+		cmdBuffer->endGPUPass();
+	}
+	else if ( frameInfo->useFSRLayer0 )
 	{
 		uint32_t inputX = frameInfo->layers[0].tex->width();
 		uint32_t inputY = frameInfo->layers[0].tex->height();
@@ -3910,6 +5639,7 @@ std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamesco
 
 		update_tmp_images(tempX, tempY);
 
+		cmdBuffer->beginGPUPass(k_EGPUPass_Upscale);
 		cmdBuffer->bindPipeline(g_device.pipeline(SHADER_TYPE_EASU));
 		cmdBuffer->bindTarget(g_output.tmpOutput);
 		cmdBuffer->bindTexture(0, frameInfo->layers[0].tex);
@@ -3921,7 +5651,9 @@ std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamesco
 		int pixelsPerGroup = 16;
 
 		cmdBuffer->dispatch(div_roundup(tempX, pixelsPerGroup), div_roundup(tempY, pixelsPerGroup));
+		cmdBuffer->endGPUPass();
 
+		cmdBuffer->beginGPUPass(k_EGPUPass_Composite);
 		cmdBuffer->bindPipeline(g_device.pipeline(SHADER_TYPE_RCAS, frameInfo->layerCount, frameInfo->ycbcrMask() & ~1, 0u, frameInfo->colorspaceMask(), outputTF ));
 		bind_all_layers(cmdBuffer.get(), frameInfo);
 		cmdBuffer->bindTexture(0, g_output.tmpOutput);
@@ -3932,6 +5664,38 @@ std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamesco
 		cmdBuffer->uploadConstants<RcasPushData_t>(frameInfo, g_upscaleFilterSharpness / 10.0f);
 
 		cmdBuffer->dispatch(div_roundup(currentOutputWidth, pixelsPerGroup), div_roundup(currentOutputHeight, pixelsPerGroup));
+		cmdBuffer->endGPUPass();
+	}
+	else if ( frameInfo->useNISLayer0 && cv_composite_fused_upscale && nis_fused_covers_output( frameInfo ) )
+	{
+		uint32_t inputX = frameInfo->layers[0].tex->width();
+		uint32_t inputY = frameInfo->layers[0].tex->height();
+
+		uint32_t tempX = frameInfo->layers[0].integerWidth();
+		uint32_t tempY = frameInfo->layers[0].integerHeight();
+
+		float nisSharpness = (20 - g_upscaleFilterSharpness) / 20.0f;
+
+		cmdBuffer->beginGPUPass(k_EGPUPass_Composite);
+		cmdBuffer->bindPipeline(g_device.pipeline(SHADER_TYPE_NIS_FUSED, frameInfo->layerCount, frameInfo->ycbcrMask() & ~1, 0u, frameInfo->colorspaceMask(), outputTF ));
+		bind_all_layers(cmdBuffer.get(), frameInfo);
+		cmdBuffer->setTextureSrgb(0, true);
+		cmdBuffer->setSamplerUnnormalized(0, false);
+		cmdBuffer->setSamplerNearest(0, false);
+		cmdBuffer->bindTexture(VKR_NIS_COEF_SCALER_SLOT, g_output.nisScalerImage);
+		cmdBuffer->setSamplerUnnormalized(VKR_NIS_COEF_SCALER_SLOT, false);
+		cmdBuffer->setSamplerNearest(VKR_NIS_COEF_SCALER_SLOT, false);
+		cmdBuffer->bindTexture(VKR_NIS_COEF_USM_SLOT, g_output.nisUsmImage);
+		cmdBuffer->setSamplerUnnormalized(VKR_NIS_COEF_USM_SLOT, false);
+		cmdBuffer->setSamplerNearest(VKR_NIS_COEF_USM_SLOT, false);
+		cmdBuffer->bindTarget(compositeImage);
+		cmdBuffer->uploadConstants<NisFusedPushData_t>(frameInfo, inputX, inputY, tempX, tempY, nisSharpness);
+
+		int pixelsPerGroupX = 32;
+		int pixelsPerGroupY = 24;
+
+		cmdBuffer->dispatch(div_roundup(tempX, pixelsPerGroupX), div_roundup(tempY, pixelsPerGroupY));
+		cmdBuffer->endGPUPass();
 	}
 	else if ( frameInfo->useNISLayer0 )
 	{
@@ -3945,6 +5709,7 @@ std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamesco
 
 		float nisSharpness = (20 - g_upscaleFilterSharpness) / 20.0f;
 
+		cmdBuffer->beginGPUPass(k_EGPUPass_Upscale);
 		cmdBuffer->bindPipeline(g_device.pipeline(SHADER_TYPE_NIS));
 		cmdBuffer->bindTarget(g_output.tmpOutput);
 		cmdBuffer->bindTexture(0, frameInfo->layers[0].tex);
@@ -3963,12 +5728,14 @@ std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamesco
 		int pixelsPerGroupY = 24;
 
 		cmdBuffer->dispatch(div_roundup(tempX, pixelsPerGroupX), div_roundup(tempY, pixelsPerGroupY));
+		cmdBuffer->endGPUPass();
 
 		struct FrameInfo_t nisFrameInfo = *frameInfo;
 		nisFrameInfo.layers[0].tex = g_output.tmpOutput;
 		nisFrameInfo.layers[0].scale.x = 1.0f;
 		nisFrameInfo.layers[0].scale.y = 1.0f;
 
+		cmdBuffer->beginGPUPass(k_EGPUPass_Composite);
 		cmdBuffer->bindPipeline( g_device.pipeline(SHADER_TYPE_BLIT, nisFrameInfo.layerCount, nisFrameInfo.ycbcrMask(), 0u, nisFrameInfo.colorspaceMask(), outputTF ));
 		bind_all_layers(cmdBuffer.get(), &nisFrameInfo);
 		cmdBuffer->bindTarget(compositeImage);
@@ -3977,60 +5744,156 @@ std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamesco
 		int pixelsPerGroup = 8;
 
 		cmdBuffer->dispatch(div_roundup(currentOutputWidth, pixelsPerGroup), div_roundup(currentOutputHeight, pixelsPerGroup));
+		cmdBuffer->endGPUPass();
 	}
 	else if ( frameInfo->blurLayer0 )
 	{
-		update_tmp_images(currentOutputWidth, currentOutputHeight);
-
-		ShaderType type = SHADER_TYPE_BLUR_FIRST_PASS;
-
 		uint32_t blur_layer_count = 1;
 		// Also blur the override on top if we have one.
 		if (frameInfo->layerCount >= 2 && frameInfo->layers[1].zpos == g_zposOverride)
 			blur_layer_count++;
 
-		cmdBuffer->bindPipeline(g_device.pipeline(type, blur_layer_count, frameInfo->ycbcrMask() & 0x3u, 0, frameInfo->colorspaceMask(), outputTF ));
-		cmdBuffer->bindTarget(g_output.tmpOutput);
+		bool useSrgbView = frameInfo->layers[0].colorspace == GAMESCOPE_APP_TEXTURE_COLORSPACE_LINEAR;
+
+		const bool bKawase = cv_blur_kawase;
+		uint32_t uKawaseLevels = 0;
+		float flKawaseOffset = 1.0f;
+		if ( bKawase )
+			kawase_blur_params( frameInfo->blurRadius, &uKawaseLevels, &flKawaseOffset );
+		update_blur_images(currentOutputWidth, currentOutputHeight, uKawaseLevels);
+
+		int pixelsPerGroup = 8;
+
+		// A static frame behind a blurred menu only needs blurring once.
+		BlurCacheState_t blurState;
 		for (uint32_t i = 0; i < blur_layer_count; i++)
+			blurState.layers.emplace_back( frameInfo->layers[i] );
+		blurState.bKawase = bKawase;
+		blurState.nRadius = frameInfo->blurRadius;
+
+		const bool bCacheable = cv_blur_cache && g_reshade_effect.empty() && blurState.IsCacheable();
+		if ( !bCacheable || !s_blurCache || !s_blurCache->Matches( blurState ) )
 		{
-			cmdBuffer->bindTexture(i, frameInfo->layers[i].tex);
-			cmdBuffer->setTextureSrgb(i, false);
-			cmdBuffer->setSamplerUnnormalized(i, true);
-			cmdBuffer->setSamplerNearest(i, false);
-		}
-		cmdBuffer->uploadConstants<BlitPushData_t>(frameInfo);
+			// blurOutput is about to be overwritten, only cache it again once
+			// this composite made it to the GPU.
+			s_blurCache.reset();
 
-		int pixelsPerGroup = 8;
+			bool bBlurred = true;
+			cmdBuffer->beginGPUPass(k_EGPUPass_Blur);
+			if ( bKawase )
+			{
+				bBlurred = blur_background_kawase( cmdBuffer.get(), frameInfo, blur_layer_count, uKawaseLevels, flKawaseOffset, useSrgbView, outputTF );
+			}
+			else
+			{
+				cmdBuffer->bindPipeline(g_device.pipeline(SHADER_TYPE_BLUR_FIRST_PASS, blur_layer_count, frameInfo->ycbcrMask() & 0x3u, 0, frameInfo->colorspaceMask(), outputTF ));
+				cmdBuffer->bindTarget(g_output.blurOutput);
+				for (uint32_t i = 0; i < blur_layer_count; i++)
+				{
+					cmdBuffer->bindTexture(i, frameInfo->layers[i].tex);
+					cmdBuffer->setTextureSrgb(i, false);
+					cmdBuffer->setSamplerUnnormalized(i, true);
+					cmdBuffer->setSamplerNearest(i, false);
+				}
+				cmdBuffer->uploadConstants<BlitPushData_t>(frameInfo);
 
-		cmdBuffer->dispatch(div_roundup(currentOutputWidth, pixelsPerGroup), div_roundup(currentOutputHeight, pixelsPerGroup));
+				cmdBuffer->dispatch(div_roundup(currentOutputWidth, pixelsPerGroup), div_roundup(currentOutputHeight, pixelsPerGroup));
+			}
+			cmdBuffer->endGPUPass();
 
-		bool useSrgbView = frameInfo->layers[0].colorspace == GAMESCOPE_APP_TEXTURE_COLORSPACE_LINEAR;
+			if ( bCacheable && bBlurred )
+				oNewBlurCache = std::move( blurState );
+		}
 
-		type = frameInfo->blurLayer0 == BLUR_MODE_COND ? SHADER_TYPE_BLUR_COND : SHADER_TYPE_BLUR;
+		ShaderType type = frameInfo->blurLayer0 == BLUR_MODE_COND ? SHADER_TYPE_BLUR_COND : SHADER_TYPE_BLUR;
+		cmdBuffer->beginGPUPass(k_EGPUPass_Composite);
 		cmdBuffer->bindPipeline(g_device.pipeline(type, frameInfo->layerCount, frameInfo->ycbcrMask(), blur_layer_count, frameInfo->colorspaceMask(), outputTF ));
 		bind_all_layers(cmdBuffer.get(), frameInfo);
 		cmdBuffer->bindTarget(compositeImage);
-		cmdBuffer->bindTexture(VKR_BLUR_EXTRA_SLOT, g_output.tmpOutput);
+		cmdBuffer->bindTexture(VKR_BLUR_EXTRA_SLOT, g_output.blurOutput);
 		cmdBuffer->setTextureSrgb(VKR_BLUR_EXTRA_SLOT, !useSrgbView); // Inverted because it chooses whether to view as linear (sRGB view) or sRGB (raw view). It's horrible. I need to change it.
 		cmdBuffer->setSamplerUnnormalized(VKR_BLUR_EXTRA_SLOT, true);
 		cmdBuffer->setSamplerNearest(VKR_BLUR_EXTRA_SLOT, false);
+		// The gaussian still needs its vertical pass here, the Kawase background is already blurred.
+		if ( bKawase )
+			cmdBuffer->uploadConstants<KawasePushData_t>(frameInfo, 1.0f);
+		else
+			cmdBuffer->uploadConstants<BlitPushData_t>(frameInfo);
 
 		cmdBuffer->dispatch(div_roundup(currentOutputWidth, pixelsPerGroup), div_roundup(currentOutputHeight, pixelsPerGroup));
+		cmdBuffer->endGPUPass();
 	}
 	else
 	{
+		cmdBuffer->beginGPUPass(k_EGPUPass_Composite);
 		cmdBuffer->bindPipeline( g_device.pipeline(SHADER_TYPE_BLIT, frameInfo->layerCount, frameInfo->ycbcrMask(), 0u, frameInfo->colorspaceMask(), outputTF ));
 		bind_all_layers(cmdBuffer.get(), frameInfo);
 		cmdBuffer->bindTarget(compositeImage);
-		cmdBuffer->uploadConstants<BlitPushData_t>(frameInfo);
 
 		const int pixelsPerGroup = 8;
 
-		cmdBuffer->dispatch(div_roundup(currentOutputWidth, pixelsPerGroup), div_roundup(currentOutputHeight, pixelsPerGroup));
+		// Redraw only what changed since this image was last composited to.
+		// Needs the image to come back from presentation in the layout we
+		// left it in.
+		DamageTiles_t damage;
+		std::vector<DamageTileRect_t> rects;
+		if ( bTrackDamage && !partial && cv_composite_tile_damage &&
+			 GetBackend()->GetPresentLayout() == VK_IMAGE_LAYOUT_GENERAL &&
+			 s_compositeDamage.GetImageDamage( g_output.nOutImage, compositeImage.get(), &damage ) &&
+			 damage.Count() * 100 <= damage.TileCount() * k_uDamageMaxTilesPercent )
+		{
+			rects = damage_tile_rects( damage );
+			// Nothing changed, still touch a tile so the image goes through the
+			// usual transitions for presentation.
+			if ( rects.empty() )
+				rects.push_back( DamageTileRect_t{ 0, 0, 1, 1 } );
+			if ( rects.size() > k_uDamageMaxRects )
+				rects.clear();
+		}
+
+		uint32_t uTilesTotal = div_roundup( currentOutputWidth, k_uDamageTileSize ) * div_roundup( currentOutputHeight, k_uDamageTileSize );
+		uint32_t uTilesComposited = 0;
+		if ( !rects.empty() )
+		{
+			cmdBuffer->preserveImage( compositeImage.get() );
+
+			BlitPushData_t constants( frameInfo );
+			for ( const DamageTileRect_t &rect : rects )
+			{
+				constants.tileOffset[0] = rect.uX * k_uDamageTileSize;
+				constants.tileOffset[1] = rect.uY * k_uDamageTileSize;
+				cmdBuffer->uploadConstants<BlitPushData_t>( constants );
+
+				const uint32_t uWidth = std::min( rect.uWidth * k_uDamageTileSize, currentOutputWidth - constants.tileOffset[0] );
+				const uint32_t uHeight = std::min( rect.uHeight * k_uDamageTileSize, currentOutputHeight - constants.tileOffset[1] );
+				cmdBuffer->dispatch(div_roundup(uWidth, pixelsPerGroup), div_roundup(uHeight, pixelsPerGroup));
+
+				uTilesComposited += rect.uWidth * rect.uHeight;
+			}
+		}
+		else
+		{
+			cmdBuffer->uploadConstants<BlitPushData_t>(frameInfo);
+			cmdBuffer->dispatch(div_roundup(currentOutputWidth, pixelsPerGroup), div_roundup(currentOutputHeight, pixelsPerGroup));
+
+			uTilesComposited = uTilesTotal;
+		}
+
+		if ( bTrackDamage && !partial )
+		{
+			cmdBuffer->setGPUPassTiles( uTilesComposited, uTilesTotal );
+
+			std::unique_lock lock( s_compositeDamageStatsMutex );
+			s_compositeDamageStats.uFrames++;
+			s_compositeDamageStats.ulTilesComposited += uTilesComposited;
+			s_compositeDamageStats.ulTilesTotal += uTilesTotal;
+		}
+		cmdBuffer->endGPUPass();
 	}
 
 	if ( pPipewireTexture != nullptr )
 	{
+		cmdBuffer->beginGPUPass(k_EGPUPass_Capture);
 
 		if (compositeImage->format() == pPipewireTexture->format() &&
 			compositeImage->width() == pPipewireTexture->width() &&
@@ -4074,10 +5937,18 @@ std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamesco
 
 			cmdBuffer->dispatch(div_roundup(pPipewireTexture->width(), dispatchSize), div_roundup(pPipewireTexture->height(), dispatchSize));
 		}
+
+		cmdBuffer->endGPUPass();
 	}
 
 	uint64_t sequence = g_device.submit(std::move(cmdBuffer));
 
+	if ( oNewBlurCache )
+		s_blurCache = std::move( oNewBlurCache );
+
+	if ( bTrackDamage && !partial )
+		s_compositeDamage.OnImageComposited( g_output.nOutImage, compositeImage );
+
 	if ( !GetBackend()->UsesVulkanSwapchain() && pOutputOverride == nullptr && increment )
 	{
 		g_output.nOutImage = ( g_output.nOutImage + 1 ) % 3;
@@ -4091,6 +5962,16 @@ void vulkan_wait( uint64_t ulSeqNo, bool bReset )
 	return g_device.wait( ulSeqNo, bReset );
 }
 
+int vulkan_export_sync_file( uint64_t ulSeqNo )
+{
+	return g_device.exportSyncFile( ulSeqNo );
+}
+
+bool vulkan_supports_sync_file_export()
+{
+	return g_device.supportsSyncFileExport();
+}
+
 gamescope::Rc<CVulkanTexture> vulkan_get_last_output_image( bool partial, bool defer )
 {
 	// Get previous image ( +2 )
@@ -4190,85 +6071,103 @@ struct wlr_renderer *vulkan_renderer_create( void )
 	return &renderer->base;
 }
 
-gamescope::OwningRc<CVulkanTexture> vulkan_create_texture_from_wlr_buffer( struct wlr_buffer *buf, gamescope::OwningRc<gamescope::IBackendFb> pBackendFb )
-{
+static gamescope::ConVar<bool> cv_vulkan_shm_import{ "vulkan_shm_import", true, "Let the GPU read shm client buffers in place with VK_EXT_external_memory_host instead of copying them into the upload buffer first." };
 
-	struct wlr_dmabuf_attributes dmabuf = {0};
-	if ( wlr_buffer_get_dmabuf( buf, &dmabuf ) )
-	{
-		return vulkan_create_texture_from_dmabuf( &dmabuf, pBackendFb );
-	}
+struct HostBufferImport_t
+{
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+};
 
-	VkResult result;
+// Wraps client memory in a VkBuffer, the pages have to stay mapped until the GPU is done with it.
+static std::optional<HostBufferImport_t> vulkan_import_host_buffer( void *pData, size_t size )
+{
+	const VkDeviceSize ulAlignment = g_device.hostPointerAlignment();
+	const uintptr_t uBase = uintptr_t( pData ) & ~uintptr_t( ulAlignment - 1 );
 
-	void *src;
-	uint32_t drmFormat;
-	size_t stride;
-	if ( !wlr_buffer_begin_data_ptr_access( buf, WLR_BUFFER_DATA_PTR_ACCESS_READ, &src, &drmFormat, &stride ) )
-	{
-		return nullptr;
-	}
+	HostBufferImport_t import;
+	import.offset = uintptr_t( pData ) - uBase;
+	const VkDeviceSize ulImportSize = align( import.offset + size, ulAlignment );
 
-	uint32_t width = buf->width;
-	uint32_t height = buf->height;
+	VkMemoryHostPointerPropertiesEXT hostPointerProps = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT,
+	};
+	if ( g_device.vk.GetMemoryHostPointerPropertiesEXT( g_device.device(), VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT, (void *)uBase, &hostPointerProps ) != VK_SUCCESS )
+		return std::nullopt;
 
+	VkExternalMemoryBufferCreateInfo externalBufferCreateInfo = {
+		.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO,
+		.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+	};
 	VkBufferCreateInfo bufferCreateInfo = {
 		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-		.size = stride * height,
+		.pNext = &externalBufferCreateInfo,
+		.size = ulImportSize,
 		.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
 	};
-	VkBuffer buffer;
-	result = g_device.vk.CreateBuffer( g_device.device(), &bufferCreateInfo, nullptr, &buffer );
-	if ( result != VK_SUCCESS )
-	{
-		wlr_buffer_end_data_ptr_access( buf );
-		return nullptr;
-	}
+	if ( g_device.vk.CreateBuffer( g_device.device(), &bufferCreateInfo, nullptr, &import.buffer ) != VK_SUCCESS )
+		return std::nullopt;
 
 	VkMemoryRequirements memRequirements;
-	g_device.vk.GetBufferMemoryRequirements(g_device.device(), buffer, &memRequirements);
+	g_device.vk.GetBufferMemoryRequirements( g_device.device(), import.buffer, &memRequirements );
 
-	uint32_t memTypeIndex =  g_device.findMemoryType(VK_MEMORY_PROPERTY_HOST_COHERENT_BIT|VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, memRequirements.memoryTypeBits );
-	if ( memTypeIndex == ~0u )
+	uint32_t memTypeIndex = g_device.findMemoryType( 0, memRequirements.memoryTypeBits & hostPointerProps.memoryTypeBits );
+	if ( memTypeIndex == ~0u || memRequirements.size > ulImportSize )
 	{
-		wlr_buffer_end_data_ptr_access( buf );
-		return nullptr;
+		g_device.vk.DestroyBuffer( g_device.device(), import.buffer, nullptr );
+		return std::nullopt;
 	}
 
+	VkImportMemoryHostPointerInfoEXT importInfo = {
+		.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT,
+		.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+		.pHostPointer = (void *)uBase,
+	};
 	VkMemoryAllocateInfo allocInfo = {
 		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-		.allocationSize = memRequirements.size,
+		.pNext = &importInfo,
+		.allocationSize = ulImportSize,
 		.memoryTypeIndex = memTypeIndex,
 	};
+	if ( g_device.vk.AllocateMemory( g_device.device(), &allocInfo, nullptr, &import.memory ) != VK_SUCCESS )
+	{
+		g_device.vk.DestroyBuffer( g_device.device(), import.buffer, nullptr );
+		return std::nullopt;
+	}
 
-	VkDeviceMemory bufferMemory;
-	result = g_device.vk.AllocateMemory( g_device.device(), &allocInfo, nullptr, &bufferMemory);
-	if ( result != VK_SUCCESS )
+	if ( g_device.vk.BindBufferMemory( g_device.device(), import.buffer, import.memory, 0 ) != VK_SUCCESS )
 	{
-		wlr_buffer_end_data_ptr_access( buf );
-		return nullptr;
+		g_device.vk.DestroyBuffer( g_device.device(), import.buffer, nullptr );
+		g_device.vk.FreeMemory( g_device.device(), import.memory, nullptr );
+		return std::nullopt;
 	}
 
-	result = g_device.vk.BindBufferMemory( g_device.device(), buffer, bufferMemory, 0 );
-	if ( result != VK_SUCCESS )
+	return import;
+}
+
+gamescope::OwningRc<CVulkanTexture> vulkan_create_texture_from_wlr_buffer( struct wlr_buffer *buf, gamescope::OwningRc<gamescope::IBackendFb> pBackendFb )
+{
+
+	struct wlr_dmabuf_attributes dmabuf = {0};
+	if ( wlr_buffer_get_dmabuf( buf, &dmabuf ) )
 	{
-		wlr_buffer_end_data_ptr_access( buf );
-		return nullptr;
+		return vulkan_create_texture_from_dmabuf( &dmabuf, pBackendFb );
 	}
 
-	void *dst;
-	result = g_device.vk.MapMemory( g_device.device(), bufferMemory, 0, VK_WHOLE_SIZE, 0, &dst );
-	if ( result != VK_SUCCESS )
+	void *src;
+	uint32_t drmFormat;
+	size_t stride;
+	if ( !wlr_buffer_begin_data_ptr_access( buf, WLR_BUFFER_DATA_PTR_ACCESS_READ, &src, &drmFormat, &stride ) )
 	{
-		wlr_buffer_end_data_ptr_access( buf );
 		return nullptr;
 	}
+	defer( wlr_buffer_end_data_ptr_access( buf ) );
 
-	memcpy( dst, src, stride * height );
-
-	g_device.vk.UnmapMemory( g_device.device(), bufferMemory );
-
-	wlr_buffer_end_data_ptr_access( buf );
+	uint32_t width = buf->width;
+	uint32_t height = buf->height;
+	size_t size = stride * height;
+	uint32_t bpp = DRMFormatGetBPP( drmFormat );
 
 	gamescope::OwningRc<CVulkanTexture> pTex = new CVulkanTexture();
 	CVulkanTexture::createFlags texCreateFlags;
@@ -4278,17 +6177,52 @@ gamescope::OwningRc<CVulkanTexture> vulkan_create_texture_from_wlr_buffer( struc
 	if ( pTex->BInit( width, height, 1u, drmFormat, texCreateFlags, nullptr, 0, 0, nullptr, pBackendFb ) == false )
 		return nullptr;
 
+	// Copy straight out of the client's shm pages if we can, otherwise
+	// go through the upload buffer.
+	std::optional<HostBufferImport_t> oImport;
+	if ( cv_vulkan_shm_import && g_device.supportsHostPointerImport() )
+	{
+		oImport = vulkan_import_host_buffer( src, size );
+		if ( oImport && oImport->offset % bpp != 0 )
+		{
+			g_device.vk.DestroyBuffer( g_device.device(), oImport->buffer, nullptr );
+			g_device.vk.FreeMemory( g_device.device(), oImport->memory, nullptr );
+			oImport = std::nullopt;
+		}
+	}
+
 	auto cmdBuffer = g_device.commandBuffer();
 
-	cmdBuffer->copyBufferToImage( buffer, 0, stride / DRMFormatGetBPP(drmFormat), pTex);
+	VkBuffer buffer;
+	VkDeviceSize offset;
+	if ( oImport )
+	{
+		buffer = oImport->buffer;
+		offset = oImport->offset;
+	}
+	else
+	{
+		void *dst = g_device.uploadBufferData( size, cmdBuffer.get() );
+		if ( !dst )
+			return nullptr;
+		memcpy( dst, src, size );
+		buffer = g_device.uploadBuffer();
+		offset = g_device.uploadBufferOffset( dst );
+	}
+
+	cmdBuffer->copyBufferToImage( buffer, offset, stride / bpp, pTex);
 	// TODO: Sync this copyBufferToImage
 
 	uint64_t sequence = g_device.submit(std::move(cmdBuffer));
 
+	// Also keeps the imported pages alive until the copy is done.
 	g_device.wait(sequence);
 
-	g_device.vk.DestroyBuffer(g_device.device(), buffer, nullptr);
-	g_device.vk.FreeMemory(g_device.device(), bufferMemory, nullptr);
+	if ( oImport )
+	{
+		g_device.vk.DestroyBuffer( g_device.device(), oImport->buffer, nullptr );
+		g_device.vk.FreeMemory( g_device.device(), oImport->memory, nullptr );
+	}
 
 	return pTex;
 }
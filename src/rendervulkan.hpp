@@ -2,6 +2,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <stdint.h>
 #include <memory>
@@ -10,12 +11,16 @@
 #include <array>
 #include <bitset>
 #include <mutex>
+#include <condition_variable>
 #include <optional>
+#include <queue>
+#include <deque>
 
 #include "main.hpp"
 
 #include "gamescope_shared.h"
 #include "backend.h"
+#include "Utils/ReadMostlyMap.h"
 
 #include "shaders/descriptor_set_constants.h"
 
@@ -142,6 +147,7 @@ public:
 			bOutputImage = false;
 			bColorAttachment = false;
 			imageType = VK_IMAGE_TYPE_2D;
+			ulExportModifier = DRM_FORMAT_MOD_INVALID;
 		}
 
 		bool bFlippable : 1;
@@ -155,6 +161,9 @@ public:
 		bool bOutputImage : 1;
 		bool bColorAttachment : 1;
 		VkImageType imageType;
+		// Allocate an exportable image with exactly this modifier, eg. the
+		// one negotiated with a PipeWire consumer.
+		uint64_t ulExportModifier;
 	};
 
 	bool BInit( uint32_t width, uint32_t height, uint32_t depth, uint32_t drmFormat, createFlags flags, wlr_dmabuf_attributes *pDMA = nullptr, uint32_t contentWidth = 0, uint32_t contentHeight = 0, CVulkanTexture *pExistingImageToReuseMemory = nullptr, gamescope::OwningRc<gamescope::IBackendFb> pBackendFb = nullptr );
@@ -266,6 +275,116 @@ inline bool close_enough(float a, float b, float epsilon = 0.001f)
 
 bool DRMFormatHasAlpha( uint32_t nDRMFormat );
 
+// Granularity the composite tracks damage at, in output pixels.
+static constexpr uint32_t k_uDamageTileSize = 64;
+
+// One bit per k_uDamageTileSize tile of the output, row-major.
+struct DamageTiles_t
+{
+	uint32_t uTilesX = 0;
+	uint32_t uTilesY = 0;
+	std::vector<uint64_t> bits;
+
+	void Reset( uint32_t uWidth, uint32_t uHeight )
+	{
+		uTilesX = ( uWidth + k_uDamageTileSize - 1 ) / k_uDamageTileSize;
+		uTilesY = ( uHeight + k_uDamageTileSize - 1 ) / k_uDamageTileSize;
+		bits.assign( ( uTilesX * uTilesY + 63 ) / 64, 0 );
+	}
+
+	uint32_t TileCount() const { return uTilesX * uTilesY; }
+
+	bool Test( uint32_t x, uint32_t y ) const
+	{
+		uint32_t uIdx = y * uTilesX + x;
+		return ( bits[ uIdx / 64 ] >> ( uIdx % 64 ) ) & 1;
+	}
+
+	void Set( uint32_t x, uint32_t y )
+	{
+		uint32_t uIdx = y * uTilesX + x;
+		bits[ uIdx / 64 ] |= 1ull << ( uIdx % 64 );
+	}
+
+	void AddAll()
+	{
+		for ( uint32_t y = 0; y < uTilesY; y++ )
+		{
+			for ( uint32_t x = 0; x < uTilesX; x++ )
+				Set( x, y );
+		}
+	}
+
+	// Output pixels [nX1, nX2) x [nY1, nY2), clipped to the output.
+	void AddRect( int32_t nX1, int32_t nY1, int32_t nX2, int32_t nY2 )
+	{
+		const int32_t nMaxX = int32_t( uTilesX * k_uDamageTileSize );
+		const int32_t nMaxY = int32_t( uTilesY * k_uDamageTileSize );
+		nX1 = std::clamp( nX1, 0, nMaxX );
+		nY1 = std::clamp( nY1, 0, nMaxY );
+		nX2 = std::clamp( nX2, 0, nMaxX );
+		nY2 = std::clamp( nY2, 0, nMaxY );
+		if ( nX1 >= nX2 || nY1 >= nY2 )
+			return;
+
+		for ( uint32_t y = nY1 / k_uDamageTileSize; y <= ( nY2 - 1 ) / k_uDamageTileSize; y++ )
+		{
+			for ( uint32_t x = nX1 / k_uDamageTileSize; x <= ( nX2 - 1 ) / k_uDamageTileSize; x++ )
+				Set( x, y );
+		}
+	}
+
+	// Bounding box of the damaged tiles in output pixels (x1, y1, x2, y2),
+	// false if nothing is damaged.
+	bool GetBounds( int32_t *pBox ) const
+	{
+		uint32_t uMinX = uTilesX, uMinY = uTilesY, uMaxX = 0, uMaxY = 0;
+		for ( uint32_t y = 0; y < uTilesY; y++ )
+		{
+			for ( uint32_t x = 0; x < uTilesX; x++ )
+			{
+				if ( !Test( x, y ) )
+					continue;
+
+				uMinX = std::min( uMinX, x );
+				uMinY = std::min( uMinY, y );
+				uMaxX = std::max( uMaxX, x + 1 );
+				uMaxY = std::max( uMaxY, y + 1 );
+			}
+		}
+
+		if ( uMinX >= uMaxX || uMinY >= uMaxY )
+			return false;
+
+		pBox[0] = int32_t( uMinX * k_uDamageTileSize );
+		pBox[1] = int32_t( uMinY * k_uDamageTileSize );
+		pBox[2] = int32_t( uMaxX * k_uDamageTileSize );
+		pBox[3] = int32_t( uMaxY * k_uDamageTileSize );
+		return true;
+	}
+
+	uint32_t Count() const
+	{
+		uint32_t uCount = 0;
+		for ( uint64_t ulBits : bits )
+			uCount += __builtin_popcountll( ulBits );
+		return uCount;
+	}
+
+	DamageTiles_t &operator|=( const DamageTiles_t &other )
+	{
+		if ( other.uTilesX != uTilesX || other.uTilesY != uTilesY )
+		{
+			AddAll();
+			return *this;
+		}
+
+		for ( size_t i = 0; i < bits.size(); i++ )
+			bits[ i ] |= other.bits[ i ];
+		return *this;
+	}
+};
+
 struct FrameInfo_t
 {
 	bool useFSRLayer0;
@@ -281,12 +400,23 @@ struct FrameInfo_t
 	bool applyOutputColorMgmt; // drm only
 	EOTF outputEncodingEOTF;
 
+	// Tiles of the output that changed since the previous composite,
+	// filled in by vulkan_composite.
+	DamageTiles_t damage;
+
 	int layerCount;
 	struct Layer_t
 	{
 		gamescope::Rc<CVulkanTexture> tex;
 		int zpos;
 
+		// The commit tex holds, 0 if it is not a client buffer.
+		uint64_t ulCommitID = 0;
+		// If tex is the commit that followed ulPrevCommitID on the same
+		// surface, only the texels in damageBox (x1, y1, x2, y2) changed.
+		uint64_t ulPrevCommitID = 0;
+		int32_t damageBox[4] = {};
+
 		vec2_t offset;
 		vec2_t scale;
 
@@ -393,8 +523,54 @@ gamescope::OwningRc<CVulkanTexture> vulkan_create_texture_from_wlr_buffer( struc
 
 std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamescope::Rc<CVulkanTexture> pScreenshotTexture, bool partial, gamescope::Rc<CVulkanTexture> pOutputOverride = nullptr, bool increment = true, std::unique_ptr<CVulkanCmdBuffer> pInCommandBuffer = nullptr );
 void vulkan_wait( uint64_t ulSeqNo, bool bReset );
+// A sync_file that signals once submission ulSeqNo is done, for handing to
+// KMS instead of waiting on the CPU. -1 if unsupported or already signalled.
+int vulkan_export_sync_file( uint64_t ulSeqNo );
+bool vulkan_supports_sync_file_export();
+
+struct CompositeDamageStats_t
+{
+	uint32_t uFrames = 0;
+	uint64_t ulTilesComposited = 0;
+	uint64_t ulTilesTotal = 0;
+	// GPU time the skipped tiles would have taken, from the measured
+	// cost per tile. Only if the device supports timestamps.
+	std::optional<double> flSavedGPUTimeMs;
+};
+// Tile damage stats of the composites since the last call.
+CompositeDamageStats_t vulkan_take_composite_damage_stats();
+
+// Passes of a composite or screenshot that get their own GPU timestamps.
+enum EGPUPass
+{
+	k_EGPUPass_Reshade,
+	k_EGPUPass_Upscale,
+	k_EGPUPass_Blur,
+	k_EGPUPass_Composite,
+	k_EGPUPass_Capture,
+	k_EGPUPass_Screenshot,
+
+	k_EGPUPass_Count,
+};
+const char *GetGPUPassName( EGPUPass ePass );
+
+struct GPUPassStats_t
+{
+	uint32_t uSamples = 0;
+	double flP50Ms = 0.0;
+	double flP90Ms = 0.0;
+	double flP99Ms = 0.0;
+};
+void vulkan_record_gpu_pass_time( EGPUPass ePass, double flGPUTimeMs );
+// Percentiles over the last few hundred timings of each pass.
+std::array<GPUPassStats_t, k_EGPUPass_Count> vulkan_get_gpu_pass_stats();
 gamescope::Rc<CVulkanTexture> vulkan_get_last_output_image( bool partial, bool defer );
 gamescope::Rc<CVulkanTexture> vulkan_acquire_screenshot_texture(uint32_t width, uint32_t height, bool exportable, uint32_t drmFormat, EStreamColorspace colorspace = k_EStreamColorspace_Unknown);
+// Modifiers an exportable image with these flags can be allocated with, for
+// zero-copy sharing (eg. PipeWire). Empty if the device has no modifier support.
+std::vector<uint64_t> vulkan_get_export_modifiers(uint32_t drmFormat, CVulkanTexture::createFlags flags);
+// Number of DMA-BUF planes an image with this format and modifier exports.
+uint32_t vulkan_get_modifier_plane_count(uint32_t drmFormat, uint64_t modifier);
 
 void vulkan_present_to_window( void );
 
@@ -408,7 +584,7 @@ bool vulkan_supports_modifiers(void);
 
 gamescope::Rc<CVulkanTexture> vulkan_create_1d_lut(uint32_t size);
 gamescope::Rc<CVulkanTexture> vulkan_create_3d_lut(uint32_t width, uint32_t height, uint32_t depth);
-void vulkan_update_luts(const gamescope::Rc<CVulkanTexture>& lut1d, const gamescope::Rc<CVulkanTexture>& lut3d, void* lut1d_data, void* lut3d_data);
+uint64_t vulkan_update_luts(const gamescope::Rc<CVulkanTexture>& lut1d, const gamescope::Rc<CVulkanTexture>& lut3d, const void* lut1d_data, const void* lut3d_data);
 
 gamescope::Rc<CVulkanTexture> vulkan_get_hacky_blank_texture();
 
@@ -517,6 +693,11 @@ struct VulkanOutput_t
 	// NIS and FSR
 	gamescope::OwningRc<CVulkanTexture> tmpOutput;
 
+	// Blurred background the blur composite reads, and the dual-Kawase
+	// levels it is built from.
+	gamescope::OwningRc<CVulkanTexture> blurOutput;
+	std::vector<gamescope::OwningRc<CVulkanTexture>> blurLevels;
+
 	// NIS
 	gamescope::OwningRc<CVulkanTexture> nisScalerImage;
 	gamescope::OwningRc<CVulkanTexture> nisUsmImage;
@@ -532,6 +713,10 @@ enum ShaderType {
 	SHADER_TYPE_RCAS,
 	SHADER_TYPE_NIS,
 	SHADER_TYPE_RGB_TO_NV12,
+	SHADER_TYPE_FSR_FUSED,
+	SHADER_TYPE_NIS_FUSED,
+	SHADER_TYPE_BLUR_KAWASE_DOWN,
+	SHADER_TYPE_BLUR_KAWASE_UP,
 
 	SHADER_TYPE_COUNT
 };
@@ -581,6 +766,7 @@ struct PipelineInfo_t
 	uint32_t colorspaceMask;
 	uint32_t outputEOTF;
 	bool itmEnable;
+	bool halfPrecision;
 
 	bool operator==(const PipelineInfo_t& o) const {
 		return
@@ -591,7 +777,8 @@ struct PipelineInfo_t
 		compositeDebug == o.compositeDebug &&
 		colorspaceMask == o.colorspaceMask &&
 		outputEOTF == o.outputEOTF &&
-		itmEnable == o.itmEnable;
+		itmEnable == o.itmEnable &&
+		halfPrecision == o.halfPrecision;
 	}
 };
 
@@ -615,11 +802,36 @@ namespace std
 			hash = hash_combine(hash, k.colorspaceMask);
 			hash = hash_combine(hash, k.outputEOTF);
 			hash = hash_combine(hash, k.itmEnable);
+			hash = hash_combine(hash, k.halfPrecision);
 			return hash;
 		}
 	};
 }
 
+enum EPipelineCompilePriority : uint32_t
+{
+	// Walk of the permutation space from compileAllPipelines.
+	k_EPipelineCompilePriority_Background = 0,
+	// Neighbours of a variant that was just requested (same EOTF/colorspaces, other layer counts).
+	k_EPipelineCompilePriority_Likely,
+	// A frame asked for this and is compositing with a fallback until it is ready.
+	k_EPipelineCompilePriority_Demand,
+};
+
+struct PipelineCompileJob_t
+{
+	EPipelineCompilePriority ePriority;
+	uint64_t ulSequence;
+	PipelineInfo_t info;
+
+	// std::priority_queue is a max-heap: highest priority first, then FIFO.
+	bool operator<(const PipelineCompileJob_t& o) const {
+		if (ePriority != o.ePriority)
+			return ePriority < o.ePriority;
+		return ulSequence > o.ulSequence;
+	}
+};
+
 static inline uint32_t div_roundup(uint32_t x, uint32_t y)
 {
 	return (x + (y - 1)) / y;
@@ -630,6 +842,7 @@ static inline uint32_t div_roundup(uint32_t x, uint32_t y)
 	VK_FUNC(EnumerateDeviceExtensionProperties) \
 	VK_FUNC(EnumeratePhysicalDevices) \
 	VK_FUNC(GetDeviceProcAddr) \
+	VK_FUNC(GetPhysicalDeviceExternalSemaphoreProperties) \
 	VK_FUNC(GetPhysicalDeviceFeatures2) \
 	VK_FUNC(GetPhysicalDeviceFormatProperties) \
 	VK_FUNC(GetPhysicalDeviceFormatProperties2) \
@@ -662,6 +875,9 @@ static inline uint32_t div_roundup(uint32_t x, uint32_t y)
 	VK_FUNC(CmdEndRendering) \
 	VK_FUNC(CmdPipelineBarrier) \
 	VK_FUNC(CmdPushConstants) \
+	VK_FUNC(CmdPushDescriptorSetKHR) \
+	VK_FUNC(CmdResetQueryPool) \
+	VK_FUNC(CmdWriteTimestamp) \
 	VK_FUNC(CreateBuffer) \
 	VK_FUNC(CreateCommandPool) \
 	VK_FUNC(CreateComputePipelines) \
@@ -671,7 +887,9 @@ static inline uint32_t div_roundup(uint32_t x, uint32_t y)
 	VK_FUNC(CreateGraphicsPipelines) \
 	VK_FUNC(CreateImage) \
 	VK_FUNC(CreateImageView) \
+	VK_FUNC(CreatePipelineCache) \
 	VK_FUNC(CreatePipelineLayout) \
+	VK_FUNC(CreateQueryPool) \
 	VK_FUNC(CreateSampler) \
 	VK_FUNC(CreateSamplerYcbcrConversion) \
 	VK_FUNC(CreateSemaphore) \
@@ -685,6 +903,7 @@ static inline uint32_t div_roundup(uint32_t x, uint32_t y)
 	VK_FUNC(DestroyImage) \
 	VK_FUNC(DestroyImageView) \
 	VK_FUNC(DestroyPipeline) \
+	VK_FUNC(DestroyQueryPool) \
 	VK_FUNC(DestroySemaphore) \
 	VK_FUNC(DestroyPipelineLayout) \
 	VK_FUNC(DestroySampler) \
@@ -699,6 +918,9 @@ static inline uint32_t div_roundup(uint32_t x, uint32_t y)
 	VK_FUNC(GetImageMemoryRequirements) \
 	VK_FUNC(GetImageSubresourceLayout) \
 	VK_FUNC(GetMemoryFdKHR) \
+	VK_FUNC(GetMemoryHostPointerPropertiesEXT) \
+	VK_FUNC(GetPipelineCacheData) \
+	VK_FUNC(GetQueryPoolResults) \
 	VK_FUNC(GetSemaphoreCounterValue) \
 	VK_FUNC(GetSwapchainImagesKHR) \
 	VK_FUNC(MapMemory) \
@@ -706,6 +928,7 @@ static inline uint32_t div_roundup(uint32_t x, uint32_t y)
 	VK_FUNC(QueueSubmit) \
 	VK_FUNC(QueueWaitIdle) \
 	VK_FUNC(ResetCommandBuffer) \
+	VK_FUNC(ResetDescriptorPool) \
 	VK_FUNC(ResetFences) \
 	VK_FUNC(UnmapMemory) \
 	VK_FUNC(UpdateDescriptorSets) \
@@ -750,18 +973,19 @@ public:
 	uint64_t submitInternal( CVulkanCmdBuffer* cmdBuf );
 	void wait(uint64_t sequence, bool reset = true);
 	void waitIdle(bool reset = true);
+	int exportSyncFile(uint64_t sequence);
 	void garbageCollect();
-	inline VkDescriptorSet descriptorSet()
-	{
-		VkDescriptorSet ret = m_descriptorSets[m_currentDescriptorSet];
-		m_currentDescriptorSet = (m_currentDescriptorSet + 1) % m_descriptorSets.size();
-		return ret;
-	}
+	void savePipelineCache();
+	VkDescriptorPool createDescriptorPool();
 
 	std::shared_ptr<VulkanTimelineSemaphore_t> CreateTimelineSemaphore( uint64_t ulStartingPoint, bool bShared = false );
 	std::shared_ptr<VulkanTimelineSemaphore_t> ImportTimelineSemaphore( gamescope::CTimeline *pTimeline );
 
+	// Initial size of the upload ring, it grows when that's not enough.
 	static const uint32_t upload_buffer_size = 1920 * 1080 * 4;
+	// Descriptor sets per pool, command buffers chain more pools as needed.
+	// Unused with push descriptors.
+	static const uint32_t descriptor_sets_per_pool = 16;
 
 	inline VkDevice device() { return m_device; }
 	inline VkPhysicalDevice physDev() {return m_physDev; }
@@ -779,22 +1003,18 @@ public:
 	inline bool hasDrmPrimaryDevId() {return m_bHasDrmPrimaryDevId;}
 	inline dev_t primaryDevId() {return m_drmPrimaryDevId;}
 	inline bool supportsFp16() {return m_bSupportsFp16;}
-
-	inline void *uploadBufferData(uint32_t size)
-	{
-		assert(size <= upload_buffer_size);
-
-		m_uploadBufferOffset = align(m_uploadBufferOffset, 16);
-		if (m_uploadBufferOffset + size > upload_buffer_size)
-		{
-			fprintf(stderr, "Exceeded uploadBufferData\n");
-			waitIdle(false);
-		}
-
-		uint8_t *ptr = ((uint8_t*)m_uploadBufferData) + m_uploadBufferOffset;
-		m_uploadBufferOffset += size;
-		return ptr;
-	}
+	inline bool supportsTimestamps() {return m_bSupportsTimestamps;}
+	inline float timestampPeriod() {return m_flTimestampPeriod;}
+	inline bool supportsHostPointerImport() {return m_bSupportsHostPointerImport;}
+	inline VkDeviceSize hostPointerAlignment() {return m_ulHostPointerAlignment;}
+	inline bool supportsPushDescriptors() {return m_bSupportsPushDescriptors;}
+	inline bool supportsSyncFileExport() {return m_bSupportsSyncFileExport;}
+
+	// Owned by pCmdBuffer until it's submitted, nullptr if the ring can't fit
+	// size alongside the data pCmdBuffer already has in it.
+	void *uploadBufferData(uint32_t size, CVulkanCmdBuffer *pCmdBuffer);
+	inline VkDeviceSize uploadBufferOffset(const void *ptr) { return (const uint8_t *)ptr - (const uint8_t *)m_uploadBufferData; }
+	inline VkDeviceSize uploadBufferSize() { return m_uploadBufferSize; }
 
 	#define VK_FUNC(x) PFN_vk##x x = nullptr;
 	struct
@@ -805,6 +1025,9 @@ public:
 	#undef VK_FUNC
 
 	void resetCmdBuffers(uint64_t sequence);
+	void retireUploadBuffer(uint64_t sequence);
+	// For command buffers that are thrown away without being submitted.
+	void releaseUploadBuffer(CVulkanCmdBuffer *pCmdBuffer);
 
 protected:
 	friend class CVulkanCmdBuffer;
@@ -814,9 +1037,19 @@ protected:
 	bool createLayouts();
 	bool createPools();
 	bool createShaders();
+	bool createPipelineCache();
 	bool createScratchResources();
-	VkPipeline compilePipeline(uint32_t layerCount, uint32_t ycbcrMask, ShaderType type, uint32_t blur_layer_count, uint32_t composite_debug, uint32_t colorspace_mask, uint32_t output_eotf, bool itm_enable);
+	bool createUploadBuffer(uint32_t size);
+	bool growUploadBuffer(uint32_t minSize, bool bIgnoreMaxSize);
+	void submitUploadBuffer(CVulkanCmdBuffer *pCmdBuffer, uint64_t sequence);
+	VkPipeline compilePipeline(uint32_t layerCount, uint32_t ycbcrMask, ShaderType type, uint32_t blur_layer_count, uint32_t composite_debug, uint32_t colorspace_mask, uint32_t output_eotf, bool itm_enable, bool half_precision);
+	bool usesHalfPrecision(ShaderType type);
 	void compileAllPipelines();
+	void startPipelineCompileThreads();
+	void pipelineCompileThreadFunc();
+	void queuePipelineCompile(const PipelineInfo_t &info, EPipelineCompilePriority ePriority);
+	void queueLikelyPipelines(const PipelineInfo_t &info);
+	VkPipeline findFallbackPipeline(const PipelineInfo_t &info);
 
 	VkDevice m_device = nullptr;
 	VkPhysicalDevice m_physDev = nullptr;
@@ -827,7 +1060,6 @@ protected:
 	VkSampler m_ycbcrSampler = VK_NULL_HANDLE;
 	VkDescriptorSetLayout m_descriptorSetLayout = VK_NULL_HANDLE;
 	VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
-	VkDescriptorPool m_descriptorPool = VK_NULL_HANDLE;
 	VkCommandPool m_commandPool = VK_NULL_HANDLE;
 	VkCommandPool m_generalCommandPool = VK_NULL_HANDLE;
 
@@ -838,30 +1070,82 @@ protected:
 	dev_t m_drmPrimaryDevId = 0;
 
 	bool m_bSupportsFp16 = false;
+	bool m_bSupportsTimestamps = false;
+	float m_flTimestampPeriod = 1.0f; // ns per tick
 	bool m_bHasDrmPrimaryDevId = false;
 	bool m_bSupportsModifiers = false;
+	bool m_bSupportsHostPointerImport = false;
+	bool m_bSupportsPushDescriptors = false;
+	bool m_bSupportsSyncFileExport = false;
+	VkDeviceSize m_ulHostPointerAlignment = 4096;
 	bool m_bInitialized = false;
 
 
 	VkPhysicalDeviceMemoryProperties m_memoryProperties;
 
-	std::unordered_map< SamplerState, VkSampler > m_samplerCache;
+	// Looked up several times per composite, readers never lock.
+	gamescope::CReadMostlyMap< SamplerState, VkSampler > m_samplerCache{ 8 };
 	std::array<VkShaderModule, SHADER_TYPE_COUNT> m_shaderModules;
-	std::unordered_map<PipelineInfo_t, VkPipeline> m_pipelineMap;
-	std::mutex m_pipelineMutex;
-
-	// currently just one set, no need to double buffer because we
-	// vkQueueWaitIdle after each submit.
-	// should be moved to the output if we are going to support multiple outputs
-	std::array<VkDescriptorSet, 3> m_descriptorSets;
-	uint32_t m_currentDescriptorSet = 0;
-
-	VkBuffer m_uploadBuffer;
-	VkDeviceMemory m_uploadBufferMemory;
-	void *m_uploadBufferData;
-	uint32_t m_uploadBufferOffset = 0;
+	// Half precision variants, where there is one and the device supports them.
+	std::array<VkShaderModule, SHADER_TYPE_COUNT> m_shaderModulesFp16 = {};
+	gamescope::CReadMostlyMap<PipelineInfo_t, VkPipeline> m_pipelineMap{ 1024 };
+
+	// Pipeline compile scheduler, a few gamescope-shdr threads draining a priority queue.
+	std::mutex m_pipelineCompileMutex;
+	std::condition_variable m_pipelineCompileCV;
+	std::priority_queue<PipelineCompileJob_t> m_pipelineCompileQueue;
+	struct PipelineCompileState_t
+	{
+		EPipelineCompilePriority ePriority;
+		bool bCompiling;
+	};
+	std::unordered_map<PipelineInfo_t, PipelineCompileState_t> m_pipelinesQueued; // queued or compiling
+	uint64_t m_ulPipelineCompileSequence = 0;
+	uint64_t m_ulPipelinePrecompileStartTime = 0;
+	uint32_t m_uPipelinesPrecompiled = 0;
+
+	// Persisted to $XDG_CACHE_HOME/gamescope/pipelines, see createPipelineCache.
+	VkPipelineCache m_pipelineCache = VK_NULL_HANDLE;
+	uint64_t m_ulShaderHash = 0;
+	std::atomic<bool> m_bPipelineCacheDirty = { false };
+	std::mutex m_pipelineCacheSaveMutex;
+
+	// Ring of host-visible memory for constants and texture uploads.
+	// Data between tail and head is in use; each allocation belongs to the
+	// command buffer it was made for, and is given back once the GPU has
+	// passed the sequence number that command buffer was submitted with.
+	VkBuffer m_uploadBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory m_uploadBufferMemory = VK_NULL_HANDLE;
+	void *m_uploadBufferData = nullptr;
+	uint32_t m_uploadBufferSize = 0;
+	uint32_t m_uploadBufferAlignment = 16;
+	uint32_t m_uploadBufferMaxRange = 16384;
+	uint32_t m_uploadBufferHead = 0;
+	uint32_t m_uploadBufferTail = 0;
+	uint32_t m_uploadBufferUsed = 0; // includes padding skipped when wrapping
+	struct UploadBufferRegion_t
+	{
+		// Still recording, ulSeqNo is only valid once this is nullptr.
+		CVulkanCmdBuffer *pCmdBuffer;
+		uint64_t ulSeqNo;
+		uint32_t uEnd;
+		uint32_t uSize;
+	};
+	// In allocation order, the tail only moves past submitted regions.
+	std::deque<UploadBufferRegion_t> m_uploadBufferRegions;
+	// Rings we outgrew, freed once every command buffer that used them is done.
+	struct RetiredUploadBuffer_t
+	{
+		uint64_t ulSeqNo;
+		std::vector<CVulkanCmdBuffer *> pendingCmdBuffers;
+		VkBuffer buffer;
+		VkDeviceMemory memory;
+	};
+	std::vector<RetiredUploadBuffer_t> m_retiredUploadBuffers;
 
 	VkSemaphore m_scratchTimelineSemaphore;
+	// Binary, a sync_file can't be taken from a timeline semaphore.
+	VkSemaphore m_syncFileSemaphore = VK_NULL_HANDLE;
 	std::atomic<uint64_t> m_submissionSeqNo = { 0 };
 	std::vector<std::unique_ptr<CVulkanCmdBuffer>> m_unusedCmdBufs;
 	std::map<uint64_t, std::unique_ptr<CVulkanCmdBuffer>> m_pendingCmdBufs;
@@ -888,7 +1172,7 @@ struct TextureState
 class CVulkanCmdBuffer
 {
 public:
-	CVulkanCmdBuffer(CVulkanDevice *parent, VkCommandBuffer cmdBuffer, VkQueue queue, uint32_t queueFamily);
+	CVulkanCmdBuffer(CVulkanDevice *parent, VkCommandBuffer cmdBuffer, VkCommandPool commandPool, VkQueue queue, uint32_t queueFamily);
 	~CVulkanCmdBuffer();
 	CVulkanCmdBuffer(const CVulkanCmdBuffer& other) = delete;
 	CVulkanCmdBuffer(CVulkanCmdBuffer&& other) = delete;
@@ -918,20 +1202,35 @@ public:
 	void prepareSrcImage(CVulkanTexture *image);
 	void prepareDestImage(CVulkanTexture *image);
 	void discardImage(CVulkanTexture *image);
+	// Like prepareDestImage, but keeps the current contents for partial updates.
+	void preserveImage(CVulkanTexture *image);
 	void markDirty(CVulkanTexture *image);
 	void insertBarrier(bool flush = false);
 
+	// Timestamps around the commands recorded in between, resolved once the
+	// GPU is done with the buffer. Passes can't nest.
+	void beginGPUPass(EGPUPass ePass);
+	// For a composite that only redrew some tiles, so the pass time also
+	// gives an estimate of what the skipped tiles would have cost.
+	void setGPUPassTiles(uint32_t uTilesComposited, uint32_t uTilesTotal);
+	void endGPUPass();
+	void resolveGPUPasses();
+
 	VkQueue queue() { return m_queue; }
 	uint32_t queueFamily() { return m_queueFamily; }
 
 	void AddDependency( std::shared_ptr<VulkanTimelineSemaphore_t> pTimelineSemaphore, uint64_t ulPoint );
 	void AddSignal( std::shared_ptr<VulkanTimelineSemaphore_t> pTimelineSemaphore, uint64_t ulPoint );
 
+	VkDescriptorSet allocateDescriptorSet();
+
 	const std::vector<VulkanTimelinePoint_t> &GetExternalDependencies() const { return m_ExternalDependencies; }
 	const std::vector<VulkanTimelinePoint_t> &GetExternalSignals() const { return m_ExternalSignals; }
 
 private:
 	VkCommandBuffer m_cmdBuffer;
+	// The pool cmdBuffer was allocated from, and is freed back to.
+	VkCommandPool m_commandPool;
 	CVulkanDevice *m_device;
 
 	VkQueue m_queue;
@@ -953,7 +1252,25 @@ private:
 	std::vector<VulkanTimelinePoint_t> m_ExternalDependencies;
 	std::vector<VulkanTimelinePoint_t> m_ExternalSignals;
 
-	uint32_t m_renderBufferOffset = 0;
+	// Reset along with the command buffer, once the GPU is done with it.
+	std::vector<VkDescriptorPool> m_descriptorPools;
+	uint32_t m_currentDescriptorPool = 0;
+
+	VkBuffer m_renderBuffer = VK_NULL_HANDLE;
+	VkDeviceSize m_renderBufferOffset = 0;
+	VkDeviceSize m_renderBufferRange = 0;
+
+	// Two queries per pass, created on first use.
+	static constexpr uint32_t k_uMaxGPUPasses = 8;
+	VkQueryPool m_gpuPassQueryPool = VK_NULL_HANDLE;
+	struct GPUPass_t
+	{
+		EGPUPass ePass;
+		uint32_t uTilesComposited = 0;
+		uint32_t uTilesTotal = 0;
+	};
+	std::vector<GPUPass_t> m_gpuPasses;
+	bool m_bGPUPassOpen = false;
 };
 
 uint32_t VulkanFormatToDRM( VkFormat vkFormat, std::optional<bool> obHasAlphaOverride = std::nullopt );
@@ -966,5 +1283,6 @@ gamescope::OwningRc<CVulkanTexture> vulkan_create_flat_texture( uint32_t width,
 bool vulkan_supports_hdr10();
 
 void vulkan_wait_idle();
+void vulkan_save_pipeline_cache();
 
 extern CVulkanDevice g_device;
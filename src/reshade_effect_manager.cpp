@@ -3,6 +3,7 @@
 #include <unordered_map>
 
 #include "reshade_effect_manager.hpp"
+#include "reshade_module_cache.hpp"
 #include "log.hpp"
 
 #include "steamcompmgr.hpp"
@@ -14,12 +15,15 @@
 
 #include "reshade_api_format.hpp"
 #include "convar.h"
+#include "gpuvis_trace_utils.h"
 
 #include <stb_image.h>
 #define STB_IMAGE_RESIZE_IMPLEMENTATION
 #include <stb_image_resize.h>
 
 #include <mutex>
+#include <thread>
+#include <pthread.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <pwd.h>
@@ -875,7 +879,20 @@ ReshadeEffectPipeline::ReshadeEffectPipeline()
 
 ReshadeEffectPipeline::~ReshadeEffectPipeline()
 {
-    m_device->waitIdle();
+    if (!m_device)
+        return;
+
+    // Only our own submissions can still be using our objects, the composite
+    // holds references to the textures it samples.
+    for (auto& pSlot : m_frameSlots)
+    {
+        if (pSlot->ulSequence)
+            m_device->wait(pSlot->ulSequence, false);
+        destroyFrameSlot(pSlot.get());
+    }
+    m_frameSlots.clear();
+
+    freeUploads(m_pendingUploads);
 
     for (auto& pipeline : m_pipelines)
         m_device->vk.DestroyPipeline(m_device->device(), pipeline, nullptr);
@@ -890,23 +907,27 @@ ReshadeEffectPipeline::~ReshadeEffectPipeline()
     m_textures.clear();
     m_rt = nullptr;
 
-    m_cmdBuffer = std::nullopt;
-
-    m_device->vk.DestroyBuffer(m_device->device(), m_buffer, nullptr);
-    m_device->vk.FreeMemory(m_device->device(), m_bufferMemory, nullptr);
-    m_mappedPtr = nullptr;
+    m_pTimelineSemaphore = nullptr;
 
     for (uint32_t i = 0; i < GAMESCOPE_RESHADE_DESCRIPTOR_SET_COUNT; i++)
-    {
-        m_device->vk.FreeDescriptorSets(m_device->device(), m_descriptorPool, 1, &m_descriptorSets[i]);
         m_device->vk.DestroyDescriptorSetLayout(m_device->device(), m_descriptorSetLayouts[i], nullptr);
-    }
 
-    m_device->vk.DestroyDescriptorPool(m_device->device(), m_descriptorPool, nullptr);
     m_device->vk.DestroyPipelineLayout(m_device->device(), m_pipelineLayout, nullptr);
 }
 
-bool ReshadeEffectPipeline::init(CVulkanDevice *device, const ReshadeEffectKey &key)
+void ReshadeEffectPipeline::freeUploads(std::vector<ReshadeTextureUpload> &uploads)
+{
+    for (auto& upload : uploads)
+    {
+        if (upload.buffer != VK_NULL_HANDLE)
+            m_device->vk.DestroyBuffer(m_device->device(), upload.buffer, nullptr);
+        if (upload.memory != VK_NULL_HANDLE)
+            m_device->vk.FreeMemory(m_device->device(), upload.memory, nullptr);
+    }
+    uploads.clear();
+}
+
+bool ReshadeEffectPipeline::init(CVulkanDevice *device, const ReshadeEffectKey &key, float flSDROnHDRBrightness)
 {
     m_key = key;
     m_device = device;
@@ -928,7 +949,7 @@ bool ReshadeEffectPipeline::init(CVulkanDevice *device, const ReshadeEffectKey &
 	pp.add_macro_definition("BUFFER_COLOR_SPACE", std::to_string(static_cast<uint32_t>(ConvertToReshadeColorSpace(key.bufferColorSpace))));
 	pp.add_macro_definition("BUFFER_COLOR_BIT_DEPTH", std::to_string(GetFormatBitDepth(key.bufferFormat)));
     pp.add_macro_definition("GAMESCOPE", "1");
-    pp.add_macro_definition("GAMESCOPE_SDR_ON_HDR_NITS", std::to_string(g_ColorMgmt.pending.flSDROnHDRBrightness));
+    pp.add_macro_definition("GAMESCOPE_SDR_ON_HDR_NITS", std::to_string(flSDROnHDRBrightness));
 
     std::string gamescope_reshade_share_path = "/share/gamescope/reshade";
 
@@ -957,21 +978,31 @@ bool ReshadeEffectPipeline::init(CVulkanDevice *device, const ReshadeEffectKey &
 		return false;
 	}
 
-	std::unique_ptr<reshadefx::codegen> codegen(reshadefx::create_codegen_spirv(
-		true /* vulkan semantics */, true /* debug info */, false /* uniforms to spec constants */, false /*flip vertex shader*/));
-
-	reshadefx::parser parser;
-	parser.parse(pp.output(), codegen.get());
+	m_module = std::make_unique<reshadefx::module>();
 
-	errors = parser.errors();
-	if (!errors.empty())
+	const uint64_t ulCacheKey = reshade_module_cache_key(pp.output(), key);
+	if (reshade_module_cache_read(ulCacheKey, m_module.get()))
 	{
-		reshade_log.errorf("Failed to parse reshade fx shader module: %s", errors.c_str());
-		return false;
+		reshade_log.infof("Using cached module for %s", key.path.c_str());
 	}
+	else
+	{
+		std::unique_ptr<reshadefx::codegen> codegen(reshadefx::create_codegen_spirv(
+			true /* vulkan semantics */, true /* debug info */, false /* uniforms to spec constants */, false /*flip vertex shader*/));
 
-	m_module = std::make_unique<reshadefx::module>();
-	codegen->write_result(*m_module);
+		reshadefx::parser parser;
+		parser.parse(pp.output(), codegen.get());
+
+		errors = parser.errors();
+		if (!errors.empty())
+		{
+			reshade_log.errorf("Failed to parse reshade fx shader module: %s", errors.c_str());
+			return false;
+		}
+
+		codegen->write_result(*m_module);
+		reshade_module_cache_write(ulCacheKey, *m_module);
+	}
 
 #if 0
     FILE *f = fopen("test.spv", "wb");
@@ -988,73 +1019,11 @@ bool ReshadeEffectPipeline::init(CVulkanDevice *device, const ReshadeEffectKey &
 	auto& technique = m_module->techniques[key.techniqueIdx];
 	reshade_log.infof("Using technique: %s\n", technique.name.c_str());
 
-    // Allocate command buffers
+    m_pTimelineSemaphore = device->CreateTimelineSemaphore(0);
+    if (!m_pTimelineSemaphore)
     {
-		VkCommandBufferAllocateInfo commandBufferAllocateInfo =
-        {
-			.sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-			.commandPool        = device->generalCommandPool(),
-			.level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-			.commandBufferCount = 1
-		};
-
-        VkCommandBuffer cmdBuffer = VK_NULL_HANDLE;
-		VkResult result = device->vk.AllocateCommandBuffers(device->device(), &commandBufferAllocateInfo, &cmdBuffer);
-		if (result != VK_SUCCESS)
-		{
-			reshade_log.errorf("vkAllocateCommandBuffers failed");
-			return false;
-		}
-
-        m_cmdBuffer.emplace(device, cmdBuffer, device->generalQueue(), device->generalQueueFamily());
-    }
-
-    // Create Uniform Buffer
-    {
-        VkBufferCreateInfo bufferCreateInfo =
-        {
-            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-            .size  = m_module->total_uniform_size,
-            .usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-        };
-
-        VkResult result = device->vk.CreateBuffer(device->device(), &bufferCreateInfo, nullptr, &m_buffer);
-        if (result != VK_SUCCESS)
-        {
-            reshade_log.errorf("vkCreateBuffer failed");
-            return false;
-        }
-
-        VkMemoryRequirements memRequirements;
-        device->vk.GetBufferMemoryRequirements(device->device(), m_buffer, &memRequirements);
-
-        uint32_t memTypeIndex = device->findMemoryType(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, memRequirements.memoryTypeBits);
-        assert(memTypeIndex != ~0u);
-        VkMemoryAllocateInfo allocInfo =
-        {
-            .sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-            .allocationSize  = memRequirements.size,
-            .memoryTypeIndex = memTypeIndex,
-        };
-        result = device->vk.AllocateMemory(device->device(), &allocInfo, nullptr, &m_bufferMemory);
-        if (result != VK_SUCCESS)
-        {
-            reshade_log.errorf("vkAllocateMemory failed");
-            return false;
-        }
-        device->vk.BindBufferMemory(device->device(), m_buffer, m_bufferMemory, 0);
-        if (result != VK_SUCCESS)
-        {
-            reshade_log.errorf("vkBindBufferMemory failed");
-            return false;
-        }
-
-        result = device->vk.MapMemory(device->device(), m_bufferMemory, 0, VK_WHOLE_SIZE, 0, &m_mappedPtr);
-        if (result != VK_SUCCESS)
-        {
-            reshade_log.errorf("vkMapMemory failed");
-            return false;
-        }
+        reshade_log.errorf("Failed to create timeline semaphore");
+        return false;
     }
 
     // Create Uniforms
@@ -1172,37 +1141,16 @@ bool ReshadeEffectPipeline::init(CVulkanDevice *device, const ReshadeEffectKey &
                 }
 
                 memcpy(scratchPtr, pixels, size);
-
-                m_cmdBuffer->reset();
-                m_cmdBuffer->begin();
-                m_cmdBuffer->copyBufferToImage(scratchBuffer, 0, 0, texture);
-                device->submitInternal(&*m_cmdBuffer);
-                device->waitIdle(false);
-
                 free(data);
-                device->vk.DestroyBuffer(device->device(), scratchBuffer, nullptr);
-                device->vk.FreeMemory(device->device(), scratchMemory, nullptr);
+
+                // This may be running on the compile thread, the copy is recorded
+                // at the start of the first execute() instead.
+                m_pendingUploads.push_back(ReshadeTextureUpload{ scratchBuffer, scratchMemory, texture });
             }
         }
         else if (texture)
         {
-            m_cmdBuffer->reset();
-            m_cmdBuffer->begin();
-            VkClearColorValue clearColor{};
-            VkImageSubresourceRange range =
-            {
-                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                .baseMipLevel = 0,
-                .levelCount = 1,
-                .baseArrayLayer = 0,
-                .layerCount = 1,
-            };
-            m_cmdBuffer->prepareDestImage(texture.get());
-            m_cmdBuffer->insertBarrier();
-            device->vk.CmdClearColorImage(m_cmdBuffer->rawBuffer(), texture->vkImage(), VK_IMAGE_LAYOUT_GENERAL, &clearColor, 1, &range);
-            m_cmdBuffer->markDirty(texture.get());
-            device->submitInternal(&*m_cmdBuffer);
-            device->waitIdle(false);
+            m_pendingUploads.push_back(ReshadeTextureUpload{ VK_NULL_HANDLE, VK_NULL_HANDLE, texture });
         }
 
         m_textures.emplace_back(std::move(texture));
@@ -1360,47 +1308,6 @@ bool ReshadeEffectPipeline::init(CVulkanDevice *device, const ReshadeEffectKey &
         }
     }
 
-    {
-        VkDescriptorPoolSize descriptorPoolSizes[] =
-        {
-            { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,         uint32_t(GAMESCOPE_RESHADE_DESCRIPTOR_SET_COUNT * 1u) },
-            { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, uint32_t(GAMESCOPE_RESHADE_DESCRIPTOR_SET_COUNT * m_module->samplers.size()) },
-            { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,          uint32_t(GAMESCOPE_RESHADE_DESCRIPTOR_SET_COUNT * m_module->storages.size()) },
-        };
-
-        VkDescriptorPoolCreateInfo descriptorPoolCreateInfo;
-        descriptorPoolCreateInfo.sType         = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-        descriptorPoolCreateInfo.pNext         = nullptr;
-        descriptorPoolCreateInfo.flags         = 0;
-        descriptorPoolCreateInfo.maxSets       = GAMESCOPE_RESHADE_DESCRIPTOR_SET_COUNT;
-        descriptorPoolCreateInfo.poolSizeCount = std::size(descriptorPoolSizes);
-        descriptorPoolCreateInfo.pPoolSizes    = descriptorPoolSizes;
-
-        VkResult result = device->vk.CreateDescriptorPool(device->device(), &descriptorPoolCreateInfo, nullptr, &m_descriptorPool);
-        if (result != VK_SUCCESS)
-        {
-            reshade_log.errorf("Failed to create descriptor pool.");
-            return false;
-        }
-    }
-
-    for (uint32_t i = 0; i < GAMESCOPE_RESHADE_DESCRIPTOR_SET_COUNT; i++)
-    {
-        VkDescriptorSetAllocateInfo descriptorSetAllocateInfo;
-        descriptorSetAllocateInfo.sType              = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-        descriptorSetAllocateInfo.pNext              = nullptr;
-        descriptorSetAllocateInfo.descriptorPool     = m_descriptorPool;
-        descriptorSetAllocateInfo.descriptorSetCount = 1;
-        descriptorSetAllocateInfo.pSetLayouts        = &m_descriptorSetLayouts[i];
-
-        VkResult result = device->vk.AllocateDescriptorSets(device->device(), &descriptorSetAllocateInfo, &m_descriptorSets[i]);
-        if (result != VK_SUCCESS)
-        {
-            reshade_log.errorf("Failed to allocate descriptor set.");
-            return false;
-        }
-    }
-
     // Create Pipelines
 	for (const auto& pass : technique.passes)
 	{
@@ -1663,34 +1570,224 @@ bool ReshadeEffectPipeline::init(CVulkanDevice *device, const ReshadeEffectKey &
     return true;
 }
 
-void ReshadeEffectPipeline::update()
+ReshadeEffectPipeline::FrameSlot_t *ReshadeEffectPipeline::acquireFrameSlot()
 {
-    if (g_effectReadyCallback && g_reshadeEffectPath) {
-        g_effectReadyCallback(g_reshadeEffectPath);
-        g_effectReadyCallback = nullptr;
+    CVulkanDevice *device = m_device;
+
+    uint64_t ulCompletedPoint = 0;
+    if (device->vk.GetSemaphoreCounterValue(device->device(), m_pTimelineSemaphore->pVkSemaphore, &ulCompletedPoint) != VK_SUCCESS)
+        ulCompletedPoint = 0;
+
+    FrameSlot_t *pOldestSlot = nullptr;
+    for (auto& pSlot : m_frameSlots)
+    {
+        if (pSlot->ulTimelinePoint <= ulCompletedPoint)
+            return recycleFrameSlot(pSlot.get());
+
+        if (!pOldestSlot || pSlot->ulTimelinePoint < pOldestSlot->ulTimelinePoint)
+            pOldestSlot = pSlot.get();
+    }
+
+    // Everything is still in flight, add another slot rather than stall the
+    // compositor, unless the GPU is so far behind that waiting is fine.
+    if (m_frameSlots.size() >= k_uMaxFrameSlots)
+    {
+        VkSemaphoreWaitInfo waitInfo =
+        {
+            .sType          = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+            .semaphoreCount = 1,
+            .pSemaphores    = &m_pTimelineSemaphore->pVkSemaphore,
+            .pValues        = &pOldestSlot->ulTimelinePoint,
+        };
+
+        if (device->vk.WaitSemaphores(device->device(), &waitInfo, ~0ull) != VK_SUCCESS)
+        {
+            reshade_log.errorf("vkWaitSemaphores failed");
+            return nullptr;
+        }
+
+        return recycleFrameSlot(pOldestSlot);
+    }
+
+    auto pSlot = std::make_unique<FrameSlot_t>();
+    if (!createFrameSlot(pSlot.get()))
+    {
+        destroyFrameSlot(pSlot.get());
+        return nullptr;
+    }
+
+    return m_frameSlots.emplace_back(std::move(pSlot)).get();
+}
+
+ReshadeEffectPipeline::FrameSlot_t *ReshadeEffectPipeline::recycleFrameSlot(FrameSlot_t *pSlot)
+{
+    freeUploads(pSlot->retiredUploads);
+    // Not one of the device's pooled buffers, so resolve its timings ourselves.
+    pSlot->pCmdBuffer->resolveGPUPasses();
+    pSlot->pCmdBuffer->reset();
+    return pSlot;
+}
+
+// Only called from the compositor thread, the general command pool isn't ours.
+bool ReshadeEffectPipeline::createFrameSlot(FrameSlot_t *pSlot)
+{
+    CVulkanDevice *device = m_device;
+
+    {
+        VkCommandBufferAllocateInfo commandBufferAllocateInfo =
+        {
+            .sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool        = device->generalCommandPool(),
+            .level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1
+        };
+
+        VkCommandBuffer cmdBuffer = VK_NULL_HANDLE;
+        VkResult result = device->vk.AllocateCommandBuffers(device->device(), &commandBufferAllocateInfo, &cmdBuffer);
+        if (result != VK_SUCCESS)
+        {
+            reshade_log.errorf("vkAllocateCommandBuffers failed");
+            return false;
+        }
+
+        pSlot->pCmdBuffer = std::make_unique<CVulkanCmdBuffer>(device, cmdBuffer, device->generalCommandPool(), device->generalQueue(), device->generalQueueFamily());
     }
 
+    // One uniform buffer per slot, the uniforms are rewritten every execution.
+    {
+        VkBufferCreateInfo bufferCreateInfo =
+        {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size  = m_module->total_uniform_size,
+            .usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        };
+
+        VkResult result = device->vk.CreateBuffer(device->device(), &bufferCreateInfo, nullptr, &pSlot->buffer);
+        if (result != VK_SUCCESS)
+        {
+            reshade_log.errorf("vkCreateBuffer failed");
+            return false;
+        }
+
+        VkMemoryRequirements memRequirements;
+        device->vk.GetBufferMemoryRequirements(device->device(), pSlot->buffer, &memRequirements);
+
+        uint32_t memTypeIndex = device->findMemoryType(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, memRequirements.memoryTypeBits);
+        assert(memTypeIndex != ~0u);
+        VkMemoryAllocateInfo allocInfo =
+        {
+            .sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .allocationSize  = memRequirements.size,
+            .memoryTypeIndex = memTypeIndex,
+        };
+        result = device->vk.AllocateMemory(device->device(), &allocInfo, nullptr, &pSlot->bufferMemory);
+        if (result != VK_SUCCESS)
+        {
+            reshade_log.errorf("vkAllocateMemory failed");
+            return false;
+        }
+        result = device->vk.BindBufferMemory(device->device(), pSlot->buffer, pSlot->bufferMemory, 0);
+        if (result != VK_SUCCESS)
+        {
+            reshade_log.errorf("vkBindBufferMemory failed");
+            return false;
+        }
+
+        result = device->vk.MapMemory(device->device(), pSlot->bufferMemory, 0, VK_WHOLE_SIZE, 0, &pSlot->mappedPtr);
+        if (result != VK_SUCCESS)
+        {
+            reshade_log.errorf("vkMapMemory failed");
+            return false;
+        }
+    }
+
+    {
+        VkDescriptorPoolSize descriptorPoolSizes[] =
+        {
+            { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,         uint32_t(GAMESCOPE_RESHADE_DESCRIPTOR_SET_COUNT * 1u) },
+            { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, uint32_t(GAMESCOPE_RESHADE_DESCRIPTOR_SET_COUNT * m_module->samplers.size()) },
+            { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,          uint32_t(GAMESCOPE_RESHADE_DESCRIPTOR_SET_COUNT * m_module->storages.size()) },
+        };
+
+        VkDescriptorPoolCreateInfo descriptorPoolCreateInfo;
+        descriptorPoolCreateInfo.sType         = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        descriptorPoolCreateInfo.pNext         = nullptr;
+        descriptorPoolCreateInfo.flags         = 0;
+        descriptorPoolCreateInfo.maxSets       = GAMESCOPE_RESHADE_DESCRIPTOR_SET_COUNT;
+        descriptorPoolCreateInfo.poolSizeCount = std::size(descriptorPoolSizes);
+        descriptorPoolCreateInfo.pPoolSizes    = descriptorPoolSizes;
+
+        VkResult result = device->vk.CreateDescriptorPool(device->device(), &descriptorPoolCreateInfo, nullptr, &pSlot->descriptorPool);
+        if (result != VK_SUCCESS)
+        {
+            reshade_log.errorf("Failed to create descriptor pool.");
+            return false;
+        }
+    }
+
+    for (uint32_t i = 0; i < GAMESCOPE_RESHADE_DESCRIPTOR_SET_COUNT; i++)
+    {
+        VkDescriptorSetAllocateInfo descriptorSetAllocateInfo;
+        descriptorSetAllocateInfo.sType              = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        descriptorSetAllocateInfo.pNext              = nullptr;
+        descriptorSetAllocateInfo.descriptorPool     = pSlot->descriptorPool;
+        descriptorSetAllocateInfo.descriptorSetCount = 1;
+        descriptorSetAllocateInfo.pSetLayouts        = &m_descriptorSetLayouts[i];
+
+        VkResult result = device->vk.AllocateDescriptorSets(device->device(), &descriptorSetAllocateInfo, &pSlot->descriptorSets[i]);
+        if (result != VK_SUCCESS)
+        {
+            reshade_log.errorf("Failed to allocate descriptor set.");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void ReshadeEffectPipeline::destroyFrameSlot(FrameSlot_t *pSlot)
+{
+    freeUploads(pSlot->retiredUploads);
+    pSlot->pCmdBuffer = nullptr;
+
+    m_device->vk.DestroyBuffer(m_device->device(), pSlot->buffer, nullptr);
+    m_device->vk.FreeMemory(m_device->device(), pSlot->bufferMemory, nullptr);
+    pSlot->mappedPtr = nullptr;
+
+    // Frees the slot's descriptor sets with it.
+    m_device->vk.DestroyDescriptorPool(m_device->device(), pSlot->descriptorPool, nullptr);
+}
+
+void ReshadeEffectPipeline::update(void *mappedPtr)
+{
     for (auto& uniform : m_uniforms)
-        uniform->update(m_mappedPtr);
+        uniform->update(mappedPtr);
 }
 
-uint64_t ReshadeEffectPipeline::execute(gamescope::Rc<CVulkanTexture> inImage, gamescope::Rc<CVulkanTexture> *outImage)
+std::optional<ReshadeExecution_t> ReshadeEffectPipeline::execute(gamescope::Rc<CVulkanTexture> inImage, gamescope::Rc<CVulkanTexture> *outImage)
 {
     CVulkanDevice *device = m_device;
-    this->update();
+
+    FrameSlot_t *pSlot = acquireFrameSlot();
+    if (!pSlot)
+        return std::nullopt;
+
+    CVulkanCmdBuffer *pCmdBuffer = pSlot->pCmdBuffer.get();
+
+    this->update(pSlot->mappedPtr);
 
     // Update descriptor sets.
     {
         VkDescriptorBufferInfo bufferInfo =
         {
-            .buffer = m_buffer,
+            .buffer = pSlot->buffer,
             .range  = VK_WHOLE_SIZE,
         };
 
         VkWriteDescriptorSet writeDescriptorSet =
         {
             .sType            = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            .dstSet           = m_descriptorSets[GAMESCOPE_RESHADE_DESCRIPTOR_SET_UBO],
+            .dstSet           = pSlot->descriptorSets[GAMESCOPE_RESHADE_DESCRIPTOR_SET_UBO],
             .dstBinding       = 0,
             .descriptorCount  = 1,
             .descriptorType   = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
@@ -1715,7 +1812,7 @@ uint64_t ReshadeEffectPipeline::execute(gamescope::Rc<CVulkanTexture> inImage, g
         VkWriteDescriptorSet writeDescriptorSet =
         {
             .sType            = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            .dstSet           = m_descriptorSets[GAMESCOPE_RESHADE_DESCRIPTOR_SET_SAMPLED_IMAGES],
+            .dstSet           = pSlot->descriptorSets[GAMESCOPE_RESHADE_DESCRIPTOR_SET_SAMPLED_IMAGES],
             .dstBinding       = uint32_t(i),
             .descriptorCount  = 1,
             .descriptorType   = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
@@ -1739,7 +1836,7 @@ uint64_t ReshadeEffectPipeline::execute(gamescope::Rc<CVulkanTexture> inImage, g
         VkWriteDescriptorSet writeDescriptorSet =
         {
             .sType            = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            .dstSet           = m_descriptorSets[GAMESCOPE_RESHADE_DESCRIPTOR_SET_STORAGE_IMAGES],
+            .dstSet           = pSlot->descriptorSets[GAMESCOPE_RESHADE_DESCRIPTOR_SET_STORAGE_IMAGES],
             .dstBinding       = uint32_t(i),
             .descriptorCount  = 1,
             .descriptorType   = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
@@ -1750,12 +1847,39 @@ uint64_t ReshadeEffectPipeline::execute(gamescope::Rc<CVulkanTexture> inImage, g
     }
 
     // Draw and compute time!
-    m_cmdBuffer->reset();
-    m_cmdBuffer->begin();
+    pCmdBuffer->begin();
 
-    VkCommandBuffer cmd = m_cmdBuffer->rawBuffer();
-    device->vk.CmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, std::size(m_descriptorSets), m_descriptorSets, 0, nullptr);
-    device->vk.CmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, std::size(m_descriptorSets), m_descriptorSets, 0, nullptr);
+    VkCommandBuffer cmd = pCmdBuffer->rawBuffer();
+
+    for (auto& upload : m_pendingUploads)
+    {
+        if (upload.buffer != VK_NULL_HANDLE)
+        {
+            pCmdBuffer->copyBufferToImage(upload.buffer, 0, 0, upload.texture);
+        }
+        else
+        {
+            VkClearColorValue clearColor{};
+            VkImageSubresourceRange range =
+            {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .baseMipLevel = 0,
+                .levelCount = 1,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            };
+            pCmdBuffer->prepareDestImage(upload.texture.get());
+            pCmdBuffer->insertBarrier();
+            device->vk.CmdClearColorImage(cmd, upload.texture->vkImage(), VK_IMAGE_LAYOUT_GENERAL, &clearColor, 1, &range);
+            pCmdBuffer->markDirty(upload.texture.get());
+        }
+    }
+    // Scratch buffers are freed once this submission has retired.
+    pSlot->retiredUploads = std::exchange(m_pendingUploads, {});
+    pCmdBuffer->beginGPUPass(k_EGPUPass_Reshade);
+
+    device->vk.CmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, std::size(pSlot->descriptorSets), pSlot->descriptorSets, 0, nullptr);
+    device->vk.CmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, std::size(pSlot->descriptorSets), pSlot->descriptorSets, 0, nullptr);
 
     for (size_t i = 0; i < m_textures.size(); i++)
     {
@@ -1763,11 +1887,11 @@ uint64_t ReshadeEffectPipeline::execute(gamescope::Rc<CVulkanTexture> inImage, g
         auto& texInfo = m_module->textures[i];
 
         if (tex && (texInfo.storage_access || texInfo.render_target))
-            m_cmdBuffer->discardImage(tex.get());
+            pCmdBuffer->discardImage(tex.get());
     }
 
     if (m_rt)
-        m_cmdBuffer->discardImage(m_rt.get());
+        pCmdBuffer->discardImage(m_rt.get());
 
     gamescope::Rc<CVulkanTexture> lastRT;
 
@@ -1781,12 +1905,12 @@ uint64_t ReshadeEffectPipeline::execute(gamescope::Rc<CVulkanTexture> inImage, g
             auto& texInfo = m_module->textures[i];
 
             if (tex && texInfo.storage_access)
-                m_cmdBuffer->prepareDestImage(tex.get());
+                pCmdBuffer->prepareDestImage(tex.get());
             else
-                m_cmdBuffer->prepareSrcImage(tex != nullptr ? tex.get() : inImage.get());
+                pCmdBuffer->prepareSrcImage(tex != nullptr ? tex.get() : inImage.get());
         }
 
-        m_cmdBuffer->insertBarrier();
+        pCmdBuffer->insertBarrier();
 
         std::array<gamescope::Rc<CVulkanTexture>, 8> rts{};
 
@@ -1814,7 +1938,7 @@ uint64_t ReshadeEffectPipeline::execute(gamescope::Rc<CVulkanTexture> inImage, g
             for (int i = 0; i < 8; i++)
             {
                 if (rts[i])
-                    m_cmdBuffer->prepareDestImage(rts[i].get());
+                    pCmdBuffer->prepareDestImage(rts[i].get());
             }
 
             device->vk.CmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelines[passIdx]);
@@ -1860,7 +1984,7 @@ uint64_t ReshadeEffectPipeline::execute(gamescope::Rc<CVulkanTexture> inImage, g
         for (int i = 0; i < 8; i++)
         {
             if (rts[i])
-                m_cmdBuffer->markDirty(rts[i].get());
+                pCmdBuffer->markDirty(rts[i].get());
         }
 
         // Insert a stupidly huge fat barrier.
@@ -1879,7 +2003,26 @@ uint64_t ReshadeEffectPipeline::execute(gamescope::Rc<CVulkanTexture> inImage, g
     if (lastRT)
         *outImage = lastRT;
 
-    return device->submitInternal(&*m_cmdBuffer);
+    pCmdBuffer->endGPUPass();
+
+    // The effect's textures are shared between executions, so this one can't
+    // start until whatever sampled the last one's output has released it.
+    if (m_ulTimelinePoint)
+        pCmdBuffer->AddDependency(m_pTimelineSemaphore, m_ulTimelinePoint);
+
+    const uint64_t ulDonePoint = m_ulTimelinePoint + 1;
+    const uint64_t ulReleasePoint = m_ulTimelinePoint + 2;
+    m_ulTimelinePoint = ulReleasePoint;
+
+    pCmdBuffer->AddSignal(m_pTimelineSemaphore, ulDonePoint);
+    pSlot->ulTimelinePoint = ulReleasePoint;
+    pSlot->ulSequence = device->submitInternal(pCmdBuffer);
+
+    return ReshadeExecution_t
+    {
+        .donePoint    = VulkanTimelinePoint_t{ m_pTimelineSemaphore, ulDonePoint },
+        .releasePoint = VulkanTimelinePoint_t{ m_pTimelineSemaphore, ulReleasePoint },
+    };
 }
 
 gamescope::Rc<CVulkanTexture> ReshadeEffectPipeline::findTexture(std::string_view name)
@@ -1912,19 +2055,88 @@ void ReshadeEffectManager::clear()
     m_lastPipeline = nullptr;
 }
 
+void ReshadeEffectManager::startCompile(const ReshadeEffectKey &key)
+{
+    m_bCompiling = true;
+    m_compileKey = key;
+
+    const float flSDROnHDRBrightness = g_ColorMgmt.pending.flSDROnHDRBrightness;
+
+    std::thread compileThread([this, key, flSDROnHDRBrightness]()
+    {
+        pthread_setname_np(pthread_self(), "gamescope-fx");
+
+        auto pipeline = std::make_unique<ReshadeEffectPipeline>();
+        bool bSuccess = pipeline->init(m_device, key, flSDROnHDRBrightness);
+
+        std::unique_lock lock(m_compileMutex);
+        if (bSuccess)
+            m_compiledPipeline = std::move(pipeline);
+        else
+            m_failedPipeline = std::move(pipeline);
+        m_bCompileFinished = true;
+        force_repaint();
+    });
+    compileThread.detach();
+}
+
 ReshadeEffectPipeline* ReshadeEffectManager::pipeline(const ReshadeEffectKey &key)
 {
     if (m_lastKey == key)
         return m_lastPipeline.get();
 
-    m_lastKey = key;
-    m_lastPipeline = nullptr;
-    auto pipeline = std::make_unique<ReshadeEffectPipeline>();
-    if (!pipeline->init(m_device, key))
-        return nullptr;
-    m_lastPipeline = std::move(pipeline);
+    bool bSwapped = false;
+    std::unique_ptr<ReshadeEffectPipeline> pOldPipeline;
+    std::unique_ptr<ReshadeEffectPipeline> pFailedPipeline;
+    {
+        std::unique_lock lock(m_compileMutex);
 
-    return m_lastPipeline.get();
+        if (m_bCompileFinished)
+        {
+            pFailedPipeline = std::move(m_failedPipeline);
+            if (m_compileKey == key)
+            {
+                // A failed compile leaves m_lastPipeline null for this key, same as before.
+                pOldPipeline = std::exchange(m_lastPipeline, std::move(m_compiledPipeline));
+                m_lastKey = key;
+                bSwapped = m_lastPipeline != nullptr;
+            }
+            else
+            {
+                // Stale, what we want changed while it was compiling.
+                pFailedPipeline = std::move(m_compiledPipeline);
+            }
+
+            m_bCompileFinished = false;
+            m_bCompiling = false;
+        }
+
+        if (m_lastKey != key && !m_bCompiling)
+            startCompile(key);
+    }
+
+    // Destroyed outside the lock, these wait for their last submission.
+    pOldPipeline = nullptr;
+    pFailedPipeline = nullptr;
+
+    if (bSwapped && g_effectReadyCallback && g_reshadeEffectPath) {
+        g_effectReadyCallback(g_reshadeEffectPath);
+        g_effectReadyCallback = nullptr;
+    }
+
+    if (m_lastKey == key)
+        return m_lastPipeline.get();
+
+    // Keep the previous effect while the new one compiles if it was built
+    // for the same buffer, otherwise composite without an effect.
+    if (m_lastPipeline &&
+        m_lastKey.bufferWidth == key.bufferWidth &&
+        m_lastKey.bufferHeight == key.bufferHeight &&
+        m_lastKey.bufferColorSpace == key.bufferColorSpace &&
+        m_lastKey.bufferFormat == key.bufferFormat)
+        return m_lastPipeline.get();
+
+    return nullptr;
 }
 
 ReshadeEffectManager g_reshadeManager;
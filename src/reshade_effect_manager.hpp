@@ -2,6 +2,7 @@
 
 #include "rendervulkan.hpp"
 #include <optional>
+#include <mutex>
 
 namespace reshadefx
 {
@@ -40,15 +41,36 @@ enum ReshadeDescriptorSets
     GAMESCOPE_RESHADE_DESCRIPTOR_SET_COUNT,
 };
 
+struct ReshadeTextureUpload
+{
+    // VK_NULL_HANDLE buffer means clear to zero.
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    gamescope::Rc<CVulkanTexture> texture;
+};
+
+struct ReshadeExecution_t
+{
+    // Signalled when the effect is done, wait on it before sampling outImage.
+    VulkanTimelinePoint_t donePoint;
+    // Signal it once done sampling outImage, the next execution overwrites
+    // the effect's textures after waiting on it.
+    VulkanTimelinePoint_t releasePoint;
+};
+
 class ReshadeEffectPipeline
 {
 public:
     ReshadeEffectPipeline();
     ~ReshadeEffectPipeline();
 
-    bool init(CVulkanDevice *device, const ReshadeEffectKey &key);
-    void update();
-    uint64_t execute(gamescope::Rc<CVulkanTexture> inImage, gamescope::Rc<CVulkanTexture> *outImage);
+    // Runs on the compile thread, anything from the compositor is passed in.
+    bool init(CVulkanDevice *device, const ReshadeEffectKey &key, float flSDROnHDRBrightness);
+    void update(void *mappedPtr);
+    // Submits the effect without waiting on it, whatever samples outImage has
+    // to wait on the done point and signal the release point.
+    // std::nullopt if nothing was submitted, outImage is then untouched.
+    std::optional<ReshadeExecution_t> execute(gamescope::Rc<CVulkanTexture> inImage, gamescope::Rc<CVulkanTexture> *outImage);
 
     const ReshadeEffectKey& key() const { return m_key; }
     reshadefx::module *module() { return m_module.get(); }
@@ -56,8 +78,10 @@ public:
     gamescope::Rc<CVulkanTexture> findTexture(std::string_view name);
 
 private:
+    void freeUploads(std::vector<ReshadeTextureUpload> &uploads);
+
     ReshadeEffectKey m_key;
-    CVulkanDevice *m_device;
+    CVulkanDevice *m_device = nullptr;
 
 	std::unique_ptr<reshadefx::module> m_module;
     std::vector<VkPipeline> m_pipelines;
@@ -65,17 +89,42 @@ private:
     gamescope::OwningRc<CVulkanTexture> m_rt;
     std::vector<ReshadeCombinedImageSampler> m_samplers;
     std::vector<std::shared_ptr<ReshadeUniform>> m_uniforms;
-
-    std::optional<CVulkanCmdBuffer> m_cmdBuffer = std::nullopt;
-    VkBuffer m_buffer = VK_NULL_HANDLE;
-    VkDeviceMemory m_bufferMemory = VK_NULL_HANDLE;
-    void* m_mappedPtr = nullptr;
+    std::vector<ReshadeTextureUpload> m_pendingUploads;
+
+    // Everything one execution needs that the GPU may still be using, reused
+    // once the effect's timeline has passed ulTimelinePoint, its release point.
+    struct FrameSlot_t
+    {
+        std::unique_ptr<CVulkanCmdBuffer> pCmdBuffer;
+        uint64_t ulSequence = 0;
+        uint64_t ulTimelinePoint = 0;
+        // Scratch buffers of the uploads recorded into pCmdBuffer.
+        std::vector<ReshadeTextureUpload> retiredUploads;
+
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceMemory bufferMemory = VK_NULL_HANDLE;
+        void* mappedPtr = nullptr;
+
+        VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+        VkDescriptorSet descriptorSets[GAMESCOPE_RESHADE_DESCRIPTOR_SET_COUNT] = {};
+    };
+
+    FrameSlot_t *acquireFrameSlot();
+    FrameSlot_t *recycleFrameSlot(FrameSlot_t *pSlot);
+    bool createFrameSlot(FrameSlot_t *pSlot);
+    void destroyFrameSlot(FrameSlot_t *pSlot);
+
+    // Grows while the GPU is behind, execute only waits once it's this far behind.
+    static constexpr size_t k_uMaxFrameSlots = 4;
+    std::vector<std::unique_ptr<FrameSlot_t>> m_frameSlots;
+    // Alternates between an execution's done point and its release point,
+    // this is the release point of the last one.
+    std::shared_ptr<VulkanTimelineSemaphore_t> m_pTimelineSemaphore;
+    uint64_t m_ulTimelinePoint = 0;
 
     VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
-    VkDescriptorPool m_descriptorPool = VK_NULL_HANDLE;
 
     VkDescriptorSetLayout m_descriptorSetLayouts[GAMESCOPE_RESHADE_DESCRIPTOR_SET_COUNT] = {};
-    VkDescriptorSet m_descriptorSets[GAMESCOPE_RESHADE_DESCRIPTOR_SET_COUNT] = {};
 };
 
 class ReshadeEffectManager
@@ -85,12 +134,24 @@ public:
 
     void init(CVulkanDevice *device);
     void clear();
+    // Effects are compiled on a background thread, until the one for key is ready
+    // this returns the previous effect if it can take the same input, or nullptr.
     ReshadeEffectPipeline* pipeline(const ReshadeEffectKey &key);
 
 private:
+    void startCompile(const ReshadeEffectKey &key);
+
     ReshadeEffectKey m_lastKey{};
     std::unique_ptr<ReshadeEffectPipeline> m_lastPipeline;
     CVulkanDevice *m_device;
+
+    std::mutex m_compileMutex;
+    bool m_bCompiling = false;
+    bool m_bCompileFinished = false;
+    ReshadeEffectKey m_compileKey{};
+    // nullptr if compilation failed, m_failedPipeline then holds it for destruction on our thread.
+    std::unique_ptr<ReshadeEffectPipeline> m_compiledPipeline;
+    std::unique_ptr<ReshadeEffectPipeline> m_failedPipeline;
 };
 
 extern ReshadeEffectManager g_reshadeManager;
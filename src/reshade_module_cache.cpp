@@ -0,0 +1,351 @@
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "reshade_module_cache.hpp"
+#include "reshade_effect_manager.hpp"
+#include "effect_module.hpp"
+#include "convar.h"
+#include "log.hpp"
+
+#include "Utils/Cache.h"
+#include "Utils/Hash.h"
+
+#include "GamescopeVersion.h"
+
+static LogScope reshade_cache_log("reshade_cache");
+
+static gamescope::ConVar<bool> cv_reshade_module_cache{ "reshade_module_cache", true, "Cache compiled ReShade effect modules on disk." };
+
+// Bump when the serialized layout below changes.
+static constexpr uint32_t k_unReshadeModuleCacheVersion = 1;
+static constexpr uint32_t k_unReshadeModuleCacheMagic = 0x4d535247; // 'GRSM'
+
+// Same visitor for reading and writing, so the two can't get out of sync.
+class CReshadeModuleArchive
+{
+public:
+    explicit CReshadeModuleArchive(std::vector<uint8_t> *pOut)
+        : m_pOut{ pOut }
+    {
+    }
+
+    CReshadeModuleArchive(const uint8_t *pData, size_t uSize)
+        : m_pIn{ pData }
+        , m_uInSize{ uSize }
+    {
+    }
+
+    bool IsReading() const { return m_pIn != nullptr; }
+    bool Ok() const { return m_bOk; }
+
+    void Bytes(void *pData, size_t uSize)
+    {
+        if (IsReading())
+        {
+            if (!m_bOk || m_uInSize - m_uInOffset < uSize)
+            {
+                m_bOk = false;
+                return;
+            }
+
+            memcpy(pData, m_pIn + m_uInOffset, uSize);
+            m_uInOffset += uSize;
+        }
+        else
+        {
+            const uint8_t *pBytes = reinterpret_cast<const uint8_t *>(pData);
+            m_pOut->insert(m_pOut->end(), pBytes, pBytes + uSize);
+        }
+    }
+
+    template <typename T>
+    void operator()(T &value);
+
+private:
+    std::vector<uint8_t> *m_pOut = nullptr;
+
+    const uint8_t *m_pIn = nullptr;
+    size_t m_uInSize = 0;
+    size_t m_uInOffset = 0;
+
+    bool m_bOk = true;
+};
+
+// Only what ReshadeEffectPipeline reads is stored.
+static void Visit(CReshadeModuleArchive &ar, reshadefx::constant &constant);
+static void Visit(CReshadeModuleArchive &ar, reshadefx::annotation &annotation);
+static void Visit(CReshadeModuleArchive &ar, reshadefx::texture_info &info);
+static void Visit(CReshadeModuleArchive &ar, reshadefx::sampler_info &info);
+static void Visit(CReshadeModuleArchive &ar, reshadefx::storage_info &info);
+static void Visit(CReshadeModuleArchive &ar, reshadefx::uniform_info &info);
+static void Visit(CReshadeModuleArchive &ar, reshadefx::pass_info &info);
+static void Visit(CReshadeModuleArchive &ar, reshadefx::technique_info &info);
+static void Visit(CReshadeModuleArchive &ar, reshadefx::module &module);
+
+template <typename T>
+void CReshadeModuleArchive::operator()(T &value)
+{
+    if constexpr (std::is_same_v<T, std::string>)
+    {
+        uint32_t uSize = uint32_t(value.size());
+        Bytes(&uSize, sizeof(uSize));
+        if (IsReading())
+        {
+            if (!m_bOk || uSize > m_uInSize - m_uInOffset)
+            {
+                m_bOk = false;
+                return;
+            }
+            value.resize(uSize);
+        }
+        Bytes(value.data(), uSize);
+    }
+    else if constexpr (std::is_array_v<T>)
+    {
+        for (auto &element : value)
+            (*this)(element);
+    }
+    else if constexpr (requires { typename T::value_type; value.resize(0); })
+    {
+        using TElement = typename T::value_type;
+
+        uint32_t uCount = uint32_t(value.size());
+        Bytes(&uCount, sizeof(uCount));
+        if (IsReading())
+        {
+            // Every element takes at least a byte, don't trust a corrupt count.
+            if (!m_bOk || uCount > m_uInSize - m_uInOffset)
+            {
+                m_bOk = false;
+                return;
+            }
+            value.resize(uCount);
+        }
+
+        if constexpr (std::is_trivially_copyable_v<TElement>)
+        {
+            Bytes(value.data(), value.size() * sizeof(TElement));
+        }
+        else
+        {
+            for (auto &element : value)
+                (*this)(element);
+        }
+    }
+    else if constexpr (std::is_trivially_copyable_v<T>)
+    {
+        Bytes(&value, sizeof(value));
+    }
+    else
+    {
+        Visit(*this, value);
+    }
+}
+
+static void Visit(CReshadeModuleArchive &ar, reshadefx::constant &constant)
+{
+    ar(constant.as_uint);
+    ar(constant.string_data);
+    ar(constant.array_data);
+}
+
+static void Visit(CReshadeModuleArchive &ar, reshadefx::annotation &annotation)
+{
+    ar(annotation.type);
+    ar(annotation.name);
+    ar(annotation.value);
+}
+
+static void Visit(CReshadeModuleArchive &ar, reshadefx::texture_info &info)
+{
+    ar(info.unique_name);
+    ar(info.semantic);
+    ar(info.annotations);
+    ar(info.type);
+    ar(info.width);
+    ar(info.height);
+    ar(info.depth);
+    ar(info.levels);
+    ar(info.format);
+    ar(info.render_target);
+    ar(info.storage_access);
+}
+
+static void Visit(CReshadeModuleArchive &ar, reshadefx::sampler_info &info)
+{
+    ar(info.texture_name);
+    ar(info.filter);
+    ar(info.address_u);
+    ar(info.address_v);
+    ar(info.address_w);
+    ar(info.min_lod);
+    ar(info.max_lod);
+    ar(info.lod_bias);
+    ar(info.srgb);
+}
+
+static void Visit(CReshadeModuleArchive &ar, reshadefx::storage_info &info)
+{
+    ar(info.texture_name);
+}
+
+static void Visit(CReshadeModuleArchive &ar, reshadefx::uniform_info &info)
+{
+    ar(info.name);
+    ar(info.type);
+    ar(info.size);
+    ar(info.offset);
+    ar(info.annotations);
+    ar(info.has_initializer_value);
+    ar(info.initializer_value);
+}
+
+static void Visit(CReshadeModuleArchive &ar, reshadefx::pass_info &info)
+{
+    ar(info.name);
+    ar(info.render_target_names);
+    ar(info.vs_entry_point);
+    ar(info.ps_entry_point);
+    ar(info.cs_entry_point);
+    ar(info.clear_render_targets);
+    ar(info.srgb_write_enable);
+    ar(info.blend_enable);
+    ar(info.stencil_enable);
+    ar(info.color_write_mask);
+    ar(info.stencil_read_mask);
+    ar(info.stencil_write_mask);
+    ar(info.blend_op);
+    ar(info.blend_op_alpha);
+    ar(info.src_blend);
+    ar(info.dest_blend);
+    ar(info.src_blend_alpha);
+    ar(info.dest_blend_alpha);
+    ar(info.stencil_comparison_func);
+    ar(info.stencil_reference_value);
+    ar(info.stencil_op_pass);
+    ar(info.stencil_op_fail);
+    ar(info.stencil_op_depth_fail);
+    ar(info.num_vertices);
+    ar(info.topology);
+    ar(info.viewport_width);
+    ar(info.viewport_height);
+    ar(info.viewport_dispatch_z);
+}
+
+static void Visit(CReshadeModuleArchive &ar, reshadefx::technique_info &info)
+{
+    ar(info.name);
+    ar(info.passes);
+}
+
+static void Visit(CReshadeModuleArchive &ar, reshadefx::module &module)
+{
+    ar(module.code);
+    ar(module.textures);
+    ar(module.samplers);
+    ar(module.storages);
+    ar(module.uniforms);
+    ar(module.techniques);
+    ar(module.total_uniform_size);
+}
+
+struct ReshadeModuleCacheHeader_t
+{
+    uint32_t uMagic;
+    uint32_t uVersion;
+    uint64_t ulCacheKey;
+    uint64_t ulDataSize;
+    uint64_t ulDataHash;
+};
+
+static std::string GetReshadeModuleCachePath(uint64_t ulCacheKey)
+{
+    char szName[64];
+    snprintf(szName, sizeof(szName), "reshade/%016llx.bin", (unsigned long long)ulCacheKey);
+    return szName;
+}
+
+uint64_t reshade_module_cache_key(std::string_view svPreprocessedSource, const ReshadeEffectKey &key)
+{
+    uint64_t ulHash = gamescope::HashFnv1a(svPreprocessedSource);
+    ulHash = gamescope::HashFnv1a(key.path, ulHash);
+    ulHash = gamescope::HashFnv1aValue(key.bufferWidth, ulHash);
+    ulHash = gamescope::HashFnv1aValue(key.bufferHeight, ulHash);
+    ulHash = gamescope::HashFnv1aValue(key.bufferColorSpace, ulHash);
+    ulHash = gamescope::HashFnv1aValue(key.bufferFormat, ulHash);
+    // The layout of the reshadefx structs we copy raw can change between builds.
+    ulHash = gamescope::HashFnv1a(std::string_view{ gamescope::k_szGamescopeVersion }, ulHash);
+    ulHash = gamescope::HashFnv1aValue(k_unReshadeModuleCacheVersion, ulHash);
+    return ulHash;
+}
+
+bool reshade_module_cache_read(uint64_t ulCacheKey, reshadefx::module *pModule)
+{
+    if (!cv_reshade_module_cache)
+        return false;
+
+    const std::string sPath = GetReshadeModuleCachePath(ulCacheKey);
+
+    std::vector<uint8_t> data;
+    if (!gamescope::ReadCacheFile(sPath, data))
+        return false;
+
+    ReshadeModuleCacheHeader_t header;
+    if (data.size() < sizeof(header))
+        return false;
+    memcpy(&header, data.data(), sizeof(header));
+
+    const uint8_t *pPayload = data.data() + sizeof(header);
+    const size_t uPayloadSize = data.size() - sizeof(header);
+    if (header.uMagic != k_unReshadeModuleCacheMagic ||
+        header.uVersion != k_unReshadeModuleCacheVersion ||
+        header.ulCacheKey != ulCacheKey ||
+        header.ulDataSize != uPayloadSize ||
+        header.ulDataHash != gamescope::HashFnv1a(pPayload, uPayloadSize))
+    {
+        reshade_cache_log.infof("Discarding stale or corrupt cache entry %s", sPath.c_str());
+        gamescope::RemoveCacheFile(sPath);
+        return false;
+    }
+
+    reshadefx::module module;
+    CReshadeModuleArchive ar(pPayload, uPayloadSize);
+    ar(module);
+    if (!ar.Ok())
+    {
+        reshade_cache_log.errorf("Failed to deserialize cache entry %s", sPath.c_str());
+        gamescope::RemoveCacheFile(sPath);
+        return false;
+    }
+
+    *pModule = std::move(module);
+    return true;
+}
+
+void reshade_module_cache_write(uint64_t ulCacheKey, const reshadefx::module &module)
+{
+    if (!cv_reshade_module_cache)
+        return;
+
+    std::vector<uint8_t> data(sizeof(ReshadeModuleCacheHeader_t));
+
+    // The archive visits by reference for reading, it doesn't modify anything when writing.
+    CReshadeModuleArchive ar(&data);
+    ar(const_cast<reshadefx::module &>(module));
+
+    const uint8_t *pPayload = data.data() + sizeof(ReshadeModuleCacheHeader_t);
+    const size_t uPayloadSize = data.size() - sizeof(ReshadeModuleCacheHeader_t);
+    ReshadeModuleCacheHeader_t header =
+    {
+        .uMagic     = k_unReshadeModuleCacheMagic,
+        .uVersion   = k_unReshadeModuleCacheVersion,
+        .ulCacheKey = ulCacheKey,
+        .ulDataSize = uPayloadSize,
+        .ulDataHash = gamescope::HashFnv1a(pPayload, uPayloadSize),
+    };
+    memcpy(data.data(), &header, sizeof(header));
+
+    gamescope::WriteCacheFile(GetReshadeModuleCachePath(ulCacheKey), data);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+namespace reshadefx
+{
+    struct module;
+}
+
+struct ReshadeEffectKey;
+
+// On-disk cache of compiled reshadefx modules (SPIR-V + the texture, sampler,
+// uniform and technique metadata ReshadeEffectPipeline consumes), so
+// re-enabling an effect or a resolution change skips parsing and codegen.
+//
+// Keyed by the preprocessed source, which already contains every include
+// and the BUFFER_* macros, plus the ReshadeEffectKey fields.
+uint64_t reshade_module_cache_key(std::string_view svPreprocessedSource, const ReshadeEffectKey &key);
+bool reshade_module_cache_read(uint64_t ulCacheKey, reshadefx::module *pModule);
+void reshade_module_cache_write(uint64_t ulCacheKey, const reshadefx::module &module);
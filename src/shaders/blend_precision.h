@@ -0,0 +1,17 @@
+#ifndef BLEND_PRECISION_H
+#define BLEND_PRECISION_H
+
+// Type of the blending and blur accumulation math, which the _fp16 variants
+// do in half precision. Coordinates, transfer functions and LUT lookups always
+// stay in full precision, half isn't enough for those.
+#ifdef COMPOSITE_FP16
+#define blend_t float16_t
+#define blend3_t f16vec3
+#define blend4_t f16vec4
+#else
+#define blend_t float
+#define blend3_t vec3
+#define blend4_t vec4
+#endif
+
+#endif
@@ -15,5 +15,13 @@ uniform layers_t {
     float u_nitsToLinear; // hdr -> sdr
     float u_itmSdrNits;
     float u_itmTargetNits;
+
+    // Origin of a partial dispatch over damaged tiles.
+    uvec2 u_tileOffset;
+
+#ifdef BLIT_KAWASE
+    // Tap distance of a dual-Kawase pass, in half source texels.
+    float u_kawaseOffset;
+#endif
 };
 
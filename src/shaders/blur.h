@@ -1,3 +1,5 @@
+#include "blend_precision.h"
+
 
 vec4 textureCond(sampler2D layerSampler, uint layerIdx, vec2 pos, bool unnormalized) {
     vec2 texSize = textureSize(layerSampler, 0);
@@ -480,7 +482,7 @@ vec4 gaussian_blur(sampler2D layerSampler, uint layerIdx, vec2 pos, uint radius,
         offsets[18] = 36.43599701;
     }
 
-    vec4 color = vec4(0);
+    blend4_t color = blend4_t(0);
 
     uint colorspace = get_layer_colorspace(layerIdx);
 
@@ -492,18 +494,22 @@ vec4 gaussian_blur(sampler2D layerSampler, uint layerIdx, vec2 pos, uint radius,
             posOffset = vec2(offsets[i], 0);
 
         vec4 tmp0 = textureCond(layerSampler, layerIdx, pos - posOffset, unnormalized);
-        tmp0.rgb = colorspace_plane_degamma_tf(tmp0.rgb, colorspace) * weights[i];
-        color += tmp0;
+        tmp0.rgb = colorspace_plane_degamma_tf(tmp0.rgb, colorspace);
 
         vec4 tmp1 = textureCond(layerSampler, layerIdx, pos + posOffset, unnormalized);
-        tmp1.rgb = colorspace_plane_degamma_tf(tmp1.rgb, colorspace) * weights[i];
-        color += tmp1;
+        tmp1.rgb = colorspace_plane_degamma_tf(tmp1.rgb, colorspace);
+
+        // Both taps share a weight, alpha is summed unweighted.
+        blend4_t taps = blend4_t(tmp0) + blend4_t(tmp1);
+        color += taps * blend4_t(blend3_t(weights[i]), 1);
     }
 
+    vec4 result = vec4(color);
+
     if (vertical)
     {
-        color.rgb = apply_layer_color_mgmt(color.rgb, layerIdx, colorspace);
+        result.rgb = apply_layer_color_mgmt(result.rgb, layerIdx, colorspace);
     }
 
-    return color;
+    return result;
 }
@@ -0,0 +1,51 @@
+// Composites the other layers over layer 0 once it has been upscaled to
+// output size, for RCAS and the fused EASU and NIS passes.
+// Uses the rcas_push_data.h layout, where layer 0 has no scale/offset.
+
+vec4 sampleLayer(uint layerIdx, vec2 uv) {
+    if ((c_ycbcrMask & (1 << layerIdx)) != 0)
+        return sampleLayerEx(s_ycbcr_samplers[layerIdx], layerIdx - 1, layerIdx, uv, false);
+    return sampleLayerEx(s_samplers[layerIdx], layerIdx - 1, layerIdx, uv, true);
+}
+
+void compositeUpscaled(uvec2 pos, vec3 layer0Color, bool bHasLayer0)
+{
+    vec3 outputValue = vec3(0.0f);
+
+    if (checkDebugFlag(compositedebug_PlaneBorders))
+        outputValue = vec3(1.0f, 0.0f, 0.0f);
+
+    if (bHasLayer0) {
+        outputValue = layer0Color;
+
+        uint colorspace = get_layer_colorspace(0);
+        if (colorspace == colorspace_linear)
+        {
+            // We don't use an sRGB view for FSR due to the spaces RCAS works in.
+            colorspace = colorspace_sRGB;
+        }
+
+        outputValue.rgb = colorspace_plane_degamma_tf(outputValue.rgb, colorspace);
+        outputValue.rgb = (vec4(outputValue.rgb, 1.0f) * u_ctm[0]).rgb;
+        outputValue.rgb = apply_layer_color_mgmt(outputValue.rgb, 0, colorspace);
+        outputValue *= u_opacity[0];
+    }
+
+
+    if (c_layerCount > 1) {
+        vec2 uv = vec2(pos);
+
+        for (int i = 1; i < c_layerCount; i++) {
+            vec4 layerColor = sampleLayer(i, uv);
+            float opacity = u_opacity[i];
+            float layerAlpha = opacity * layerColor.a;
+            outputValue = layerColor.rgb * opacity + outputValue * (1.0f - layerAlpha);
+        }
+    }
+
+    outputValue = encodeOutputColor(outputValue);
+    imageStore(dst, ivec2(pos), vec4(outputValue, 0));
+
+    if (checkDebugFlag(compositedebug_Markers))
+        compositing_debug(pos);
+}
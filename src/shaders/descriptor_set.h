@@ -50,7 +50,7 @@ layout(binding = 1, rgba8) writeonly uniform image2D dst_luma;
 layout(binding = 2, rgba8) writeonly uniform image2D dst_chroma;
 
 layout(binding = 3) uniform sampler2D s_samplers[VKR_SAMPLER_SLOTS];
-layout(binding = 4) uniform sampler2D s_ycbcr_samplers[VKR_SAMPLER_SLOTS];
+layout(binding = 4) uniform sampler2D s_ycbcr_samplers[VKR_YCBCR_SAMPLER_SLOTS];
 
 layout(binding = 5) uniform sampler1D s_shaperLut[VKR_LUT3D_COUNT];
 layout(binding = 6) uniform sampler3D s_lut3D[VKR_LUT3D_COUNT];
@@ -2,13 +2,18 @@
 #define DESCRIPTOR_SET_CONSTANTS_H_
 
 #define VKR_TARGET_SLOTS 2u
-#define VKR_SAMPLER_SLOTS 16u
 #define VKR_MAX_LAYERS 6u
 
 #define VKR_BLUR_EXTRA_SLOT       VKR_MAX_LAYERS
 #define VKR_NIS_COEF_SCALER_SLOT (VKR_BLUR_EXTRA_SLOT + 1u)
 #define VKR_NIS_COEF_USM_SLOT    (VKR_NIS_COEF_SCALER_SLOT + 1u)
 
+// Only as many as we use, so the whole set stays under the usual
+// maxPushDescriptors of 32.
+#define VKR_SAMPLER_SLOTS       (VKR_NIS_COEF_USM_SLOT + 1u)
+// Only layers can be ycbcr.
+#define VKR_YCBCR_SAMPLER_SLOTS VKR_MAX_LAYERS
+
 #define VKR_LUT3D_COUNT 2 // Must match EOTF_Count
 
 #endif
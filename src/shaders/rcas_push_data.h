@@ -0,0 +1,64 @@
+layout(binding = 0, scalar)
+uniform layers_t {
+    uvec2 u_layer0Offset;
+    vec2 u_scale[VKR_MAX_LAYERS - 1];
+    vec2 u_offset[VKR_MAX_LAYERS - 1];
+    float u_opacity[VKR_MAX_LAYERS];
+    mat3x4 u_ctm[VKR_MAX_LAYERS];
+    uint u_borderMask;
+    uint u_frameId;
+    uint u_c1;
+
+	uint u_shaderFilter;
+
+    // hdr
+    float u_linearToNits;
+    float u_nitsToLinear;
+    float u_itmSdrNits;
+    float u_itmTargetNits;
+
+#ifdef RCAS_FUSED_EASU
+    // EASU constants, and the size it upscales layer 0 to.
+    uvec4 u_easuCon[4];
+    uvec2 u_layer0Extent;
+#endif
+
+#ifdef RCAS_FUSED_NIS
+    // NISConfig, without its padding.
+    float kDetectRatio;
+    float kDetectThres;
+    float kMinContrastRatio;
+    float kRatioNorm;
+
+    float kContrastBoost;
+    float kEps;
+    float kSharpStartY;
+    float kSharpScaleY;
+
+    float kSharpStrengthMin;
+    float kSharpStrengthScale;
+    float kSharpLimitMin;
+    float kSharpLimitScale;
+
+    float kScaleX;
+    float kScaleY;
+
+    float kDstNormX;
+    float kDstNormY;
+    float kSrcNormX;
+    float kSrcNormY;
+
+    uint kInputViewportOriginX;
+    uint kInputViewportOriginY;
+    uint kInputViewportWidth;
+    uint kInputViewportHeight;
+
+    uint kOutputViewportOriginX;
+    uint kOutputViewportOriginY;
+    uint kOutputViewportWidth;
+    uint kOutputViewportHeight;
+
+    float reserved0;
+    float reserved1;
+#endif
+};
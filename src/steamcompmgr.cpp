@@ -42,7 +42,9 @@
 #include <condition_variable>
 #include <mutex>
 #include <atomic>
+#include <optional>
 #include <vector>
+#include <list>
 #include <algorithm>
 #include <array>
 #include <iostream>
@@ -81,6 +83,7 @@
 #include "main.hpp"
 #include "wlserver.hpp"
 #include "rendervulkan.hpp"
+#include "reshade_effect_manager.hpp"
 #include "steamcompmgr.hpp"
 #include "vblankmanager.hpp"
 #include "log.hpp"
@@ -94,6 +97,8 @@
 #include "BufferMemo.h"
 #include "Utils/Process.h"
 #include "Utils/Algorithm.h"
+#include "Utils/Cache.h"
+#include "Utils/Hash.h"
 
 #include "wlr_begin.hpp"
 #include "wlr/types/wlr_pointer_constraints_v1.h"
@@ -117,6 +122,7 @@ static const int g_nBaseCursorScale = 36;
 
 #define GPUVIS_TRACE_IMPLEMENTATION
 #include "gpuvis_trace_utils.h"
+#include "GamescopeVersion.h"
 
 
 LogScope xwm_log("xwm");
@@ -141,9 +147,6 @@ gamescope_color_mgmt_luts g_ColorMgmtLuts[ EOTF_Count ];
 gamescope_color_mgmt_luts g_ScreenshotColorMgmtLuts[ EOTF_Count ];
 gamescope_color_mgmt_luts g_ScreenshotColorMgmtLutsHDR[ EOTF_Count ];
 
-static lut1d_t g_tmpLut1d;
-static lut3d_t g_tmpLut3d;
-
 extern int g_nDynamicRefreshHz;
 
 bool g_bForceHDRSupportDebug = false;
@@ -222,24 +225,24 @@ static const gamescope_color_mgmt_t k_ScreenshotColorMgmtHDR =
 //#define COLOR_MGMT_MICROBENCH
 // sudo cpupower frequency-set --governor performance
 
+// Only touches CPU memory, so this can run off the compositor thread
+// as long as the overrides and looks passed in aren't being modified.
 static void
-create_color_mgmt_luts(const gamescope_color_mgmt_t& newColorMgmt, gamescope_color_mgmt_luts outColorMgmtLuts[ EOTF_Count ])
+generate_color_mgmt_luts(const gamescope_color_mgmt_t& newColorMgmt, const gamescope_color_mgmt_luts overrideLuts[ EOTF_Count ], const lut3d_t looks[ EOTF_Count ],
+	gamescope_color_mgmt_luts outColorMgmtLuts[ EOTF_Count ])
 {
+	thread_local lut1d_t tmpLut1d;
+	thread_local lut3d_t tmpLut3d;
+
 	const displaycolorimetry_t& displayColorimetry = newColorMgmt.displayColorimetry;
 	const displaycolorimetry_t& outputEncodingColorimetry = newColorMgmt.outputEncodingColorimetry;
 
 	for ( uint32_t nInputEOTF = 0; nInputEOTF < EOTF_Count; nInputEOTF++ )
 	{
-		if (!outColorMgmtLuts[nInputEOTF].vk_lut1d)
-			outColorMgmtLuts[nInputEOTF].vk_lut1d = vulkan_create_1d_lut(s_nLutSize1d);
-
-		if (!outColorMgmtLuts[nInputEOTF].vk_lut3d)
-			outColorMgmtLuts[nInputEOTF].vk_lut3d = vulkan_create_3d_lut(s_nLutEdgeSize3d, s_nLutEdgeSize3d, s_nLutEdgeSize3d);
-
-		if ( g_ColorMgmtLutsOverride[nInputEOTF].HasLuts() )
+		if ( overrideLuts[nInputEOTF].HasLuts() )
 		{
-			memcpy(g_ColorMgmtLuts[nInputEOTF].lut1d, g_ColorMgmtLutsOverride[nInputEOTF].lut1d, sizeof(g_ColorMgmtLutsOverride[nInputEOTF].lut1d));
-			memcpy(g_ColorMgmtLuts[nInputEOTF].lut3d, g_ColorMgmtLutsOverride[nInputEOTF].lut3d, sizeof(g_ColorMgmtLutsOverride[nInputEOTF].lut3d));
+			memcpy(outColorMgmtLuts[nInputEOTF].lut1d, overrideLuts[nInputEOTF].lut1d, sizeof(overrideLuts[nInputEOTF].lut1d));
+			memcpy(outColorMgmtLuts[nInputEOTF].lut3d, overrideLuts[nInputEOTF].lut3d, sizeof(overrideLuts[nInputEOTF].lut3d));
 		}
 		else
 		{
@@ -251,7 +254,7 @@ create_color_mgmt_luts(const gamescope_color_mgmt_t& newColorMgmt, gamescope_col
 
 			EOTF inputEOTF = static_cast<EOTF>( nInputEOTF );
 			float flGain = 1.f;
-			lut3d_t * pLook = g_ColorMgmtLooks[nInputEOTF].lutEdgeSize > 0 ? &g_ColorMgmtLooks[nInputEOTF] : nullptr;
+			const lut3d_t * pLook = looks[nInputEOTF].lutEdgeSize > 0 ? &looks[nInputEOTF] : nullptr;
 
 			if ( inputEOTF == EOTF_Gamma22 )
 			{
@@ -320,36 +323,492 @@ create_color_mgmt_luts(const gamescope_color_mgmt_t& newColorMgmt, gamescope_col
 				buildPQColorimetry( &inputColorimetry, &colorMapping, displayColorimetry );
 			}
 
-			calcColorTransform<s_nLutEdgeSize3d>( &g_tmpLut1d, s_nLutSize1d, &g_tmpLut3d, inputColorimetry, inputEOTF,
+			calcColorTransform<s_nLutEdgeSize3d>( &tmpLut1d, s_nLutSize1d, &tmpLut3d, inputColorimetry, inputEOTF,
 				outputEncodingColorimetry, newColorMgmt.outputEncodingEOTF,
 				newColorMgmt.outputVirtualWhite, newColorMgmt.chromaticAdaptationMode,
 				colorMapping, newColorMgmt.nightmode, tonemapping, pLook, flGain );
 
 			// Create quantized output luts
-			for ( size_t i=0, end = g_tmpLut1d.dataR.size(); i<end; ++i )
+			for ( size_t i=0, end = tmpLut1d.dataR.size(); i<end; ++i )
 			{
-				outColorMgmtLuts[nInputEOTF].lut1d[4*i+0] = quantize_lut_value_16bit( g_tmpLut1d.dataR[i] );
-				outColorMgmtLuts[nInputEOTF].lut1d[4*i+1] = quantize_lut_value_16bit( g_tmpLut1d.dataG[i] );
-				outColorMgmtLuts[nInputEOTF].lut1d[4*i+2] = quantize_lut_value_16bit( g_tmpLut1d.dataB[i] );
+				outColorMgmtLuts[nInputEOTF].lut1d[4*i+0] = quantize_lut_value_16bit( tmpLut1d.dataR[i] );
+				outColorMgmtLuts[nInputEOTF].lut1d[4*i+1] = quantize_lut_value_16bit( tmpLut1d.dataG[i] );
+				outColorMgmtLuts[nInputEOTF].lut1d[4*i+2] = quantize_lut_value_16bit( tmpLut1d.dataB[i] );
 				outColorMgmtLuts[nInputEOTF].lut1d[4*i+3] = 0;
 			}
 
-			for ( size_t i=0, end = g_tmpLut3d.data.size(); i<end; ++i )
+			for ( size_t i=0, end = tmpLut3d.data.size(); i<end; ++i )
 			{
-				outColorMgmtLuts[nInputEOTF].lut3d[4*i+0] = quantize_lut_value_16bit( g_tmpLut3d.data[i].r );
-				outColorMgmtLuts[nInputEOTF].lut3d[4*i+1] = quantize_lut_value_16bit( g_tmpLut3d.data[i].g );
-				outColorMgmtLuts[nInputEOTF].lut3d[4*i+2] = quantize_lut_value_16bit( g_tmpLut3d.data[i].b );
+				outColorMgmtLuts[nInputEOTF].lut3d[4*i+0] = quantize_lut_value_16bit( tmpLut3d.data[i].r );
+				outColorMgmtLuts[nInputEOTF].lut3d[4*i+1] = quantize_lut_value_16bit( tmpLut3d.data[i].g );
+				outColorMgmtLuts[nInputEOTF].lut3d[4*i+2] = quantize_lut_value_16bit( tmpLut3d.data[i].b );
 				outColorMgmtLuts[nInputEOTF].lut3d[4*i+3] = 0;
 			}
 		}
 
 		outColorMgmtLuts[nInputEOTF].bHasLut1D = true;
 		outColorMgmtLuts[nInputEOTF].bHasLut3D = true;
+	}
+}
+
+// The overrides and looks are only reloaded when externalDirtyCtr changes,
+// so the worker gets an immutable copy of them instead of the globals.
+struct ColorMgmtLutSources_t
+{
+	gamescope_color_mgmt_luts overrideLuts[ EOTF_Count ];
+	lut3d_t looks[ EOTF_Count ];
+	// Hash of the contents, externalDirtyCtr means nothing across restarts.
+	uint64_t ulHash = 0;
+};
+
+static std::shared_ptr<const ColorMgmtLutSources_t>
+get_color_mgmt_lut_sources( uint32_t uExternalDirtyCtr )
+{
+	static std::shared_ptr<const ColorMgmtLutSources_t> s_pSources;
+	static uint32_t s_uSourcesDirtyCtr = 0;
+
+	if ( !s_pSources || s_uSourcesDirtyCtr != uExternalDirtyCtr )
+	{
+		auto pSources = std::make_shared<ColorMgmtLutSources_t>();
+		uint64_t ulHash = gamescope::k_ulFnv1aOffsetBasis;
+		for ( uint32_t i = 0; i < EOTF_Count; i++ )
+		{
+			pSources->overrideLuts[i] = g_ColorMgmtLutsOverride[i];
+			pSources->looks[i] = g_ColorMgmtLooks[i];
+
+			const gamescope_color_mgmt_luts &overrideLuts = pSources->overrideLuts[i];
+			ulHash = gamescope::HashFnv1aValue( overrideLuts.HasLuts(), ulHash );
+			if ( overrideLuts.HasLuts() )
+			{
+				ulHash = gamescope::HashFnv1aValue( overrideLuts.lut1d, ulHash );
+				ulHash = gamescope::HashFnv1aValue( overrideLuts.lut3d, ulHash );
+			}
+
+			const lut3d_t &look = pSources->looks[i];
+			ulHash = gamescope::HashFnv1aValue( look.lutEdgeSize, ulHash );
+			ulHash = gamescope::HashFnv1a( look.data.data(), look.data.size() * sizeof( look.data[0] ), ulHash );
+		}
+		pSources->ulHash = ulHash;
+
+		s_pSources = std::move( pSources );
+		s_uSourcesDirtyCtr = uExternalDirtyCtr;
+	}
+
+	return s_pSources;
+}
+
+// Bump when generate_color_mgmt_luts changes its output for the same input.
+static constexpr uint32_t k_unColorMgmtLutCacheVersion = 1;
+static constexpr uint32_t k_unColorMgmtLutCacheMagic = 0x55544c47; // 'GLTU'
+
+// Only the parts of the state generate_color_mgmt_luts looks at, field by
+// field, as the struct has padding and a blob pointer that don't matter.
+static uint64_t
+get_color_mgmt_lut_key( const gamescope_color_mgmt_t &colorMgmt, const ColorMgmtLutSources_t &sources )
+{
+	uint64_t ulHash = gamescope::HashFnv1aValue( k_unColorMgmtLutCacheVersion );
+	ulHash = gamescope::HashFnv1a( std::string_view{ gamescope::k_szGamescopeVersion }, ulHash );
+	ulHash = gamescope::HashFnv1aValue( s_nLutSize1d, ulHash );
+	ulHash = gamescope::HashFnv1aValue( s_nLutEdgeSize3d, ulHash );
+	ulHash = gamescope::HashFnv1aValue( sources.ulHash, ulHash );
+
+	ulHash = gamescope::HashFnv1aValue( colorMgmt.nightmode.amount, ulHash );
+	ulHash = gamescope::HashFnv1aValue( colorMgmt.nightmode.hue, ulHash );
+	ulHash = gamescope::HashFnv1aValue( colorMgmt.nightmode.saturation, ulHash );
+	ulHash = gamescope::HashFnv1aValue( colorMgmt.sdrGamutWideness, ulHash );
+	ulHash = gamescope::HashFnv1aValue( colorMgmt.flInternalDisplayBrightness, ulHash );
+	ulHash = gamescope::HashFnv1aValue( colorMgmt.flSDROnHDRBrightness, ulHash );
+	ulHash = gamescope::HashFnv1aValue( colorMgmt.flHDRInputGain, ulHash );
+	ulHash = gamescope::HashFnv1aValue( colorMgmt.flSDRInputGain, ulHash );
+	ulHash = gamescope::HashFnv1aValue( uint32_t( colorMgmt.hdrTonemapOperator ), ulHash );
+	for ( const tonemap_info_t &info : { colorMgmt.hdrTonemapDisplayMetadata, colorMgmt.hdrTonemapSourceMetadata } )
+	{
+		ulHash = gamescope::HashFnv1aValue( info.flBlackPointNits, ulHash );
+		ulHash = gamescope::HashFnv1aValue( info.flWhitePointNits, ulHash );
+	}
+	for ( const displaycolorimetry_t &colorimetry : { colorMgmt.displayColorimetry, colorMgmt.outputEncodingColorimetry } )
+	{
+		for ( const glm::vec2 &xy : { colorimetry.primaries.r, colorimetry.primaries.g, colorimetry.primaries.b, colorimetry.white } )
+		{
+			ulHash = gamescope::HashFnv1aValue( xy.x, ulHash );
+			ulHash = gamescope::HashFnv1aValue( xy.y, ulHash );
+		}
+	}
+	ulHash = gamescope::HashFnv1aValue( uint32_t( colorMgmt.outputEncodingEOTF ), ulHash );
+	ulHash = gamescope::HashFnv1aValue( colorMgmt.outputVirtualWhite.x, ulHash );
+	ulHash = gamescope::HashFnv1aValue( colorMgmt.outputVirtualWhite.y, ulHash );
+	ulHash = gamescope::HashFnv1aValue( uint32_t( colorMgmt.chromaticAdaptationMode ), ulHash );
+	return ulHash;
+}
+
+gamescope::ConVar<uint32_t> cv_color_mgmt_lut_cache_size{ "color_mgmt_lut_cache_size", 8, "Number of color management LUT sets to keep in memory. 0 disables the cache." };
+gamescope::ConVar<bool> cv_color_mgmt_lut_cache_disk{ "color_mgmt_lut_cache_disk", true, "Keep color management LUT sets that were used more than once on disk." };
+
+// LRU of quantized LUT sets. Slider drags go through lots of states that are
+// never seen again, so only entries that get hit are written to disk.
+class CColorMgmtLutCache
+{
+public:
+	bool Lookup( uint64_t ulKey, gamescope_color_mgmt_luts outLuts[ EOTF_Count ], bool bAllowDisk )
+	{
+		bool bFound = false;
+		std::vector<uint8_t> persistData;
+		{
+			std::unique_lock lock( m_Mutex );
+
+			auto iter = std::find_if( m_Entries.begin(), m_Entries.end(), [ulKey]( const Entry_t &entry ) { return entry.ulKey == ulKey; } );
+			if ( iter != m_Entries.end() )
+			{
+				m_Entries.splice( m_Entries.begin(), m_Entries, iter );
+				CopyLuts( outLuts, iter->luts );
+				bFound = true;
+
+				if ( !iter->bPersisted && cv_color_mgmt_lut_cache_disk )
+				{
+					Serialize( ulKey, iter->luts, persistData );
+					iter->bPersisted = true;
+				}
+			}
+		}
+
+		if ( bFound )
+		{
+			m_ulHits++;
+			if ( !persistData.empty() )
+				gamescope::WriteCacheFile( GetPath( ulKey ), persistData );
+			return true;
+		}
+
+		if ( bAllowDisk && cv_color_mgmt_lut_cache_disk && ReadFromDisk( ulKey, outLuts ) )
+		{
+			m_ulDiskHits++;
+			Insert( ulKey, outLuts, true );
+			return true;
+		}
+
+		// Memory-only probes are followed by a full lookup on the worker, don't count them twice.
+		if ( bAllowDisk )
+			m_ulMisses++;
+		return false;
+	}
+
+	void Insert( uint64_t ulKey, const gamescope_color_mgmt_luts luts[ EOTF_Count ], bool bPersisted = false )
+	{
+		std::unique_lock lock( m_Mutex );
+
+		if ( cv_color_mgmt_lut_cache_size == 0 )
+		{
+			m_Entries.clear();
+			return;
+		}
+
+		auto iter = std::find_if( m_Entries.begin(), m_Entries.end(), [ulKey]( const Entry_t &entry ) { return entry.ulKey == ulKey; } );
+		if ( iter == m_Entries.end() )
+			iter = m_Entries.emplace( m_Entries.begin() );
+		else
+			m_Entries.splice( m_Entries.begin(), m_Entries, iter );
+
+		iter->ulKey = ulKey;
+		iter->bPersisted = bPersisted;
+		CopyLuts( iter->luts, luts );
+
+		while ( m_Entries.size() > cv_color_mgmt_lut_cache_size )
+			m_Entries.pop_back();
+	}
+
+	void PrintStats()
+	{
+		std::unique_lock lock( m_Mutex );
+		console_log.infof( "color_mgmt_lut_cache: %zu entries, %llu hits, %llu disk hits, %llu misses",
+			m_Entries.size(),
+			(unsigned long long)m_ulHits.load(),
+			(unsigned long long)m_ulDiskHits.load(),
+			(unsigned long long)m_ulMisses.load() );
+	}
+
+private:
+	struct Entry_t
+	{
+		uint64_t ulKey = 0;
+		bool bPersisted = false;
+		gamescope_color_mgmt_luts luts[ EOTF_Count ];
+	};
+
+	struct Header_t
+	{
+		uint32_t uMagic;
+		uint32_t uVersion;
+		uint64_t ulCacheKey;
+		uint64_t ulDataHash;
+	};
+
+	static constexpr size_t k_uDataSize = EOTF_Count * ( sizeof( gamescope_color_mgmt_luts::lut1d ) + sizeof( gamescope_color_mgmt_luts::lut3d ) );
+
+	static void CopyLuts( gamescope_color_mgmt_luts dst[ EOTF_Count ], const gamescope_color_mgmt_luts src[ EOTF_Count ] )
+	{
+		for ( uint32_t i = 0; i < EOTF_Count; i++ )
+		{
+			memcpy( dst[i].lut1d, src[i].lut1d, sizeof( dst[i].lut1d ) );
+			memcpy( dst[i].lut3d, src[i].lut3d, sizeof( dst[i].lut3d ) );
+			dst[i].bHasLut1D = src[i].bHasLut1D;
+			dst[i].bHasLut3D = src[i].bHasLut3D;
+		}
+	}
+
+	static std::string GetPath( uint64_t ulKey )
+	{
+		char szName[64];
+		snprintf( szName, sizeof( szName ), "color_luts/%016llx.bin", (unsigned long long)ulKey );
+		return szName;
+	}
+
+	static void Serialize( uint64_t ulKey, const gamescope_color_mgmt_luts luts[ EOTF_Count ], std::vector<uint8_t> &outData )
+	{
+		outData.resize( sizeof( Header_t ) + k_uDataSize );
+
+		uint8_t *pPayload = outData.data() + sizeof( Header_t );
+		for ( uint32_t i = 0; i < EOTF_Count; i++ )
+		{
+			memcpy( pPayload, luts[i].lut1d, sizeof( luts[i].lut1d ) );
+			pPayload += sizeof( luts[i].lut1d );
+			memcpy( pPayload, luts[i].lut3d, sizeof( luts[i].lut3d ) );
+			pPayload += sizeof( luts[i].lut3d );
+		}
+
+		Header_t header =
+		{
+			.uMagic     = k_unColorMgmtLutCacheMagic,
+			.uVersion   = k_unColorMgmtLutCacheVersion,
+			.ulCacheKey = ulKey,
+			.ulDataHash = gamescope::HashFnv1a( outData.data() + sizeof( Header_t ), k_uDataSize ),
+		};
+		memcpy( outData.data(), &header, sizeof( header ) );
+	}
+
+	static bool ReadFromDisk( uint64_t ulKey, gamescope_color_mgmt_luts outLuts[ EOTF_Count ] )
+	{
+		const std::string sPath = GetPath( ulKey );
+
+		std::vector<uint8_t> data;
+		if ( !gamescope::ReadCacheFile( sPath, data ) )
+			return false;
+
+		Header_t header;
+		if ( data.size() != sizeof( header ) + k_uDataSize )
+		{
+			gamescope::RemoveCacheFile( sPath );
+			return false;
+		}
+		memcpy( &header, data.data(), sizeof( header ) );
+
+		const uint8_t *pPayload = data.data() + sizeof( header );
+		if ( header.uMagic != k_unColorMgmtLutCacheMagic ||
+		     header.uVersion != k_unColorMgmtLutCacheVersion ||
+		     header.ulCacheKey != ulKey ||
+		     header.ulDataHash != gamescope::HashFnv1a( pPayload, k_uDataSize ) )
+		{
+			gamescope::RemoveCacheFile( sPath );
+			return false;
+		}
+
+		for ( uint32_t i = 0; i < EOTF_Count; i++ )
+		{
+			memcpy( outLuts[i].lut1d, pPayload, sizeof( outLuts[i].lut1d ) );
+			pPayload += sizeof( outLuts[i].lut1d );
+			memcpy( outLuts[i].lut3d, pPayload, sizeof( outLuts[i].lut3d ) );
+			pPayload += sizeof( outLuts[i].lut3d );
+			outLuts[i].bHasLut1D = true;
+			outLuts[i].bHasLut3D = true;
+		}
+		return true;
+	}
+
+	std::mutex m_Mutex;
+	std::list<Entry_t> m_Entries;
+
+	std::atomic<uint64_t> m_ulHits = { 0 };
+	std::atomic<uint64_t> m_ulDiskHits = { 0 };
+	std::atomic<uint64_t> m_ulMisses = { 0 };
+};
+
+static CColorMgmtLutCache s_ColorMgmtLutCache;
+
+static gamescope::ConCommand cc_color_mgmt_lut_cache_stats( "color_mgmt_lut_cache_stats", "Print color management LUT cache hit/miss counters.",
+[]( std::span<std::string_view> args )
+{
+	s_ColorMgmtLutCache.PrintStats();
+});
+
+static void
+build_color_mgmt_luts( const gamescope_color_mgmt_t &colorMgmt, const ColorMgmtLutSources_t &sources, gamescope_color_mgmt_luts outColorMgmtLuts[ EOTF_Count ] )
+{
+	const uint64_t ulKey = get_color_mgmt_lut_key( colorMgmt, sources );
+#ifndef COLOR_MGMT_MICROBENCH
+	if ( s_ColorMgmtLutCache.Lookup( ulKey, outColorMgmtLuts, true ) )
+		return;
+#endif
+
+	generate_color_mgmt_luts( colorMgmt, sources.overrideLuts, sources.looks, outColorMgmtLuts );
+	s_ColorMgmtLutCache.Insert( ulKey, outColorMgmtLuts );
+}
+
+static void
+create_color_mgmt_luts(const gamescope_color_mgmt_t& newColorMgmt, gamescope_color_mgmt_luts outColorMgmtLuts[ EOTF_Count ])
+{
+	build_color_mgmt_luts( newColorMgmt, *get_color_mgmt_lut_sources( g_ColorMgmt.pending.externalDirtyCtr ), outColorMgmtLuts );
+
+	for ( uint32_t nInputEOTF = 0; nInputEOTF < EOTF_Count; nInputEOTF++ )
+	{
+		if (!outColorMgmtLuts[nInputEOTF].vk_lut1d)
+			outColorMgmtLuts[nInputEOTF].vk_lut1d = vulkan_create_1d_lut(s_nLutSize1d);
+
+		if (!outColorMgmtLuts[nInputEOTF].vk_lut3d)
+			outColorMgmtLuts[nInputEOTF].vk_lut3d = vulkan_create_3d_lut(s_nLutEdgeSize3d, s_nLutEdgeSize3d, s_nLutEdgeSize3d);
 
 		vulkan_update_luts(outColorMgmtLuts[nInputEOTF].vk_lut1d, outColorMgmtLuts[nInputEOTF].vk_lut3d, outColorMgmtLuts[nInputEOTF].lut1d, outColorMgmtLuts[nInputEOTF].lut3d);
 	}
 }
 
+gamescope::ConVar<bool> cv_color_mgmt_async_luts{ "color_mgmt_async_luts", true, "Build color management LUTs on a background thread instead of at the start of a frame." };
+
+struct ColorMgmtLutBuild_t
+{
+	gamescope_color_mgmt_t colorMgmt;
+	gamescope_color_mgmt_luts luts[ EOTF_Count ];
+};
+
+// Builds LUT sets on its own thread. Only the latest request is kept, so
+// dragging a slider doesn't queue up a build for every intermediate value.
+class CColorMgmtLutWorker
+{
+public:
+	void Request( const gamescope_color_mgmt_t &colorMgmt, std::shared_ptr<const ColorMgmtLutSources_t> pSources )
+	{
+		std::unique_lock lock( m_Mutex );
+
+		if ( !m_bThreadStarted )
+		{
+			std::thread thread( [this]() { Run(); } );
+			thread.detach();
+			m_bThreadStarted = true;
+		}
+
+		m_oRequest = Request_t{ colorMgmt, std::move( pSources ) };
+		m_CV.notify_one();
+	}
+
+	std::unique_ptr<ColorMgmtLutBuild_t> TakeFinished()
+	{
+		std::unique_lock lock( m_Mutex );
+		return std::move( m_pFinished );
+	}
+
+	// Drops any queued or in-flight build, eg. when color management
+	// got disabled in the meantime.
+	void Cancel()
+	{
+		std::unique_lock lock( m_Mutex );
+		m_oRequest = std::nullopt;
+		m_pFinished = nullptr;
+		m_uGeneration++;
+	}
+
+private:
+	struct Request_t
+	{
+		gamescope_color_mgmt_t colorMgmt;
+		std::shared_ptr<const ColorMgmtLutSources_t> pSources;
+	};
+
+	void Run()
+	{
+		pthread_setname_np( pthread_self(), "gamescope-lut" );
+
+		for ( ;; )
+		{
+			Request_t request;
+			uint32_t uGeneration;
+			{
+				std::unique_lock lock( m_Mutex );
+				m_CV.wait( lock, [this]() { return m_oRequest.has_value(); } );
+				request = std::move( *m_oRequest );
+				m_oRequest = std::nullopt;
+				uGeneration = m_uGeneration;
+			}
+
+			auto pBuild = std::make_unique<ColorMgmtLutBuild_t>();
+			pBuild->colorMgmt = request.colorMgmt;
+			build_color_mgmt_luts( request.colorMgmt, *request.pSources, pBuild->luts );
+
+			{
+				std::unique_lock lock( m_Mutex );
+				if ( uGeneration != m_uGeneration )
+					continue;
+				m_pFinished = std::move( pBuild );
+			}
+
+			force_repaint();
+		}
+	}
+
+	std::mutex m_Mutex;
+	std::condition_variable m_CV;
+	bool m_bThreadStarted = false;
+	std::optional<Request_t> m_oRequest;
+	std::unique_ptr<ColorMgmtLutBuild_t> m_pFinished;
+	uint32_t m_uGeneration = 0;
+};
+
+// Never destroyed, the thread is detached.
+static CColorMgmtLutWorker *s_pColorMgmtLutWorker = new CColorMgmtLutWorker;
+static std::optional<gamescope_color_mgmt_t> s_oRequestedColorMgmt;
+
+// Two sets of LUT textures: frames in flight keep sampling the front set
+// while a new build is uploaded into the back one.
+struct ColorMgmtLutTextures_t
+{
+	gamescope::Rc<CVulkanTexture> vk_lut1d[ EOTF_Count ];
+	gamescope::Rc<CVulkanTexture> vk_lut3d[ EOTF_Count ];
+	// Every frame that sampled this set was submitted before this point.
+	uint64_t ulRetiredSeq = 0;
+};
+
+static ColorMgmtLutTextures_t s_ColorMgmtLutTextures[ 2 ];
+static uint32_t s_uColorMgmtLutFront = 0;
+
+static void
+commit_color_mgmt_luts( const ColorMgmtLutBuild_t &build )
+{
+	ColorMgmtLutTextures_t &front = s_ColorMgmtLutTextures[ s_uColorMgmtLutFront ];
+	ColorMgmtLutTextures_t &back = s_ColorMgmtLutTextures[ s_uColorMgmtLutFront ^ 1 ];
+
+	if ( back.ulRetiredSeq )
+		vulkan_wait( back.ulRetiredSeq, false );
+
+	uint64_t ulUploadSeq = 0;
+	for ( uint32_t i = 0; i < EOTF_Count; i++ )
+	{
+		if ( !back.vk_lut1d[i] )
+			back.vk_lut1d[i] = vulkan_create_1d_lut( s_nLutSize1d );
+
+		if ( !back.vk_lut3d[i] )
+			back.vk_lut3d[i] = vulkan_create_3d_lut( s_nLutEdgeSize3d, s_nLutEdgeSize3d, s_nLutEdgeSize3d );
+
+		ulUploadSeq = vulkan_update_luts( back.vk_lut1d[i], back.vk_lut3d[i], build.luts[i].lut1d, build.luts[i].lut3d );
+
+		// The backend builds its blobs from these.
+		memcpy( g_ColorMgmtLuts[i].lut1d, build.luts[i].lut1d, sizeof( g_ColorMgmtLuts[i].lut1d ) );
+		memcpy( g_ColorMgmtLuts[i].lut3d, build.luts[i].lut3d, sizeof( g_ColorMgmtLuts[i].lut3d ) );
+		g_ColorMgmtLuts[i].bHasLut1D = build.luts[i].bHasLut1D;
+		g_ColorMgmtLuts[i].bHasLut3D = build.luts[i].bHasLut3D;
+		g_ColorMgmtLuts[i].vk_lut1d = back.vk_lut1d[i];
+		g_ColorMgmtLuts[i].vk_lut3d = back.vk_lut3d[i];
+	}
+
+	front.ulRetiredSeq = ulUploadSeq;
+	s_uColorMgmtLutFront ^= 1;
+}
+
 gamescope::ConVar<bool> cv_tearing_enabled{ "tearing_enabled", false, "Whether or not tearing is enabled." };
 int g_nSteamMaxHeight = 0;
 bool g_bVRRCapable_CachedValue = false;
@@ -374,21 +833,78 @@ update_color_mgmt()
 	g_ColorMgmt.pending.flInternalDisplayBrightness =
 		GetBackend()->GetCurrentConnector()->GetHDRInfo().uMaxContentLightLevel;
 
+	static uint32_t s_NextColorMgmtSerial = 0;
+
+	// Pick up a set the worker finished since the last frame.
+	if ( std::unique_ptr<ColorMgmtLutBuild_t> pBuild = s_pColorMgmtLutWorker->TakeFinished() )
+	{
+		commit_color_mgmt_luts( *pBuild );
+
+		g_ColorMgmt.serial = ++s_NextColorMgmtSerial;
+		g_ColorMgmt.current = pBuild->colorMgmt;
+
+		if ( s_oRequestedColorMgmt == pBuild->colorMgmt )
+			s_oRequestedColorMgmt = std::nullopt;
+	}
+
 #ifdef COLOR_MGMT_MICROBENCH
 	struct timespec t0, t1;
 #else
 	// check if any part of our color mgmt stack is dirty
 	if ( g_ColorMgmt.pending == g_ColorMgmt.current && g_ColorMgmt.serial != 0 )
+	{
+		// Went back to what we are showing before the worker caught up.
+		if ( s_oRequestedColorMgmt )
+		{
+			s_pColorMgmtLutWorker->Cancel();
+			s_oRequestedColorMgmt = std::nullopt;
+		}
+		return;
+	}
+
+	// Keep showing the current LUTs until the worker is done with these.
+	// The very first set is built inline, so we never composite without one.
+	if ( g_ColorMgmt.pending.enabled && g_ColorMgmt.serial != 0 && cv_color_mgmt_async_luts )
+	{
+		if ( s_oRequestedColorMgmt == g_ColorMgmt.pending )
+			return;
+
+		std::shared_ptr<const ColorMgmtLutSources_t> pSources = get_color_mgmt_lut_sources( g_ColorMgmt.pending.externalDirtyCtr );
+
+		// Toggling back to a state we've seen doesn't need to wait a frame for the worker.
+		auto pBuild = std::make_unique<ColorMgmtLutBuild_t>();
+		pBuild->colorMgmt = g_ColorMgmt.pending;
+		if ( s_ColorMgmtLutCache.Lookup( get_color_mgmt_lut_key( pBuild->colorMgmt, *pSources ), pBuild->luts, false ) )
+		{
+			s_pColorMgmtLutWorker->Cancel();
+			s_oRequestedColorMgmt = std::nullopt;
+
+			commit_color_mgmt_luts( *pBuild );
+
+			g_ColorMgmt.serial = ++s_NextColorMgmtSerial;
+			g_ColorMgmt.current = g_ColorMgmt.pending;
+			return;
+		}
+
+		s_pColorMgmtLutWorker->Request( g_ColorMgmt.pending, std::move( pSources ) );
+		s_oRequestedColorMgmt = g_ColorMgmt.pending;
 		return;
+	}
 #endif
 
+	s_pColorMgmtLutWorker->Cancel();
+	s_oRequestedColorMgmt = std::nullopt;
+
 #ifdef COLOR_MGMT_MICROBENCH
 	clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
 #endif
 
 	if (g_ColorMgmt.pending.enabled)
 	{
-		create_color_mgmt_luts(g_ColorMgmt.pending, g_ColorMgmtLuts);
+		auto pBuild = std::make_unique<ColorMgmtLutBuild_t>();
+		pBuild->colorMgmt = g_ColorMgmt.pending;
+		build_color_mgmt_luts( pBuild->colorMgmt, *get_color_mgmt_lut_sources( pBuild->colorMgmt.externalDirtyCtr ), pBuild->luts );
+		commit_color_mgmt_luts( *pBuild );
 	}
 	else
 	{
@@ -418,8 +934,6 @@ update_color_mgmt()
 	}
 #endif
 
-	static uint32_t s_NextColorMgmtSerial = 0;
-
 	g_ColorMgmt.serial = ++s_NextColorMgmtSerial;
 	g_ColorMgmt.current = g_ColorMgmt.pending;
 }
@@ -1852,6 +2366,7 @@ paint_cached_base_layer(const gamescope::Rc<commit_t>& commit, const BaseLayerIn
 	if (layer->colorspace == GAMESCOPE_APP_TEXTURE_COLORSPACE_SCRGB)
 		layer->ctm = s_scRGB709To2020Matrix;
 	layer->tex = commit->vulkanTex;
+	layer->ulCommitID = commit->commitID;
 
 	layer->filter = base.filter;
 	layer->blackBorder = true;
@@ -1920,6 +2435,17 @@ paint_window_commit( const gamescope::Rc<commit_t> &lastCommit, steamcompmgr_win
 
 	layer->tex = lastCommit->GetTexture( layer->filter, g_upscaleScaler );
 
+	layer->ulCommitID = lastCommit->commitID;
+	// The damage is in the client's texels, not those of an upscaled copy.
+	if ( layer->tex == lastCommit->vulkanTex )
+	{
+		layer->ulPrevCommitID = lastCommit->ulPrevCommitID;
+		layer->damageBox[0] = lastCommit->damage.nX;
+		layer->damageBox[1] = lastCommit->damage.nY;
+		layer->damageBox[2] = lastCommit->damage.nX + lastCommit->damage.nWidth;
+		layer->damageBox[3] = lastCommit->damage.nY + lastCommit->damage.nHeight;
+	}
+
 	if (notificationMode)
 	{
 		sourceWidth = mainOverlayWindow->GetGeometry().nWidth;
@@ -2030,7 +2556,8 @@ paint_window_commit( const gamescope::Rc<commit_t> &lastCommit, steamcompmgr_win
 		layer->zpos = g_zposExternalOverlay;
 	}
 
-	layer->colorspace = lastCommit->colorspace();
+	// An upscaled copy is already encoded for the output.
+	layer->colorspace = lastCommit->GetTextureColorspace( layer->filter, g_upscaleScaler );
 	layer->ctm = nullptr;
 	if (layer->colorspace == GAMESCOPE_APP_TEXTURE_COLORSPACE_SCRGB)
 		layer->ctm = s_scRGB709To2020Matrix;
@@ -2045,6 +2572,151 @@ paint_window_commit( const gamescope::Rc<commit_t> &lastCommit, steamcompmgr_win
 	return layer;
 }
 
+struct TempUpscaleImage_t
+{
+	gamescope::OwningRc<CVulkanTexture> pTexture;
+	// Timeline of upscale -> release, to be used as acquire for the commit.
+	std::shared_ptr<gamescope::CTimeline> pReleaseTimeline;
+	uint64_t ulLastPoint = 0ul;
+};
+
+static std::vector<TempUpscaleImage_t> g_pUpscaleImages;
+void ClearUpscaleImages()
+{
+	g_pUpscaleImages.clear();
+}
+
+static TempUpscaleImage_t *GetTempUpscaleImage( uint32_t uWidth, uint32_t uHeight, uint32_t uDrmFormat )
+{
+	if ( g_pUpscaleImages.size() )
+	{
+		// Mixing and matching sizes to only do the min required would be nice
+		// but massively complicates caching.
+		if ( g_pUpscaleImages[0].pTexture->width() != uWidth ||
+			 g_pUpscaleImages[0].pTexture->height() != uHeight ||
+			 g_pUpscaleImages[0].pTexture->drmFormat() != uDrmFormat )
+		{
+			g_pUpscaleImages.clear();
+		}
+	}
+
+	for ( TempUpscaleImage_t &image : g_pUpscaleImages )
+	{
+		if ( !image.pTexture->IsInUse() )
+			return &image;
+	}
+
+	if ( g_pUpscaleImages.size() > 8 )
+	{
+		xwm_log.warnf( "No upscale images free!\n" );
+		return {};
+	}
+
+	gamescope::OwningRc<CVulkanTexture> pTexture = new CVulkanTexture();
+
+	std::shared_ptr<gamescope::CTimeline> pTimeline = gamescope::CTimeline::Create();
+	if ( !pTimeline )
+		return nullptr;
+
+	CVulkanTexture::createFlags imageFlags;
+	imageFlags.bSampled = true;
+	imageFlags.bStorage = true;
+	imageFlags.bFlippable = true;
+	pTexture->BInit( g_nOutputWidth, g_nOutputHeight, 1, uDrmFormat, imageFlags );
+	TempUpscaleImage_t &image = g_pUpscaleImages.emplace_back( std::move( pTexture ), std::move( pTimeline ) );
+
+	return &image;
+}
+
+static EOTF upscale_commit_eotf( const gamescope::Rc<commit_t> &commit )
+{
+	return ( commit->colorspace() == GAMESCOPE_APP_TEXTURE_COLORSPACE_LINEAR || commit->colorspace() == GAMESCOPE_APP_TEXTURE_COLORSPACE_SRGB )
+		? EOTF_Gamma22
+		: EOTF_PQ;
+}
+
+static VkColorSpaceKHR upscale_commit_vk_colorspace( const gamescope::Rc<commit_t> &commit )
+{
+	return upscale_commit_eotf( commit ) == EOTF_Gamma22 ? VK_COLOR_SPACE_SRGB_NONLINEAR_KHR : VK_COLOR_SPACE_HDR10_ST2084_EXT;
+}
+
+// Upscales a commit to the output size with the current shader filter and
+// keeps the result on it, so painting it again is just a blit.
+//
+// If pAcquirePoint is given, the upscale waits on it and pEventFd gets an
+// acquire point for the upscaled result instead.
+static bool upscale_commit( const gamescope::Rc<commit_t> &commit, steamcompmgr_win_t *w, gamescope::CAcquireTimelinePoint *pAcquirePoint, std::pair<int32_t, bool> *pEventFd )
+{
+	FrameInfo_t upscaledFrameInfo{};
+	upscaledFrameInfo.applyOutputColorMgmt = true;
+	upscaledFrameInfo.outputEncodingEOTF = upscale_commit_eotf( commit );
+
+	paint_window_commit( commit, w, w, &upscaledFrameInfo, nullptr );
+	upscaledFrameInfo.useFSRLayer0 = g_upscaleFilter == GamescopeUpscaleFilter::FSR;
+	upscaledFrameInfo.useNISLayer0 = g_upscaleFilter == GamescopeUpscaleFilter::NIS;
+
+	TempUpscaleImage_t *pTempImage = GetTempUpscaleImage( g_nOutputWidth, g_nOutputHeight, commit->vulkanTex->drmFormat() );
+	if ( !pTempImage )
+		return false;
+
+	const uint64_t ulNextReleasePoint = ++pTempImage->ulLastPoint;
+
+	std::unique_ptr<CVulkanCmdBuffer> pCommandBuffer = g_device.commandBuffer();
+
+	if ( pAcquirePoint )
+		pCommandBuffer->AddDependency( pAcquirePoint->GetTimeline()->ToVkSemaphore(), pAcquirePoint->GetPoint() );
+	pCommandBuffer->AddSignal( pTempImage->pReleaseTimeline->ToVkSemaphore(), ulNextReleasePoint );
+
+	auto seqNo = vulkan_composite( &upscaledFrameInfo, nullptr, false, pTempImage->pTexture, false, std::move( pCommandBuffer ) );
+
+	// Composites that sample the copy are submitted after it on the same queue,
+	// only the preemptive path, which makes it the commit's contents, waits.
+	if ( pEventFd )
+		vulkan_wait( *seqNo, true );
+
+	commit->AddUpscaledTexture( UpscaledTexture_t
+	{
+		g_upscaleFilter,
+		g_upscaleScaler,
+		g_nOutputWidth,
+		g_nOutputHeight,
+		g_upscaleFilterSharpness,
+		pTempImage->pTexture,
+		VkColorSpaceToGamescopeAppTextureColorSpace( pTempImage->pTexture->format(), upscale_commit_vk_colorspace( commit ) ),
+	} );
+
+	// Manifest a new acquire timeline point with this inline work.
+	if ( pEventFd )
+		*pEventFd = gamescope::CAcquireTimelinePoint( pTempImage->pReleaseTimeline, ulNextReleasePoint ).CreateEventFd();
+
+	return true;
+}
+
+gamescope::ConVar<bool> cv_upscale_reuse_base_plane( "upscale_reuse_base_plane", true, "When the base plane is repainted without a new commit, eg. for an overlay or the cursor, keep an upscaled copy of it instead of running FSR/NIS on it again every frame." );
+
+gamescope::ConVar<int> cv_upscale_reuse_base_plane_repaints( "upscale_reuse_base_plane_repaints", 3, "How many composites in a row FSR/NIS has to run on the same base plane commit before an upscaled copy of it is kept." );
+
+// The base plane commit FSR/NIS ran on in the last composites, and in how many in a row.
+static uint64_t s_ulLastShaderUpscaledCommitID = 0;
+static int s_nShaderUpscaledCommitRepaints = 0;
+
+static void
+upscale_base_commit_for_reuse( const gamescope::Rc<commit_t> &commit, steamcompmgr_win_t *w )
+{
+	if ( !cv_upscale_reuse_base_plane || !commit->vulkanTex )
+		return;
+
+	if ( g_upscaleFilter != GamescopeUpscaleFilter::FSR && g_upscaleFilter != GamescopeUpscaleFilter::NIS )
+		return;
+
+	// The copy costs an upscale and a blit, only worth it for commits that keep being repainted.
+	if ( commit->commitID != s_ulLastShaderUpscaledCommitID || s_nShaderUpscaledCommitRepaints < cv_upscale_reuse_base_plane_repaints ||
+		 commit->HasUpscaledTexture( g_upscaleFilter, g_upscaleScaler ) )
+		return;
+
+	upscale_commit( commit, w, nullptr, nullptr );
+}
+
 static void
 paint_window(steamcompmgr_win_t *w, steamcompmgr_win_t *scaleW, struct FrameInfo_t *frameInfo,
 			  MouseCursor *cursor, PaintWindowFlags flags = 0, float flOpacityScale = 1.0f, steamcompmgr_win_t *fit = nullptr )
@@ -2075,6 +2747,9 @@ paint_window(steamcompmgr_win_t *w, steamcompmgr_win_t *scaleW, struct FrameInfo
 		}
 	}
 
+	if ( lastCommit != nullptr && ( flags & PaintWindowFlag::BasePlane ) )
+		upscale_base_commit_for_reuse( lastCommit, w );
+
 	FrameInfo_t::Layer_t *layer = paint_window_commit( lastCommit, w, scaleW, frameInfo, cursor, flags, flOpacityScale, fit );
 
 	if ( layer && ( flags & PaintWindowFlag::BasePlane ) )
@@ -2285,6 +2960,26 @@ paint_all(bool async)
 		{
 			stats_printf( "focus=%i\n", w ? w->appID : 0 );
 		}
+
+		CompositeDamageStats_t damageStats = vulkan_take_composite_damage_stats();
+		if ( damageStats.uFrames )
+		{
+			stats_printf( "composite_tiles_pct=%f\n", 100.0 * damageStats.ulTilesComposited / std::max<uint64_t>( damageStats.ulTilesTotal, 1 ) );
+			if ( damageStats.flSavedGPUTimeMs )
+				stats_printf( "composite_saved_gpu_ms=%f\n", *damageStats.flSavedGPUTimeMs / damageStats.uFrames );
+		}
+
+		std::array<GPUPassStats_t, k_EGPUPass_Count> gpuPassStats = vulkan_get_gpu_pass_stats();
+		for ( uint32_t i = 0; i < k_EGPUPass_Count; i++ )
+		{
+			if ( !gpuPassStats[ i ].uSamples )
+				continue;
+
+			const char *pszPass = GetGPUPassName( EGPUPass( i ) );
+			stats_printf( "gpu_%s_p50_ms=%f\n", pszPass, gpuPassStats[ i ].flP50Ms );
+			stats_printf( "gpu_%s_p90_ms=%f\n", pszPass, gpuPassStats[ i ].flP90Ms );
+			stats_printf( "gpu_%s_p99_ms=%f\n", pszPass, gpuPassStats[ i ].flP99Ms );
+		}
 	}
 
 	struct FrameInfo_t frameInfo = {};
@@ -2492,6 +3187,12 @@ paint_all(bool async)
 	}
 
 	g_bFSRActive = frameInfo.useFSRLayer0;
+	const uint64_t ulShaderUpscaledCommitID = ( frameInfo.useFSRLayer0 || frameInfo.useNISLayer0 ) ? frameInfo.layers[0].ulCommitID : 0;
+	if ( ulShaderUpscaledCommitID && ulShaderUpscaledCommitID == s_ulLastShaderUpscaledCommitID )
+		s_nShaderUpscaledCommitRepaints++;
+	else
+		s_nShaderUpscaledCommitRepaints = ulShaderUpscaledCommitID ? 1 : 0;
+	s_ulLastShaderUpscaledCommitID = ulShaderUpscaledCommitID;
 
 	g_bFirstFrame = false;
 
@@ -5919,6 +6620,9 @@ steamcompmgr_exit(void)
 		statsThreadSem.signal();
 	}
 
+	// Persist any pipelines compiled on-demand this session.
+	vulkan_save_pipeline_cache();
+
 	{
 		g_ColorMgmt.pending.appHDRMetadata = nullptr;
 		g_ColorMgmt.current.appHDRMetadata = nullptr;
@@ -6298,62 +7002,6 @@ void force_repaint( void )
 	nudge_steamcompmgr();
 }
 
-struct TempUpscaleImage_t
-{
-	gamescope::OwningRc<CVulkanTexture> pTexture;
-	// Timeline of upscale -> release, to be used as acquire for the commit.
-	std::shared_ptr<gamescope::CTimeline> pReleaseTimeline;
-	uint64_t ulLastPoint = 0ul;
-};
-
-static std::vector<TempUpscaleImage_t> g_pUpscaleImages;
-void ClearUpscaleImages()
-{
-	g_pUpscaleImages.clear();
-}
-
-static TempUpscaleImage_t *GetTempUpscaleImage( uint32_t uWidth, uint32_t uHeight, uint32_t uDrmFormat )
-{
-	if ( g_pUpscaleImages.size() )
-	{
-		// Mixing and matching sizes to only do the min required would be nice
-		// but massively complicates caching.
-		if ( g_pUpscaleImages[0].pTexture->width() != uWidth ||
-			 g_pUpscaleImages[0].pTexture->height() != uHeight ||
-			 g_pUpscaleImages[0].pTexture->drmFormat() != uDrmFormat )
-		{
-			g_pUpscaleImages.clear();
-		}
-	}
-
-	for ( TempUpscaleImage_t &image : g_pUpscaleImages )
-	{
-		if ( !image.pTexture->IsInUse() )
-			return &image;
-	}
-
-	if ( g_pUpscaleImages.size() > 8 )
-	{
-		xwm_log.warnf( "No upscale images free!\n" );
-		return {};
-	}
-
-	gamescope::OwningRc<CVulkanTexture> pTexture = new CVulkanTexture();
-
-	std::shared_ptr<gamescope::CTimeline> pTimeline = gamescope::CTimeline::Create();
-	if ( !pTimeline )
-		return nullptr;
-
-	CVulkanTexture::createFlags imageFlags;
-	imageFlags.bSampled = true;
-	imageFlags.bStorage = true;
-	imageFlags.bFlippable = true;
-	pTexture->BInit( g_nOutputWidth, g_nOutputHeight, 1, uDrmFormat, imageFlags );
-	TempUpscaleImage_t &image = g_pUpscaleImages.emplace_back( std::move( pTexture ), std::move( pTimeline ) );
-
-	return &image;
-}
-
 gamescope::ConVar<bool> cv_surface_update_force_only_current_surface( "surface_update_force_only_current_surface", false, "Force updates to apply only to the current surface, ignoring commits for other surfaces." );
 
 void update_wayland_res(CommitDoneList_t *doneCommits, steamcompmgr_win_t *w, ResListEntry_t& reslistentry)
@@ -6378,6 +7026,11 @@ void update_wayland_res(CommitDoneList_t *doneCommits, steamcompmgr_win_t *w, Re
 		return;
 	}
 
+	// Damage is relative to the previous commit, so any commit we drop
+	// below breaks the chain.
+	const uint64_t ulPrevCommitID = std::exchange( w->ulLastCommitID, 0 );
+	const bool bSameSurface = w->pLastCommitSurface == reslistentry.surf;
+
 	// If we ever use HDR on the surface, only ever accept flip commits from the WSI layer.
 	if ( reslistentry.feedback && reslistentry.feedback->vk_colorspace != VK_COLOR_SPACE_SRGB_NONLINEAR_KHR )
 	{
@@ -6448,6 +7101,15 @@ void update_wayland_res(CommitDoneList_t *doneCommits, steamcompmgr_win_t *w, Re
 	int fence = -1;
 	if ( newCommit != nullptr )
 	{
+		if ( reslistentry.oDamage && bSameSurface )
+		{
+			const pixman_box32_t &box = *reslistentry.oDamage;
+			newCommit->ulPrevCommitID = ulPrevCommitID;
+			newCommit->damage = Rect{ box.x1, box.y1, box.x2 - box.x1, box.y2 - box.y1 };
+		}
+		w->ulLastCommitID = newCommit->commitID;
+		w->pLastCommitSurface = reslistentry.surf;
+
 		// Whether or not to nudge mango app when this commit is done.
 		const bool mango_nudge = ( w == global_focus.focusWindow && !w->isSteamStreamingClient ) ||
 									( global_focus.focusWindow && global_focus.focusWindow->isSteamStreamingClient && w->isSteamStreamingClientVideo );
@@ -6461,45 +7123,10 @@ void update_wayland_res(CommitDoneList_t *doneCommits, steamcompmgr_win_t *w, Re
 
 		if ( bPreemptiveUpscale )
 		{
-			FrameInfo_t upscaledFrameInfo{};
-			upscaledFrameInfo.applyOutputColorMgmt = true;
-			upscaledFrameInfo.outputEncodingEOTF = ( newCommit->colorspace() == GAMESCOPE_APP_TEXTURE_COLORSPACE_LINEAR || newCommit->colorspace() == GAMESCOPE_APP_TEXTURE_COLORSPACE_SRGB )
-				? EOTF_Gamma22
-				: EOTF_PQ;
-
-			if ( newCommit->feedback )
-				newCommit->feedback->vk_colorspace = upscaledFrameInfo.outputEncodingEOTF == EOTF_Gamma22 ? VK_COLOR_SPACE_SRGB_NONLINEAR_KHR : VK_COLOR_SPACE_HDR10_ST2084_EXT;
-
-			paint_window_commit( newCommit, w, w, &upscaledFrameInfo, nullptr );
-			upscaledFrameInfo.useFSRLayer0 = g_upscaleFilter == GamescopeUpscaleFilter::FSR;
-			upscaledFrameInfo.useNISLayer0 = g_upscaleFilter == GamescopeUpscaleFilter::NIS;
-
-			TempUpscaleImage_t *pTempImage = GetTempUpscaleImage( g_nOutputWidth, g_nOutputHeight, newCommit->vulkanTex->drmFormat() );
-			if ( pTempImage )
+			if ( upscale_commit( newCommit, w, reslistentry.pAcquirePoint.get(), &eventFd ) )
 			{
-				const uint64_t ulNextReleasePoint = ++pTempImage->ulLastPoint;
-
-				std::unique_ptr<CVulkanCmdBuffer> pCommandBuffer = g_device.commandBuffer();
-				
-				pCommandBuffer->AddDependency( reslistentry.pAcquirePoint->GetTimeline()->ToVkSemaphore(), reslistentry.pAcquirePoint->GetPoint() );
-				pCommandBuffer->AddSignal( pTempImage->pReleaseTimeline->ToVkSemaphore(), ulNextReleasePoint );
-
-				auto seqNo = vulkan_composite( &upscaledFrameInfo, nullptr, false, pTempImage->pTexture, false, std::move( pCommandBuffer ) );
-
-				vulkan_wait( *seqNo, true );
-
-				newCommit->upscaledTexture = std::optional<UpscaledTexture_t>
-				{
-					std::in_place_t{},
-					g_upscaleFilter,
-					g_upscaleScaler,
-					g_nOutputWidth,
-					g_nOutputHeight,
-					pTempImage->pTexture,
-				};
-
-				// Manifest a new acquire timeline point with this inline work.
-				eventFd = gamescope::CAcquireTimelinePoint( pTempImage->pReleaseTimeline, ulNextReleasePoint ).CreateEventFd();
+				if ( newCommit->feedback )
+					newCommit->feedback->vk_colorspace = upscale_commit_vk_colorspace( newCommit );
 
 				//xwm_log.infof( "Pre-emptively upscaling!" );
 			}
@@ -7897,11 +8524,12 @@ steamcompmgr_main(int argc, char **argv)
 		const bool bForceRepaint = vblank && g_bForceRepaint.exchange(false);
 		const bool bForceSyncFlip = bForceRepaint || is_fading_out();
 
-		// If we are compositing, always force sync flips because we currently wait
+		// If we are compositing, force sync flips unless the backend can have the
+		// display wait on the composite (eg. IN_FENCE_FD), as otherwise we wait
 		// for composition to finish before submitting.
-		// If we want to do async + composite, we should set up syncfile stuff and have DRM wait on it.
 		const bool bSurfaceWantsAsync = (g_HeldCommits[HELD_COMMIT_BASE] != nullptr && g_HeldCommits[HELD_COMMIT_BASE]->async);
 		const bool bTearing = cv_tearing_enabled && GetBackend()->SupportsTearing() && bSurfaceWantsAsync;
+		const bool bTearingWhileCompositing = GetBackend()->SupportsTearingWhileCompositing();
 
 		enum class FlipType
 		{
@@ -7922,9 +8550,9 @@ steamcompmgr_main(int argc, char **argv)
 
 			if ( nIgnoredOverlayRepaints )
 				eFlipType = FlipType::Normal;
-			if ( bHasOverlay ) // Don't tear if the Steam or perf overlay is up atm.
+			if ( bHasOverlay && !bTearingWhileCompositing ) // Don't tear if the Steam or perf overlay is up atm.
 				eFlipType = FlipType::Normal;
-			if ( GetVBlankTimer().WasCompositing() )
+			if ( GetVBlankTimer().WasCompositing() && !bTearingWhileCompositing )
 				eFlipType = FlipType::Normal;
 		}
 		else
@@ -141,6 +141,10 @@ struct steamcompmgr_win_t {
 	bool receivedDoneCommit = false;
 
 	std::vector< gamescope::Rc<commit_t> > commit_queue;
+	// Last commit imported without a gap, and its surface, for chaining
+	// buffer damage. 0 after a commit was dropped.
+	uint64_t ulLastCommitID = 0;
+	struct wlr_surface *pLastCommitSurface = nullptr;
 	std::shared_ptr<std::vector< uint32_t >> icon;
 
 	steamcompmgr_win_type_t		type;
@@ -146,6 +146,13 @@ std::optional<ResListEntry_t> PrepareCommit( struct wlr_surface *surf, struct wl
 		}
 	}
 
+	// Commits that were held back until the surface got a window are
+	// processed later, by which point the damage may belong to a newer buffer.
+	std::optional<pixman_box32_t> oDamage;
+	VulkanWlrTexture_t *pCurrentTex = (VulkanWlrTexture_t *) wlr_surface_get_texture( surf );
+	if ( pCurrentTex && pCurrentTex->buf == buf )
+		oDamage = surf->buffer_damage.extents;
+
 	auto oNewEntry = std::optional<ResListEntry_t> {
 		std::in_place_t{},
 		surf,
@@ -157,7 +164,8 @@ std::optional<ResListEntry_t> PrepareCommit( struct wlr_surface *surf, struct wl
 		wl_surf->present_id,
 		wl_surf->desired_present_time,
 		std::move( pAcquirePoint ),
-		std::move( pReleasePoint )
+		std::move( pReleasePoint ),
+		oDamage
 	};
 	wl_surf->present_id = std::nullopt;
 	wl_surf->desired_present_time = 0;
@@ -48,6 +48,8 @@ struct ResListEntry_t {
 	uint64_t desired_present_time;
 	std::shared_ptr<gamescope::CAcquireTimelinePoint> pAcquirePoint;
 	std::shared_ptr<gamescope::CReleaseTimelinePoint> pReleasePoint;
+	// Extents of the buffer damage of this commit, if it is still known.
+	std::optional<pixman_box32_t> oDamage;
 };
 
 struct wlserver_content_override;